@@ -0,0 +1,283 @@
+//
+//  BEAddressStore.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 07/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BEAddressStore.h"
+
+//  Constructor
+
+BEAddressStore * BENewAddressStore(char * dataDir, void (*onErrorReceived)(CBError error,char *,...)){
+	BEAddressStore * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewAddressStore\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeAddressStore;
+	if (BEInitAddressStore(self, dataDir, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEAddressStore * BEGetAddressStore(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitAddressStore(BEAddressStore * self, char * dataDir, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	char addressFile[strlen(dataDir) + strlen(BE_ADDRESS_DATA_FILE) + 1];
+	sprintf(addressFile, "%s%s", dataDir, BE_ADDRESS_DATA_FILE);
+	self->fd = open(addressFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (self->fd == -1) {
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the address file %s. errno = %i",addressFile, errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(self->fd, &st)) {
+		close(self->fd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not get the size of the address file.");
+		return false;
+	}
+	// Only the header is read. The buckets are checked as they are used.
+	uint8_t header[24];
+	bool valid = st.st_size == BE_ADDRESS_FILE_SIZE
+		&& pread(self->fd, header, 24, 0) == 24
+		&& (header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24) == BE_ADDRESS_FILE_VERSION
+		&& BECRC32C(0, header, 20) == (header[20] | (uint32_t)header[21] << 8 | (uint32_t)header[22] << 16 | (uint32_t)header[23] << 24);
+	if (NOT valid) {
+		if (st.st_size)
+			onErrorReceived(CB_ERROR_GENERAL,"The address file is not a valid address file and is replaced with an empty one.");
+		if (NOT BEAddressStoreCreate(self)) {
+			close(self->fd);
+			return false;
+		}
+	}
+	self->map = mmap(NULL, BE_ADDRESS_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, self->fd, 0);
+	if (self->map == MAP_FAILED) {
+		close(self->fd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not map the address file. errno = %i",errno);
+		return false;
+	}
+	self->key0 = BESipHashReadInt64(self->map + 4);
+	self->key1 = BESipHashReadInt64(self->map + 12);
+	memset(self->checked, 0, sizeof(self->checked));
+	memset(self->dirty, 0, sizeof(self->dirty));
+	self->numDirty = 0;
+	self->savedBuckets = 0;
+	return true;
+}
+
+//  Destructor
+
+void BEFreeAddressStore(void * vself){
+	BEAddressStore * self = vself;
+	munmap(self->map, BE_ADDRESS_FILE_SIZE);
+	close(self->fd);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+bool BEAddressStoreAdd(BEAddressStore * self, BEAddress * address, uint32_t now){
+	uint16_t bucket;
+	uint8_t * record = BEAddressStoreGetRecord(self, address->ip, address->port, &bucket);
+	BEAddress stored;
+	BEAddressStoreReadRecord(record, &stored);
+	if (stored.flags & BE_ADDRESS_USED && (memcmp(stored.ip, address->ip, 16) || stored.port != address->port)) {
+		// Keep the other address unless it looks like it is no longer used.
+		if (stored.attempts < BE_ADDRESS_MAX_ATTEMPTS && stored.lastSeen + BE_ADDRESS_MAX_AGE > now)
+			return false;
+		stored.flags = 0;
+	}
+	if (stored.flags & BE_ADDRESS_USED) {
+		// Update the address, leaving the bucket clean if nothing changed.
+		if (address->lastSeen <= stored.lastSeen && address->services == stored.services)
+			return true;
+		if (address->lastSeen > stored.lastSeen)
+			stored.lastSeen = address->lastSeen;
+		stored.services = address->services;
+	}else{
+		stored = *address;
+		stored.flags |= BE_ADDRESS_USED;
+	}
+	BEAddressStoreWriteRecord(record, &stored);
+	BEAddressStoreSetDirty(self, bucket);
+	return true;
+}
+bool BEAddressStoreCreate(BEAddressStore * self){
+	uint8_t header[BE_ADDRESS_HEADER_SIZE] = {0};
+	for (uint8_t x = 0; x < 4; x++)
+		header[x] = BE_ADDRESS_FILE_VERSION >> 8*x;
+	// The key must not be guessed by peers, or they could choose addresses which all go in one bucket.
+	BESipHashRandomKey(header + 4);
+	uint32_t crc = BECRC32C(0, header, 20);
+	// Every bucket is empty, which is all zeros.
+	uint8_t emptyBucket[BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE] = {0};
+	uint32_t emptyCrc = BECRC32C(0, emptyBucket, BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE);
+	for (uint8_t x = 0; x < 4; x++)
+		header[20 + x] = crc >> 8*x;
+	for (uint16_t x = 0; x < BE_ADDRESS_BUCKETS; x++)
+		for (uint8_t y = 0; y < 4; y++)
+			header[24 + 4*x + y] = emptyCrc >> 8*y;
+	// Empty the file before setting the length, so that the buckets are zeros without writing them.
+	if (ftruncate(self->fd, 0) || ftruncate(self->fd, BE_ADDRESS_FILE_SIZE)
+		|| pwrite(self->fd, header, BE_ADDRESS_HEADER_SIZE, 0) != BE_ADDRESS_HEADER_SIZE
+		|| fdatasync(self->fd)) {
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create the address file. errno = %i",errno);
+		return false;
+	}
+	return true;
+}
+bool BEAddressStoreFind(BEAddressStore * self, uint8_t * ip, uint16_t port, BEAddress * address){
+	uint16_t bucket;
+	BEAddressStoreReadRecord(BEAddressStoreGetRecord(self, ip, port, &bucket), address);
+	return address->flags & BE_ADDRESS_USED && NOT memcmp(address->ip, ip, 16) && address->port == port;
+}
+uint16_t BEAddressStoreGetBucket(BEAddressStore * self, uint8_t * ip){
+	// Use the /16 group of IPv4 addresses and the /32 group of IPv6 addresses.
+	if (NOT memcmp(ip, (uint8_t []){0,0,0,0,0,0,0,0,0,0,0xFF,0xFF}, 12))
+		return BESipHash(self->key0, self->key1, ip + 12, 2) % BE_ADDRESS_BUCKETS;
+	return BESipHash(self->key0, self->key1, ip, 4) % BE_ADDRESS_BUCKETS;
+}
+bool BEAddressStoreGetRandom(BEAddressStore * self, uint64_t random, BEAddress * address){
+	for (uint32_t x = 0; x < BE_ADDRESS_BUCKETS; x++) {
+		uint8_t * data = BEAddressStoreUseBucket(self, (random + x) % BE_ADDRESS_BUCKETS);
+		for (uint32_t y = 0; y < BE_ADDRESS_BUCKET_SIZE; y++) {
+			uint8_t * record = data + ((random >> 16) + y) % BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE;
+			if (record[31] & BE_ADDRESS_USED) {
+				BEAddressStoreReadRecord(record, address);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+uint8_t * BEAddressStoreGetRecord(BEAddressStore * self, uint8_t * ip, uint16_t port, uint16_t * bucket){
+	*bucket = BEAddressStoreGetBucket(self, ip);
+	uint8_t key[18];
+	memcpy(key, ip, 16);
+	key[16] = port;
+	key[17] = port >> 8;
+	return BEAddressStoreUseBucket(self, *bucket) + BESipHash(self->key0, self->key1, key, 18) % BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE;
+}
+bool BEAddressStoreMarkAttempt(BEAddressStore * self, uint8_t * ip, uint16_t port, bool worked, uint32_t now){
+	uint16_t bucket;
+	uint8_t * record = BEAddressStoreGetRecord(self, ip, port, &bucket);
+	BEAddress address;
+	BEAddressStoreReadRecord(record, &address);
+	if (NOT (address.flags & BE_ADDRESS_USED) || memcmp(address.ip, ip, 16) || address.port != port)
+		return false;
+	if (worked) {
+		address.attempts = 0;
+		address.flags |= BE_ADDRESS_TRIED;
+		address.lastSeen = now;
+	}else if (address.attempts != UINT8_MAX)
+		address.attempts++;
+	BEAddressStoreWriteRecord(record, &address);
+	BEAddressStoreSetDirty(self, bucket);
+	return true;
+}
+void BEAddressStoreReadRecord(uint8_t * record, BEAddress * address){
+	memcpy(address->ip, record, 16);
+	address->port = record[16] | (uint16_t)record[17] << 8;
+	address->services = 0;
+	for (uint8_t x = 0; x < 8; x++)
+		address->services |= (uint64_t)record[18 + x] << 8*x;
+	address->lastSeen = record[26] | (uint32_t)record[27] << 8 | (uint32_t)record[28] << 16 | (uint32_t)record[29] << 24;
+	address->attempts = record[30];
+	address->flags = record[31];
+}
+bool BEAddressStoreRemove(BEAddressStore * self, uint8_t * ip, uint16_t port){
+	uint16_t bucket;
+	uint8_t * record = BEAddressStoreGetRecord(self, ip, port, &bucket);
+	BEAddress address;
+	BEAddressStoreReadRecord(record, &address);
+	if (NOT (address.flags & BE_ADDRESS_USED) || memcmp(address.ip, ip, 16) || address.port != port)
+		return false;
+	memset(record, 0, BE_ADDRESS_RECORD_SIZE);
+	BEAddressStoreSetDirty(self, bucket);
+	return true;
+}
+bool BEAddressStoreSave(BEAddressStore * self){
+	if (NOT self->numDirty)
+		return true;
+	bool ok = true;
+	for (uint16_t x = 0; x < BE_ADDRESS_BUCKETS && ok; x++) {
+		if (NOT self->dirty[x])
+			continue;
+		uint8_t * data = self->map + BE_ADDRESS_HEADER_SIZE + (size_t)x * BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE;
+		ok = pwrite(self->fd, data, BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE, data - self->map) == BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE;
+		uint32_t crc = BECRC32C(0, data, BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE);
+		for (uint8_t y = 0; y < 4; y++)
+			self->map[24 + 4*x + y] = crc >> 8*y;
+	}
+	// Sync the buckets before the checksums, so that the checksums never match buckets which are not on disk. A bucket which was being written when the program stopped does not match its checksum and is emptied when used.
+	ok = ok && NOT fdatasync(self->fd)
+		&& pwrite(self->fd, self->map + 24, 4 * BE_ADDRESS_BUCKETS, 24) == 4 * BE_ADDRESS_BUCKETS
+		&& NOT fdatasync(self->fd);
+	if (NOT ok) {
+		// The buckets stay dirty so that they are written by the next save.
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not save the address file. errno = %i",errno);
+		return false;
+	}
+	memset(self->dirty, 0, sizeof(self->dirty));
+	self->savedBuckets += self->numDirty;
+	self->numDirty = 0;
+	return true;
+}
+void BEAddressStoreSetDirty(BEAddressStore * self, uint16_t bucket){
+	if (NOT self->dirty[bucket]) {
+		self->dirty[bucket] = true;
+		self->numDirty++;
+	}
+}
+uint8_t * BEAddressStoreUseBucket(BEAddressStore * self, uint16_t bucket){
+	uint8_t * data = self->map + BE_ADDRESS_HEADER_SIZE + (size_t)bucket * BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE;
+	if (NOT self->checked[bucket]) {
+		self->checked[bucket] = true;
+		uint8_t * checksum = self->map + 24 + 4*bucket;
+		if (BECRC32C(0, data, BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE) != (checksum[0] | (uint32_t)checksum[1] << 8 | (uint32_t)checksum[2] << 16 | (uint32_t)checksum[3] << 24)) {
+			self->onErrorReceived(CB_ERROR_GENERAL,"Address bucket %u does not have the right checksum and is emptied.",bucket);
+			memset(data, 0, BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE);
+			BEAddressStoreSetDirty(self, bucket);
+		}
+	}
+	return data;
+}
+void BEAddressStoreWriteRecord(uint8_t * record, BEAddress * address){
+	memcpy(record, address->ip, 16);
+	record[16] = address->port;
+	record[17] = address->port >> 8;
+	for (uint8_t x = 0; x < 8; x++)
+		record[18 + x] = address->services >> 8*x;
+	for (uint8_t x = 0; x < 4; x++)
+		record[26 + x] = address->lastSeen >> 8*x;
+	record[30] = address->attempts;
+	record[31] = address->flags;
+}
@@ -0,0 +1,207 @@
+//
+//  BEAddressStore.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 07/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Stores the addresses of peers in a file of fixed-size records which is memory mapped, so that opening the store takes the same time however many addresses there are.
+ */
+
+#ifndef BEADDRESSSTOREH
+#define BEADDRESSSTOREH
+
+#include "BEConstants.h"
+#include "BECRC32C.h"
+#include "BESipHash.h"
+#include "CBObject.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ @brief Flags for stored addresses.
+ */
+typedef enum{
+	BE_ADDRESS_USED = 1, /**< The record holds an address. */
+	BE_ADDRESS_TRIED = 2, /**< A connection to the address has worked. */
+} BEAddressFlags;
+
+/**
+ @brief A stored address.
+ */
+typedef struct{
+	uint8_t ip[16]; /**< The IPv6 or IPv4-mapped address. */
+	uint16_t port; /**< The port. */
+	uint64_t services; /**< The services of the peer. */
+	uint32_t lastSeen; /**< The time the address was last seen. */
+	uint8_t attempts; /**< The number of failed connection attempts since the address last worked. */
+	uint8_t flags; /**< The BEAddressFlags of the address. */
+} BEAddress;
+
+/**
+ @brief Structure for BEAddressStore objects. @see BEAddressStore.h
+ */
+typedef struct{
+	CBObject base;
+	int fd; /**< The file descriptor for the address file. */
+	uint8_t * map; /**< The private mapping of the address file. */
+	uint64_t key0; /**< The first 8 bytes of the SipHash key. */
+	uint64_t key1; /**< The last 8 bytes of the SipHash key. */
+	bool checked[BE_ADDRESS_BUCKETS]; /**< True for each bucket which has been checked against its checksum. */
+	bool dirty[BE_ADDRESS_BUCKETS]; /**< True for each bucket changed since the last save. */
+	uint16_t numDirty; /**< The number of dirty buckets. */
+	uint64_t savedBuckets; /**< The number of buckets written by saves. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEAddressStore;
+
+/**
+ @brief Creates a new BEAddressStore object, opening the address file in the data directory or creating it.
+ @param dataDir The directory for the address file.
+ @returns A new BEAddressStore object.
+ */
+BEAddressStore * BENewAddressStore(char * dataDir, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEAddressStore from another object. Use this to avoid casts.
+ @param self The object to obtain the BEAddressStore from.
+ @returns The BEAddressStore object.
+ */
+BEAddressStore * BEGetAddressStore(void * self);
+
+/**
+ @brief Initialises a BEAddressStore object, opening the address file in the data directory or creating it.
+ @param self The BEAddressStore object to initialise.
+ @param dataDir The directory for the address file.
+ @returns true on success, false on failure.
+ */
+bool BEInitAddressStore(BEAddressStore * self, char * dataDir, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEAddressStore object. Changes which have not been saved are lost.
+ @param self The BEAddressStore object to free.
+ */
+void BEFreeAddressStore(void * self);
+
+// Functions
+
+/**
+ @brief Adds an address or updates the address if it is already stored.
+ @param self The BEAddressStore object.
+ @param address The address. The attempts and flags are only used for new addresses.
+ @param now The current time.
+ @returns true if the address was added or updated and false if its place is held by another address which cannot be replaced.
+ */
+bool BEAddressStoreAdd(BEAddressStore * self, BEAddress * address, uint32_t now);
+/**
+ @brief Creates the address file with a new key and no addresses.
+ @param self The BEAddressStore object, with the file descriptor set.
+ @returns true on success and false on failure.
+ */
+bool BEAddressStoreCreate(BEAddressStore * self);
+/**
+ @brief Finds a stored address.
+ @param self The BEAddressStore object.
+ @param ip The 16 byte IP address.
+ @param port The port.
+ @param address Set to the stored address if it is found.
+ @returns true if the address is found and false otherwise.
+ */
+bool BEAddressStoreFind(BEAddressStore * self, uint8_t * ip, uint16_t port, BEAddress * address);
+/**
+ @brief Gets the bucket for an address.
+ @param self The BEAddressStore object.
+ @param ip The 16 byte IP address.
+ @returns The bucket.
+ */
+uint16_t BEAddressStoreGetBucket(BEAddressStore * self, uint8_t * ip);
+/**
+ @brief Gets a stored address, starting from a random place.
+ @param self The BEAddressStore object.
+ @param random A random number.
+ @param address Set to the address.
+ @returns true if an address was found and false if the store is empty.
+ */
+bool BEAddressStoreGetRandom(BEAddressStore * self, uint64_t random, BEAddress * address);
+/**
+ @brief Gets the record for an address, checking its bucket if it has not been checked.
+ @param self The BEAddressStore object.
+ @param ip The 16 byte IP address.
+ @param port The port.
+ @param bucket Set to the bucket of the record.
+ @returns The record in the mapping.
+ */
+uint8_t * BEAddressStoreGetRecord(BEAddressStore * self, uint8_t * ip, uint16_t port, uint16_t * bucket);
+/**
+ @brief Records the result of a connection attempt to a stored address.
+ @param self The BEAddressStore object.
+ @param ip The 16 byte IP address.
+ @param port The port.
+ @param worked True if the connection worked.
+ @param now The current time.
+ @returns true if the address is stored and false otherwise.
+ */
+bool BEAddressStoreMarkAttempt(BEAddressStore * self, uint8_t * ip, uint16_t port, bool worked, uint32_t now);
+/**
+ @brief Reads an address from a record.
+ @param record The BE_ADDRESS_RECORD_SIZE bytes of the record.
+ @param address Set to the address.
+ */
+void BEAddressStoreReadRecord(uint8_t * record, BEAddress * address);
+/**
+ @brief Removes a stored address.
+ @param self The BEAddressStore object.
+ @param ip The 16 byte IP address.
+ @param port The port.
+ @returns true if the address was removed and false if it is not stored.
+ */
+bool BEAddressStoreRemove(BEAddressStore * self, uint8_t * ip, uint16_t port);
+/**
+ @brief Writes the buckets changed since the last save to the address file, followed by their checksums, and syncs the file.
+ @param self The BEAddressStore object.
+ @returns true on success and false on failure.
+ */
+bool BEAddressStoreSave(BEAddressStore * self);
+/**
+ @brief Marks a bucket as changed, so that it is written by the next save.
+ @param self The BEAddressStore object.
+ @param bucket The bucket.
+ */
+void BEAddressStoreSetDirty(BEAddressStore * self, uint16_t bucket);
+/**
+ @brief Checks a bucket against its checksum if it has not been checked, emptying the bucket if it does not match.
+ @param self The BEAddressStore object.
+ @param bucket The bucket.
+ @returns The bucket data in the mapping.
+ */
+uint8_t * BEAddressStoreUseBucket(BEAddressStore * self, uint16_t bucket);
+/**
+ @brief Writes an address to a record.
+ @param record The BE_ADDRESS_RECORD_SIZE bytes of the record.
+ @param address The address.
+ */
+void BEAddressStoreWriteRecord(uint8_t * record, BEAddress * address);
+
+#endif
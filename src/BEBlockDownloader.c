@@ -0,0 +1,255 @@
+//
+//  BEBlockDownloader.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 23/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BEBlockDownloader.h"
+
+//  Constructor
+
+BEBlockDownloader * BENewBlockDownloader(void (*onErrorReceived)(CBError error,char *,...)){
+	BEBlockDownloader * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewBlockDownloader\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeBlockDownloader;
+	if (BEInitBlockDownloader(self, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEBlockDownloader * BEGetBlockDownloader(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitBlockDownloader(BEBlockDownloader * self, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	self->requestHashes = malloc(32 * BE_DOWNLOAD_MAX_PEER_WINDOW);
+	if (NOT self->requestHashes) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the request hashes in BEInitBlockDownloader.",32 * BE_DOWNLOAD_MAX_PEER_WINDOW);
+		return false;
+	}
+	self->blocks = NULL;
+	self->start = 0;
+	self->numBlocks = 0;
+	self->blocksSize = 0;
+	for (uint8_t x = 0; x < BE_DOWNLOAD_MAX_PEERS; x++)
+		self->peers[x].peer = NULL;
+	self->paused = false;
+	self->delivered = 0;
+	self->stalls = 0;
+	self->duplicates = 0;
+	self->callbackHandler = NULL;
+	self->requestBlocks = NULL;
+	self->onBlock = NULL;
+	return true;
+}
+
+//  Destructor
+
+void BEFreeBlockDownloader(void * vself){
+	BEBlockDownloader * self = vself;
+	for (uint32_t x = self->start; x < self->numBlocks; x++)
+		if (self->blocks[x].block)
+			CBReleaseObject(self->blocks[x].block);
+	free(self->blocks);
+	free(self->requestHashes);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+bool BEBlockDownloaderAddHashes(BEBlockDownloader * self, uint8_t * hashes, uint32_t numHashes){
+	if (self->start && self->start >= self->numBlocks / 2) {
+		// Remove the blocks given out, which are at least half of the entries.
+		memmove(self->blocks, self->blocks + self->start, (self->numBlocks - self->start) * sizeof(*self->blocks));
+		self->numBlocks -= self->start;
+		self->start = 0;
+	}
+	if (self->numBlocks + numHashes > self->blocksSize) {
+		uint32_t blocksSize = BE_MAX(self->blocksSize * 2, self->numBlocks + numHashes);
+		BEDownloadBlock * blocks = realloc(self->blocks, blocksSize * sizeof(*blocks));
+		if (NOT blocks) {
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u blocks in BEBlockDownloaderAddHashes.",blocksSize);
+			return false;
+		}
+		self->blocks = blocks;
+		self->blocksSize = blocksSize;
+	}
+	for (uint32_t x = 0; x < numHashes; x++) {
+		BEDownloadBlock * block = self->blocks + self->numBlocks++;
+		memcpy(block->hash, hashes + 32*x, 32);
+		block->state = BE_DOWNLOAD_WANTED;
+		block->peer = -1;
+		block->stalledPeer = -1;
+		block->block = NULL;
+	}
+	return true;
+}
+int32_t BEBlockDownloaderAddPeer(BEBlockDownloader * self, void * peer){
+	for (int32_t x = 0; x < BE_DOWNLOAD_MAX_PEERS; x++) {
+		BEDownloadPeer * peerData = self->peers + x;
+		if (peerData->peer)
+			continue;
+		peerData->peer = peer;
+		peerData->inFlight = 0;
+		// Start small until the peer has been measured.
+		peerData->window = 2;
+		peerData->minLatency = 0;
+		peerData->interval = 0;
+		peerData->lastReceived = 0;
+		peerData->blocks = 0;
+		peerData->bytes = 0;
+		peerData->stalls = 0;
+		peerData->stalled = false;
+		return x;
+	}
+	return -1;
+}
+void BEBlockDownloaderDeliver(BEBlockDownloader * self){
+	while (self->start < self->numBlocks && self->blocks[self->start].state == BE_DOWNLOAD_RECEIVED) {
+		CBBlock * block = self->blocks[self->start].block;
+		self->blocks[self->start].block = NULL;
+		self->start++;
+		self->delivered++;
+		if (self->onBlock)
+			self->onBlock(self->callbackHandler, block);
+		CBReleaseObject(block);
+	}
+}
+int64_t BEBlockDownloaderFind(BEBlockDownloader * self, uint8_t * hash){
+	// Only blocks in the download window are requested.
+	uint32_t end = BE_MIN(self->numBlocks, self->start + BE_DOWNLOAD_WINDOW);
+	for (uint32_t x = self->start; x < end; x++)
+		if (NOT memcmp(self->blocks[x].hash, hash, 32))
+			return x;
+	return -1;
+}
+bool BEBlockDownloaderReceived(BEBlockDownloader * self, int32_t peer, CBBlock * block, uint64_t now){
+	int64_t index = BEBlockDownloaderFind(self, CBBlockGetHash(block));
+	if (index == -1)
+		return false;
+	BEDownloadBlock * blockData = self->blocks + index;
+	if (blockData->state == BE_DOWNLOAD_RECEIVED) {
+		self->duplicates++;
+		return true;
+	}
+	if (blockData->state == BE_DOWNLOAD_REQUESTED) {
+		BEDownloadPeer * peerData = self->peers + blockData->peer;
+		if (blockData->peer == peer) {
+			// Measure the peer. The lowest latency is without waiting behind other requests and the time between blocks is only measured while the peer has other requests.
+			double latency = now - blockData->requestTime;
+			if (NOT peerData->blocks || latency < peerData->minLatency)
+				peerData->minLatency = latency;
+			if (peerData->blocks && peerData->inFlight > 1) {
+				double interval = now - peerData->lastReceived;
+				peerData->interval = peerData->interval ? peerData->interval * 0.875 + interval * 0.125 : interval;
+			}
+			peerData->lastReceived = now;
+			peerData->stalled = false;
+			peerData->blocks++;
+			peerData->bytes += CBGetMessage(block)->bytes->length;
+			// Keep enough requests in flight to cover the latency, growing by at most one at a time.
+			uint32_t target = peerData->interval ? (uint32_t)ceil(peerData->minLatency / peerData->interval) + 2 : peerData->window + 1;
+			target = BE_MIN(target, BE_DOWNLOAD_MAX_PEER_WINDOW);
+			peerData->window = target > peerData->window ? peerData->window + 1 : target;
+		}
+		peerData->inFlight--;
+	}
+	CBRetainObject(block);
+	blockData->block = block;
+	blockData->state = BE_DOWNLOAD_RECEIVED;
+	blockData->peer = -1;
+	BEBlockDownloaderDeliver(self);
+	BEBlockDownloaderRequest(self, now);
+	return true;
+}
+void BEBlockDownloaderRemovePeer(BEBlockDownloader * self, int32_t peer){
+	uint32_t end = BE_MIN(self->numBlocks, self->start + BE_DOWNLOAD_WINDOW);
+	for (uint32_t x = self->start; x < end; x++)
+		if (self->blocks[x].state == BE_DOWNLOAD_REQUESTED && self->blocks[x].peer == peer)
+			BEBlockDownloaderUnassign(self, x);
+	self->peers[peer].peer = NULL;
+}
+void BEBlockDownloaderRequest(BEBlockDownloader * self, uint64_t now){
+	// Without requestBlocks the blocks are left wanted rather than waiting for requests which were never made.
+	if (self->paused || NOT self->requestBlocks)
+		return;
+	uint8_t numPeers = 0;
+	for (uint8_t x = 0; x < BE_DOWNLOAD_MAX_PEERS; x++)
+		if (self->peers[x].peer)
+			numPeers++;
+	uint32_t end = BE_MIN(self->numBlocks, self->start + BE_DOWNLOAD_WINDOW);
+	for (int32_t x = 0; x < BE_DOWNLOAD_MAX_PEERS; x++) {
+		BEDownloadPeer * peerData = self->peers + x;
+		if (NOT peerData->peer || peerData->inFlight >= peerData->window)
+			continue;
+		// Request the earliest wanted blocks, so that blocks can be given out as soon as possible, unless the peer has stalled. Blocks which stalled with this peer go to other peers if there are any.
+		uint32_t numHashes = 0;
+		for (uint32_t y = 0; y < end - self->start && peerData->inFlight < peerData->window; y++) {
+			BEDownloadBlock * blockData = self->blocks + (peerData->stalled ? end - 1 - y : self->start + y);
+			if (blockData->state != BE_DOWNLOAD_WANTED || (blockData->stalledPeer == x && numPeers > 1))
+				continue;
+			blockData->state = BE_DOWNLOAD_REQUESTED;
+			blockData->peer = x;
+			blockData->requestTime = now;
+			peerData->inFlight++;
+			memcpy(self->requestHashes + 32*numHashes++, blockData->hash, 32);
+		}
+		if (numHashes)
+			self->requestBlocks(self->callbackHandler, peerData->peer, self->requestHashes, numHashes);
+	}
+}
+void BEBlockDownloaderTick(BEBlockDownloader * self, uint64_t now){
+	uint32_t end = BE_MIN(self->numBlocks, self->start + BE_DOWNLOAD_WINDOW);
+	for (uint32_t x = self->start; x < end; x++) {
+		BEDownloadBlock * blockData = self->blocks + x;
+		if (blockData->state != BE_DOWNLOAD_REQUESTED)
+			continue;
+		// Allow for the latency and the blocks the peer is sending first.
+		BEDownloadPeer * peerData = self->peers + blockData->peer;
+		double expected = peerData->minLatency + peerData->interval * peerData->inFlight;
+		if (now - blockData->requestTime > BE_DOWNLOAD_MIN_TIMEOUT + 2 * expected) {
+			blockData->stalledPeer = blockData->peer;
+			peerData->window = BE_MAX(peerData->window / 2, 1);
+			peerData->stalls++;
+			peerData->stalled = true;
+			self->stalls++;
+			BEBlockDownloaderUnassign(self, x);
+		}
+	}
+	BEBlockDownloaderRequest(self, now);
+}
+void BEBlockDownloaderUnassign(BEBlockDownloader * self, uint32_t index){
+	BEDownloadBlock * blockData = self->blocks + index;
+	self->peers[blockData->peer].inFlight--;
+	blockData->state = BE_DOWNLOAD_WANTED;
+	blockData->peer = -1;
+}
@@ -0,0 +1,184 @@
+//
+//  BEBlockDownloader.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 23/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Schedules the download of blocks from many peers at once and gives the blocks out in chain order.
+ */
+
+#ifndef BEBLOCKDOWNLOADERH
+#define BEBLOCKDOWNLOADERH
+
+#include "BEConstants.h"
+#include "CBBlock.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ @brief The download state of a block.
+ */
+typedef enum{
+	BE_DOWNLOAD_WANTED, /**< The block has not been requested, or its request stalled. */
+	BE_DOWNLOAD_REQUESTED, /**< The block has been requested from a peer. */
+	BE_DOWNLOAD_RECEIVED, /**< The block has been received and is waiting for the blocks before it. */
+} BEDownloadState;
+
+/**
+ @brief A block to download.
+ */
+typedef struct{
+	uint8_t hash[32]; /**< The block hash. */
+	BEDownloadState state; /**< The download state. */
+	int32_t peer; /**< The peer the block was requested from or -1. */
+	int32_t stalledPeer; /**< The last peer the request stalled with or -1. The block is requested from other peers if there are any. */
+	uint64_t requestTime; /**< The time the block was requested. */
+	CBBlock * block; /**< The received block, which is retained, or NULL. */
+} BEDownloadBlock;
+
+/**
+ @brief A peer blocks are downloaded from.
+ */
+typedef struct{
+	void * peer; /**< The peer given to BEBlockDownloaderAddPeer or NULL for an unused slot. */
+	uint32_t inFlight; /**< The number of requests waiting for blocks. */
+	uint32_t window; /**< The number of requests which can be in flight. */
+	double minLatency; /**< The lowest time from a request to its block in milliseconds or zero before the first block. */
+	double interval; /**< The average time between blocks while requests are in flight in milliseconds or zero before it is measured. */
+	uint64_t lastReceived; /**< The time the last requested block was received. */
+	uint64_t blocks; /**< The number of requested blocks received from the peer. */
+	uint64_t bytes; /**< The number of bytes of requested blocks received from the peer. */
+	uint32_t stalls; /**< The number of requests to the peer which stalled. */
+	bool stalled; /**< True if a request to the peer stalled since the last block from it. The peer is then given the last wanted blocks in the download window, so that it does not hold up the next blocks to give out. */
+} BEDownloadPeer;
+
+/**
+ @brief Structure for BEBlockDownloader objects. @see BEBlockDownloader.h
+ */
+typedef struct{
+	CBObject base;
+	BEDownloadBlock * blocks; /**< The blocks not yet given out, in chain order from blocks[start]. */
+	uint32_t start; /**< The index of the next block to give out. */
+	uint32_t numBlocks; /**< The number of entries in blocks, including those before start. */
+	uint32_t blocksSize; /**< The number of entries allocated for blocks. */
+	BEDownloadPeer peers[BE_DOWNLOAD_MAX_PEERS]; /**< The peers. */
+	bool paused; /**< True if no requests should be made. */
+	uint64_t delivered; /**< The number of blocks given to onBlock. */
+	uint64_t stalls; /**< The number of stalled requests. */
+	uint64_t duplicates; /**< The number of blocks received which were already received. */
+	uint8_t * requestHashes; /**< Buffer for the hashes of a batch of requests. */
+	void * callbackHandler; /**< Passed to the callbacks. */
+	void (*requestBlocks)(void * callbackHandler, void * peer, uint8_t * hashes, uint32_t numHashes); /**< Called to request blocks from a peer, with the 32 byte hashes one after the other, or NULL, in which case no blocks are requested. */
+	void (*onBlock)(void * callbackHandler, CBBlock * block); /**< Called with each block in chain order, or NULL. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEBlockDownloader;
+
+/**
+ @brief Creates a new BEBlockDownloader object.
+ @returns A new BEBlockDownloader object.
+ */
+BEBlockDownloader * BENewBlockDownloader(void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEBlockDownloader from another object. Use this to avoid casts.
+ @param self The object to obtain the BEBlockDownloader from.
+ @returns The BEBlockDownloader object.
+ */
+BEBlockDownloader * BEGetBlockDownloader(void * self);
+
+/**
+ @brief Initialises a BEBlockDownloader object.
+ @param self The BEBlockDownloader object to initialise.
+ @returns true on success, false on failure.
+ */
+bool BEInitBlockDownloader(BEBlockDownloader * self, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEBlockDownloader object, releasing the received blocks.
+ @param self The BEBlockDownloader object to free.
+ */
+void BEFreeBlockDownloader(void * self);
+
+// Functions
+
+/**
+ @brief Adds the hashes of blocks to download, following the blocks already added.
+ @param self The BEBlockDownloader object.
+ @param hashes The 32 byte hashes one after the other, in chain order.
+ @param numHashes The number of hashes.
+ @returns true on success and false on failure.
+ */
+bool BEBlockDownloaderAddHashes(BEBlockDownloader * self, uint8_t * hashes, uint32_t numHashes);
+/**
+ @brief Adds a peer to download blocks from.
+ @param self The BEBlockDownloader object.
+ @param peer The peer, which is given to requestBlocks.
+ @returns The index of the peer or -1 if there are BE_DOWNLOAD_MAX_PEERS peers.
+ */
+int32_t BEBlockDownloaderAddPeer(BEBlockDownloader * self, void * peer);
+/**
+ @brief Gives the received blocks which follow the blocks already given out to onBlock.
+ @param self The BEBlockDownloader object.
+ */
+void BEBlockDownloaderDeliver(BEBlockDownloader * self);
+/**
+ @brief Finds a block which has not been given out by its hash.
+ @param self The BEBlockDownloader object.
+ @param hash The block hash.
+ @returns The index of the block or -1 if it is not found.
+ */
+int64_t BEBlockDownloaderFind(BEBlockDownloader * self, uint8_t * hash);
+/**
+ @brief Handles a received block. The block is used if it is one of the blocks to download, from any peer.
+ @param self The BEBlockDownloader object.
+ @param peer The index of the peer the block was received from.
+ @param block The block, which is retained until it is given out.
+ @param now The current time in milliseconds.
+ @returns true if the block was one of the blocks to download, even if it was already received, and false otherwise.
+ */
+bool BEBlockDownloaderReceived(BEBlockDownloader * self, int32_t peer, CBBlock * block, uint64_t now);
+/**
+ @brief Removes a peer, giving its requests to other peers.
+ @param self The BEBlockDownloader object.
+ @param peer The index of the peer.
+ */
+void BEBlockDownloaderRemovePeer(BEBlockDownloader * self, int32_t peer);
+/**
+ @brief Requests blocks from the peers with room in their windows. Nothing is requested while paused or without requestBlocks.
+ @param self The BEBlockDownloader object.
+ @param now The current time in milliseconds.
+ */
+void BEBlockDownloaderRequest(BEBlockDownloader * self, uint64_t now);
+/**
+ @brief Takes stalled requests from their peers and makes new requests. Call this regularly.
+ @param self The BEBlockDownloader object.
+ @param now The current time in milliseconds.
+ */
+void BEBlockDownloaderTick(BEBlockDownloader * self, uint64_t now);
+/**
+ @brief Takes a request from its peer so that the block can be requested again.
+ @param self The BEBlockDownloader object.
+ @param index The index of the block.
+ */
+void BEBlockDownloaderUnassign(BEBlockDownloader * self, uint32_t index);
+
+#endif
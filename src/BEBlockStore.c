@@ -0,0 +1,1616 @@
+//
+//  BEBlockStore.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 01/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#ifdef __linux__
+#define _GNU_SOURCE // For fallocate
+#endif
+
+#include "BEBlockStore.h"
+
+//  Constructor
+
+BEBlockStore * BENewBlockStore(char * dataDir, uint32_t maxOpenFiles, void (*onErrorReceived)(CBError error,char *,...)){
+	BEBlockStore * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewBlockStore\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeBlockStore;
+	if (BEInitBlockStore(self, dataDir, maxOpenFiles, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEBlockStore * BEGetBlockStore(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitBlockStore(BEBlockStore * self, char * dataDir, uint32_t maxOpenFiles, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	self->dataDir = malloc(strlen(dataDir) + 1);
+	if (NOT self->dataDir) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the data directory in BEInitBlockStore.",strlen(dataDir) + 1);
+		return false;
+	}
+	strcpy(self->dataDir, dataDir);
+	// Leave at least half of the file descriptors for everything else.
+	struct rlimit descLim;
+	if (NOT getrlimit(RLIMIT_NOFILE, &descLim) && descLim.rlim_cur != RLIM_INFINITY && maxOpenFiles > descLim.rlim_cur / 2)
+		maxOpenFiles = descLim.rlim_cur / 2;
+	if (NOT maxOpenFiles)
+		maxOpenFiles = 1;
+	self->maxOpenFiles = maxOpenFiles;
+	self->files = malloc(sizeof(*self->files) * maxOpenFiles);
+	// Use at least twice as many buckets as files so that the chains are short.
+	for (self->numBuckets = 1; self->numBuckets < maxOpenFiles * 2; self->numBuckets <<= 1);
+	self->buckets = malloc(sizeof(*self->buckets) * self->numBuckets);
+	if (NOT self->files || NOT self->buckets) {
+		free(self->files);
+		free(self->buckets);
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u block files in BEInitBlockStore.",maxOpenFiles);
+		return false;
+	}
+	// All slots are unused to begin with.
+	for (uint32_t x = 0; x < maxOpenFiles; x++) {
+		self->files[x].fd = -1;
+		self->files[x].next = x + 1 < maxOpenFiles ? (int32_t)x + 1 : -1;
+	}
+	for (uint32_t x = 0; x < self->numBuckets; x++)
+		self->buckets[x] = -1;
+	self->numFiles = 0;
+	self->lruHead = -1;
+	self->lruTail = -1;
+	self->freeHead = 0;
+	self->opens = 0;
+	self->hits = 0;
+	self->evictions = 0;
+	self->filesCounted = false;
+	self->index = NULL;
+	self->numIndexed = 0;
+	self->indexSize = 0;
+	self->indexTable = NULL;
+	self->indexTableSize = 0;
+	// The key must not be guessed by peers, or they could make blocks which all go in the same slots.
+	uint8_t key[16];
+	BESipHashRandomKey(key);
+	self->indexKey0 = BESipHashReadInt64(key);
+	self->indexKey1 = BESipHashReadInt64(key + 8);
+	self->numRecords = 0;
+	self->prunedFiles = NULL;
+	self->prunedFilesLength = 0;
+	self->unsynced = false;
+	self->syncDirectory = false;
+	self->scrubbing = false;
+	self->scrubbedBytes = 0;
+	self->scrubPasses = 0;
+	self->scrubErrors = 0;
+	self->targetFileSize = BE_BLOCK_FILE_TARGET_SIZE;
+	self->preallocationSize = BE_BLOCK_FILE_PREALLOCATION;
+#ifdef BE_LZ4
+	self->compress = true;
+#else
+	self->compress = false;
+#endif
+	// Files cannot go above the operating system limit.
+	struct rlimit fileLim;
+	if (NOT getrlimit(RLIMIT_FSIZE, &fileLim) && fileLim.rlim_cur != RLIM_INFINITY && fileLim.rlim_cur < self->targetFileSize)
+		self->targetFileSize = fileLim.rlim_cur;
+	if (pthread_rwlock_init(&self->filesLock, NULL)) {
+		free(self->files);
+		free(self->buckets);
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the files lock in BEInitBlockStore.");
+		return false;
+	}
+	if (pthread_mutex_init(&self->appendLock, NULL)) {
+		pthread_rwlock_destroy(&self->filesLock);
+		free(self->files);
+		free(self->buckets);
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the append lock in BEInitBlockStore.");
+		return false;
+	}
+	if (pthread_mutex_init(&self->lruLock, NULL)) {
+		pthread_mutex_destroy(&self->appendLock);
+		pthread_rwlock_destroy(&self->filesLock);
+		free(self->files);
+		free(self->buckets);
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the LRU lock in BEInitBlockStore.");
+		return false;
+	}
+	if (NOT BEBlockStoreLoadIndex(self)) {
+		pthread_mutex_destroy(&self->lruLock);
+		pthread_mutex_destroy(&self->appendLock);
+		pthread_rwlock_destroy(&self->filesLock);
+		free(self->files);
+		free(self->buckets);
+		free(self->dataDir);
+		return false;
+	}
+	// Check the blocks which may not have been synced before the program stopped.
+	if (NOT BEBlockStoreRecover(self)) {
+		for (uint32_t x = 0; x < self->maxOpenFiles; x++)
+			if (self->files[x].fd != -1)
+				BEBlockStoreCloseFile(self, self->files + x);
+		close(self->indexFd);
+		free(self->index);
+		free(self->indexTable);
+		free(self->prunedFiles);
+		pthread_mutex_destroy(&self->lruLock);
+		pthread_mutex_destroy(&self->appendLock);
+		pthread_rwlock_destroy(&self->filesLock);
+		free(self->files);
+		free(self->buckets);
+		free(self->dataDir);
+		return false;
+	}
+	return true;
+}
+
+//  Destructor
+
+void BEFreeBlockStore(void * vself){
+	BEBlockStore * self = vself;
+	BEBlockStoreStopScrub(self);
+	for (uint32_t x = 0; x < self->maxOpenFiles; x++){
+		if (self->files[x].fd == -1)
+			continue;
+		if (self->files[x].map)
+			munmap(self->files[x].map, self->files[x].mapSize);
+		if (self->files[x].compressed) {
+			free(self->files[x].frames);
+			close(self->files[x].frameFd);
+		}
+		close(self->files[x].fd);
+	}
+	close(self->indexFd);
+	free(self->index);
+	free(self->indexTable);
+	free(self->prunedFiles);
+	free(self->files);
+	free(self->buckets);
+	free(self->dataDir);
+	pthread_rwlock_destroy(&self->filesLock);
+	pthread_mutex_destroy(&self->appendLock);
+	pthread_mutex_destroy(&self->lruLock);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+bool BEBlockStoreAddBlock(BEBlockStore * self, uint8_t * hash, uint8_t * data, uint32_t length, BEFileReference * ref, bool * added){
+	// Checksum the block before taking the append lock so that other appenders do not wait for it.
+	uint32_t crc = BECRC32C(0, data, length);
+	pthread_mutex_lock(&self->appendLock);
+	// Blocks are only stored once, so look for the block first.
+	pthread_rwlock_rdlock(&self->filesLock);
+	bool found;
+	uint32_t indexPos = BEBlockStoreFindIndexEntry(self, hash, &found);
+	if (found)
+		*ref = self->index[indexPos].ref;
+	pthread_rwlock_unlock(&self->filesLock);
+	if (found) {
+		pthread_mutex_unlock(&self->appendLock);
+		*added = false;
+		return true;
+	}
+	uint16_t fileID = BEBlockStoreGetAppendFile(self, length);
+	pthread_rwlock_wrlock(&self->filesLock);
+	// Make room in the index now so that adding the entry cannot fail after the block is written.
+	if (NOT BEBlockStoreReserveIndex(self, self->numIndexed + 1)) {
+		pthread_rwlock_unlock(&self->filesLock);
+		pthread_mutex_unlock(&self->appendLock);
+		return false;
+	}
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	if (NOT file) {
+		pthread_rwlock_unlock(&self->filesLock);
+		pthread_mutex_unlock(&self->appendLock);
+		return false;
+	}
+	// Readers do not look past the size, so writing can be done without the files lock. The file is pinned so that it is not closed meanwhile.
+	BEBlockStorePinFile(file);
+	bool compressed = file->compressed;
+	pthread_rwlock_unlock(&self->filesLock);
+	uint8_t header[BE_BLOCK_RECORD_HEADER_SIZE];
+	for (uint8_t x = 0; x < 4; x++) {
+		header[x] = length >> 8*x;
+		header[4 + x] = crc >> 8*x;
+	}
+	uint32_t physLength = BE_BLOCK_RECORD_HEADER_SIZE + length;
+	uint8_t * frame = NULL;
+	if (compressed) {
+		// Compress the length and the block together into a frame which can be decompressed on its own.
+		frame = BEBlockStoreCompressFrame(self, header, data, length, &physLength);
+		if (NOT frame) {
+			BEBlockStoreUnpinFile(file);
+			pthread_mutex_unlock(&self->appendLock);
+			return false;
+		}
+	}
+	pthread_rwlock_wrlock(&self->filesLock);
+	int fd = file->fd;
+	uint64_t pos = file->size;
+	uint64_t physPos = file->physSize;
+	// Make sure there is space so that the file grows in large contiguous chunks.
+	if (physPos + physLength > file->allocated)
+		BEBlockStorePreallocate(self, file, physPos + physLength);
+	if (compressed) {
+		BEBlockStoreFrame * temp2 = realloc(file->frames, sizeof(*file->frames) * (file->numFrames + 1));
+		if (NOT temp2) {
+			pthread_rwlock_unlock(&self->filesLock);
+			free(frame);
+			BEBlockStoreUnpinFile(file);
+			pthread_mutex_unlock(&self->appendLock);
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the frames of block file %u in BEBlockStoreAddBlock.",sizeof(*file->frames) * (file->numFrames + 1), fileID);
+			return false;
+		}
+		file->frames = temp2;
+	}
+	pthread_rwlock_unlock(&self->filesLock);
+	bool written;
+	BEBlockStoreFrame newFrame = {pos, physPos, BE_BLOCK_RECORD_HEADER_SIZE + length, physLength};
+	if (compressed) {
+		// Write the frame and then record it in the frame index.
+		uint8_t frameRecord[BE_FRAME_INDEX_RECORD_SIZE];
+		BEBlockStoreSerialiseFrame(&newFrame, frameRecord);
+		written = pwrite(fd, frame, physLength, physPos) == physLength
+			&& pwrite(file->frameFd, frameRecord, BE_FRAME_INDEX_RECORD_SIZE, (off_t)file->numFrames * BE_FRAME_INDEX_RECORD_SIZE) == BE_FRAME_INDEX_RECORD_SIZE;
+		free(frame);
+		if (NOT written)
+			ftruncate(file->frameFd, (off_t)file->numFrames * BE_FRAME_INDEX_RECORD_SIZE);
+	}else
+		written = pwrite(fd, header, BE_BLOCK_RECORD_HEADER_SIZE, pos) == BE_BLOCK_RECORD_HEADER_SIZE
+			&& pwrite(fd, data, length, pos + BE_BLOCK_RECORD_HEADER_SIZE) == length;
+	if (NOT written) {
+		// Remove anything which was partially written.
+		ftruncate(fd, physPos);
+		BEBlockStoreUnpinFile(file);
+		pthread_mutex_unlock(&self->appendLock);
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not write a block of %u bytes to block file %u.",length, fileID);
+		return false;
+	}
+	// Record the block in the index file after the block, so that the index never refers to incomplete blocks.
+	BEBlockStoreIndexEntry entry;
+	memcpy(entry.blockHash, hash, 32);
+	entry.ref.fileID = fileID;
+	entry.ref.filePos = pos;
+	entry.record = self->numRecords;
+	entry.status = BE_BLOCK_DATA_AVAILABLE;
+	entry.checksummed = false;
+	uint8_t record[BE_BLOCK_INDEX_RECORD_SIZE];
+	BEBlockStoreSerialiseIndexEntry(&entry, record);
+	if (pwrite(self->indexFd, record, BE_BLOCK_INDEX_RECORD_SIZE, (off_t)self->numRecords * BE_BLOCK_INDEX_RECORD_SIZE) != BE_BLOCK_INDEX_RECORD_SIZE) {
+		ftruncate(self->indexFd, (off_t)self->numRecords * BE_BLOCK_INDEX_RECORD_SIZE);
+		if (compressed)
+			ftruncate(file->frameFd, (off_t)file->numFrames * BE_FRAME_INDEX_RECORD_SIZE);
+		ftruncate(fd, physPos);
+		BEBlockStoreUnpinFile(file);
+		pthread_mutex_unlock(&self->appendLock);
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not write to the block index file.");
+		return false;
+	}
+	// The block is complete so make it visible to readers.
+	pthread_rwlock_wrlock(&self->filesLock);
+	if (compressed)
+		file->frames[file->numFrames++] = newFrame;
+	file->size = pos + BE_BLOCK_RECORD_HEADER_SIZE + length;
+	file->physSize = physPos + physLength;
+	self->indexTable[BEBlockStoreFindIndexSlot(self, hash, &found)] = self->numIndexed + 1;
+	self->index[self->numIndexed++] = entry;
+	self->numRecords++;
+	if (NOT self->unsynced || fileID < self->firstUnsyncedFile)
+		self->firstUnsyncedFile = fileID;
+	self->unsynced = true;
+	BEBlockStoreUnpinFile(file);
+	pthread_rwlock_unlock(&self->filesLock);
+	pthread_mutex_unlock(&self->appendLock);
+	ref->fileID = fileID;
+	ref->filePos = pos;
+	*added = true;
+	return true;
+}
+void BEBlockStoreAdvise(BEBlockStore * self, uint16_t fileID, uint64_t pos, uint32_t length){
+	pthread_rwlock_wrlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	if (file && file->compressed) {
+		// Advise the whole frame which holds the data.
+		if (file->numFrames) {
+			BEBlockStoreFrame * frame = file->frames + BEBlockStoreFindFrame(file, pos);
+			posix_fadvise(file->fd, frame->physPos, frame->physLength, POSIX_FADV_WILLNEED);
+		}
+	}else if (file)
+		posix_fadvise(file->fd, pos, length, POSIX_FADV_WILLNEED);
+	pthread_rwlock_unlock(&self->filesLock);
+}
+bool BEBlockStoreBorrow(BEBlockStore * self, uint16_t fileID, uint64_t pos, uint32_t length, uint8_t ** data){
+	// Make sure the files are counted, so that it is known which are finished.
+	BEBlockStoreGetNumFiles(self);
+	pthread_rwlock_wrlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	// Compressed files cannot be used directly.
+	if (NOT file || file->compressed || NOT BEBlockStoreFileIsFinished(self, file) || pos + length > file->size) {
+		pthread_rwlock_unlock(&self->filesLock);
+		return false;
+	}
+	if (NOT file->map) {
+		// Map the whole file. It is not appended to so the mapping stays valid.
+		void * map = mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+		if (map == MAP_FAILED) {
+			pthread_rwlock_unlock(&self->filesLock);
+			return false;
+		}
+		file->map = map;
+		file->mapSize = file->size;
+		madvise(file->map, file->mapSize, file->access == BE_BLOCK_STORE_ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+	}
+	if (file->access == BE_BLOCK_STORE_ACCESS_RANDOM) {
+		// With random access the kernel does not read ahead, so ask for all of the data at once.
+		uint64_t pageSize = sysconf(_SC_PAGESIZE);
+		uint64_t start = (pos / pageSize) * pageSize;
+		madvise(file->map + start, pos + length - start, MADV_WILLNEED);
+	}
+	*data = file->map + pos;
+	file->borrows++;
+	pthread_rwlock_unlock(&self->filesLock);
+	return true;
+}
+bool BEBlockStoreBorrowBlock(BEBlockStore * self, uint16_t fileID, uint64_t filePos, uint8_t ** data, uint32_t * length){
+	uint8_t * header;
+	if (NOT BEBlockStoreBorrow(self, fileID, filePos, BE_BLOCK_RECORD_HEADER_SIZE, &header))
+		return false;
+	uint32_t blockLen = header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+	uint32_t crc = header[4] | (uint32_t)header[5] << 8 | (uint32_t)header[6] << 16 | (uint32_t)header[7] << 24;
+	BEBlockStoreReturnBlock(self, fileID);
+	if (NOT BEBlockStoreBorrow(self, fileID, filePos + BE_BLOCK_RECORD_HEADER_SIZE, blockLen, data))
+		return false;
+	if (BECRC32C(0, *data, blockLen) != crc) {
+		BEBlockStoreReturnBlock(self, fileID);
+		self->onErrorReceived(CB_ERROR_GENERAL,"The block at position %llu in block file %u does not have the right checksum.",(unsigned long long)filePos, fileID);
+		return false;
+	}
+	*length = blockLen;
+	return true;
+}
+void BEBlockStoreCloseFile(BEBlockStore * self, BEBlockStoreFile * file){
+	int32_t x = (int32_t)(file - self->files);
+	// Remove from the hash table
+	int32_t * link = self->buckets + BEBlockStoreGetBucket(self, file->fileID);
+	while (*link != x)
+		link = &self->files[*link].hashNext;
+	*link = file->hashNext;
+	// Remove from the least recently used list
+	if (file->prev == -1)
+		self->lruHead = file->next;
+	else
+		self->files[file->prev].next = file->next;
+	if (file->next == -1)
+		self->lruTail = file->prev;
+	else
+		self->files[file->next].prev = file->prev;
+	// Close the file and free the slot
+	if (file->map)
+		munmap(file->map, file->mapSize);
+	if (file->compressed) {
+		free(file->frames);
+		close(file->frameFd);
+	}
+	close(file->fd);
+	file->fd = -1;
+	file->next = self->freeHead;
+	self->freeHead = x;
+	self->numFiles--;
+}
+uint8_t * BEBlockStoreCompressFrame(BEBlockStore * self, uint8_t * header, uint8_t * data, uint32_t length, uint32_t * frameLength){
+#ifdef BE_LZ4
+	// The record header and block are compressed together so they need to be in one buffer.
+	uint32_t rawLength = BE_BLOCK_RECORD_HEADER_SIZE + length;
+	uint8_t * raw = malloc(rawLength);
+	uint8_t * frame = malloc(BE_BLOCK_FRAME_HEADER_SIZE + LZ4_compressBound(rawLength));
+	if (NOT raw || NOT frame) {
+		free(raw);
+		free(frame);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory to compress a block of %u bytes in BEBlockStoreCompressFrame.",length);
+		return NULL;
+	}
+	memcpy(raw, header, BE_BLOCK_RECORD_HEADER_SIZE);
+	memcpy(raw + BE_BLOCK_RECORD_HEADER_SIZE, data, length);
+	int compressedLength = LZ4_compress_default((char *)raw, (char *)frame + BE_BLOCK_FRAME_HEADER_SIZE, rawLength, LZ4_compressBound(rawLength));
+	free(raw);
+	if (compressedLength <= 0) {
+		free(frame);
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not compress a block of %u bytes.",length);
+		return NULL;
+	}
+	// The frame header has the compressed length and then the uncompressed length.
+	for (uint8_t x = 0; x < 4; x++) {
+		frame[x] = (uint32_t)compressedLength >> 8*x;
+		frame[4 + x] = rawLength >> 8*x;
+	}
+	*frameLength = BE_BLOCK_FRAME_HEADER_SIZE + compressedLength;
+	return frame;
+#else
+	(void)header;
+	(void)data;
+	(void)frameLength;
+	self->onErrorReceived(CB_ERROR_GENERAL,"Cannot compress a block of %u bytes without BE_LZ4.",length);
+	return NULL;
+#endif
+}
+BEBlockSendStatus BEBlockStoreContinueSend(BEBlockStore * self, BEBlockSend * blockSend, int socket){
+	uint32_t total = BE_MESSAGE_HEADER_SIZE + blockSend->length;
+	while (blockSend->sent < total) {
+		ssize_t sent;
+		if (blockSend->file && blockSend->sent >= BE_MESSAGE_HEADER_SIZE) {
+			// Send the block from the file without copying it through user space.
+			off_t offset = blockSend->filePos + blockSend->sent - BE_MESSAGE_HEADER_SIZE;
+			sent = sendfile(socket, blockSend->file->fd, &offset, total - blockSend->sent);
+			if (NOT sent) {
+				// The file ended before the block, so the block was removed while being sent.
+				self->onErrorReceived(CB_ERROR_GENERAL,"Block file %u ended while sending the block at position %llu.",blockSend->file->fileID, (unsigned long long)blockSend->filePos);
+				return BE_BLOCK_SEND_ERROR;
+			}
+		}else if (blockSend->file)
+			// Hold the header back so that it goes out in the same packets as the start of the block.
+			sent = send(socket, blockSend->header + blockSend->sent, BE_MESSAGE_HEADER_SIZE - blockSend->sent, MSG_MORE | MSG_NOSIGNAL);
+		else{
+			// Gather what is left of the header and the block into one write.
+			uint32_t headerSent = BE_MIN(blockSend->sent, BE_MESSAGE_HEADER_SIZE);
+			struct iovec parts[2];
+			parts[0].iov_base = blockSend->header + headerSent;
+			parts[0].iov_len = BE_MESSAGE_HEADER_SIZE - headerSent;
+			parts[1].iov_base = CBByteArrayGetData(blockSend->data) + blockSend->sent - headerSent;
+			parts[1].iov_len = total - BE_MESSAGE_HEADER_SIZE - (blockSend->sent - headerSent);
+			struct msghdr message = {.msg_iov = parts, .msg_iovlen = 2};
+			sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+		}
+		if (sent == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return BE_BLOCK_SEND_BLOCKED;
+			return BE_BLOCK_SEND_ERROR;
+		}
+		blockSend->sent += (uint32_t)sent;
+	}
+	return BE_BLOCK_SEND_DONE;
+}
+void BEBlockStoreEndSend(BEBlockStore * self, BEBlockSend * blockSend){
+	// The file is unpinned without the files lock, so only the send is needed.
+	(void)self;
+	if (blockSend->file)
+		BEBlockStoreUnpinFile(blockSend->file);
+	if (blockSend->data)
+		CBReleaseObject(blockSend->data);
+}
+bool BEBlockStoreEvictFile(BEBlockStore * self){
+	// Find the least recently used file which is not in use. Files with borrowed data are in use as the mapping must stay valid.
+	int32_t x = self->lruTail;
+	while (x != -1 && (self->files[x].users || self->files[x].borrows))
+		x = self->files[x].prev;
+	if (x == -1)
+		return false;
+	BEBlockStoreCloseFile(self, self->files + x);
+	self->evictions++;
+	return true;
+}
+bool BEBlockStoreFileIsFinished(BEBlockStore * self, BEBlockStoreFile * file){
+	return self->filesCounted && file->fileID + 1 < self->numBlockFiles;
+}
+bool BEBlockStoreFileIsPruned(BEBlockStore * self, uint16_t fileID){
+	return fileID < self->prunedFilesLength && self->prunedFiles[fileID];
+}
+bool BEBlockStoreFindBlock(BEBlockStore * self, uint8_t * hash, BEFileReference * ref){
+	pthread_rwlock_rdlock(&self->filesLock);
+	bool found;
+	uint32_t indexPos = BEBlockStoreFindIndexEntry(self, hash, &found);
+	if (found)
+		*ref = self->index[indexPos].ref;
+	pthread_rwlock_unlock(&self->filesLock);
+	return found;
+}
+BEBlockStoreFile * BEBlockStoreFindFile(BEBlockStore * self, uint16_t fileID){
+	int32_t x = self->buckets[BEBlockStoreGetBucket(self, fileID)];
+	while (x != -1 && self->files[x].fileID != fileID)
+		x = self->files[x].hashNext;
+	if (x == -1)
+		return NULL;
+	BEBlockStoreFile * file = self->files + x;
+	// Move to the front of the least recently used list. Readers may do this at the same time so use the LRU lock.
+	pthread_mutex_lock(&self->lruLock);
+	self->hits++;
+	if (file->prev != -1) {
+		self->files[file->prev].next = file->next;
+		if (file->next == -1)
+			self->lruTail = file->prev;
+		else
+			self->files[file->next].prev = file->prev;
+		file->prev = -1;
+		file->next = self->lruHead;
+		self->files[self->lruHead].prev = x;
+		self->lruHead = x;
+	}
+	pthread_mutex_unlock(&self->lruLock);
+	return file;
+}
+uint32_t BEBlockStoreFindFrame(BEBlockStoreFile * file, uint64_t pos){
+	// Find the last frame starting at or before the position.
+	uint32_t left = 0;
+	uint32_t right = file->numFrames - 1;
+	while (left < right) {
+		uint32_t mid = (left + right + 1)/2;
+		if (file->frames[mid].rawPos <= pos)
+			left = mid;
+		else
+			right = mid - 1;
+	}
+	return left;
+}
+uint32_t BEBlockStoreFindIndexEntry(BEBlockStore * self, uint8_t * hash, bool * found){
+	uint32_t slot = BEBlockStoreFindIndexSlot(self, hash, found);
+	return *found ? self->indexTable[slot] - 1 : self->numIndexed;
+}
+uint32_t BEBlockStoreFindIndexSlot(BEBlockStore * self, uint8_t * hash, bool * found){
+	// The table is at most half full, so there is always an empty slot to stop at.
+	uint32_t mask = self->indexTableSize - 1;
+	uint32_t slot = BESipHash256(self->indexKey0, self->indexKey1, hash) & mask;
+	while (self->indexTable[slot]) {
+		if (NOT memcmp(self->index[self->indexTable[slot] - 1].blockHash, hash, 32)) {
+			*found = true;
+			return slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+	*found = false;
+	return slot;
+}
+uint16_t BEBlockStoreGetAppendFile(BEBlockStore * self, uint32_t length){
+	uint16_t fileID = BEBlockStoreGetNumFiles(self);
+	if (NOT fileID)
+		return 0;
+	fileID--;
+	pthread_rwlock_wrlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	bool roll = file && file->physSize && file->physSize + BE_BLOCK_RECORD_HEADER_SIZE + length > self->targetFileSize;
+	if (roll) {
+		// The file is full. Release the unused preallocated space, which is beyond the end of the file, and move onto the next file.
+		if (file->allocated > file->physSize && NOT ftruncate(file->fd, file->physSize))
+			file->allocated = file->physSize;
+		fileID++;
+	}
+	pthread_rwlock_unlock(&self->filesLock);
+	// Finished files are synced before blocks go into the next file, so only the last file needs to be checked when recovering. On failure the blocks stay unsynced and the next sync tries again.
+	if (roll)
+		BEBlockStoreSyncFiles(self);
+	return fileID;
+}
+BEBlockDataStatus BEBlockStoreGetBlockStatus(BEBlockStore * self, uint8_t * hash){
+	pthread_rwlock_rdlock(&self->filesLock);
+	bool found;
+	uint32_t indexPos = BEBlockStoreFindIndexEntry(self, hash, &found);
+	BEBlockDataStatus status = found ? self->index[indexPos].status : BE_BLOCK_DATA_MISSING;
+	pthread_rwlock_unlock(&self->filesLock);
+	return status;
+}
+uint32_t BEBlockStoreGetBucket(BEBlockStore * self, uint16_t fileID){
+	return ((uint32_t)fileID * 2654435761u) & (self->numBuckets - 1);
+}
+uint64_t BEBlockStoreGetDiskUsage(BEBlockStore * self){
+	uint16_t numFiles = BEBlockStoreGetNumFiles(self);
+	char blockFile[strlen(self->dataDir) + 16];
+	struct stat st;
+	uint64_t usage = 0;
+	pthread_rwlock_rdlock(&self->filesLock);
+	for (uint16_t x = 0; x < numFiles; x++) {
+		if (BEBlockStoreFileIsPruned(self, x))
+			continue;
+		// Use the sizes on disk, which include preallocated space and frame indexes.
+		sprintf(blockFile, "%sblocks%u.dat", self->dataDir, x);
+		if (NOT stat(blockFile, &st))
+			usage += (uint64_t)st.st_blocks * 512;
+		sprintf(blockFile, "%sblocks%u.idx", self->dataDir, x);
+		if (NOT stat(blockFile, &st))
+			usage += (uint64_t)st.st_blocks * 512;
+	}
+	pthread_rwlock_unlock(&self->filesLock);
+	return usage;
+}
+BEBlockStoreFile * BEBlockStoreGetFile(BEBlockStore * self, uint16_t fileID){
+	BEBlockStoreFile * file = BEBlockStoreFindFile(self, fileID);
+	if (file)
+		return file;
+	// The data of pruned files is gone.
+	if (BEBlockStoreFileIsPruned(self, fileID))
+		return NULL;
+	// Not open. Make room for the file if needed.
+	if (self->numFiles == self->maxOpenFiles && NOT BEBlockStoreEvictFile(self)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not open block file %u as all %u open block files are in use.",fileID, self->maxOpenFiles);
+		return NULL;
+	}
+	// Open the file, creating it if it does not exist.
+	char blockFile[strlen(self->dataDir) + 16];
+	sprintf(blockFile, "%sblocks%u.dat", self->dataDir, fileID);
+	int fd = open(blockFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not open the block file %s. errno = %i",blockFile, errno);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	BEBlockStoreFile opened;
+	opened.fd = fd;
+	opened.fileID = fileID;
+	opened.size = st.st_size;
+	opened.physSize = st.st_size;
+	opened.allocated = BE_MAX((uint64_t)st.st_blocks * 512, (uint64_t)st.st_size);
+	opened.map = NULL;
+	opened.mapSize = 0;
+	opened.borrows = 0;
+	opened.access = BE_BLOCK_STORE_ACCESS_RANDOM;
+	opened.users = 0;
+	opened.frames = NULL;
+	opened.numFrames = 0;
+	// Files with a frame index are compressed. New files are compressed if compression is enabled.
+	char frameFile[strlen(self->dataDir) + 16];
+	sprintf(frameFile, "%sblocks%u.idx", self->dataDir, fileID);
+	opened.compressed = NOT access(frameFile, F_OK) || (NOT st.st_size && self->compress);
+	// A new file is only durable once the directory is synced.
+	if (NOT st.st_size)
+		self->syncDirectory = true;
+	if (opened.compressed && NOT BEBlockStoreLoadFrames(self, &opened)) {
+		close(fd);
+		return NULL;
+	}
+	// Take an unused slot
+	int32_t x = self->freeHead;
+	file = self->files + x;
+	self->freeHead = file->next;
+	*file = opened;
+	// Add to the hash table
+	uint32_t bucket = BEBlockStoreGetBucket(self, fileID);
+	file->hashNext = self->buckets[bucket];
+	self->buckets[bucket] = x;
+	// Add to the front of the least recently used list
+	file->prev = -1;
+	file->next = self->lruHead;
+	if (self->lruHead == -1)
+		self->lruTail = x;
+	else
+		self->files[self->lruHead].prev = x;
+	self->lruHead = x;
+	self->numFiles++;
+	self->opens++;
+	// Opening a new file may add a file.
+	if (self->filesCounted && fileID >= self->numBlockFiles)
+		self->numBlockFiles = fileID + 1;
+	return file;
+}
+uint64_t BEBlockStoreGetFileSize(BEBlockStore * self, uint16_t fileID){
+	pthread_rwlock_wrlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	uint64_t size = file ? file->size : 0;
+	pthread_rwlock_unlock(&self->filesLock);
+	return size;
+}
+uint16_t BEBlockStoreGetNumFiles(BEBlockStore * self){
+	pthread_rwlock_wrlock(&self->filesLock);
+	if (NOT self->filesCounted) {
+		// Count the block files which exist. This is only done once, after which the count is kept up to date as files are opened. Pruned files no longer exist, so start after the last file with indexed or pruned blocks.
+		char blockFile[strlen(self->dataDir) + 16];
+		uint16_t num = self->prunedFilesLength;
+		for (uint32_t x = 0; x < self->numIndexed; x++)
+			if (self->index[x].ref.fileID >= num)
+				num = self->index[x].ref.fileID + 1;
+		for (;; num++) {
+			sprintf(blockFile, "%sblocks%u.dat", self->dataDir, num);
+			if (access(blockFile, F_OK))
+				break;
+		}
+		self->numBlockFiles = num;
+		self->filesCounted = true;
+	}
+	uint16_t num = self->numBlockFiles;
+	pthread_rwlock_unlock(&self->filesLock);
+	return num;
+}
+bool BEBlockStoreLoadFrames(BEBlockStore * self, BEBlockStoreFile * file){
+	char frameFile[strlen(self->dataDir) + 16];
+	sprintf(frameFile, "%sblocks%u.idx", self->dataDir, file->fileID);
+	file->frameFd = open(frameFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (file->frameFd == -1) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not open the frame index %s. errno = %i",frameFile, errno);
+		return false;
+	}
+	struct stat st, frameSt;
+	if (fstat(file->fd, &st) || fstat(file->frameFd, &frameSt)) {
+		close(file->frameFd);
+		return false;
+	}
+	uint32_t numRecords = (uint32_t)(frameSt.st_size / BE_FRAME_INDEX_RECORD_SIZE);
+	uint8_t * data = NULL;
+	if (numRecords) {
+		data = malloc((size_t)numRecords * BE_FRAME_INDEX_RECORD_SIZE);
+		file->frames = malloc(sizeof(*file->frames) * numRecords);
+		if (NOT data || NOT file->frames
+			|| pread(file->frameFd, data, (size_t)numRecords * BE_FRAME_INDEX_RECORD_SIZE, 0) != (ssize_t)numRecords * BE_FRAME_INDEX_RECORD_SIZE) {
+			free(data);
+			free(file->frames);
+			close(file->frameFd);
+			self->onErrorReceived(CB_ERROR_GENERAL,"Could not load the frame index %s.",frameFile);
+			return false;
+		}
+	}
+	// Load the frames which are completely in the file.
+	uint64_t rawEnd = 0;
+	uint64_t physEnd = 0;
+	file->numFrames = 0;
+	for (uint32_t x = 0; x < numRecords; x++) {
+		uint8_t * record = data + (size_t)x * BE_FRAME_INDEX_RECORD_SIZE;
+		// Records from a bad checksum onwards are found again from the frame headers.
+		uint32_t crc = record[24] | (uint32_t)record[25] << 8 | (uint32_t)record[26] << 16 | (uint32_t)record[27] << 24;
+		if (BECRC32C(0, record, BE_FRAME_INDEX_RECORD_SIZE - 4) != crc)
+			break;
+		BEBlockStoreFrame * frame = file->frames + x;
+		frame->rawPos = 0;
+		frame->physPos = 0;
+		for (uint8_t y = 0; y < 8; y++) {
+			frame->rawPos |= (uint64_t)record[y] << 8*y;
+			frame->physPos |= (uint64_t)record[8 + y] << 8*y;
+		}
+		frame->rawLength = record[16] | (uint32_t)record[17] << 8 | (uint32_t)record[18] << 16 | (uint32_t)record[19] << 24;
+		frame->physLength = record[20] | (uint32_t)record[21] << 8 | (uint32_t)record[22] << 16 | (uint32_t)record[23] << 24;
+		if (frame->rawPos != rawEnd || frame->physPos != physEnd || frame->physPos + frame->physLength > (uint64_t)st.st_size)
+			break;
+		rawEnd += frame->rawLength;
+		physEnd += frame->physLength;
+		file->numFrames++;
+	}
+	free(data);
+	// Frames written after the last index record, before the program stopped, are found from the frame headers.
+	uint8_t header[BE_BLOCK_FRAME_HEADER_SIZE];
+	while (physEnd + BE_BLOCK_FRAME_HEADER_SIZE <= (uint64_t)st.st_size && BEBlockStoreReadFully(file->fd, header, BE_BLOCK_FRAME_HEADER_SIZE, physEnd)) {
+		uint32_t compressedLength = header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+		uint32_t rawLength = header[4] | (uint32_t)header[5] << 8 | (uint32_t)header[6] << 16 | (uint32_t)header[7] << 24;
+		if (physEnd + BE_BLOCK_FRAME_HEADER_SIZE + compressedLength > (uint64_t)st.st_size)
+			break;
+		BEBlockStoreFrame * temp = realloc(file->frames, sizeof(*file->frames) * (file->numFrames + 1));
+		if (NOT temp)
+			break;
+		file->frames = temp;
+		BEBlockStoreFrame * frame = file->frames + file->numFrames;
+		frame->rawPos = rawEnd;
+		frame->physPos = physEnd;
+		frame->rawLength = rawLength;
+		frame->physLength = BE_BLOCK_FRAME_HEADER_SIZE + compressedLength;
+		uint8_t record[BE_FRAME_INDEX_RECORD_SIZE];
+		BEBlockStoreSerialiseFrame(frame, record);
+		if (pwrite(file->frameFd, record, BE_FRAME_INDEX_RECORD_SIZE, (off_t)file->numFrames * BE_FRAME_INDEX_RECORD_SIZE) != BE_FRAME_INDEX_RECORD_SIZE)
+			break;
+		file->numFrames++;
+		rawEnd += rawLength;
+		physEnd += frame->physLength;
+	}
+	// Remove any partially written frame and index records for frames which are not in the file.
+	if (physEnd < (uint64_t)st.st_size)
+		ftruncate(file->fd, physEnd);
+	ftruncate(file->frameFd, (off_t)file->numFrames * BE_FRAME_INDEX_RECORD_SIZE);
+	file->size = rawEnd;
+	file->physSize = physEnd;
+	return true;
+}
+bool BEBlockStoreLoadIndex(BEBlockStore * self){
+	char indexFile[strlen(self->dataDir) + strlen(BE_BLOCK_INDEX_FILE) + 1];
+	sprintf(indexFile, "%s%s", self->dataDir, BE_BLOCK_INDEX_FILE);
+	self->indexFd = open(indexFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (self->indexFd == -1) {
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the block index file %s. errno = %i",indexFile, errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(self->indexFd, &st)) {
+		close(self->indexFd);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not get the size of the block index file.");
+		return false;
+	}
+	// Ignore a partially written record at the end.
+	uint32_t numRecords = (uint32_t)(st.st_size / BE_BLOCK_INDEX_RECORD_SIZE);
+	if (NOT BEBlockStoreReserveIndex(self, numRecords ? numRecords : 1)) {
+		free(self->index);
+		close(self->indexFd);
+		return false;
+	}
+	if (NOT numRecords)
+		return true;
+	uint8_t * data = malloc((size_t)numRecords * BE_BLOCK_INDEX_RECORD_SIZE);
+	if (NOT data) {
+		free(self->index);
+		free(self->indexTable);
+		close(self->indexFd);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u block index records in BEBlockStoreLoadIndex.",numRecords);
+		return false;
+	}
+	if (pread(self->indexFd, data, (size_t)numRecords * BE_BLOCK_INDEX_RECORD_SIZE, 0) != (ssize_t)numRecords * BE_BLOCK_INDEX_RECORD_SIZE) {
+		free(data);
+		free(self->index);
+		free(self->indexTable);
+		close(self->indexFd);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not read the block index file.");
+		return false;
+	}
+	uint32_t numIndexed = 0;
+	for (uint32_t x = 0; x < numRecords; x++) {
+		uint8_t * record = data + (size_t)x * BE_BLOCK_INDEX_RECORD_SIZE;
+		uint32_t crc = record[43] | (uint32_t)record[44] << 8 | (uint32_t)record[45] << 16 | (uint32_t)record[46] << 24;
+		if (BECRC32C(0, record, BE_BLOCK_INDEX_RECORD_SIZE - 4) != crc) {
+			// Leave out the corrupt record. The block will not be found, so it can be added again.
+			self->onErrorReceived(CB_ERROR_GENERAL,"Block index record %u does not have the right checksum and is skipped.",x);
+			continue;
+		}
+		BEBlockStoreIndexEntry * entry = self->index + numIndexed++;
+		memcpy(entry->blockHash, record, 32);
+		entry->ref.fileID = record[32] | (uint16_t)record[33] << 8;
+		entry->ref.filePos = 0;
+		for (uint8_t y = 0; y < 8; y++)
+			entry->ref.filePos |= (uint64_t)record[34 + y] << 8*y;
+		entry->record = x;
+		entry->status = record[42];
+		entry->checksummed = false;
+		if (entry->status == BE_BLOCK_DATA_PRUNED && NOT BEBlockStoreFileIsPruned(self, entry->ref.fileID)
+			&& NOT BEBlockStoreSetPruned(self, entry->ref.fileID)) {
+			free(data);
+			free(self->index);
+			free(self->indexTable);
+			close(self->indexFd);
+			return false;
+		}
+	}
+	free(data);
+	// Remove pruned files which were left when the program stopped after marking the blocks as pruned.
+	char blockFile[strlen(self->dataDir) + 16];
+	for (uint16_t x = 0; x < self->prunedFilesLength; x++) {
+		if (NOT self->prunedFiles[x])
+			continue;
+		sprintf(blockFile, "%sblocks%u.dat", self->dataDir, x);
+		unlink(blockFile);
+		sprintf(blockFile, "%sblocks%u.idx", self->dataDir, x);
+		unlink(blockFile);
+	}
+	self->numIndexed = numIndexed;
+	self->numRecords = numRecords;
+	BEBlockStoreRebuildIndexTable(self);
+	return true;
+}
+void BEBlockStorePinFile(BEBlockStoreFile * file){
+	// Readers pin files at the same time so the count is changed atomically.
+	__sync_fetch_and_add(&file->users, 1);
+}
+BEBlockStoreFile * BEBlockStorePinOpenFile(BEBlockStore * self, uint16_t fileID, uint64_t * size){
+	// Only use the read lock if the file is already open.
+	pthread_rwlock_rdlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreFindFile(self, fileID);
+	if (file) {
+		BEBlockStorePinFile(file);
+		*size = file->size;
+	}
+	pthread_rwlock_unlock(&self->filesLock);
+	if (NOT file) {
+		// Open the file with the write lock.
+		pthread_rwlock_wrlock(&self->filesLock);
+		file = BEBlockStoreGetFile(self, fileID);
+		if (file) {
+			BEBlockStorePinFile(file);
+			*size = file->size;
+		}
+		pthread_rwlock_unlock(&self->filesLock);
+	}
+	return file;
+}
+void BEBlockStorePreallocate(BEBlockStore * self, BEBlockStoreFile * file, uint64_t needed){
+	if (NOT self->preallocationSize)
+		return;
+	// Allocate whole chunks but do not go far past the target size.
+	uint64_t newAllocated = ((needed + self->preallocationSize - 1) / self->preallocationSize) * self->preallocationSize;
+	if (newAllocated > self->targetFileSize)
+		newAllocated = BE_MAX(needed, self->targetFileSize);
+	if (newAllocated <= file->allocated)
+		return;
+	// Allocate without changing the file size so that the size continues to give the end of the block data. On failure the writes will allocate the space instead.
+#if defined(__linux__)
+	if (NOT fallocate(file->fd, FALLOC_FL_KEEP_SIZE, file->allocated, newAllocated - file->allocated))
+		file->allocated = newAllocated;
+#elif defined(__APPLE__)
+	fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, newAllocated - file->allocated, 0};
+	if (fcntl(file->fd, F_PREALLOCATE, &store) == -1) {
+		// Could not allocate contiguous space so try fragmented space.
+		store.fst_flags = F_ALLOCATEALL;
+		if (fcntl(file->fd, F_PREALLOCATE, &store) == -1)
+			return;
+	}
+	file->allocated = newAllocated;
+#endif
+}
+bool BEBlockStorePruneFile(BEBlockStore * self, uint16_t fileID){
+	uint16_t numFiles = BEBlockStoreGetNumFiles(self);
+	pthread_mutex_lock(&self->appendLock);
+	pthread_rwlock_wrlock(&self->filesLock);
+	if (BEBlockStoreFileIsPruned(self, fileID)) {
+		pthread_rwlock_unlock(&self->filesLock);
+		pthread_mutex_unlock(&self->appendLock);
+		return true;
+	}
+	// The last file is appended to, so only finished files can be pruned.
+	if (fileID + 1 >= numFiles) {
+		pthread_rwlock_unlock(&self->filesLock);
+		pthread_mutex_unlock(&self->appendLock);
+		self->onErrorReceived(CB_ERROR_GENERAL,"Cannot prune block file %u as it is not finished.",fileID);
+		return false;
+	}
+	// Close the file. Files which are in use cannot be closed.
+	int32_t x = self->buckets[BEBlockStoreGetBucket(self, fileID)];
+	while (x != -1 && self->files[x].fileID != fileID)
+		x = self->files[x].hashNext;
+	if (x != -1) {
+		if (self->files[x].users || self->files[x].borrows) {
+			pthread_rwlock_unlock(&self->filesLock);
+			pthread_mutex_unlock(&self->appendLock);
+			return false;
+		}
+		BEBlockStoreCloseFile(self, self->files + x);
+	}
+	if (NOT BEBlockStoreSetPruned(self, fileID)) {
+		pthread_rwlock_unlock(&self->filesLock);
+		pthread_mutex_unlock(&self->appendLock);
+		return false;
+	}
+	// Mark the blocks as pruned in the index before removing the file, so that the index never says data is available when it is not.
+	bool ok = true;
+	uint8_t record[BE_BLOCK_INDEX_RECORD_SIZE];
+	for (uint32_t y = 0; y < self->numIndexed; y++) {
+		if (self->index[y].ref.fileID != fileID)
+			continue;
+		// The checksum covers the status, so write the whole record again.
+		self->index[y].status = BE_BLOCK_DATA_PRUNED;
+		BEBlockStoreSerialiseIndexEntry(self->index + y, record);
+		if (pwrite(self->indexFd, record, BE_BLOCK_INDEX_RECORD_SIZE, (off_t)self->index[y].record * BE_BLOCK_INDEX_RECORD_SIZE) != BE_BLOCK_INDEX_RECORD_SIZE)
+			ok = false;
+	}
+	ok = ok && NOT fdatasync(self->indexFd);
+	pthread_rwlock_unlock(&self->filesLock);
+	pthread_mutex_unlock(&self->appendLock);
+	if (NOT ok) {
+		// The file is not used anymore and it will be removed when the block store is next opened if the index was updated.
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not mark the blocks of block file %u as pruned.",fileID);
+		return false;
+	}
+	char blockFile[strlen(self->dataDir) + 16];
+	sprintf(blockFile, "%sblocks%u.dat", self->dataDir, fileID);
+	unlink(blockFile);
+	sprintf(blockFile, "%sblocks%u.idx", self->dataDir, fileID);
+	unlink(blockFile);
+	return true;
+}
+bool BEBlockStoreRead(BEBlockStore * self, uint16_t fileID, uint64_t pos, uint8_t * data, uint32_t length){
+	uint64_t size;
+	BEBlockStoreFile * file = BEBlockStorePinOpenFile(self, fileID, &size);
+	if (NOT file)
+		return false;
+	// Do not read data which is not complete.
+	bool ok = pos + length <= size;
+	if (file->compressed) {
+		// Copy the data out of each frame it is in.
+		while (ok && length) {
+			uint8_t * raw;
+			uint64_t rawPos = 0;
+			uint32_t rawLength = 0;
+			if (NOT BEBlockStoreReadFrame(self, file, pos, &raw, &rawPos, &rawLength)) {
+				ok = false;
+				break;
+			}
+			uint32_t num = (uint32_t)BE_MIN((uint64_t)length, rawPos + rawLength - pos);
+			memcpy(data, raw + (pos - rawPos), num);
+			free(raw);
+			data += num;
+			pos += num;
+			length -= num;
+		}
+	}else if (ok)
+		ok = BEBlockStoreReadFully(file->fd, data, length, pos);
+	BEBlockStoreUnpinFile(file);
+	return ok;
+}
+CBByteArray * BEBlockStoreReadBlock(BEBlockStore * self, uint16_t fileID, uint64_t filePos){
+	// If the file is finished, copy the block once from the mapping.
+	uint8_t * borrowed;
+	uint32_t borrowedLen;
+	if (BEBlockStoreBorrowBlock(self, fileID, filePos, &borrowed, &borrowedLen)) {
+		CBByteArray * data = CBNewByteArrayWithDataCopy(borrowed, borrowedLen, self->onErrorReceived);
+		BEBlockStoreReturnBlock(self, fileID);
+		return data;
+	}
+	// Compressed blocks have a frame each, so decompress the frame once for the whole block.
+	pthread_rwlock_wrlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	bool compressed = file && file->compressed;
+	if (compressed)
+		BEBlockStorePinFile(file);
+	pthread_rwlock_unlock(&self->filesLock);
+	if (compressed) {
+		uint8_t * raw;
+		uint64_t rawPos = 0;
+		uint32_t rawLength = 0;
+		CBByteArray * data = NULL;
+		if (BEBlockStoreReadFrame(self, file, filePos, &raw, &rawPos, &rawLength)) {
+			if (rawPos == filePos && rawLength >= BE_BLOCK_RECORD_HEADER_SIZE)
+				data = CBNewByteArrayWithDataCopy(raw + BE_BLOCK_RECORD_HEADER_SIZE, rawLength - BE_BLOCK_RECORD_HEADER_SIZE, self->onErrorReceived);
+			free(raw);
+		}
+		BEBlockStoreUnpinFile(file);
+		return data;
+	}
+	// Get the length and checksum of the block.
+	uint8_t header[BE_BLOCK_RECORD_HEADER_SIZE];
+	if (NOT BEBlockStoreRead(self, fileID, filePos, header, BE_BLOCK_RECORD_HEADER_SIZE))
+		return NULL;
+	CBByteArray * data = CBNewByteArrayOfSize(header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24, self->onErrorReceived);
+	if (NOT data)
+		return NULL;
+	// Now read block data
+	if (NOT BEBlockStoreRead(self, fileID, filePos + BE_BLOCK_RECORD_HEADER_SIZE, CBByteArrayGetData(data), data->length)) {
+		CBReleaseObject(data);
+		return NULL;
+	}
+	if (BECRC32C(0, CBByteArrayGetData(data), data->length) != (header[4] | (uint32_t)header[5] << 8 | (uint32_t)header[6] << 16 | (uint32_t)header[7] << 24)) {
+		CBReleaseObject(data);
+		self->onErrorReceived(CB_ERROR_GENERAL,"The block at position %llu in block file %u does not have the right checksum.",(unsigned long long)filePos, fileID);
+		return NULL;
+	}
+	return data;
+}
+bool BEBlockStoreReadFrame(BEBlockStore * self, BEBlockStoreFile * file, uint64_t pos, uint8_t ** data, uint64_t * rawPos, uint32_t * rawLength){
+	// Find the frame with the lock as an appender may move the frames.
+	pthread_rwlock_rdlock(&self->filesLock);
+	if (NOT file->numFrames) {
+		pthread_rwlock_unlock(&self->filesLock);
+		return false;
+	}
+	BEBlockStoreFrame frame = file->frames[BEBlockStoreFindFrame(file, pos)];
+	pthread_rwlock_unlock(&self->filesLock);
+	if (pos >= frame.rawPos + frame.rawLength)
+		return false;
+	uint8_t * physData = malloc(frame.physLength);
+	*data = malloc(frame.rawLength);
+	if (NOT physData || NOT *data) {
+		free(physData);
+		free(*data);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory to decompress a frame of %u bytes in BEBlockStoreReadFrame.",frame.rawLength);
+		return false;
+	}
+	bool ok = BEBlockStoreReadFully(file->fd, physData, frame.physLength, frame.physPos);
+#ifdef BE_LZ4
+	ok = ok && LZ4_decompress_safe((char *)physData + BE_BLOCK_FRAME_HEADER_SIZE, (char *)*data, frame.physLength - BE_BLOCK_FRAME_HEADER_SIZE, frame.rawLength) == (int)frame.rawLength;
+#else
+	if (ok)
+		self->onErrorReceived(CB_ERROR_GENERAL,"Cannot read compressed block file %u without BE_LZ4.",file->fileID);
+	ok = false;
+#endif
+	free(physData);
+	if (ok) {
+		// Check the block in the frame against the checksum in the block record header.
+		uint8_t * header = *data;
+		ok = frame.rawLength >= BE_BLOCK_RECORD_HEADER_SIZE
+			&& (header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24) == frame.rawLength - BE_BLOCK_RECORD_HEADER_SIZE
+			&& BECRC32C(0, header + BE_BLOCK_RECORD_HEADER_SIZE, frame.rawLength - BE_BLOCK_RECORD_HEADER_SIZE) == (header[4] | (uint32_t)header[5] << 8 | (uint32_t)header[6] << 16 | (uint32_t)header[7] << 24);
+		if (NOT ok)
+			self->onErrorReceived(CB_ERROR_GENERAL,"The block at position %llu in block file %u does not have the right checksum.",(unsigned long long)frame.rawPos, file->fileID);
+	}
+	if (NOT ok) {
+		free(*data);
+		return false;
+	}
+	*rawPos = frame.rawPos;
+	*rawLength = frame.rawLength;
+	return true;
+}
+bool BEBlockStoreReadFully(int fd, uint8_t * data, uint32_t length, uint64_t pos){
+	while (length) {
+		ssize_t res = pread(fd, data, length, pos);
+		if (res <= 0) {
+			if (res == -1 && errno == EINTR)
+				continue;
+			return false;
+		}
+		data += res;
+		pos += res;
+		length -= res;
+	}
+	return true;
+}
+void BEBlockStoreRebuildIndexTable(BEBlockStore * self){
+	memset(self->indexTable, 0, sizeof(*self->indexTable) * self->indexTableSize);
+	for (uint32_t x = 0; x < self->numIndexed; x++) {
+		bool found;
+		self->indexTable[BEBlockStoreFindIndexSlot(self, self->index[x].blockHash, &found)] = x + 1;
+	}
+}
+bool BEBlockStoreRecover(BEBlockStore * self){
+	uint16_t numFiles = BEBlockStoreGetNumFiles(self);
+	if (NOT numFiles || BEBlockStoreFileIsPruned(self, numFiles - 1))
+		return true;
+	uint16_t lastFile = numFiles - 1;
+	// Blocks are added in order, so the records from the first record of the last file are for the last file.
+	uint32_t firstRecord = self->numRecords;
+	for (uint32_t x = 0; x < self->numIndexed; x++)
+		if (self->index[x].ref.fileID == lastFile && self->index[x].record < firstRecord)
+			firstRecord = self->index[x].record;
+	uint32_t numTail = self->numRecords - firstRecord;
+	BEBlockStoreIndexEntry ** tail = malloc(sizeof(*tail) * (numTail ? numTail : 1));
+	if (NOT tail) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u block index records in BEBlockStoreRecover.",numTail);
+		return false;
+	}
+	// Records which were skipped for bad checksums have no entry.
+	for (uint32_t x = 0; x < numTail; x++)
+		tail[x] = NULL;
+	for (uint32_t x = 0; x < self->numIndexed; x++)
+		if (self->index[x].record >= firstRecord)
+			tail[self->index[x].record - firstRecord] = self->index + x;
+	pthread_rwlock_wrlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, lastFile);
+	uint64_t size = 0;
+	if (file) {
+		BEBlockStorePinFile(file);
+		size = file->size;
+	}
+	pthread_rwlock_unlock(&self->filesLock);
+	if (NOT file) {
+		free(tail);
+		return false;
+	}
+	// Follow the blocks through the file, checking the checksums, until a record does not match a complete block. The blocks of skipped records are passed over and kept if later records match.
+	uint64_t end = 0;
+	uint64_t indexedEnd = 0;
+	uint32_t valid = 0;
+	for (uint32_t x = 0; x < numTail; x++) {
+		BEBlockStoreIndexEntry * entry = tail[x];
+		if (entry && (entry->ref.fileID != lastFile || entry->ref.filePos != end))
+			break;
+		uint32_t length;
+		if (NOT BEBlockStoreVerifyBlock(self, file, end, size, &length))
+			break;
+		end += BE_BLOCK_RECORD_HEADER_SIZE + length;
+		if (entry) {
+			indexedEnd = end;
+			valid = x + 1;
+		}
+	}
+	BEBlockStoreUnpinFile(file);
+	free(tail);
+	bool truncate = valid < numTail || indexedEnd < size;
+	if (valid < numTail) {
+		// Remove the records which do not match blocks.
+		pthread_rwlock_wrlock(&self->filesLock);
+		uint32_t kept = 0;
+		for (uint32_t x = 0; x < self->numIndexed; x++)
+			if (self->index[x].record < firstRecord + valid)
+				self->index[kept++] = self->index[x];
+		self->numIndexed = kept;
+		self->numRecords = firstRecord + valid;
+		BEBlockStoreRebuildIndexTable(self);
+		pthread_rwlock_unlock(&self->filesLock);
+	}
+	if (NOT truncate)
+		return true;
+	// Remove data which is not indexed, such as a partially written block.
+	self->onErrorReceived(CB_ERROR_GENERAL,"Recovering block file %u by removing %u block index records and the data after position %llu.",lastFile, numTail - valid, (unsigned long long)indexedEnd);
+	return BEBlockStoreTruncate(self, lastFile, indexedEnd) && BEBlockStoreSync(self);
+}
+bool BEBlockStoreReserveIndex(BEBlockStore * self, uint32_t numEntries){
+	if (numEntries <= self->indexSize)
+		return true;
+	// Grow geometrically so that adding blocks one at a time takes constant time on average.
+	uint32_t indexSize = self->indexSize ? self->indexSize : BE_BLOCK_INDEX_MIN_ENTRIES;
+	while (indexSize < numEntries)
+		indexSize *= 2;
+	BEBlockStoreIndexEntry * index = realloc(self->index, sizeof(*index) * indexSize);
+	if (NOT index) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u block index entries in BEBlockStoreReserveIndex.",indexSize);
+		return false;
+	}
+	self->index = index;
+	uint32_t * indexTable = malloc(sizeof(*indexTable) * indexSize * 2);
+	if (NOT indexTable) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u block index hash table slots in BEBlockStoreReserveIndex.",indexSize * 2);
+		return false;
+	}
+	free(self->indexTable);
+	self->indexTable = indexTable;
+	self->indexTableSize = indexSize * 2;
+	self->indexSize = indexSize;
+	BEBlockStoreRebuildIndexTable(self);
+	return true;
+}
+void BEBlockStoreReturnBlock(BEBlockStore * self, uint16_t fileID){
+	pthread_rwlock_wrlock(&self->filesLock);
+	// Files with borrowed data are never closed so the file will be found.
+	BEBlockStoreFile * file = BEBlockStoreFindFile(self, fileID);
+	if (file && file->borrows)
+		file->borrows--;
+	pthread_rwlock_unlock(&self->filesLock);
+}
+void * BEBlockStoreScrub(void * vself){
+	BEBlockStore * self = vself;
+	while (NOT self->stopScrub) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		double start = ts.tv_sec + ts.tv_nsec / 1e9;
+		uint64_t passBytes = 0;
+		uint16_t numFiles = BEBlockStoreGetNumFiles(self);
+		bool finished = true;
+		for (uint16_t x = 0; finished && x < numFiles; x++)
+			finished = BEBlockStoreScrubFile(self, x, start, &passBytes);
+		if (finished)
+			self->scrubPasses++;
+		if (NOT passBytes && NOT self->stopScrub) {
+			// There are no blocks, so wait before looking again.
+			struct timespec wait = {0, BE_SCRUB_MAX_SLEEP};
+			nanosleep(&wait, NULL);
+		}
+	}
+	return NULL;
+}
+bool BEBlockStoreScrubFile(BEBlockStore * self, uint16_t fileID, double start, uint64_t * passBytes){
+	for (uint64_t pos = 0;;) {
+		if (self->stopScrub)
+			return false;
+		// Only pin the file while checking one block, so that the file can be closed or pruned in between.
+		pthread_rwlock_wrlock(&self->filesLock);
+		BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+		uint64_t size = 0;
+		if (file) {
+			BEBlockStorePinFile(file);
+			size = file->size;
+		}
+		pthread_rwlock_unlock(&self->filesLock);
+		if (NOT file)
+			return true;
+		if (pos >= size) {
+			BEBlockStoreUnpinFile(file);
+			return true;
+		}
+		uint32_t length;
+		bool ok = BEBlockStoreVerifyBlock(self, file, pos, size, &length);
+		BEBlockStoreUnpinFile(file);
+		if (NOT ok) {
+			self->scrubErrors++;
+			self->onErrorReceived(CB_ERROR_GENERAL,"Scrubbing found a corrupt block at position %llu in block file %u.",(unsigned long long)pos, fileID);
+			// Without the length the following blocks cannot be found.
+			if (NOT length)
+				return true;
+		}
+		pos += BE_BLOCK_RECORD_HEADER_SIZE + length;
+		*passBytes += BE_BLOCK_RECORD_HEADER_SIZE + length;
+		self->scrubbedBytes += BE_BLOCK_RECORD_HEADER_SIZE + length;
+		// Wait until reading the bytes so far keeps to the rate.
+		double due = start + (double)*passBytes / self->scrubRate;
+		while (NOT self->stopScrub) {
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			double now = ts.tv_sec + ts.tv_nsec / 1e9;
+			if (now >= due)
+				break;
+			struct timespec wait = {0, (long)BE_MIN((due - now) * 1e9, (double)BE_SCRUB_MAX_SLEEP)};
+			nanosleep(&wait, NULL);
+		}
+	}
+}
+void BEBlockStoreSerialiseFrame(BEBlockStoreFrame * frame, uint8_t * record){
+	for (uint8_t x = 0; x < 8; x++) {
+		record[x] = frame->rawPos >> 8*x;
+		record[8 + x] = frame->physPos >> 8*x;
+	}
+	for (uint8_t x = 0; x < 4; x++) {
+		record[16 + x] = frame->rawLength >> 8*x;
+		record[20 + x] = frame->physLength >> 8*x;
+	}
+	uint32_t crc = BECRC32C(0, record, BE_FRAME_INDEX_RECORD_SIZE - 4);
+	for (uint8_t x = 0; x < 4; x++)
+		record[24 + x] = crc >> 8*x;
+}
+void BEBlockStoreSerialiseIndexEntry(BEBlockStoreIndexEntry * entry, uint8_t * record){
+	memcpy(record, entry->blockHash, 32);
+	record[32] = entry->ref.fileID;
+	record[33] = entry->ref.fileID >> 8;
+	for (uint8_t x = 0; x < 8; x++)
+		record[34 + x] = entry->ref.filePos >> 8*x;
+	record[42] = entry->status;
+	uint32_t crc = BECRC32C(0, record, BE_BLOCK_INDEX_RECORD_SIZE - 4);
+	for (uint8_t x = 0; x < 4; x++)
+		record[43 + x] = crc >> 8*x;
+}
+void BEBlockStoreSetAccess(BEBlockStore * self, uint16_t fileID, BEBlockStoreAccess access){
+	pthread_rwlock_wrlock(&self->filesLock);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	if (file && file->access != access) {
+		file->access = access;
+		if (file->map)
+			madvise(file->map, file->mapSize, access == BE_BLOCK_STORE_ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+		posix_fadvise(file->fd, 0, 0, access == BE_BLOCK_STORE_ACCESS_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+	}
+	pthread_rwlock_unlock(&self->filesLock);
+}
+bool BEBlockStoreSetPruned(BEBlockStore * self, uint16_t fileID){
+	if (fileID >= self->prunedFilesLength) {
+		bool * temp = realloc(self->prunedFiles, sizeof(*self->prunedFiles) * (fileID + 1));
+		if (NOT temp) {
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the pruned files in BEBlockStoreSetPruned.",sizeof(*self->prunedFiles) * (fileID + 1));
+			return false;
+		}
+		self->prunedFiles = temp;
+		memset(self->prunedFiles + self->prunedFilesLength, 0, sizeof(*self->prunedFiles) * (fileID + 1 - self->prunedFilesLength));
+		self->prunedFilesLength = fileID + 1;
+	}
+	self->prunedFiles[fileID] = true;
+	return true;
+}
+bool BEBlockStoreStartSend(BEBlockStore * self, uint8_t * hash, uint32_t networkID, BEBlockSend * blockSend){
+	pthread_rwlock_rdlock(&self->filesLock);
+	bool found;
+	uint32_t indexPos = BEBlockStoreFindIndexEntry(self, hash, &found);
+	BEBlockStoreIndexEntry entry;
+	if (found)
+		entry = self->index[indexPos];
+	pthread_rwlock_unlock(&self->filesLock);
+	if (NOT found || entry.status != BE_BLOCK_DATA_AVAILABLE)
+		return false;
+	blockSend->sent = 0;
+	blockSend->filePos = entry.ref.filePos + BE_BLOCK_RECORD_HEADER_SIZE;
+	blockSend->file = NULL;
+	blockSend->data = NULL;
+	uint64_t size;
+	BEBlockStoreFile * file = BEBlockStorePinOpenFile(self, entry.ref.fileID, &size);
+	if (NOT file)
+		return false;
+	if (entry.checksummed && NOT file->compressed) {
+		// Only the length is needed, which is in the block record header.
+		uint8_t header[BE_BLOCK_RECORD_HEADER_SIZE];
+		if (entry.ref.filePos + BE_BLOCK_RECORD_HEADER_SIZE > size
+			|| NOT BEBlockStoreReadFully(file->fd, header, BE_BLOCK_RECORD_HEADER_SIZE, entry.ref.filePos)) {
+			BEBlockStoreUnpinFile(file);
+			return false;
+		}
+		blockSend->length = header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+		if (blockSend->filePos + blockSend->length > size) {
+			BEBlockStoreUnpinFile(file);
+			return false;
+		}
+		blockSend->file = file;
+	}else{
+		// The block data is needed. Use the mapping if the file is finished, and then the block can still be sent from the file. Otherwise the block is read and sent from memory.
+		uint8_t * data;
+		bool borrowed = NOT file->compressed && BEBlockStoreBorrowBlock(self, entry.ref.fileID, entry.ref.filePos, &data, &blockSend->length);
+		if (borrowed)
+			blockSend->file = file;
+		else{
+			BEBlockStoreUnpinFile(file);
+			blockSend->data = BEBlockStoreReadBlock(self, entry.ref.fileID, entry.ref.filePos);
+			if (NOT blockSend->data)
+				return false;
+			data = CBByteArrayGetData(blockSend->data);
+			blockSend->length = blockSend->data->length;
+		}
+		if (NOT entry.checksummed) {
+			uint8_t hash1[32];
+			uint8_t hash2[32];
+			CBSha256(data, blockSend->length, hash1);
+			CBSha256(hash1, 32, hash2);
+			memcpy(entry.messageChecksum, hash2, 4);
+			// Keep the checksum for the next time. The index may have changed, so find the block again.
+			pthread_rwlock_wrlock(&self->filesLock);
+			indexPos = BEBlockStoreFindIndexEntry(self, hash, &found);
+			if (found && self->index[indexPos].ref.fileID == entry.ref.fileID && self->index[indexPos].ref.filePos == entry.ref.filePos) {
+				memcpy(self->index[indexPos].messageChecksum, entry.messageChecksum, 4);
+				self->index[indexPos].checksummed = true;
+			}
+			pthread_rwlock_unlock(&self->filesLock);
+		}
+		if (borrowed)
+			BEBlockStoreReturnBlock(self, entry.ref.fileID);
+	}
+	// Make the message header
+	for (uint8_t x = 0; x < 4; x++) {
+		blockSend->header[x] = networkID >> 8*x;
+		blockSend->header[16 + x] = blockSend->length >> 8*x;
+	}
+	memcpy(blockSend->header + 4, "block\0\0\0\0\0\0\0", 12);
+	memcpy(blockSend->header + 20, entry.messageChecksum, 4);
+	return true;
+}
+bool BEBlockStoreStartScrub(BEBlockStore * self, uint64_t bytesPerSecond){
+	self->scrubRate = bytesPerSecond ? bytesPerSecond : 1;
+	if (self->scrubbing)
+		return true;
+	self->stopScrub = false;
+	if (pthread_create(&self->scrubThread, NULL, BEBlockStoreScrub, self)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not start the scrub thread.");
+		return false;
+	}
+	self->scrubbing = true;
+	return true;
+}
+void BEBlockStoreStopScrub(BEBlockStore * self){
+	if (NOT self->scrubbing)
+		return;
+	self->stopScrub = true;
+	pthread_join(self->scrubThread, NULL);
+	self->scrubbing = false;
+}
+bool BEBlockStoreSync(BEBlockStore * self){
+	pthread_mutex_lock(&self->appendLock);
+	bool ok = BEBlockStoreSyncFiles(self);
+	pthread_mutex_unlock(&self->appendLock);
+	return ok;
+}
+bool BEBlockStoreSyncFiles(BEBlockStore * self){
+	if (NOT self->unsynced && NOT self->syncDirectory)
+		return true;
+	bool ok = true;
+	// Sync the block data before the index so that the index does not refer to blocks which were lost.
+	if (self->unsynced) {
+		uint16_t numFiles = BEBlockStoreGetNumFiles(self);
+		for (uint16_t x = self->firstUnsyncedFile; ok && x < numFiles; x++) {
+			pthread_rwlock_wrlock(&self->filesLock);
+			BEBlockStoreFile * file = BEBlockStoreGetFile(self, x);
+			if (file)
+				BEBlockStorePinFile(file);
+			pthread_rwlock_unlock(&self->filesLock);
+			if (NOT file)
+				continue;
+			ok = NOT fdatasync(file->fd) && (NOT file->compressed || NOT fdatasync(file->frameFd));
+			BEBlockStoreUnpinFile(file);
+		}
+		ok = ok && NOT fdatasync(self->indexFd);
+	}
+	// Sync the directory so that new files are kept.
+	if (ok && self->syncDirectory) {
+		int dirFd = open(self->dataDir, O_RDONLY);
+		ok = dirFd != -1 && NOT fsync(dirFd);
+		if (dirFd != -1)
+			close(dirFd);
+	}
+	if (NOT ok) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not sync the block files. errno = %i",errno);
+		return false;
+	}
+	self->unsynced = false;
+	self->syncDirectory = false;
+	return true;
+}
+bool BEBlockStoreTruncate(BEBlockStore * self, uint16_t fileID, uint64_t size){
+	pthread_mutex_lock(&self->appendLock);
+	pthread_rwlock_wrlock(&self->filesLock);
+	// Remove the blocks from the index. Blocks are added in order, so the removed blocks have the last records.
+	uint32_t firstRecord = self->numRecords;
+	uint32_t kept = 0;
+	for (uint32_t x = 0; x < self->numIndexed; x++) {
+		BEFileReference * ref = &self->index[x].ref;
+		if (ref->fileID > fileID || (ref->fileID == fileID && ref->filePos >= size)) {
+			if (self->index[x].record < firstRecord)
+				firstRecord = self->index[x].record;
+		}else
+			self->index[kept++] = self->index[x];
+	}
+	// Truncate the index first so that it never refers to removed blocks.
+	bool ok = NOT ftruncate(self->indexFd, (off_t)firstRecord * BE_BLOCK_INDEX_RECORD_SIZE);
+	self->numIndexed = kept;
+	self->numRecords = firstRecord;
+	BEBlockStoreRebuildIndexTable(self);
+	BEBlockStoreFile * file = BEBlockStoreGetFile(self, fileID);
+	ok = ok && file;
+	uint64_t physSize = size;
+	if (ok && file->compressed) {
+		// Blocks are removed whole, so the new size is at the start of a frame.
+		uint32_t frame = file->numFrames;
+		if (size < file->size) {
+			frame = BEBlockStoreFindFrame(file, size);
+			ok = file->frames[frame].rawPos == size;
+		}
+		physSize = frame < file->numFrames ? file->frames[frame].physPos : file->physSize;
+		ok = ok && NOT ftruncate(file->frameFd, (off_t)frame * BE_FRAME_INDEX_RECORD_SIZE);
+		if (ok)
+			file->numFrames = frame;
+	}
+	if (ok && NOT ftruncate(file->fd, physSize)) {
+		file->size = size;
+		file->physSize = physSize;
+		if (NOT self->unsynced || fileID < self->firstUnsyncedFile)
+			self->firstUnsyncedFile = fileID;
+		self->unsynced = true;
+	}else
+		ok = false;
+	pthread_rwlock_unlock(&self->filesLock);
+	pthread_mutex_unlock(&self->appendLock);
+	return ok;
+}
+void BEBlockStoreUnpinFile(BEBlockStoreFile * file){
+	__sync_fetch_and_sub(&file->users, 1);
+}
+bool BEBlockStoreVerifyBlock(BEBlockStore * self, BEBlockStoreFile * file, uint64_t pos, uint64_t size, uint32_t * length){
+	*length = 0;
+	if (file->compressed) {
+		// The frame gives the length even if the frame is corrupt.
+		pthread_rwlock_rdlock(&self->filesLock);
+		BEBlockStoreFrame frame = {0, 0, 0, 0};
+		if (file->numFrames)
+			frame = file->frames[BEBlockStoreFindFrame(file, pos)];
+		pthread_rwlock_unlock(&self->filesLock);
+		if (frame.rawPos != pos || frame.rawLength < BE_BLOCK_RECORD_HEADER_SIZE || pos + frame.rawLength > size)
+			return false;
+		*length = frame.rawLength - BE_BLOCK_RECORD_HEADER_SIZE;
+		// Reading the frame checks the checksum.
+		uint8_t * raw;
+		uint64_t rawPos;
+		uint32_t rawLength;
+		if (NOT BEBlockStoreReadFrame(self, file, pos, &raw, &rawPos, &rawLength))
+			return false;
+		free(raw);
+		return true;
+	}
+	uint8_t header[BE_BLOCK_RECORD_HEADER_SIZE];
+	if (pos + BE_BLOCK_RECORD_HEADER_SIZE > size || NOT BEBlockStoreReadFully(file->fd, header, BE_BLOCK_RECORD_HEADER_SIZE, pos))
+		return false;
+	uint32_t blockLength = header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+	if (pos + BE_BLOCK_RECORD_HEADER_SIZE + blockLength > size)
+		return false;
+	*length = blockLength;
+	// Check the block a part at a time so that large blocks do not need much memory.
+	uint8_t * buffer = malloc(BE_SCRUB_BUFFER_SIZE);
+	if (NOT buffer) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory in BEBlockStoreVerifyBlock.",BE_SCRUB_BUFFER_SIZE);
+		return false;
+	}
+	uint32_t crc = 0;
+	for (uint32_t done = 0; done < blockLength;) {
+		uint32_t num = BE_MIN(blockLength - done, BE_SCRUB_BUFFER_SIZE);
+		if (NOT BEBlockStoreReadFully(file->fd, buffer, num, pos + BE_BLOCK_RECORD_HEADER_SIZE + done)) {
+			free(buffer);
+			return false;
+		}
+		crc = BECRC32C(crc, buffer, num);
+		done += num;
+	}
+	free(buffer);
+	return crc == (header[4] | (uint32_t)header[5] << 8 | (uint32_t)header[6] << 16 | (uint32_t)header[7] << 24);
+}
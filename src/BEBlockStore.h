@@ -0,0 +1,599 @@
+//
+//  BEBlockStore.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 01/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Stores the blocks of all branches in block files using positional reads and writes on file descriptors.
+ */
+
+#ifndef BEBLOCKSTOREH
+#define BEBLOCKSTOREH
+
+#include "BEConstants.h"
+#include "BECRC32C.h"
+#include "BESipHash.h"
+#include "CBBlock.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#ifdef BE_LZ4
+#include <lz4.h>
+#endif
+
+/**
+ @brief How block data is going to be accessed, used to advise the operating system.
+ */
+typedef enum{
+	BE_BLOCK_STORE_ACCESS_RANDOM, /**< Blocks are read in no particular order, such as when serving blocks. */
+	BE_BLOCK_STORE_ACCESS_SEQUENTIAL, /**< Blocks are read one after the other, such as when replaying blocks for a reorganisation. */
+} BEBlockStoreAccess;
+
+/**
+ @brief Whether the data for a block is stored.
+ */
+typedef enum{
+	BE_BLOCK_DATA_MISSING, /**< The block is not in the block index. */
+	BE_BLOCK_DATA_AVAILABLE, /**< The block data is stored. */
+	BE_BLOCK_DATA_PRUNED, /**< The block was stored but its file was pruned. */
+} BEBlockDataStatus;
+
+/**
+ @brief References a part of block storage.
+ */
+typedef struct{
+	uint16_t fileID; /**< The file being referenced. */
+	uint64_t filePos; /**< The position in the file which is being referenced. */
+} BEFileReference;
+
+/**
+ @brief The position of a stored block, found by the block hash.
+ */
+typedef struct{
+	uint8_t blockHash[32]; /**< The block hash. */
+	BEFileReference ref; /**< The position of the block. */
+	uint32_t record; /**< The index of the record for the block in the block index file. */
+	BEBlockDataStatus status; /**< Whether the block data is available or pruned. */
+	bool checksummed; /**< True if messageChecksum has been worked out. This is not saved in the block index file. */
+	uint8_t messageChecksum[4]; /**< The network message checksum of the block. */
+} BEBlockStoreIndexEntry;
+
+/**
+ @brief A compressed frame holding one block.
+ */
+typedef struct{
+	uint64_t rawPos; /**< The position of the block record in the uncompressed data. */
+	uint64_t physPos; /**< The position of the frame in the file. */
+	uint32_t rawLength; /**< The length of the uncompressed block record. */
+	uint32_t physLength; /**< The length of the frame including the frame header. */
+} BEBlockStoreFrame;
+
+/**
+ @brief Whether a block has been sent. @see BEBlockStoreContinueSend
+ */
+typedef enum{
+	BE_BLOCK_SEND_DONE, /**< The message has been completely sent. */
+	BE_BLOCK_SEND_BLOCKED, /**< The socket is full. Continue when the socket is writable. */
+	BE_BLOCK_SEND_ERROR, /**< The socket failed or the block could not be read. */
+} BEBlockSendStatus;
+
+/**
+ @brief An open block file.
+ */
+typedef struct{
+	int fd; /**< The file descriptor. */
+	uint16_t fileID; /**< The index of the file. */
+	uint64_t size; /**< The number of bytes of complete blocks in the file. For compressed files this is the uncompressed size. */
+	uint64_t physSize; /**< The number of bytes of complete blocks or frames written to the file. */
+	uint64_t allocated; /**< The number of bytes allocated on disk for the file, including preallocated space. */
+	uint8_t * map; /**< The memory mapping of a finished file or NULL if not mapped. */
+	uint64_t mapSize; /**< The length of the mapping. */
+	uint32_t borrows; /**< The number of borrowed blocks from the mapping which have not been returned. */
+	BEBlockStoreAccess access; /**< The advised access pattern for the file. */
+	uint32_t users; /**< The number of threads using the file descriptor outside of the files lock. The file is not closed while in use. */
+	int32_t prev; /**< The index of the more recently used file or -1 if this is the most recently used file. */
+	int32_t next; /**< The index of the less recently used file or -1 if this is the least recently used file. For unused slots this is the next unused slot. */
+	int32_t hashNext; /**< The index of the next file in the same hash bucket or -1. */
+	bool compressed; /**< True if the blocks are stored in compressed frames. */
+	BEBlockStoreFrame * frames; /**< The frames of a compressed file in order. */
+	uint32_t numFrames; /**< The number of frames. */
+	int frameFd; /**< The file descriptor for the frame index of a compressed file. */
+} BEBlockStoreFile;
+
+/**
+ @brief A block being sent to a socket as a block message. @see BEBlockStoreStartSend
+ */
+typedef struct{
+	uint8_t header[BE_MESSAGE_HEADER_SIZE]; /**< The message header. */
+	uint32_t length; /**< The length of the block. */
+	uint32_t sent; /**< The number of bytes of the header and the block which have been sent. */
+	uint64_t filePos; /**< The position of the block data in the file, after the block record header. */
+	BEBlockStoreFile * file; /**< The pinned block file the block is sent from, or NULL if the block is sent from data. */
+	CBByteArray * data; /**< The block when it is sent from memory, or NULL. */
+} BEBlockSend;
+
+/**
+ @brief Structure for BEBlockStore objects. @see BEBlockStore.h
+ */
+typedef struct{
+	CBObject base;
+	char * dataDir; /**< Data directory path */
+	BEBlockStoreFile * files; /**< Slots for open block files. Unused slots have a file descriptor of -1. The slots are never moved so pointers to open files remain valid until the files are closed. */
+	uint32_t maxOpenFiles; /**< The number of slots, which is the maximum number of open block files. */
+	uint32_t numFiles; /**< The number of open block files. */
+	int32_t * buckets; /**< Hash table of the first file index for each bucket or -1 */
+	uint32_t numBuckets; /**< The number of hash table buckets, a power of two. */
+	int32_t lruHead; /**< The index of the most recently used file or -1. */
+	int32_t lruTail; /**< The index of the least recently used file or -1. */
+	int32_t freeHead; /**< The index of the first unused slot or -1. */
+	uint64_t opens; /**< The number of times a block file was opened. */
+	uint64_t hits; /**< The number of times a block file was found already open. */
+	uint64_t evictions; /**< The number of times a block file was closed to make room for another. */
+	uint16_t numBlockFiles; /**< The number of block files. */
+	bool filesCounted; /**< True if the block files have been counted. */
+	BEBlockStoreIndexEntry * index; /**< The positions of the stored blocks in the order of their records. */
+	uint32_t numIndexed; /**< The number of stored blocks. */
+	uint32_t indexSize; /**< The number of entries allocated for index. */
+	uint32_t * indexTable; /**< Open addressing hash table of one more than the index of the entry for each block hash, or zero for empty slots. */
+	uint32_t indexTableSize; /**< The number of slots in indexTable, a power of two which is at least twice the number of entries. */
+	uint64_t indexKey0; /**< The first half of the random SipHash key for indexTable. */
+	uint64_t indexKey1; /**< The second half of the random SipHash key for indexTable. */
+	uint32_t numRecords; /**< The number of records in the block index file, which includes records skipped because of bad checksums. */
+	int indexFd; /**< The file descriptor for the block index file. */
+	bool * prunedFiles; /**< True for each file ID which has been pruned. */
+	uint16_t prunedFilesLength; /**< The length of prunedFiles, which is one more than the highest pruned file ID. */
+	bool unsynced; /**< True if blocks were added or removed since the last sync. */
+	uint16_t firstUnsyncedFile; /**< The first block file changed since the last sync. */
+	bool syncDirectory; /**< True if block files were created since the last sync. */
+	uint64_t targetFileSize; /**< The size at which a new block file is started. Defaults to BE_BLOCK_FILE_TARGET_SIZE. */
+	uint64_t preallocationSize; /**< The number of bytes preallocated at a time. Defaults to BE_BLOCK_FILE_PREALLOCATION. Zero disables preallocation. */
+	bool compress; /**< True if new block files are compressed. Defaults to true when compiled with BE_LZ4. */
+	pthread_rwlock_t filesLock; /**< Protects the file list, the file sizes and the block index. Readers take a read lock. */
+	pthread_mutex_t appendLock; /**< Held while writing so that there is only one appender. */
+	pthread_mutex_t lruLock; /**< Protects the least recently used list and the counters, which are changed by readers. */
+	pthread_t scrubThread; /**< The thread checking the block files when scrubbing. */
+	bool scrubbing; /**< True while the scrub thread is running. */
+	volatile bool stopScrub; /**< Set to stop the scrub thread. */
+	uint64_t scrubRate; /**< The maximum number of bytes read per second when scrubbing. */
+	uint64_t scrubbedBytes; /**< The number of bytes of blocks checked by the scrub thread. */
+	uint32_t scrubPasses; /**< The number of times the scrub thread has checked all of the block files. */
+	uint32_t scrubErrors; /**< The number of corrupt blocks found by the scrub thread. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEBlockStore;
+
+/**
+ @brief Creates a new BEBlockStore object.
+ @param dataDir The directory for the block files.
+ @param maxOpenFiles The maximum number of block files to keep open. This is lowered to half of the file descriptor limit.
+ @returns A new BEBlockStore object.
+ */
+BEBlockStore * BENewBlockStore(char * dataDir, uint32_t maxOpenFiles, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEBlockStore from another object. Use this to avoid casts.
+ @param self The object to obtain the BEBlockStore from.
+ @returns The BEBlockStore object.
+ */
+BEBlockStore * BEGetBlockStore(void * self);
+
+/**
+ @brief Initialises a BEBlockStore object.
+ @param self The BEBlockStore object to initialise.
+ @param dataDir The directory for the block files.
+ @param maxOpenFiles The maximum number of block files to keep open. This is lowered to half of the file descriptor limit.
+ @returns true on success, false on failure.
+ */
+bool BEInitBlockStore(BEBlockStore * self, char * dataDir, uint32_t maxOpenFiles, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEBlockStore object.
+ @param self The BEBlockStore object to free.
+ */
+void BEFreeBlockStore(void * self);
+
+// Functions
+
+/**
+ @brief Adds a block to the store unless it is already stored. New blocks are appended to the last block file, or to a new file once the last file reaches the target size. Only one block is written at a time.
+ @param self The BEBlockStore object.
+ @param hash The block hash.
+ @param data The serialised block.
+ @param length The length of the serialised block.
+ @param ref Set to the position of the block.
+ @param added Set to true if the block was written or false if the block was already stored. Blocks which were pruned are not written again.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreAddBlock(BEBlockStore * self, uint8_t * hash, uint8_t * data, uint32_t length, BEFileReference * ref, bool * added);
+/**
+ @brief Tells the operating system that part of a block file will be read soon so that it can begin reading it.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param pos The position of the data which will be read.
+ @param length The length of the data which will be read.
+ */
+void BEBlockStoreAdvise(BEBlockStore * self, uint16_t fileID, uint64_t pos, uint32_t length);
+/**
+ @brief Borrows data directly from the memory mapping of a finished block file without copying it. The data must be returned with BEBlockStoreReturnBlock.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param pos The position of the data in the file.
+ @param length The length of the data.
+ @param data Set to the data in the mapping.
+ @returns true if the data was borrowed or false if the block file is not finished or on failure, in which case the data should be read with BEBlockStoreRead.
+ */
+bool BEBlockStoreBorrow(BEBlockStore * self, uint16_t fileID, uint64_t pos, uint32_t length, uint8_t ** data);
+/**
+ @brief Borrows a block directly from the memory mapping of a finished block file without copying it. The block must be returned with BEBlockStoreReturnBlock.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param filePos The position of the block in the file.
+ @param data Set to the serialised block in the mapping.
+ @param length Set to the length of the serialised block.
+ @returns true if the block was borrowed or false if the block file is not finished, the block is corrupt or on failure, in which case the block should be read with BEBlockStoreReadBlock.
+ */
+bool BEBlockStoreBorrowBlock(BEBlockStore * self, uint16_t fileID, uint64_t filePos, uint8_t ** data, uint32_t * length);
+/**
+ @brief Closes an open block file, which must not be in use. The files lock must be held for writing.
+ @param self The BEBlockStore object.
+ @param file The block file.
+ */
+void BEBlockStoreCloseFile(BEBlockStore * self, BEBlockStoreFile * file);
+/**
+ @brief Compresses a block record into a frame.
+ @param self The BEBlockStore object.
+ @param header The block record header.
+ @param data The block data.
+ @param length The length of the block.
+ @param frameLength Set to the length of the frame.
+ @returns The frame, which should be freed, or NULL on failure.
+ */
+uint8_t * BEBlockStoreCompressFrame(BEBlockStore * self, uint8_t * header, uint8_t * data, uint32_t length, uint32_t * frameLength);
+/**
+ @brief Sends as much of a block message as the socket takes. The socket should be non-blocking. SIGPIPE should be ignored, as sendfile cannot be told not to raise it.
+ @param self The BEBlockStore object.
+ @param blockSend The block send started with BEBlockStoreStartSend.
+ @param socket The socket to send to. Nothing else should be sent to the socket until the message is done.
+ @returns BE_BLOCK_SEND_DONE once the whole message is sent, BE_BLOCK_SEND_BLOCKED if the socket is full, in which case this should be called again when the socket is writable, or BE_BLOCK_SEND_ERROR on failure. The send should be ended with BEBlockStoreEndSend in every case.
+ */
+BEBlockSendStatus BEBlockStoreContinueSend(BEBlockStore * self, BEBlockSend * blockSend, int socket);
+/**
+ @brief Ends a block send, releasing the block file or the block data.
+ @param self The BEBlockStore object.
+ @param blockSend The block send started with BEBlockStoreStartSend.
+ */
+void BEBlockStoreEndSend(BEBlockStore * self, BEBlockSend * blockSend);
+/**
+ @brief Closes the least recently used block file which is not in use. The files lock must be held for writing.
+ @param self The BEBlockStore object.
+ @returns true if a file was closed and false if all files are in use.
+ */
+bool BEBlockStoreEvictFile(BEBlockStore * self);
+/**
+ @brief Determines if a block file is finished. The files lock must be held.
+ @param self The BEBlockStore object.
+ @param file The block file.
+ @returns true if the block file will not be appended to.
+ */
+bool BEBlockStoreFileIsFinished(BEBlockStore * self, BEBlockStoreFile * file);
+/**
+ @brief Determines if a block file has been pruned. The files lock must be held.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @returns true if the block file was pruned.
+ */
+bool BEBlockStoreFileIsPruned(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Finds the position of a stored block.
+ @param self The BEBlockStore object.
+ @param hash The block hash.
+ @param ref Set to the position of the block if found.
+ @returns true if the block is stored and false otherwise.
+ */
+bool BEBlockStoreFindBlock(BEBlockStore * self, uint8_t * hash, BEFileReference * ref);
+/**
+ @brief Finds a block file if it is open and marks it as the most recently used. The files lock must be held for reading or writing.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @returns The open block file or NULL if the file is not open.
+ */
+BEBlockStoreFile * BEBlockStoreFindFile(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Finds the frame of a compressed file which holds a position with a binary search. The files lock must be held.
+ @param file The compressed block file, which must have at least one frame.
+ @param pos The uncompressed position.
+ @returns The index of the last frame starting at or before the position.
+ */
+uint32_t BEBlockStoreFindFrame(BEBlockStoreFile * file, uint64_t pos);
+/**
+ @brief Finds a block hash in the block index. The files lock must be held.
+ @param self The BEBlockStore object.
+ @param hash The block hash.
+ @param found Set to true if the hash was found.
+ @returns The index of the entry if found, or else the number of entries.
+ */
+uint32_t BEBlockStoreFindIndexEntry(BEBlockStore * self, uint8_t * hash, bool * found);
+/**
+ @brief Finds the slot of a block hash in the block index hash table. The files lock must be held.
+ @param self The BEBlockStore object.
+ @param hash The block hash.
+ @param found Set to true if the hash was found.
+ @returns The slot with the hash if found, or else the empty slot where the hash should be put.
+ */
+uint32_t BEBlockStoreFindIndexSlot(BEBlockStore * self, uint8_t * hash, bool * found);
+/**
+ @brief Gets the block file which the next block should be appended to. This is the last file unless adding the block would take the file over the target size, in which case the unused preallocated space of the last file is released and the next file is used. The append lock must be held.
+ @param self The BEBlockStore object.
+ @param length The length of the serialised block.
+ @returns The id of the block file.
+ */
+uint16_t BEBlockStoreGetAppendFile(BEBlockStore * self, uint32_t length);
+/**
+ @brief Gets whether the data of a block is stored.
+ @param self The BEBlockStore object.
+ @param hash The block hash.
+ @returns The status of the block data.
+ */
+BEBlockDataStatus BEBlockStoreGetBlockStatus(BEBlockStore * self, uint8_t * hash);
+/**
+ @brief Gets the hash table bucket for a block file.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @returns The bucket index.
+ */
+uint32_t BEBlockStoreGetBucket(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Gets the disk space used by the block files which are not pruned.
+ @param self The BEBlockStore object.
+ @returns The number of bytes used on disk.
+ */
+uint64_t BEBlockStoreGetDiskUsage(BEBlockStore * self);
+/**
+ @brief Finds an open block file, opening or creating the file if needed. The least recently used file is closed if too many files are open. The files lock must be held for writing.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @returns The open block file or NULL on failure or if the file was pruned.
+ */
+BEBlockStoreFile * BEBlockStoreGetFile(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Gets the number of bytes of complete blocks in a block file.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @returns The size of the file or zero if the file does not exist.
+ */
+uint64_t BEBlockStoreGetFileSize(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Gets the number of block files.
+ @param self The BEBlockStore object.
+ @returns The number of block files.
+ */
+uint16_t BEBlockStoreGetNumFiles(BEBlockStore * self);
+/**
+ @brief Loads the frame index of a compressed file, recovering frames which are not in the index and removing partially written frames.
+ @param self The BEBlockStore object.
+ @param file The compressed block file with the file descriptor and file ID set. The size, frames and frame index are set.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreLoadFrames(BEBlockStore * self, BEBlockStoreFile * file);
+/**
+ @brief Loads the block index file, creating it if it does not exist.
+ @param self The BEBlockStore object.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreLoadIndex(BEBlockStore * self);
+/**
+ @brief Marks a file as being in use so that it will not be closed. The files lock must be held for reading or writing.
+ @param file The block file.
+ */
+void BEBlockStorePinFile(BEBlockStoreFile * file);
+/**
+ @brief Finds an open block file, opening the file if needed, and pins it. The files lock must not be held.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param size Set to the number of bytes of complete blocks in the file.
+ @returns The pinned block file, which should be unpinned with BEBlockStoreUnpinFile, or NULL on failure.
+ */
+BEBlockStoreFile * BEBlockStorePinOpenFile(BEBlockStore * self, uint16_t fileID, uint64_t * size);
+/**
+ @brief Preallocates space at the end of a block file without changing the size of the file. The files lock must be held for writing.
+ @param self The BEBlockStore object.
+ @param file The block file.
+ @param needed The file will have at least this many bytes allocated.
+ */
+void BEBlockStorePreallocate(BEBlockStore * self, BEBlockStoreFile * file, uint64_t needed);
+/**
+ @brief Deletes a finished block file and marks its blocks as pruned in the block index.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file. This cannot be the last file.
+ @returns true if the file was pruned or was already pruned, false if the file is in use, is not finished or the index could not be updated.
+ */
+bool BEBlockStorePruneFile(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Reads data from a block file. Many threads may read at once.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param pos The position to read from.
+ @param data The buffer to read into.
+ @param length The number of bytes to read.
+ @returns true if all of the bytes were read and false otherwise.
+ */
+bool BEBlockStoreRead(BEBlockStore * self, uint16_t fileID, uint64_t pos, uint8_t * data, uint32_t length);
+/**
+ @brief Reads a block from a block file.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param filePos The position of the block in the file.
+ @returns A new CBByteArray with the serialised block or NULL if the block does not have the right checksum or on failure.
+ */
+CBByteArray * BEBlockStoreReadBlock(BEBlockStore * self, uint16_t fileID, uint64_t filePos);
+/**
+ @brief Reads and decompresses the frame of a compressed file which holds a position, checking the checksum of the block in the frame.
+ @param self The BEBlockStore object.
+ @param file The compressed block file, which must be pinned.
+ @param pos The uncompressed position.
+ @param data Set to the uncompressed frame data, which should be freed.
+ @param rawPos Set to the uncompressed position of the frame.
+ @param rawLength Set to the uncompressed length of the frame.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreReadFrame(BEBlockStore * self, BEBlockStoreFile * file, uint64_t pos, uint8_t ** data, uint64_t * rawPos, uint32_t * rawLength);
+/**
+ @brief Reads from a file descriptor at a position until all of the data is read.
+ @param fd The file descriptor.
+ @param data The buffer to read into.
+ @param length The number of bytes to read.
+ @param pos The position to read from.
+ @returns true if all of the data was read and false otherwise.
+ */
+bool BEBlockStoreReadFully(int fd, uint8_t * data, uint32_t length, uint64_t pos);
+/**
+ @brief Puts every entry of the block index into the hash table again, after entries were removed. The files lock must be held for writing.
+ @param self The BEBlockStore object.
+ */
+void BEBlockStoreRebuildIndexTable(BEBlockStore * self);
+/**
+ @brief Checks the blocks of the last block file against the block index after the block store was opened, removing index records which do not match complete blocks and data which is not indexed.
+ @param self The BEBlockStore object.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreRecover(BEBlockStore * self);
+/**
+ @brief Makes room in the block index for more entries, growing the entries and the hash table to twice their size when they are full. The files lock must be held for writing.
+ @param self The BEBlockStore object.
+ @param numEntries The number of entries which need room.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreReserveIndex(BEBlockStore * self, uint32_t numEntries);
+/**
+ @brief Returns a block or data borrowed with BEBlockStoreBorrowBlock or BEBlockStoreBorrow.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ */
+void BEBlockStoreReturnBlock(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Checks all of the block files over and over at a limited rate, until stopped. This is the function of the scrub thread.
+ @param self The BEBlockStore object.
+ @returns NULL
+ */
+void * BEBlockStoreScrub(void * self);
+/**
+ @brief Checks the blocks in a block file at the scrub rate.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param start The time the scrub pass started, from CLOCK_MONOTONIC in seconds.
+ @param passBytes The number of bytes checked in this pass, which is increased by the bytes checked in the file.
+ @returns true if the file was checked or false if the scrub was stopped.
+ */
+bool BEBlockStoreScrubFile(BEBlockStore * self, uint16_t fileID, double start, uint64_t * passBytes);
+/**
+ @brief Serialises a frame into a frame index record.
+ @param frame The frame.
+ @param record The BE_FRAME_INDEX_RECORD_SIZE bytes of the record.
+ */
+void BEBlockStoreSerialiseFrame(BEBlockStoreFrame * frame, uint8_t * record);
+/**
+ @brief Serialises a block index entry into a block index record.
+ @param entry The block index entry.
+ @param record The BE_BLOCK_INDEX_RECORD_SIZE bytes of the record.
+ */
+void BEBlockStoreSerialiseIndexEntry(BEBlockStoreIndexEntry * entry, uint8_t * record);
+/**
+ @brief Advises the operating system how a block file is going to be read.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param access The access pattern.
+ */
+void BEBlockStoreSetAccess(BEBlockStore * self, uint16_t fileID, BEBlockStoreAccess access);
+/**
+ @brief Records that a block file is pruned. The files lock must be held for writing.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @returns true on success and false if memory could not be allocated.
+ */
+bool BEBlockStoreSetPruned(BEBlockStore * self, uint16_t fileID);
+/**
+ @brief Starts sending a stored block to a socket as a block message, making the message header. The first time a block is sent the block is read to work out the message checksum, after which the block is sent straight from its file.
+ @param self The BEBlockStore object.
+ @param hash The hash of the block.
+ @param networkID The network magic bytes for the message header.
+ @param blockSend The block send to start.
+ @returns true if the send was started and false if the block is not available or on failure. The send only needs to be ended if it was started.
+ */
+bool BEBlockStoreStartSend(BEBlockStore * self, uint8_t * hash, uint32_t networkID, BEBlockSend * blockSend);
+/**
+ @brief Starts a thread which checks the checksums of all of the blocks in the background, reporting corrupt blocks with the error callback. The thread checks the files over and over until stopped.
+ @param self The BEBlockStore object.
+ @param bytesPerSecond The maximum number of bytes to read per second, so that other reads are not slowed down much.
+ @returns true if the thread was started or was already running and false on failure.
+ */
+bool BEBlockStoreStartScrub(BEBlockStore * self, uint64_t bytesPerSecond);
+/**
+ @brief Stops the scrub thread and waits for it to finish.
+ @param self The BEBlockStore object.
+ */
+void BEBlockStoreStopScrub(BEBlockStore * self);
+/**
+ @brief Makes the blocks which were added or removed durable.
+ @param self The BEBlockStore object.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreSync(BEBlockStore * self);
+/**
+ @brief Makes the blocks which were added or removed durable. The append lock must be held.
+ @param self The BEBlockStore object.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreSyncFiles(BEBlockStore * self);
+/**
+ @brief Removes blocks from the end of the last block file, which are also removed from the block index.
+ @param self The BEBlockStore object.
+ @param fileID The id of the block file.
+ @param size The new size of the file.
+ @returns true on success and false on failure.
+ */
+bool BEBlockStoreTruncate(BEBlockStore * self, uint16_t fileID, uint64_t size);
+/**
+ @brief Marks a file pinned with BEBlockStorePinFile as no longer in use. The files lock does not need to be held.
+ @param file The block file.
+ */
+void BEBlockStoreUnpinFile(BEBlockStoreFile * file);
+/**
+ @brief Checks the checksum of a block.
+ @param self The BEBlockStore object.
+ @param file The block file, which must be pinned.
+ @param pos The position of the block in the file.
+ @param size The size of the file when it was pinned.
+ @param length Set to the length of the block if it is known, even if the block is corrupt, so that the next block can be found. Set to zero if the length is not known.
+ @returns true if the block is complete and has the right checksum, false otherwise.
+ */
+bool BEBlockStoreVerifyBlock(BEBlockStore * self, BEBlockStoreFile * file, uint64_t pos, uint64_t size, uint32_t * length);
+
+#endif
@@ -0,0 +1,97 @@
+//
+//  BECRC32C.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 08/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BECRC32C.h"
+
+// The tables for the software checksum. BECRC32CTables[n][b] is the checksum change for byte b followed by n zero bytes.
+uint32_t BECRC32CTables[8][256];
+pthread_once_t BECRC32CTablesOnce = PTHREAD_ONCE_INIT;
+
+uint32_t BECRC32C(uint32_t crc, uint8_t * data, size_t length){
+#ifdef BE_CRC32C_HARDWARE
+	if (__builtin_cpu_supports("sse4.2"))
+		return BECRC32CHardware(crc, data, length);
+#endif
+	return BECRC32CSoftware(crc, data, length);
+}
+#ifdef BE_CRC32C_HARDWARE
+__attribute__((target("sse4.2")))
+uint32_t BECRC32CHardware(uint32_t crc, uint8_t * data, size_t length){
+	crc = ~crc;
+	// Take single bytes until the data is aligned for whole words.
+	for (; length && (uintptr_t)data & 7; length--)
+		crc = _mm_crc32_u8(crc, *data++);
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+#endif
+	for (; length >= 4; length -= 4, data += 4) {
+		uint32_t word;
+		memcpy(&word, data, 4);
+		crc = _mm_crc32_u32(crc, word);
+	}
+	for (; length; length--)
+		crc = _mm_crc32_u8(crc, *data++);
+	return ~crc;
+}
+#else
+uint32_t BECRC32CHardware(uint32_t crc, uint8_t * data, size_t length){
+	return BECRC32CSoftware(crc, data, length);
+}
+#endif
+void BECRC32CInitTables(void){
+	// The reflected Castagnoli polynomial is 0x82F63B78
+	for (uint32_t x = 0; x < 256; x++) {
+		uint32_t crc = x;
+		for (uint8_t y = 0; y < 8; y++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+		BECRC32CTables[0][x] = crc;
+	}
+	for (uint32_t x = 0; x < 256; x++)
+		for (uint8_t y = 1; y < 8; y++)
+			BECRC32CTables[y][x] = (BECRC32CTables[y - 1][x] >> 8) ^ BECRC32CTables[0][BECRC32CTables[y - 1][x] & 0xFF];
+}
+uint32_t BECRC32CSoftware(uint32_t crc, uint8_t * data, size_t length){
+	pthread_once(&BECRC32CTablesOnce, BECRC32CInitTables);
+	crc = ~crc;
+	for (; length && (uintptr_t)data & 7; length--)
+		crc = BECRC32CTables[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	// Eight bytes at a time, combining the table entries for each byte.
+	for (; length >= 8; length -= 8, data += 8) {
+		uint32_t low = crc ^ (data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+		uint32_t high = data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+		crc = BECRC32CTables[7][low & 0xFF] ^ BECRC32CTables[6][(low >> 8) & 0xFF]
+			^ BECRC32CTables[5][(low >> 16) & 0xFF] ^ BECRC32CTables[4][low >> 24]
+			^ BECRC32CTables[3][high & 0xFF] ^ BECRC32CTables[2][(high >> 8) & 0xFF]
+			^ BECRC32CTables[1][(high >> 16) & 0xFF] ^ BECRC32CTables[0][high >> 24];
+	}
+	for (; length; length--)
+		crc = BECRC32CTables[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
@@ -0,0 +1,72 @@
+//
+//  BECRC32C.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 08/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Calculates CRC32C (Castagnoli) checksums, which are used to detect corruption of stored data.
+ */
+
+#ifndef BECRC32CH
+#define BECRC32CH
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define BE_CRC32C_HARDWARE
+#include <nmmintrin.h>
+#endif
+
+// Functions
+
+/**
+ @brief Calculates the CRC32C checksum of data, using the crc32 instruction if the processor has it.
+ @param crc Zero, or the checksum of the preceding data to continue the checksum.
+ @param data The data.
+ @param length The length of the data.
+ @returns The checksum.
+ */
+uint32_t BECRC32C(uint32_t crc, uint8_t * data, size_t length);
+/**
+ @brief Calculates the CRC32C checksum of data with the crc32 instruction of SSE4.2. Only use this when the processor supports SSE4.2.
+ @param crc Zero, or the checksum of the preceding data to continue the checksum.
+ @param data The data.
+ @param length The length of the data.
+ @returns The checksum.
+ */
+uint32_t BECRC32CHardware(uint32_t crc, uint8_t * data, size_t length);
+/**
+ @brief Creates the lookup tables for BECRC32CSoftware.
+ */
+void BECRC32CInitTables(void);
+/**
+ @brief Calculates the CRC32C checksum of data with lookup tables.
+ @param crc Zero, or the checksum of the preceding data to continue the checksum.
+ @param data The data.
+ @param length The length of the data.
+ @returns The checksum.
+ */
+uint32_t BECRC32CSoftware(uint32_t crc, uint8_t * data, size_t length);
+
+#endif
@@ -0,0 +1,546 @@
+//
+//  BECompactBlock.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 27/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BECompactBlock.h"
+
+//  Constructors
+
+BECompactBlock * BENewCompactBlockFromBlock(CBBlock * block, uint64_t nonce, void (*onErrorReceived)(CBError error,char *,...)){
+	BECompactBlock * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewCompactBlockFromBlock\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeCompactBlock;
+	if (BEInitCompactBlockFromBlock(self, block, nonce, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+BECompactBlock * BENewCompactBlockFromData(CBByteArray * data, uint64_t now, void (*onErrorReceived)(CBError error,char *,...)){
+	BECompactBlock * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewCompactBlockFromData\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeCompactBlock;
+	if (BEInitCompactBlockFromData(self, data, now, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BECompactBlock * BEGetCompactBlock(void * self){
+	return self;
+}
+
+//  Initialisers
+
+bool BEInitCompactBlockFromBlock(BECompactBlock * self, CBBlock * block, uint64_t nonce, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	// Make the header
+	CBByteArray * headerBytes = CBNewByteArrayWithDataCopy(CBByteArrayGetData(CBGetMessage(block)->bytes), 81, onErrorReceived);
+	if (NOT headerBytes)
+		return false;
+	CBByteArraySetByte(headerBytes, 80, 0);
+	self->header = CBNewBlockFromData(headerBytes, onErrorReceived);
+	CBReleaseObject(headerBytes);
+	if (NOT self->header)
+		return false;
+	if (NOT CBBlockDeserialise(self->header, false)) {
+		CBReleaseObject(self->header);
+		return false;
+	}
+	self->nonce = nonce;
+	BECompactBlockSetKeys(self);
+	self->transactionNum = block->transactionNum;
+	self->transactions = malloc(sizeof(*self->transactions) * block->transactionNum);
+	self->shortIDs = malloc(sizeof(*self->shortIDs) * block->transactionNum);
+	self->prefilled = malloc(sizeof(*self->prefilled) * block->transactionNum);
+	if (NOT self->transactions || NOT self->shortIDs || NOT self->prefilled) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u transactions in BEInitCompactBlockFromBlock.",block->transactionNum);
+		free(self->transactions);
+		free(self->shortIDs);
+		free(self->prefilled);
+		CBReleaseObject(self->header);
+		return false;
+	}
+	// Only the coinbase is sent in full, as no peer can have it.
+	for (uint32_t x = 0; x < block->transactionNum; x++) {
+		CBRetainObject(block->transactions[x]);
+		self->transactions[x] = block->transactions[x];
+		self->prefilled[x] = NOT x;
+		self->shortIDs[x] = x ? BECompactBlockGetShortID(self, CBTransactionGetHash(block->transactions[x])) : 0;
+	}
+	self->numPrefilled = 1;
+	self->numMissing = 0;
+	self->fromPool = 0;
+	self->requested = 0;
+	self->receivedTime = 0;
+	return true;
+}
+bool BEInitCompactBlockFromData(BECompactBlock * self, CBByteArray * data, uint64_t now, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	if (data->length < 90) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A compact block is too short at %u bytes.",data->length);
+		return false;
+	}
+	uint32_t cursor = 88;
+	uint64_t numShortIDs;
+	if (NOT BECompactBlockReadVarInt(data, &cursor, &numShortIDs) || numShortIDs > (data->length - cursor) / BE_SHORT_ID_SIZE) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A compact block has more short IDs than fit in the data.");
+		return false;
+	}
+	uint32_t shortIDsStart = cursor;
+	cursor += numShortIDs * BE_SHORT_ID_SIZE;
+	uint64_t numPrefilled;
+	// Each prefilled transaction takes at least ten bytes.
+	if (NOT BECompactBlockReadVarInt(data, &cursor, &numPrefilled) || numPrefilled > (data->length - cursor) / 10) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A compact block has more prefilled transactions than fit in the data.");
+		return false;
+	}
+	if (NOT numShortIDs && NOT numPrefilled) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A compact block has no transactions.");
+		return false;
+	}
+	// Make the header
+	CBByteArray * headerBytes = CBNewByteArrayWithDataCopy(CBByteArrayGetData(data), 81, onErrorReceived);
+	if (NOT headerBytes)
+		return false;
+	CBByteArraySetByte(headerBytes, 80, 0);
+	self->header = CBNewBlockFromData(headerBytes, onErrorReceived);
+	CBReleaseObject(headerBytes);
+	if (NOT self->header)
+		return false;
+	if (NOT CBBlockDeserialise(self->header, false)) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"The header of a compact block could not be deserialised.");
+		CBReleaseObject(self->header);
+		return false;
+	}
+	self->nonce = CBByteArrayReadInt64(data, 80);
+	BECompactBlockSetKeys(self);
+	self->transactionNum = (uint32_t)(numShortIDs + numPrefilled);
+	self->transactions = calloc(self->transactionNum, sizeof(*self->transactions));
+	self->shortIDs = calloc(self->transactionNum, sizeof(*self->shortIDs));
+	self->prefilled = calloc(self->transactionNum, sizeof(*self->prefilled));
+	if (NOT self->transactions || NOT self->shortIDs || NOT self->prefilled) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u transactions in BEInitCompactBlockFromData.",self->transactionNum);
+		free(self->transactions);
+		free(self->shortIDs);
+		free(self->prefilled);
+		CBReleaseObject(self->header);
+		return false;
+	}
+	self->numPrefilled = (uint32_t)numPrefilled;
+	self->numMissing = (uint32_t)numShortIDs;
+	self->fromPool = 0;
+	self->requested = 0;
+	self->receivedTime = now;
+	// Read the prefilled transactions. The indexes are sent as the difference from the index after the last.
+	uint64_t next = 0;
+	bool ok = true;
+	for (uint32_t x = 0; x < numPrefilled; x++) {
+		uint64_t diff;
+		if (NOT BECompactBlockReadVarInt(data, &cursor, &diff) || diff >= self->transactionNum - next) {
+			onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A prefilled transaction of a compact block has a bad index.");
+			ok = false;
+			break;
+		}
+		next += diff;
+		self->transactions[next] = BECompactBlockReadTransaction(data, &cursor, onErrorReceived);
+		if (NOT self->transactions[next]) {
+			ok = false;
+			break;
+		}
+		self->prefilled[next++] = true;
+	}
+	if (ok && cursor != data->length) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A compact block has %u bytes after the prefilled transactions.",data->length - cursor);
+		ok = false;
+	}
+	if (NOT ok) {
+		for (uint32_t x = 0; x < self->transactionNum; x++)
+			if (self->transactions[x])
+				CBReleaseObject(self->transactions[x]);
+		free(self->transactions);
+		free(self->shortIDs);
+		free(self->prefilled);
+		CBReleaseObject(self->header);
+		return false;
+	}
+	// Give the short IDs to the other transactions in order.
+	uint8_t * shortID = CBByteArrayGetData(data) + shortIDsStart;
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		if (self->prefilled[x])
+			continue;
+		self->shortIDs[x] = (uint64_t)shortID[0] | (uint64_t)shortID[1] << 8 | (uint64_t)shortID[2] << 16 | (uint64_t)shortID[3] << 24 | (uint64_t)shortID[4] << 32 | (uint64_t)shortID[5] << 40;
+		shortID += BE_SHORT_ID_SIZE;
+	}
+	return true;
+}
+
+//  Destructor
+
+void BEFreeCompactBlock(void * vself){
+	BECompactBlock * self = vself;
+	for (uint32_t x = 0; x < self->transactionNum; x++)
+		if (self->transactions[x])
+			CBReleaseObject(self->transactions[x]);
+	free(self->transactions);
+	free(self->shortIDs);
+	free(self->prefilled);
+	CBReleaseObject(self->header);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+BECompactBlockStatus BECompactBlockAddTransactions(BECompactBlock * self, CBByteArray * data){
+	uint32_t cursor = 32;
+	uint64_t num;
+	if (data->length < 33 || memcmp(CBByteArrayGetData(data), CBBlockGetHash(self->header), 32)) {
+		self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"Transactions were received for the wrong compact block.");
+		return BE_COMPACT_BLOCK_BAD;
+	}
+	if (NOT BECompactBlockReadVarInt(data, &cursor, &num) || num != self->numMissing) {
+		self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"The wrong number of transactions were received for a compact block.");
+		return BE_COMPACT_BLOCK_BAD;
+	}
+	// Read all of the transactions before using any, so that the block is unchanged if the message is bad.
+	CBTransaction ** received = malloc(sizeof(*received) * (num ? num : 1));
+	if (NOT received) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u transactions in BECompactBlockAddTransactions.",(uint32_t)num);
+		return BE_COMPACT_BLOCK_BAD;
+	}
+	for (uint32_t x = 0; x < num; x++) {
+		received[x] = BECompactBlockReadTransaction(data, &cursor, self->onErrorReceived);
+		if (NOT received[x]) {
+			for (uint32_t y = 0; y < x; y++)
+				CBReleaseObject(received[y]);
+			free(received);
+			return BE_COMPACT_BLOCK_BAD;
+		}
+	}
+	if (cursor != data->length) {
+		self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"Transactions for a compact block have %u bytes after them.",data->length - cursor);
+		for (uint32_t x = 0; x < num; x++)
+			CBReleaseObject(received[x]);
+		free(received);
+		return BE_COMPACT_BLOCK_BAD;
+	}
+	uint32_t y = 0;
+	for (uint32_t x = 0; x < self->transactionNum; x++)
+		if (NOT self->transactions[x])
+			self->transactions[x] = received[y++];
+	free(received);
+	self->requested += self->numMissing;
+	self->numMissing = 0;
+	return BE_COMPACT_BLOCK_COMPLETE;
+}
+CBBlock * BECompactBlockGetBlock(BECompactBlock * self){
+	if (self->numMissing)
+		return NULL;
+	uint32_t size = 80 + CBVarIntSizeOf(self->transactionNum);
+	for (uint32_t x = 0; x < self->transactionNum; x++)
+		size += CBGetMessage(self->transactions[x])->bytes->length;
+	CBByteArray * bytes = CBNewByteArrayOfSize(size, self->onErrorReceived);
+	if (NOT bytes)
+		return NULL;
+	CBByteArraySetBytes(bytes, 0, CBByteArrayGetData(CBGetMessage(self->header)->bytes), 80);
+	CBVarIntEncode(bytes, 80, CBVarIntFromUInt64(self->transactionNum));
+	uint32_t cursor = 80 + CBVarIntSizeOf(self->transactionNum);
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		CBByteArray * txBytes = CBGetMessage(self->transactions[x])->bytes;
+		CBByteArraySetBytes(bytes, cursor, CBByteArrayGetData(txBytes), txBytes->length);
+		cursor += txBytes->length;
+	}
+	CBBlock * block = CBNewBlockFromData(bytes, self->onErrorReceived);
+	CBReleaseObject(bytes);
+	if (NOT block)
+		return NULL;
+	if (NOT CBBlockDeserialise(block, true)) {
+		self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A rebuilt compact block could not be deserialised.");
+		CBReleaseObject(block);
+		return NULL;
+	}
+	// Check the merkle root, as a short ID could have matched the wrong transaction.
+	uint8_t * txHashes = malloc(32 * self->transactionNum);
+	if (NOT txHashes) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the transaction hashes in BECompactBlockGetBlock.",32 * self->transactionNum);
+		CBReleaseObject(block);
+		return NULL;
+	}
+	for (uint32_t x = 0; x < self->transactionNum; x++)
+		memcpy(txHashes + 32*x, CBTransactionGetHash(block->transactions[x]), 32);
+	CBCalculateMerkleRoot(txHashes, self->transactionNum);
+	bool match = NOT memcmp(txHashes, CBByteArrayGetData(CBGetMessage(self->header)->bytes) + 36, 32);
+	free(txHashes);
+	if (NOT match) {
+		CBReleaseObject(block);
+		return NULL;
+	}
+	return block;
+}
+uint64_t BECompactBlockGetShortID(BECompactBlock * self, uint8_t * txHash){
+	return BESipHash256(self->key0, self->key1, txHash) & BE_SHORT_ID_MASK;
+}
+CBByteArray * BECompactBlockGetTransactionRequest(BECompactBlock * self){
+	// The indexes are sent as the difference from the index after the last.
+	uint32_t size = 32 + CBVarIntSizeOf(self->numMissing);
+	uint32_t next = 0;
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		if (NOT self->transactions[x]) {
+			size += CBVarIntSizeOf(x - next);
+			next = x + 1;
+		}
+	}
+	CBByteArray * request = CBNewByteArrayOfSize(size, self->onErrorReceived);
+	if (NOT request)
+		return NULL;
+	CBByteArraySetBytes(request, 0, CBBlockGetHash(self->header), 32);
+	CBVarIntEncode(request, 32, CBVarIntFromUInt64(self->numMissing));
+	uint32_t cursor = 32 + CBVarIntSizeOf(self->numMissing);
+	next = 0;
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		if (NOT self->transactions[x]) {
+			CBVarIntEncode(request, cursor, CBVarIntFromUInt64(x - next));
+			cursor += CBVarIntSizeOf(x - next);
+			next = x + 1;
+		}
+	}
+	return request;
+}
+bool BECompactBlockReadVarInt(CBByteArray * data, uint32_t * cursor, uint64_t * value){
+	if (*cursor >= data->length)
+		return false;
+	uint8_t first = CBByteArrayGetByte(data, *cursor);
+	uint8_t size = first < 253 ? 1 : (first == 253 ? 3 : (first == 254 ? 5 : 9));
+	if (data->length - *cursor < size)
+		return false;
+	CBVarInt varInt = CBVarIntDecode(data, *cursor);
+	*value = varInt.val;
+	*cursor += varInt.size;
+	return true;
+}
+CBTransaction * BECompactBlockReadTransaction(CBByteArray * data, uint32_t * cursor, void (*onErrorReceived)(CBError error,char *,...)){
+	if (*cursor >= data->length) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A transaction is missing from the end of the data.");
+		return NULL;
+	}
+	CBByteArray * txBytes = CBNewByteArraySubReference(data, *cursor, data->length - *cursor);
+	if (NOT txBytes)
+		return NULL;
+	CBTransaction * tx = CBNewTransactionFromData(txBytes, onErrorReceived);
+	CBReleaseObject(txBytes);
+	if (NOT tx)
+		return NULL;
+	uint32_t length = CBTransactionDeserialise(tx);
+	if (NOT length) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A transaction could not be deserialised.");
+		CBReleaseObject(tx);
+		return NULL;
+	}
+	CBGetMessage(tx)->bytes->length = length;
+	*cursor += length;
+	return tx;
+}
+BECompactBlockStatus BECompactBlockReconstruct(BECompactBlock * self, CBTransaction ** transactions, uint32_t numTransactions){
+	if (NOT self->numMissing)
+		return BE_COMPACT_BLOCK_COMPLETE;
+	// Make an open addressing hash table of the short IDs of the missing transactions. Each bucket has the index of the transaction plus one, or zero. The short IDs are already random, so the low bits are used directly.
+	uint32_t numBuckets = 1;
+	while (numBuckets < self->numMissing * 2)
+		numBuckets <<= 1;
+	uint32_t * buckets = calloc(numBuckets, sizeof(*buckets));
+	bool * collided = calloc(self->transactionNum, sizeof(*collided));
+	if (NOT buckets || NOT collided) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u short IDs in BECompactBlockReconstruct.",numBuckets);
+		free(buckets);
+		free(collided);
+		return BE_COMPACT_BLOCK_FAILED;
+	}
+	uint32_t mask = numBuckets - 1;
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		if (self->transactions[x])
+			continue;
+		uint32_t bucket = self->shortIDs[x] & mask;
+		for (; buckets[bucket]; bucket = (bucket + 1) & mask) {
+			if (self->shortIDs[buckets[bucket] - 1] == self->shortIDs[x]) {
+				// The same short ID for two transactions cannot be resolved with getblocktxn.
+				free(buckets);
+				free(collided);
+				return BE_COMPACT_BLOCK_FAILED;
+			}
+		}
+		buckets[bucket] = x + 1;
+	}
+	for (uint32_t x = 0; x < numTransactions; x++) {
+		uint8_t * hash = CBTransactionGetHash(transactions[x]);
+		uint64_t shortID = BECompactBlockGetShortID(self, hash);
+		uint32_t bucket = shortID & mask;
+		for (; buckets[bucket]; bucket = (bucket + 1) & mask)
+			if (self->shortIDs[buckets[bucket] - 1] == shortID)
+				break;
+		if (NOT buckets[bucket])
+			continue;
+		uint32_t index = buckets[bucket] - 1;
+		if (collided[index])
+			continue;
+		if (self->transactions[index]) {
+			if (NOT memcmp(CBTransactionGetHash(self->transactions[index]), hash, 32))
+				continue;
+			// Two of our transactions have the short ID, so request the transaction.
+			CBReleaseObject(self->transactions[index]);
+			self->transactions[index] = NULL;
+			collided[index] = true;
+			self->numMissing++;
+			self->fromPool--;
+			continue;
+		}
+		CBRetainObject(transactions[x]);
+		self->transactions[index] = transactions[x];
+		self->numMissing--;
+		self->fromPool++;
+	}
+	free(buckets);
+	free(collided);
+	return self->numMissing ? BE_COMPACT_BLOCK_INCOMPLETE : BE_COMPACT_BLOCK_COMPLETE;
+}
+CBByteArray * BECompactBlockRespond(CBBlock * block, CBByteArray * request, void (*onErrorReceived)(CBError error,char *,...)){
+	uint32_t cursor = 32;
+	uint64_t num;
+	if (request->length < 33 || memcmp(CBByteArrayGetData(request), CBBlockGetHash(block), 32)
+		|| NOT BECompactBlockReadVarInt(request, &cursor, &num) || num > block->transactionNum) {
+		onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A request for the transactions of a block is invalid.");
+		return NULL;
+	}
+	uint32_t * indexes = malloc(sizeof(*indexes) * (num ? num : 1));
+	if (NOT indexes) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u indexes in BECompactBlockRespond.",(uint32_t)num);
+		return NULL;
+	}
+	uint32_t size = 32 + CBVarIntSizeOf(num);
+	uint64_t next = 0;
+	for (uint32_t x = 0; x < num; x++) {
+		uint64_t diff;
+		if (NOT BECompactBlockReadVarInt(request, &cursor, &diff) || diff >= block->transactionNum - next) {
+			onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"A request for the transactions of a block has a bad index.");
+			free(indexes);
+			return NULL;
+		}
+		next += diff;
+		indexes[x] = (uint32_t)next++;
+		size += CBGetMessage(block->transactions[indexes[x]])->bytes->length;
+	}
+	CBByteArray * response = CBNewByteArrayOfSize(size, onErrorReceived);
+	if (NOT response) {
+		free(indexes);
+		return NULL;
+	}
+	CBByteArraySetBytes(response, 0, CBBlockGetHash(block), 32);
+	CBVarIntEncode(response, 32, CBVarIntFromUInt64(num));
+	cursor = 32 + CBVarIntSizeOf(num);
+	for (uint32_t x = 0; x < num; x++) {
+		CBByteArray * txBytes = CBGetMessage(block->transactions[indexes[x]])->bytes;
+		CBByteArraySetBytes(response, cursor, CBByteArrayGetData(txBytes), txBytes->length);
+		cursor += txBytes->length;
+	}
+	free(indexes);
+	return response;
+}
+CBByteArray * BECompactBlockSerialise(BECompactBlock * self){
+	uint32_t numShortIDs = self->transactionNum - self->numPrefilled;
+	uint32_t size = 88 + CBVarIntSizeOf(numShortIDs) + numShortIDs * BE_SHORT_ID_SIZE + CBVarIntSizeOf(self->numPrefilled);
+	uint32_t next = 0;
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		if (self->prefilled[x]) {
+			size += CBVarIntSizeOf(x - next) + CBGetMessage(self->transactions[x])->bytes->length;
+			next = x + 1;
+		}
+	}
+	CBByteArray * data = CBNewByteArrayOfSize(size, self->onErrorReceived);
+	if (NOT data)
+		return NULL;
+	CBByteArraySetBytes(data, 0, CBByteArrayGetData(CBGetMessage(self->header)->bytes), 80);
+	CBByteArraySetInt64(data, 80, self->nonce);
+	CBVarIntEncode(data, 88, CBVarIntFromUInt64(numShortIDs));
+	uint32_t cursor = 88 + CBVarIntSizeOf(numShortIDs);
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		if (self->prefilled[x])
+			continue;
+		for (uint8_t y = 0; y < BE_SHORT_ID_SIZE; y++)
+			CBByteArraySetByte(data, cursor++, self->shortIDs[x] >> (8 * y));
+	}
+	CBVarIntEncode(data, cursor, CBVarIntFromUInt64(self->numPrefilled));
+	cursor += CBVarIntSizeOf(self->numPrefilled);
+	next = 0;
+	for (uint32_t x = 0; x < self->transactionNum; x++) {
+		if (NOT self->prefilled[x])
+			continue;
+		CBVarIntEncode(data, cursor, CBVarIntFromUInt64(x - next));
+		cursor += CBVarIntSizeOf(x - next);
+		CBByteArray * txBytes = CBGetMessage(self->transactions[x])->bytes;
+		CBByteArraySetBytes(data, cursor, CBByteArrayGetData(txBytes), txBytes->length);
+		cursor += txBytes->length;
+		next = x + 1;
+	}
+	return data;
+}
+void BECompactBlockSetKeys(BECompactBlock * self){
+	// The keys are the first 16 bytes of the SHA-256 of the header followed by the nonce.
+	uint8_t data[88];
+	uint8_t hash[32];
+	memcpy(data, CBByteArrayGetData(CBGetMessage(self->header)->bytes), 80);
+	for (uint8_t x = 0; x < 8; x++)
+		data[80 + x] = self->nonce >> (8 * x);
+	CBSha256(data, 88, hash);
+	self->key0 = BESipHashReadInt64(hash);
+	self->key1 = BESipHashReadInt64(hash + 8);
+}
+double BECompactBlockStatsGetHitRate(BECompactBlockStats * stats){
+	uint64_t notPrefilled = stats->transactions - stats->prefilled;
+	return notPrefilled ? (double)stats->fromPool / notPrefilled : 1;
+}
+void BECompactBlockStatsRecord(BECompactBlockStats * stats, BECompactBlock * self, CBBlock * block, uint64_t now){
+	stats->blocks++;
+	if (NOT block)
+		stats->failed++;
+	else if (NOT self->requested)
+		stats->immediate++;
+	stats->transactions += self->transactionNum;
+	stats->prefilled += self->numPrefilled;
+	stats->fromPool += self->fromPool;
+	stats->requested += self->requested;
+	uint64_t latency = now - self->receivedTime;
+	stats->totalLatency += latency;
+	if (latency > stats->maxLatency)
+		stats->maxLatency = latency;
+}
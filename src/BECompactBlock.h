@@ -0,0 +1,217 @@
+//
+//  BECompactBlock.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 27/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+
+/**
+ @file
+ @brief Compact blocks (BIP 152), which relay a block as its header and short IDs of its transactions, so that a peer can rebuild the block from the transactions it already has.
+ */
+
+#ifndef BECOMPACTBLOCKH
+#define BECOMPACTBLOCKH
+
+#include "BEConstants.h"
+#include "BESipHash.h"
+#include "CBBlock.h"
+#include "CBVarInt.h"
+#include "CBValidationFunctions.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ @brief The result of rebuilding a compact block.
+ */
+typedef enum{
+	BE_COMPACT_BLOCK_COMPLETE, /**< All of the transactions are known and the block can be taken with BECompactBlockGetBlock. */
+	BE_COMPACT_BLOCK_INCOMPLETE, /**< Transactions are missing and should be requested with BECompactBlockGetTransactionRequest. */
+	BE_COMPACT_BLOCK_FAILED, /**< The block cannot be rebuilt, because short IDs in the block are the same, so the full block should be requested. */
+	BE_COMPACT_BLOCK_BAD, /**< The data from the peer is invalid. */
+} BECompactBlockStatus;
+
+/**
+ @brief Structure for BECompactBlock objects. @see BECompactBlock.h
+ */
+typedef struct{
+	CBObject base;
+	CBBlock * header; /**< The block with only the header, for the hash and for checking the header before rebuilding the block. */
+	uint64_t nonce; /**< The nonce chosen by the sender. */
+	uint64_t key0; /**< The first SipHash key for the short IDs. */
+	uint64_t key1; /**< The second SipHash key for the short IDs. */
+	uint32_t transactionNum; /**< The number of transactions in the block. */
+	CBTransaction ** transactions; /**< The transactions in block order, which are retained, or NULL where they are missing. */
+	uint64_t * shortIDs; /**< The short ID of each transaction which was not sent in full. */
+	bool * prefilled; /**< True for each transaction sent in full. */
+	uint32_t numPrefilled; /**< The number of transactions sent in full. */
+	uint32_t numMissing; /**< The number of missing transactions. */
+	uint32_t fromPool; /**< The number of transactions found by BECompactBlockReconstruct. */
+	uint32_t requested; /**< The number of transactions received with BECompactBlockAddTransactions. */
+	uint64_t receivedTime; /**< The time the compact block was received in milliseconds. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BECompactBlock;
+
+/**
+ @brief Reconstruction statistics for compact blocks.
+ */
+typedef struct{
+	uint64_t blocks; /**< The number of compact blocks finished. */
+	uint64_t immediate; /**< The number of blocks rebuilt without requesting transactions. */
+	uint64_t failed; /**< The number of blocks which could not be rebuilt, so that the full block was needed. */
+	uint64_t transactions; /**< The number of transactions in the blocks. */
+	uint64_t prefilled; /**< The number of transactions sent in full. */
+	uint64_t fromPool; /**< The number of transactions found in the transaction pool. */
+	uint64_t requested; /**< The number of transactions requested with getblocktxn. */
+	uint64_t totalLatency; /**< The total time from receiving the compact blocks to finishing them in milliseconds. */
+	uint64_t maxLatency; /**< The longest time from receiving a compact block to finishing it in milliseconds. */
+} BECompactBlockStats;
+
+/**
+ @brief Creates a new BECompactBlock object from a block, to send to peers.
+ @param block The serialised block.
+ @param nonce A random nonce for the short IDs.
+ @returns A new BECompactBlock object.
+ */
+BECompactBlock * BENewCompactBlockFromBlock(CBBlock * block, uint64_t nonce, void (*onErrorReceived)(CBError error,char *,...));
+/**
+ @brief Creates a new BECompactBlock object from a cmpctblock message.
+ @param data The cmpctblock message payload.
+ @param now The time the message was received in milliseconds.
+ @returns A new BECompactBlock object or NULL if the data is invalid or on failure.
+ */
+BECompactBlock * BENewCompactBlockFromData(CBByteArray * data, uint64_t now, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BECompactBlock from another object. Use this to avoid casts.
+ @param self The object to obtain the BECompactBlock from.
+ @returns The BECompactBlock object.
+ */
+BECompactBlock * BEGetCompactBlock(void * self);
+
+/**
+ @brief Initialises a BECompactBlock object from a block.
+ @param self The BECompactBlock object to initialise.
+ @param block The serialised block.
+ @param nonce A random nonce for the short IDs.
+ @returns true on success, false on failure.
+ */
+bool BEInitCompactBlockFromBlock(BECompactBlock * self, CBBlock * block, uint64_t nonce, void (*onErrorReceived)(CBError error,char *,...));
+/**
+ @brief Initialises a BECompactBlock object from a cmpctblock message.
+ @param self The BECompactBlock object to initialise.
+ @param data The cmpctblock message payload.
+ @param now The time the message was received in milliseconds.
+ @returns true on success, false if the data is invalid or on failure.
+ */
+bool BEInitCompactBlockFromData(BECompactBlock * self, CBByteArray * data, uint64_t now, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BECompactBlock object.
+ @param self The BECompactBlock object to free.
+ */
+void BEFreeCompactBlock(void * self);
+
+// Functions
+
+/**
+ @brief Adds the missing transactions from a blocktxn message.
+ @param self The BECompactBlock object.
+ @param data The blocktxn message payload.
+ @returns BE_COMPACT_BLOCK_COMPLETE on success and BE_COMPACT_BLOCK_BAD if the message is not the reply to the request for this block.
+ */
+BECompactBlockStatus BECompactBlockAddTransactions(BECompactBlock * self, CBByteArray * data);
+/**
+ @brief Gets the full block once no transactions are missing.
+ @param self The BECompactBlock object.
+ @returns The deserialised block or NULL if the merkle root does not match, which happens when a short ID matched the wrong transaction, or on failure. The full block should then be requested.
+ */
+CBBlock * BECompactBlockGetBlock(BECompactBlock * self);
+/**
+ @brief Calculates the short ID of a transaction for this block.
+ @param self The BECompactBlock object.
+ @param txHash The transaction hash.
+ @returns The short ID.
+ */
+uint64_t BECompactBlockGetShortID(BECompactBlock * self, uint8_t * txHash);
+/**
+ @brief Makes a getblocktxn message requesting the missing transactions.
+ @param self The BECompactBlock object.
+ @returns The getblocktxn message payload or NULL on failure.
+ */
+CBByteArray * BECompactBlockGetTransactionRequest(BECompactBlock * self);
+/**
+ @brief Reads a variable length integer, checking it is within the data.
+ @param data The data.
+ @param cursor The position of the integer, which is moved past it.
+ @param value Set to the integer.
+ @returns true on success and false if the integer goes past the end of the data.
+ */
+bool BECompactBlockReadVarInt(CBByteArray * data, uint32_t * cursor, uint64_t * value);
+/**
+ @brief Reads a transaction, checking it is within the data.
+ @param data The data.
+ @param cursor The position of the transaction, which is moved past it.
+ @param onErrorReceived The error callback.
+ @returns The transaction or NULL if it is invalid or on failure.
+ */
+CBTransaction * BECompactBlockReadTransaction(CBByteArray * data, uint32_t * cursor, void (*onErrorReceived)(CBError error,char *,...));
+/**
+ @brief Fills in the missing transactions from the transactions the node has, by their short IDs. If two of the transactions match the same short ID, it is left missing so that it is requested.
+ @param self The BECompactBlock object.
+ @param transactions The transactions, such as those of the transaction pool.
+ @param numTransactions The number of transactions.
+ @returns BE_COMPACT_BLOCK_COMPLETE if no transactions are missing, BE_COMPACT_BLOCK_INCOMPLETE if transactions should be requested and BE_COMPACT_BLOCK_FAILED if the full block should be requested.
+ */
+BECompactBlockStatus BECompactBlockReconstruct(BECompactBlock * self, CBTransaction ** transactions, uint32_t numTransactions);
+/**
+ @brief Makes the blocktxn reply to a getblocktxn message.
+ @param block The block requested, which has the hash in the first 32 bytes of the request, deserialised with its transactions.
+ @param request The getblocktxn message payload.
+ @param onErrorReceived The error callback.
+ @returns The blocktxn message payload or NULL if the request is invalid or on failure.
+ */
+CBByteArray * BECompactBlockRespond(CBBlock * block, CBByteArray * request, void (*onErrorReceived)(CBError error,char *,...));
+/**
+ @brief Makes the cmpctblock message.
+ @param self The BECompactBlock object, which has all of its transactions.
+ @returns The cmpctblock message payload or NULL on failure.
+ */
+CBByteArray * BECompactBlockSerialise(BECompactBlock * self);
+/**
+ @brief Calculates the short ID keys from the header and nonce.
+ @param self The BECompactBlock object.
+ */
+void BECompactBlockSetKeys(BECompactBlock * self);
+/**
+ @brief Gets the proportion of the transactions which were not sent in full that were found in the transaction pool.
+ @param stats The statistics.
+ @returns The hit rate from zero to one, or one if there were no such transactions.
+ */
+double BECompactBlockStatsGetHitRate(BECompactBlockStats * stats);
+/**
+ @brief Records a finished compact block in the statistics.
+ @param stats The statistics.
+ @param self The BECompactBlock object.
+ @param block The block from BECompactBlockGetBlock or NULL if the full block was needed.
+ @param now The current time in milliseconds.
+ */
+void BECompactBlockStatsRecord(BECompactBlockStats * stats, BECompactBlock * self, CBBlock * block, uint64_t now);
+
+#endif
@@ -27,10 +27,80 @@
 
 #define BE_DATA_DIRECTORY "/.BitEagle_FullNode_Data/"
 #define BE_ADDRESS_DATA_FILE "addresses.dat"
+#define BE_ADDRESS_FILE_VERSION 1 // The version of the address file layout.
+#define BE_ADDRESS_BUCKETS 256 // The number of address buckets.
+#define BE_ADDRESS_BUCKET_SIZE 128 // The number of address records in each bucket.
+#define BE_ADDRESS_RECORD_SIZE 32 // The IP address, port, services, time last seen, failed attempts and flags of each address record, so that each bucket is 4096 bytes.
+#define BE_ADDRESS_HEADER_SIZE 4096 // The version, key and bucket checksums at the start of the address file, padded so that the buckets are page aligned.
+#define BE_ADDRESS_FILE_SIZE (BE_ADDRESS_HEADER_SIZE + BE_ADDRESS_BUCKETS * BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE) // The address file always has every bucket.
+#define BE_ADDRESS_MAX_ATTEMPTS 3 // Addresses which have failed this many times since they last worked can be replaced.
+#define BE_ADDRESS_MAX_AGE 2592000 // Addresses not seen for 30 days can be replaced.
+#define BE_ADDRESS_SEED_COUNT 64 // The number of stored addresses given to the address manager when the node starts.
 #define BE_VALIDATION_DATA_FILE "validation.dat"
-#define BE_MAX_ORPHAN_CACHE 20
+#define BE_BLOCK_INDEX_FILE "blockindex.dat"
 #define BE_MAX_BRANCH_CACHE 4
 #define BE_NO_VALIDATION 0xFFFFFFFF
+#define BE_INVALID_BLOCK_CACHE 1024 // The number of hashes of known invalid blocks which are remembered. Must be a power of two.
+#define BE_MAX_BLOCK_TRANSACTIONS 16666 // Transactions are at least 60 bytes, so a block of at most 1MB cannot have more than this many.
+#define BE_ORPHAN_DATA_FILE "orphans.dat"
+#define BE_ORPHAN_POOL_SIZE 33554432 // Orphans are removed once their total size is over 32MB.
+#define BE_ORPHAN_MAX_AGE 3600 // Orphans are removed once they are an hour old.
+#define BE_ORPHAN_POOL_MIN_BUCKETS 16 // The initial number of orphan slots and hash table buckets.
+#define BE_ORPHAN_RECORD_OVERHEAD 9 // The type, length and CRC32C checksum of each record in the orphan file.
+#define BE_ORPHAN_FILE_MIN_COMPACT 1048576 // The orphan file is not rewritten until it is at least 1MB.
+#define BE_VALIDATION_HEADER_SIZE 6 // The main branch, the number of branches and a CRC32C checksum of them in the validation data file.
+#define BE_BRANCH_FILE_VERSION 4 // The version of the branch file layout.
+#define BE_BRANCH_FILE_BYTE_ORDER 0x01020304 // Written in the byte order of the machine to detect branch files from machines with another byte order.
+#define BE_BRANCH_FILE_ALIGNMENT 8 // The alignment of the arrays in the branch files, so that they can be used directly from a mapping.
+#define BE_BLOCK_RECORD_HEADER_SIZE 8 // The block length and the CRC32C checksum of the block before each block in the block files.
+#define BE_BLOCK_INDEX_RECORD_SIZE 47 // The block hash, file ID, file position, data status and CRC32C checksum of the record for each block in the block index file.
+#define BE_BLOCK_INDEX_MIN_ENTRIES 1024 // The initial number of block index entries, with twice as many hash table slots.
+#define BE_MESSAGE_HEADER_SIZE 24 // The network magic, command, payload length and payload checksum before each network message.
+#define BE_BLOCK_FRAME_HEADER_SIZE 8 // The compressed and uncompressed lengths before each compressed frame.
+#define BE_FRAME_INDEX_RECORD_SIZE 28 // The uncompressed position, compressed position, both lengths and the CRC32C checksum of the record for each frame in a frame index file.
+#define BE_FILTER_DATA_FILE "filters.dat"
+#define BE_FILTER_INDEX_FILE "filterindex.dat"
+#define BE_FILTER_P 19 // The number of bits of the remainder of each Golomb-Rice code in a block filter.
+#define BE_FILTER_M 784931 // The inverse of the false positive rate of block filters.
+#define BE_FILTER_RECORD_OVERHEAD 72 // The block hash, filter hash, filter length and CRC32C checksum of each record in the filter file.
+#define BE_FILTER_INDEX_RECORD_SIZE 44 // The filter position, filter header and CRC32C checksum of the record for each height in the filter index file.
+#define BE_NO_FILTER 0xFFFFFFFFFFFFFFFF // The filter position of blocks without a filter.
+#define BE_BLOCK_FILE_TARGET_SIZE 134217728 // Block files are rolled over once they reach 128MB.
+#define BE_BLOCK_FILE_PREALLOCATION 16777216 // Block files are preallocated in 16MB chunks.
+#define BE_PRUNE_MIN_DEPTH 288 // Blocks at least this deep are not kept for reorganisations when pruning.
+#define BE_SPENT_OUTPUT_DEPTH 288 // The outputs spent by blocks at least this deep in a branch are forgotten, so a new branch cannot be validated if it forks deeper than this.
+#define BE_MAX_OPEN_BLOCK_FILES 64 // Block files which are not used recently are closed when more than this are open.
+#define BE_PREFETCH_OUTPUT_SIZE 128 // Bytes read for each previous output, enough for the value and standard scripts.
+#define BE_PREFETCH_MAX_GAP 4096 // Previous outputs closer than this are read together.
+#define BE_SCRUB_BUFFER_SIZE 65536 // Block data is checked in chunks of this size when scrubbing.
+#define BE_SCRUB_MAX_SLEEP 100000000 // The scrub thread sleeps for at most this many nanoseconds at a time, so that it stops quickly.
+#define BE_BLOCK_QUEUE_SIZE 64 // The number of received blocks which can wait to be processed by the validator thread.
+#define BE_BLOCK_QUEUE_RESUME 32 // Once the block queue is full, the node is busy until fewer than this many blocks are waiting.
+#define BE_DROPPED_BLOCK_LIST_SIZE 256 // The number of blocks dropped while the node is busy which are requested again once it is not.
+#define BE_EVENT_LOOP_MAX_EVENTS 256 // The number of events taken from epoll at once.
+#define BE_EVENT_LOOP_MIN_SLOTS 64 // The initial number of peer slots in an event loop.
+#define BE_TIMER_WHEEL_SLOTS 512 // The number of slots in the timer wheel. Must be a power of two.
+#define BE_TIMER_TICK 100 // The length of a timer wheel tick in milliseconds.
+#define BE_EVENT_LOOP_WAKE 0xFFFFFFFF // The epoll data for the wake eventfd.
+#define BE_EVENT_LOOP_LISTEN 0xFFFFFFFE // The epoll data for the listening socket.
+#define BE_DOWNLOAD_WINDOW 1024 // Blocks are only requested up to this many blocks ahead of the next block to give to the validator.
+#define BE_DOWNLOAD_MAX_PEERS 32 // The number of peers blocks are downloaded from at once.
+#define BE_DOWNLOAD_MAX_PEER_WINDOW 64 // The most requests in flight to one peer.
+#define BE_DOWNLOAD_MIN_TIMEOUT 2000 // Requests stall after at least this many milliseconds.
+#define BE_SHORT_ID_SIZE 6 // The length of the short transaction IDs of compact blocks.
+#define BE_SHORT_ID_MASK 0xFFFFFFFFFFFF // Takes the short transaction ID from a SipHash.
+#define BE_MEMPOOL_MAX_SIZE 67108864 // Transactions with the lowest fee rates are removed once the transaction pool is over 64MB.
+#define BE_MEMPOOL_MAX_ANCESTORS 25 // Transactions depending on more than this many transactions in the pool, including themselves, are rejected.
+#define BE_MEMPOOL_MIN_BUCKETS 64 // The initial number of transaction pool slots and hash table buckets.
+#define BE_TRANSACTION_QUEUE_SIZE 256 // The number of received transactions which can wait to be validated by the validator thread.
+#define BE_MERKLE_CACHE_BLOCKS 16 // The number of recent main chain blocks whose merkle trees are kept for merkle branches.
+#define BE_TX_INDEX_FILE "txindex.dat"
+#define BE_TX_INDEX_FILE_VERSION 1 // The version of the transaction index file layout.
+#define BE_TX_INDEX_HEADER_SIZE 4096 // The header at the start of the transaction index file, padded so that the records are page aligned.
+#define BE_TX_INDEX_RECORD_SIZE 64 // The transaction hash, block position, transaction offset, length, height, state and CRC32C checksum of each record, padded so that no record crosses a page.
+#define BE_TX_INDEX_PAGE_SIZE 4096 // Changes to the transaction index are written a page at a time.
+#define BE_TX_INDEX_MIN_SLOTS 1048576 // The initial number of records in the transaction index. Must be a power of two.
+#define BE_TX_INDEX_MAX_DIRTY_PAGES 65536 // Changed pages of the transaction index are written once there are this many, which is 256MB of changes.
 #define BEHashMiniKey(hash) (uint64_t)hash[31] << 56 | (uint64_t)hash[30] << 48 | (uint64_t)hash[29] << 40 | (uint64_t)hash[28] << 32 | (uint64_t)hash[27] << 24 | (uint64_t)hash[26] << 16 | (uint64_t)hash[25] << 8 | (uint64_t)hash[24]
 #define BE_MIN(a,b) ((a) < (b) ? a : b)
 #define BE_MAX(a,b) ((a) > (b) ? a : b)
@@ -61,4 +131,14 @@ typedef enum{
 	BE_BLOCK_VALIDATION_ERR, /**< There was an error during the validation processing. */
 } BEBlockValidationResult;
 
+/**
+ @brief How much of a branch has been loaded. Each state includes the states before it.
+ */
+typedef enum{
+	BE_BRANCH_NOT_LOADED, /**< Nothing has been loaded. */
+	BE_BRANCH_SUMMARY, /**< The branch file is mapped and the header and work are checked and loaded, giving the height, work and other information about the tip. */
+	BE_BRANCH_REFERENCES, /**< The block references and lookup table are checked. */
+	BE_BRANCH_ALL, /**< The unspent outputs are checked. */
+} BEBranchLoadState;
+
 #endif
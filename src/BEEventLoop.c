@@ -0,0 +1,466 @@
+//
+//  BEEventLoop.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 19/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BEEventLoop.h"
+
+//  Constructor
+
+BEEventLoop * BENewEventLoop(uint32_t bufferSize, void (*onErrorReceived)(CBError error,char *,...)){
+	BEEventLoop * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewEventLoop\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeEventLoop;
+	if (BEInitEventLoop(self, bufferSize, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEEventLoop * BEGetEventLoop(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitEventLoop(BEEventLoop * self, uint32_t bufferSize, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	self->bufferSize = bufferSize;
+	self->peers = NULL;
+	self->numSlots = 0;
+	self->numPeers = 0;
+	self->freeHead = -1;
+	self->closedHead = -1;
+	self->pendingHead = -1;
+	self->listenFd = -1;
+	for (uint32_t x = 0; x < BE_TIMER_WHEEL_SLOTS; x++)
+		self->timerWheel[x] = -1;
+	self->tick = 0;
+	self->startTime = BEEventLoopGetTime();
+	self->stop = false;
+	self->bytesRead = 0;
+	self->bytesWritten = 0;
+	self->callbackHandler = NULL;
+	self->onConnected = NULL;
+	self->onReadable = NULL;
+	self->onTimeout = NULL;
+	self->onClosed = NULL;
+	self->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (self->epollFd == -1) {
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create the epoll instance in BEInitEventLoop. Error: %i",errno);
+		return false;
+	}
+	self->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (self->wakeFd == -1) {
+		close(self->epollFd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create the wake eventfd in BEInitEventLoop. Error: %i",errno);
+		return false;
+	}
+	struct epoll_event event = {EPOLLIN | EPOLLET, {.u32 = BE_EVENT_LOOP_WAKE}};
+	if (epoll_ctl(self->epollFd, EPOLL_CTL_ADD, self->wakeFd, &event)) {
+		close(self->wakeFd);
+		close(self->epollFd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not add the wake eventfd to epoll in BEInitEventLoop. Error: %i",errno);
+		return false;
+	}
+	return true;
+}
+
+//  Destructor
+
+void BEFreeEventLoop(void * vself){
+	BEEventLoop * self = vself;
+	for (uint32_t x = 0; x < self->numSlots; x++) {
+		if (self->peers[x].fd != -1)
+			close(self->peers[x].fd);
+		free(self->peers[x].readBuffer);
+		free(self->peers[x].writeBuffer);
+	}
+	free(self->peers);
+	if (self->listenFd != -1)
+		close(self->listenFd);
+	close(self->wakeFd);
+	close(self->epollFd);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+void BEEventLoopAccept(BEEventLoop * self){
+	for (;;) {
+		int fd = accept4(self->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				self->onErrorReceived(CB_ERROR_GENERAL,"Could not accept a connection in BEEventLoopAccept. Error: %i",errno);
+			return;
+		}
+		int32_t peer = BEEventLoopAddSocket(self, fd, false);
+		if (peer != -1 && self->onConnected)
+			self->onConnected(self->callbackHandler, peer);
+	}
+}
+int32_t BEEventLoopAddSocket(BEEventLoop * self, int fd, bool connecting){
+	if (self->freeHead == -1) {
+		// Double the slots, chaining the new slots as unused.
+		uint32_t numSlots = self->numSlots ? self->numSlots * 2 : BE_EVENT_LOOP_MIN_SLOTS;
+		BEEventPeer * peers = realloc(self->peers, sizeof(*peers) * numSlots);
+		if (NOT peers) {
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u peer slots in BEEventLoopAddSocket.",numSlots);
+			close(fd);
+			return -1;
+		}
+		self->peers = peers;
+		for (uint32_t x = self->numSlots; x < numSlots; x++) {
+			peers[x].fd = -1;
+			peers[x].readBuffer = NULL;
+			peers[x].writeBuffer = NULL;
+			peers[x].timerNext = x + 1 < numSlots ? (int32_t)x + 1 : -1;
+		}
+		self->freeHead = self->numSlots;
+		self->numSlots = numSlots;
+	}
+	int32_t peer = self->freeHead;
+	BEEventPeer * peerData = self->peers + peer;
+	// The buffers of unused slots are kept for the next peer.
+	if (NOT peerData->readBuffer)
+		peerData->readBuffer = malloc(self->bufferSize);
+	if (NOT peerData->writeBuffer)
+		peerData->writeBuffer = malloc(self->bufferSize);
+	if (NOT peerData->readBuffer || NOT peerData->writeBuffer) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the peer buffers in BEEventLoopAddSocket.",self->bufferSize * 2);
+		close(fd);
+		return -1;
+	}
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not make a socket non-blocking in BEEventLoopAddSocket. Error: %i",errno);
+		close(fd);
+		return -1;
+	}
+	// Messages are small and latency matters more than packet count.
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	struct epoll_event event = {EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, {.u32 = peer}};
+	if (epoll_ctl(self->epollFd, EPOLL_CTL_ADD, fd, &event)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not add a socket to epoll in BEEventLoopAddSocket. Error: %i",errno);
+		close(fd);
+		return -1;
+	}
+	self->freeHead = peerData->timerNext;
+	peerData->fd = fd;
+	peerData->connecting = connecting;
+	peerData->readBlocked = false;
+	peerData->pending = false;
+	peerData->readStart = 0;
+	peerData->readLength = 0;
+	peerData->writeStart = 0;
+	peerData->writeLength = 0;
+	peerData->timerTick = 0;
+	peerData->timerNext = -1;
+	peerData->timerPrev = -1;
+	peerData->listNext = -1;
+	peerData->expiredNext = -1;
+	peerData->data = NULL;
+	self->numPeers++;
+	return peer;
+}
+void BEEventLoopAdvanceTimers(BEEventLoop * self){
+	uint64_t now = (BEEventLoopGetTime() - self->startTime) / BE_TIMER_TICK;
+	while (self->tick < now) {
+		self->tick++;
+		// Take the expired timers out of the slot first, as the callbacks can set and cancel timers.
+		int32_t expired = -1;
+		int32_t * slot = self->timerWheel + (self->tick & (BE_TIMER_WHEEL_SLOTS - 1));
+		for (int32_t peer = *slot; peer != -1;) {
+			int32_t next = self->peers[peer].timerNext;
+			if (self->peers[peer].timerTick <= self->tick) {
+				BEEventLoopRemoveTimer(self, peer);
+				self->peers[peer].expiredNext = expired;
+				expired = peer;
+			}
+			peer = next;
+		}
+		while (expired != -1) {
+			int32_t peer = expired;
+			expired = self->peers[peer].expiredNext;
+			// The peer may have been closed by an earlier callback.
+			if (self->peers[peer].fd != -1 && self->onTimeout)
+				self->onTimeout(self->callbackHandler, peer);
+		}
+	}
+}
+void BEEventLoopClose(BEEventLoop * self, int32_t peer){
+	BEEventPeer * peerData = self->peers + peer;
+	if (peerData->fd == -1)
+		return;
+	if (self->onClosed)
+		self->onClosed(self->callbackHandler, peer);
+	BEEventLoopRemoveTimer(self, peer);
+	// Closing the socket removes it from epoll.
+	close(peerData->fd);
+	peerData->fd = -1;
+	self->numPeers--;
+	// A pending peer is skipped when the pending list is handled, and goes on the closed list afterwards.
+	if (NOT peerData->pending) {
+		peerData->listNext = self->closedHead;
+		self->closedHead = peer;
+	}
+}
+int32_t BEEventLoopConnect(BEEventLoop * self, struct sockaddr * address, socklen_t addressLength){
+	int fd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not create a socket in BEEventLoopConnect. Error: %i",errno);
+		return -1;
+	}
+	if (connect(fd, address, addressLength) && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	// The connection is finished when the socket becomes writable.
+	return BEEventLoopAddSocket(self, fd, true);
+}
+void BEEventLoopConsume(BEEventLoop * self, int32_t peer, uint32_t length){
+	BEEventPeer * peerData = self->peers + peer;
+	peerData->readStart = (peerData->readStart + length) & (self->bufferSize - 1);
+	peerData->readLength -= length;
+	if (length && peerData->readBlocked && NOT peerData->pending) {
+		// There may be more data in the socket, for which there will be no other event.
+		peerData->pending = true;
+		peerData->listNext = self->pendingHead;
+		self->pendingHead = peer;
+	}
+}
+bool BEEventLoopFlush(BEEventLoop * self, int32_t peer){
+	BEEventPeer * peerData = self->peers + peer;
+	while (peerData->writeLength) {
+		// The data may wrap around the end of the ring buffer.
+		struct iovec parts[2];
+		uint32_t first = BE_MIN(peerData->writeLength, self->bufferSize - peerData->writeStart);
+		parts[0].iov_base = peerData->writeBuffer + peerData->writeStart;
+		parts[0].iov_len = first;
+		parts[1].iov_base = peerData->writeBuffer;
+		parts[1].iov_len = peerData->writeLength - first;
+		ssize_t written = writev(peerData->fd, parts, parts[1].iov_len ? 2 : 1);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				// Written again on the next EPOLLOUT event.
+				return true;
+			BEEventLoopClose(self, peer);
+			return false;
+		}
+		peerData->writeStart = (peerData->writeStart + (uint32_t)written) & (self->bufferSize - 1);
+		peerData->writeLength -= (uint32_t)written;
+		self->bytesWritten += written;
+	}
+	return true;
+}
+uint64_t BEEventLoopGetTime(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+bool BEEventLoopListen(BEEventLoop * self, struct sockaddr * address, socklen_t addressLength){
+	self->listenFd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (self->listenFd == -1) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not create the listening socket in BEEventLoopListen. Error: %i",errno);
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(self->listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	struct epoll_event event = {EPOLLIN | EPOLLET, {.u32 = BE_EVENT_LOOP_LISTEN}};
+	if (bind(self->listenFd, address, addressLength)
+		|| listen(self->listenFd, SOMAXCONN)
+		|| epoll_ctl(self->epollFd, EPOLL_CTL_ADD, self->listenFd, &event)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not listen for connections in BEEventLoopListen. Error: %i",errno);
+		close(self->listenFd);
+		self->listenFd = -1;
+		return false;
+	}
+	return true;
+}
+uint32_t BEEventLoopPeek(BEEventLoop * self, int32_t peer, uint8_t * data, uint32_t length){
+	BEEventPeer * peerData = self->peers + peer;
+	length = BE_MIN(length, peerData->readLength);
+	uint32_t first = BE_MIN(length, self->bufferSize - peerData->readStart);
+	memcpy(data, peerData->readBuffer + peerData->readStart, first);
+	memcpy(data + first, peerData->readBuffer, length - first);
+	return length;
+}
+void BEEventLoopRead(BEEventLoop * self, int32_t peer){
+	BEEventPeer * peerData = self->peers + peer;
+	bool readData = false;
+	peerData->readBlocked = false;
+	for (;;) {
+		if (peerData->readLength == self->bufferSize) {
+			// Stop reading until data is consumed.
+			peerData->readBlocked = true;
+			break;
+		}
+		// Read into the free space, which may wrap around the end of the ring buffer.
+		uint32_t end = (peerData->readStart + peerData->readLength) & (self->bufferSize - 1);
+		uint32_t space = self->bufferSize - peerData->readLength;
+		uint32_t first = BE_MIN(space, self->bufferSize - end);
+		struct iovec parts[2] = {{peerData->readBuffer + end, first}, {peerData->readBuffer, space - first}};
+		ssize_t got = readv(peerData->fd, parts, parts[1].iov_len ? 2 : 1);
+		if (got > 0) {
+			peerData->readLength += (uint32_t)got;
+			self->bytesRead += got;
+			readData = true;
+			continue;
+		}
+		if (got == -1 && errno == EINTR)
+			continue;
+		if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		// The peer closed the connection or there was an error. Give the data already read first.
+		if (readData && self->onReadable)
+			self->onReadable(self->callbackHandler, peer);
+		BEEventLoopClose(self, peer);
+		return;
+	}
+	if (readData && self->onReadable)
+		self->onReadable(self->callbackHandler, peer);
+}
+void BEEventLoopRemoveTimer(BEEventLoop * self, int32_t peer){
+	BEEventPeer * peerData = self->peers + peer;
+	if (NOT peerData->timerTick)
+		return;
+	if (peerData->timerPrev == -1)
+		self->timerWheel[peerData->timerTick & (BE_TIMER_WHEEL_SLOTS - 1)] = peerData->timerNext;
+	else
+		self->peers[peerData->timerPrev].timerNext = peerData->timerNext;
+	if (peerData->timerNext != -1)
+		self->peers[peerData->timerNext].timerPrev = peerData->timerPrev;
+	peerData->timerTick = 0;
+	peerData->timerNext = -1;
+	peerData->timerPrev = -1;
+}
+bool BEEventLoopRun(BEEventLoop * self){
+	struct epoll_event events[BE_EVENT_LOOP_MAX_EVENTS];
+	while (NOT self->stop) {
+		// Wake at least once a tick for the timers.
+		int numEvents = epoll_wait(self->epollFd, events, BE_EVENT_LOOP_MAX_EVENTS, BE_TIMER_TICK);
+		if (numEvents == -1) {
+			if (errno == EINTR)
+				continue;
+			self->onErrorReceived(CB_ERROR_GENERAL,"Could not wait for events in BEEventLoopRun. Error: %i",errno);
+			return false;
+		}
+		for (int x = 0; x < numEvents; x++) {
+			uint32_t id = events[x].data.u32;
+			if (id == BE_EVENT_LOOP_WAKE) {
+				uint64_t value;
+				while (read(self->wakeFd, &value, sizeof(value)) > 0);
+				continue;
+			}
+			if (id == BE_EVENT_LOOP_LISTEN) {
+				BEEventLoopAccept(self);
+				continue;
+			}
+			int32_t peer = (int32_t)id;
+			BEEventPeer * peerData = self->peers + peer;
+			if (peerData->fd == -1)
+				// Closed while handling an earlier event.
+				continue;
+			if (peerData->connecting && events[x].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+				int error = 0;
+				socklen_t errorLength = sizeof(error);
+				if (getsockopt(peerData->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) || error) {
+					BEEventLoopClose(self, peer);
+					continue;
+				}
+				peerData->connecting = false;
+				if (self->onConnected)
+					self->onConnected(self->callbackHandler, peer);
+				// The callback can add peers, which can move the slots.
+				if (self->peers[peer].fd == -1)
+					continue;
+			}
+			if (events[x].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				BEEventLoopRead(self, peer);
+			if (self->peers[peer].fd != -1 && events[x].events & EPOLLOUT)
+				BEEventLoopFlush(self, peer);
+		}
+		BEEventLoopAdvanceTimers(self);
+		// Read again from peers which had full read buffers and have since had data consumed.
+		while (self->pendingHead != -1) {
+			int32_t peer = self->pendingHead;
+			self->pendingHead = self->peers[peer].listNext;
+			self->peers[peer].pending = false;
+			if (self->peers[peer].fd == -1) {
+				self->peers[peer].listNext = self->closedHead;
+				self->closedHead = peer;
+			}else
+				BEEventLoopRead(self, peer);
+		}
+		// No events refer to the closed slots any more, so they can be reused.
+		while (self->closedHead != -1) {
+			int32_t peer = self->closedHead;
+			self->closedHead = self->peers[peer].listNext;
+			self->peers[peer].timerNext = self->freeHead;
+			self->freeHead = peer;
+		}
+	}
+	return true;
+}
+bool BEEventLoopSend(BEEventLoop * self, int32_t peer, uint8_t * data, uint32_t length){
+	BEEventPeer * peerData = self->peers + peer;
+	if (peerData->fd == -1 || self->bufferSize - peerData->writeLength < length)
+		return false;
+	uint32_t end = (peerData->writeStart + peerData->writeLength) & (self->bufferSize - 1);
+	uint32_t first = BE_MIN(length, self->bufferSize - end);
+	memcpy(peerData->writeBuffer + end, data, first);
+	memcpy(peerData->writeBuffer, data + first, length - first);
+	peerData->writeLength += length;
+	if (peerData->connecting)
+		// Written once connected.
+		return true;
+	return BEEventLoopFlush(self, peer);
+}
+void BEEventLoopSetTimer(BEEventLoop * self, int32_t peer, uint32_t milliseconds){
+	BEEventLoopRemoveTimer(self, peer);
+	if (NOT milliseconds)
+		return;
+	BEEventPeer * peerData = self->peers + peer;
+	peerData->timerTick = self->tick + (milliseconds + BE_TIMER_TICK - 1) / BE_TIMER_TICK;
+	int32_t * slot = self->timerWheel + (peerData->timerTick & (BE_TIMER_WHEEL_SLOTS - 1));
+	peerData->timerNext = *slot;
+	if (*slot != -1)
+		self->peers[*slot].timerPrev = peer;
+	*slot = peer;
+}
+void BEEventLoopStop(BEEventLoop * self){
+	self->stop = true;
+	uint64_t value = 1;
+	write(self->wakeFd, &value, sizeof(value));
+}
@@ -0,0 +1,240 @@
+//
+//  BEEventLoop.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 19/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Handles the sockets of many peers on one thread with an edge-triggered epoll event loop.
+ */
+
+#ifndef BEEVENTLOOPH
+#define BEEVENTLOOPH
+
+// For accept4
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "BEConstants.h"
+#include "CBObject.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+/**
+ @brief A peer socket in the event loop.
+ */
+typedef struct{
+	int fd; /**< The socket or -1 for an unused slot. */
+	bool connecting; /**< True until an outgoing connection is made. */
+	bool readBlocked; /**< True if reading stopped because the read buffer was full. */
+	bool pending; /**< True if the peer is in the list of peers to read again. */
+	uint8_t * readBuffer; /**< Ring buffer of received data. */
+	uint32_t readStart; /**< The position of the first received byte in the read buffer. */
+	uint32_t readLength; /**< The number of received bytes in the read buffer. */
+	uint8_t * writeBuffer; /**< Ring buffer of data to send. */
+	uint32_t writeStart; /**< The position of the first byte to send in the write buffer. */
+	uint32_t writeLength; /**< The number of bytes to send in the write buffer. */
+	uint64_t timerTick; /**< The tick the timer expires at or zero if there is no timer. */
+	int32_t timerNext; /**< The next peer in the timer wheel slot or -1. For unused slots this is the next unused slot. */
+	int32_t timerPrev; /**< The previous peer in the timer wheel slot or -1. */
+	int32_t listNext; /**< The next peer in the list of peers to read again or of closed peers, or -1. */
+	int32_t expiredNext; /**< The next peer in the list of expired timers being handled, or -1. */
+	void * data; /**< Data for the user of the event loop. */
+} BEEventPeer;
+
+/**
+ @brief Structure for BEEventLoop objects. @see BEEventLoop.h
+ */
+typedef struct{
+	CBObject base;
+	int epollFd; /**< The epoll instance. */
+	int wakeFd; /**< An eventfd used to wake the loop from other threads. */
+	int listenFd; /**< The listening socket or -1. */
+	BEEventPeer * peers; /**< Slots for the peers. */
+	uint32_t numSlots; /**< The number of slots. */
+	uint32_t numPeers; /**< The number of open peers. */
+	int32_t freeHead; /**< The first unused slot or -1. */
+	int32_t closedHead; /**< The first slot closed since the events were received, which becomes unused after the events are handled, or -1. */
+	int32_t pendingHead; /**< The first peer to read again after data was consumed from a full read buffer, or -1. */
+	uint32_t bufferSize; /**< The size of the ring buffers, a power of two. */
+	int32_t timerWheel[BE_TIMER_WHEEL_SLOTS]; /**< The first peer with a timer in each slot or -1. */
+	uint64_t tick; /**< The number of ticks of the timer wheel which have been handled. */
+	uint64_t startTime; /**< The time the loop was created from CLOCK_MONOTONIC in milliseconds. */
+	volatile bool stop; /**< Set to stop the loop. */
+	uint64_t bytesRead; /**< The number of bytes read from all peers. */
+	uint64_t bytesWritten; /**< The number of bytes written to all peers. */
+	void * callbackHandler; /**< Passed to the callbacks. */
+	void (*onConnected)(void * callbackHandler, int32_t peer); /**< Called when an outgoing connection is made or an incoming connection is accepted, or NULL. */
+	void (*onReadable)(void * callbackHandler, int32_t peer); /**< Called when data has been read into the read buffer of a peer, or NULL. */
+	void (*onTimeout)(void * callbackHandler, int32_t peer); /**< Called when the timer of a peer expires, or NULL. */
+	void (*onClosed)(void * callbackHandler, int32_t peer); /**< Called when a peer is closed, before its slot is cleared, or NULL. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEEventLoop;
+
+/**
+ @brief Creates a new BEEventLoop object.
+ @param bufferSize The size of the read and write buffers of each peer, a power of two.
+ @returns A new BEEventLoop object.
+ */
+BEEventLoop * BENewEventLoop(uint32_t bufferSize, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEEventLoop from another object. Use this to avoid casts.
+ @param self The object to obtain the BEEventLoop from.
+ @returns The BEEventLoop object.
+ */
+BEEventLoop * BEGetEventLoop(void * self);
+
+/**
+ @brief Initialises a BEEventLoop object.
+ @param self The BEEventLoop object to initialise.
+ @param bufferSize The size of the read and write buffers of each peer, a power of two.
+ @returns true on success, false on failure.
+ */
+bool BEInitEventLoop(BEEventLoop * self, uint32_t bufferSize, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEEventLoop object, closing all of the sockets.
+ @param self The BEEventLoop object to free.
+ */
+void BEFreeEventLoop(void * self);
+
+// Functions
+
+/**
+ @brief Accepts all waiting incoming connections.
+ @param self The BEEventLoop object.
+ */
+void BEEventLoopAccept(BEEventLoop * self);
+/**
+ @brief Adds a connected or connecting socket to the loop, making it non-blocking.
+ @param self The BEEventLoop object.
+ @param fd The socket, which is closed by the loop.
+ @param connecting True if the socket is still connecting.
+ @returns The peer or -1 on failure, in which case the socket is closed.
+ */
+int32_t BEEventLoopAddSocket(BEEventLoop * self, int fd, bool connecting);
+/**
+ @brief Handles the expired timers up to the current time.
+ @param self The BEEventLoop object.
+ */
+void BEEventLoopAdvanceTimers(BEEventLoop * self);
+/**
+ @brief Closes a peer. onClosed is called and the slot is reused once the events already received have been handled.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ */
+void BEEventLoopClose(BEEventLoop * self, int32_t peer);
+/**
+ @brief Starts a connection to a peer.
+ @param self The BEEventLoop object.
+ @param address The address to connect to.
+ @param addressLength The length of the address.
+ @returns The peer, for which onConnected or onClosed is called once the connection is made or fails, or -1 on failure.
+ */
+int32_t BEEventLoopConnect(BEEventLoop * self, struct sockaddr * address, socklen_t addressLength);
+/**
+ @brief Removes data from the start of the read buffer of a peer. If reading had stopped because the buffer was full, the peer is read again.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ @param length The number of bytes to remove, which is at most the number of bytes in the read buffer.
+ */
+void BEEventLoopConsume(BEEventLoop * self, int32_t peer, uint32_t length);
+/**
+ @brief Writes as much of the write buffer of a peer as the socket allows.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ @returns true on success and false if the peer was closed.
+ */
+bool BEEventLoopFlush(BEEventLoop * self, int32_t peer);
+/**
+ @brief Gets the time from CLOCK_MONOTONIC in milliseconds.
+ @returns The time.
+ */
+uint64_t BEEventLoopGetTime(void);
+/**
+ @brief Listens for incoming connections, which are accepted by the loop.
+ @param self The BEEventLoop object.
+ @param address The address to listen on.
+ @param addressLength The length of the address.
+ @returns true on success and false on failure.
+ */
+bool BEEventLoopListen(BEEventLoop * self, struct sockaddr * address, socklen_t addressLength);
+/**
+ @brief Copies data from the start of the read buffer of a peer without removing it.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ @param data The buffer to copy into.
+ @param length The maximum number of bytes to copy.
+ @returns The number of bytes copied.
+ */
+uint32_t BEEventLoopPeek(BEEventLoop * self, int32_t peer, uint8_t * data, uint32_t length);
+/**
+ @brief Reads from the socket of a peer until there is no more data or the read buffer is full, and calls onReadable if data was read.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ */
+void BEEventLoopRead(BEEventLoop * self, int32_t peer);
+/**
+ @brief Removes the timer of a peer from the timer wheel if it has one.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ */
+void BEEventLoopRemoveTimer(BEEventLoop * self, int32_t peer);
+/**
+ @brief Handles events until BEEventLoopStop is called.
+ @param self The BEEventLoop object.
+ @returns true if stopped and false on failure.
+ */
+bool BEEventLoopRun(BEEventLoop * self);
+/**
+ @brief Copies data to the write buffer of a peer and writes as much as the socket allows.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ @param data The data to send.
+ @param length The length of the data.
+ @returns true on success and false if there is not enough room in the write buffer or the peer was closed.
+ */
+bool BEEventLoopSend(BEEventLoop * self, int32_t peer, uint8_t * data, uint32_t length);
+/**
+ @brief Sets the timer of a peer, replacing any timer already set.
+ @param self The BEEventLoop object.
+ @param peer The peer.
+ @param milliseconds The time until onTimeout is called, rounded up to ticks, or zero to cancel the timer.
+ */
+void BEEventLoopSetTimer(BEEventLoop * self, int32_t peer, uint32_t milliseconds);
+/**
+ @brief Stops the loop. This can be called from any thread.
+ @param self The BEEventLoop object.
+ */
+void BEEventLoopStop(BEEventLoop * self);
+
+#endif
@@ -0,0 +1,372 @@
+//
+//  BEFilterIndex.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 12/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BEFilterIndex.h"
+
+//  Constructor
+
+BEFilterIndex * BENewFilterIndex(char * dataDir, void (*onErrorReceived)(CBError error,char *,...)){
+	BEFilterIndex * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewFilterIndex\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeFilterIndex;
+	if (BEInitFilterIndex(self, dataDir, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEFilterIndex * BEGetFilterIndex(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitFilterIndex(BEFilterIndex * self, char * dataDir, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	char fileName[strlen(dataDir) + strlen(BE_FILTER_INDEX_FILE) + 1];
+	sprintf(fileName, "%s%s", dataDir, BE_FILTER_DATA_FILE);
+	self->filterFd = open(fileName, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (self->filterFd == -1) {
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the filter file %s. errno = %i",fileName, errno);
+		return false;
+	}
+	sprintf(fileName, "%s%s", dataDir, BE_FILTER_INDEX_FILE);
+	self->indexFd = open(fileName, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (self->indexFd == -1) {
+		close(self->filterFd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the filter index file %s. errno = %i",fileName, errno);
+		return false;
+	}
+	struct stat filterSt, indexSt;
+	if (fstat(self->filterFd, &filterSt) || fstat(self->indexFd, &indexSt)) {
+		close(self->filterFd);
+		close(self->indexFd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not get the size of the filter files.");
+		return false;
+	}
+	if (pthread_mutex_init(&self->lock, NULL)) {
+		close(self->filterFd);
+		close(self->indexFd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the lock in BEInitFilterIndex.");
+		return false;
+	}
+	self->filterFileSize = filterSt.st_size;
+	self->unsynced = false;
+	// Remove the records at the end which were not completely written. Only the last record is read when the index is intact.
+	self->numFilters = (uint32_t)(indexSt.st_size / BE_FILTER_INDEX_RECORD_SIZE);
+	uint64_t filterPos;
+	while (self->numFilters && NOT BEFilterIndexGetEntry(self, self->numFilters - 1, &filterPos, self->lastHeader))
+		self->numFilters--;
+	if (NOT self->numFilters)
+		memset(self->lastHeader, 0, 32);
+	if ((uint64_t)indexSt.st_size != (uint64_t)self->numFilters * BE_FILTER_INDEX_RECORD_SIZE
+		&& ftruncate(self->indexFd, (off_t)self->numFilters * BE_FILTER_INDEX_RECORD_SIZE)) {
+		pthread_mutex_destroy(&self->lock);
+		close(self->filterFd);
+		close(self->indexFd);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not remove the incomplete records of the filter index. errno = %i",errno);
+		return false;
+	}
+	return true;
+}
+
+//  Destructor
+
+void BEFreeFilterIndex(void * vself){
+	BEFilterIndex * self = vself;
+	pthread_mutex_destroy(&self->lock);
+	close(self->filterFd);
+	close(self->indexFd);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+uint64_t BEFilterIndexAddFilter(BEFilterIndex * self, uint8_t * blockHash, CBByteArray * filter){
+	uint8_t head[BE_FILTER_RECORD_OVERHEAD - 4];
+	uint8_t tail[4];
+	memcpy(head, blockHash, 32);
+	uint8_t hash[32];
+	CBSha256(CBByteArrayGetData(filter), filter->length, hash);
+	CBSha256(hash, 32, head + 32);
+	for (uint8_t x = 0; x < 4; x++)
+		head[64 + x] = filter->length >> 8*x;
+	uint32_t crc = BECRC32C(BECRC32C(0, head, sizeof(head)), CBByteArrayGetData(filter), filter->length);
+	for (uint8_t x = 0; x < 4; x++)
+		tail[x] = crc >> 8*x;
+	// A record which is not completely written is written over by the next record, as the filter file size is not changed.
+	struct iovec parts[3] = {{head, sizeof(head)}, {CBByteArrayGetData(filter), filter->length}, {tail, 4}};
+	uint64_t filterPos = self->filterFileSize;
+	if (pwritev(self->filterFd, parts, 3, (off_t)filterPos) != BE_FILTER_RECORD_OVERHEAD + filter->length) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not write the filter to the filter file. errno = %i",errno);
+		return BE_NO_FILTER;
+	}
+	pthread_mutex_lock(&self->lock);
+	self->filterFileSize += BE_FILTER_RECORD_OVERHEAD + filter->length;
+	pthread_mutex_unlock(&self->lock);
+	self->unsynced = true;
+	return filterPos;
+}
+bool BEFilterIndexAppend(BEFilterIndex * self, uint64_t filterPos){
+	// Check the filter is intact before giving it a height.
+	uint8_t hashes[64];
+	CBByteArray * filter = BEFilterIndexReadFilter(self, filterPos, NULL, hashes);
+	if (NOT filter)
+		return false;
+	CBReleaseObject(filter);
+	memcpy(hashes + 32, self->lastHeader, 32);
+	uint8_t record[BE_FILTER_INDEX_RECORD_SIZE];
+	for (uint8_t x = 0; x < 8; x++)
+		record[x] = filterPos >> 8*x;
+	uint8_t hash[32];
+	CBSha256(hashes, 64, hash);
+	CBSha256(hash, 32, record + 8);
+	uint32_t crc = BECRC32C(0, record, 40);
+	for (uint8_t x = 0; x < 4; x++)
+		record[40 + x] = crc >> 8*x;
+	pthread_mutex_lock(&self->lock);
+	bool ok = pwrite(self->indexFd, record, BE_FILTER_INDEX_RECORD_SIZE, (off_t)self->numFilters * BE_FILTER_INDEX_RECORD_SIZE) == BE_FILTER_INDEX_RECORD_SIZE;
+	if (ok) {
+		self->numFilters++;
+		memcpy(self->lastHeader, record + 8, 32);
+	}
+	pthread_mutex_unlock(&self->lock);
+	if (NOT ok)
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not write to the filter index. errno = %i",errno);
+	return ok;
+}
+CBByteArray * BEFilterIndexBuildFilter(uint8_t * blockHash, CBScript ** scripts, uint32_t numScripts, void (*onErrorReceived)(CBError error,char *,...)){
+	uint64_t * values = malloc(sizeof(*values) * BE_MAX(numScripts, 1));
+	if (NOT values) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the filter values in BEFilterIndexBuildFilter.",sizeof(*values) * numScripts);
+		return NULL;
+	}
+	uint64_t key0 = BESipHashReadInt64(blockHash);
+	uint64_t key1 = BESipHashReadInt64(blockHash + 8);
+	for (uint32_t x = 0; x < numScripts; x++)
+		values[x] = BESipHash(key0, key1, CBByteArrayGetData(scripts[x]), scripts[x]->length);
+	// Sort and remove scripts given more than once, which have the same hash.
+	qsort(values, numScripts, sizeof(*values), BEFilterIndexCompareValues);
+	uint32_t numValues = 0;
+	for (uint32_t x = 0; x < numScripts; x++)
+		if (NOT numValues || values[x] != values[numValues - 1])
+			values[numValues++] = values[x];
+	// Map the hashes onto the range, which keeps them sorted, and count the bits of the codes for the differences.
+	uint64_t range = (uint64_t)numValues * BE_FILTER_M;
+	uint64_t numBits = 0;
+	uint64_t last = 0;
+	for (uint32_t x = 0; x < numValues; x++) {
+		values[x] = BEFilterIndexMultiplyHigh(values[x], range);
+		numBits += ((values[x] - last) >> BE_FILTER_P) + 1 + BE_FILTER_P;
+		last = values[x];
+	}
+	uint8_t sizeBytes = CBVarIntSizeOf(numValues);
+	CBByteArray * filter = CBNewByteArrayOfSize(sizeBytes + (uint32_t)((numBits + 7) / 8), onErrorReceived);
+	if (NOT filter) {
+		free(values);
+		return NULL;
+	}
+	uint8_t * bits = CBByteArrayGetData(filter) + sizeBytes;
+	memset(bits, 0, (numBits + 7) / 8);
+	CBVarIntEncode(filter, 0, CBVarIntFromUInt64(numValues));
+	// Write the quotient in unary with a zero after it, followed by the remainder, most significant bits first.
+	uint64_t bitPos = 0;
+	last = 0;
+	for (uint32_t x = 0; x < numValues; x++) {
+		uint64_t delta = values[x] - last;
+		last = values[x];
+		for (uint64_t quotient = delta >> BE_FILTER_P; quotient; quotient--, bitPos++)
+			bits[bitPos / 8] |= 0x80 >> bitPos % 8;
+		bitPos++;
+		for (int8_t y = BE_FILTER_P - 1; y >= 0; y--, bitPos++)
+			if (delta >> y & 1)
+				bits[bitPos / 8] |= 0x80 >> bitPos % 8;
+	}
+	free(values);
+	return filter;
+}
+int BEFilterIndexCompareValues(const void * a, const void * b){
+	uint64_t valueA = *(const uint64_t *)a;
+	uint64_t valueB = *(const uint64_t *)b;
+	if (valueA != valueB)
+		return valueA < valueB ? -1 : 1;
+	return 0;
+}
+bool BEFilterIndexGetEntry(BEFilterIndex * self, uint32_t height, uint64_t * filterPos, uint8_t * header){
+	uint8_t record[BE_FILTER_INDEX_RECORD_SIZE];
+	pthread_mutex_lock(&self->lock);
+	bool ok = height < self->numFilters
+		&& pread(self->indexFd, record, BE_FILTER_INDEX_RECORD_SIZE, (off_t)height * BE_FILTER_INDEX_RECORD_SIZE) == BE_FILTER_INDEX_RECORD_SIZE;
+	uint64_t filterFileSize = self->filterFileSize;
+	pthread_mutex_unlock(&self->lock);
+	if (NOT ok || BECRC32C(0, record, 40) != (record[40] | (uint32_t)record[41] << 8 | (uint32_t)record[42] << 16 | (uint32_t)record[43] << 24))
+		return false;
+	*filterPos = BESipHashReadInt64(record);
+	if (filterFileSize < BE_FILTER_RECORD_OVERHEAD || *filterPos > filterFileSize - BE_FILTER_RECORD_OVERHEAD)
+		return false;
+	memcpy(header, record + 8, 32);
+	return true;
+}
+CBByteArray * BEFilterIndexGetFilter(BEFilterIndex * self, uint32_t height, uint8_t * blockHash){
+	uint64_t filterPos;
+	uint8_t header[32];
+	if (NOT BEFilterIndexGetEntry(self, height, &filterPos, header))
+		return NULL;
+	return BEFilterIndexReadFilter(self, filterPos, blockHash, NULL);
+}
+bool BEFilterIndexGetHeaders(BEFilterIndex * self, uint32_t start, uint32_t count, uint8_t * headers){
+	uint8_t * records = malloc((size_t)count * BE_FILTER_INDEX_RECORD_SIZE);
+	if (NOT records) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the filter index records in BEFilterIndexGetHeaders.",count * BE_FILTER_INDEX_RECORD_SIZE);
+		return false;
+	}
+	size_t length = (size_t)count * BE_FILTER_INDEX_RECORD_SIZE;
+	pthread_mutex_lock(&self->lock);
+	bool ok = (uint64_t)start + count <= self->numFilters
+		&& pread(self->indexFd, records, length, (off_t)start * BE_FILTER_INDEX_RECORD_SIZE) == (ssize_t)length;
+	pthread_mutex_unlock(&self->lock);
+	for (uint32_t x = 0; ok && x < count; x++) {
+		uint8_t * record = records + (size_t)x * BE_FILTER_INDEX_RECORD_SIZE;
+		ok = BECRC32C(0, record, 40) == (record[40] | (uint32_t)record[41] << 8 | (uint32_t)record[42] << 16 | (uint32_t)record[43] << 24);
+		memcpy(headers + 32*x, record + 8, 32);
+	}
+	free(records);
+	return ok;
+}
+bool BEFilterIndexMatch(CBByteArray * filter, uint8_t * blockHash, uint8_t * element, uint32_t length){
+	if (NOT filter->length)
+		return false;
+	uint8_t * data = CBByteArrayGetData(filter);
+	uint8_t sizeBytes = data[0] < 253 ? 1 : (data[0] == 253 ? 3 : (data[0] == 254 ? 5 : 9));
+	if (filter->length < sizeBytes)
+		return false;
+	uint64_t numValues = CBVarIntDecode(filter, 0).val;
+	uint64_t numBits = (uint64_t)(filter->length - sizeBytes) * 8;
+	// Each value takes at least the remainder and the end of the quotient, so larger counts are malformed.
+	if (NOT numValues || numValues > numBits / (BE_FILTER_P + 1))
+		return false;
+	uint64_t target = BEFilterIndexMultiplyHigh(BESipHash(BESipHashReadInt64(blockHash), BESipHashReadInt64(blockHash + 8), element, length), numValues * BE_FILTER_M);
+	uint8_t * bits = data + sizeBytes;
+	uint64_t bitPos = 0;
+	uint64_t value = 0;
+	for (uint64_t x = 0; x < numValues; x++) {
+		uint64_t quotient = 0;
+		for (;; quotient++, bitPos++) {
+			if (bitPos == numBits)
+				return false;
+			if (NOT (bits[bitPos / 8] & 0x80 >> bitPos % 8))
+				break;
+		}
+		bitPos++;
+		if (bitPos + BE_FILTER_P > numBits)
+			return false;
+		uint64_t remainder = 0;
+		for (uint8_t y = 0; y < BE_FILTER_P; y++, bitPos++)
+			remainder = remainder << 1 | (bits[bitPos / 8] >> (7 - bitPos % 8) & 1);
+		// The values are sorted, so stop once past the target.
+		value += quotient << BE_FILTER_P | remainder;
+		if (value == target)
+			return true;
+		if (value > target)
+			return false;
+	}
+	return false;
+}
+uint64_t BEFilterIndexMultiplyHigh(uint64_t a, uint64_t b){
+	uint64_t aLow = a & 0xFFFFFFFF, aHigh = a >> 32;
+	uint64_t bLow = b & 0xFFFFFFFF, bHigh = b >> 32;
+	uint64_t low = aLow * bLow;
+	uint64_t middle1 = aHigh * bLow;
+	uint64_t middle2 = aLow * bHigh;
+	uint64_t carry = ((low >> 32) + (middle1 & 0xFFFFFFFF) + (middle2 & 0xFFFFFFFF)) >> 32;
+	return aHigh * bHigh + (middle1 >> 32) + (middle2 >> 32) + carry;
+}
+CBByteArray * BEFilterIndexReadFilter(BEFilterIndex * self, uint64_t filterPos, uint8_t * blockHash, uint8_t * filterHash){
+	uint8_t head[BE_FILTER_RECORD_OVERHEAD - 4];
+	if (pread(self->filterFd, head, sizeof(head), (off_t)filterPos) != sizeof(head)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not read the filter record at %llu. errno = %i",(unsigned long long)filterPos, errno);
+		return NULL;
+	}
+	uint32_t length = head[64] | (uint32_t)head[65] << 8 | (uint32_t)head[66] << 16 | (uint32_t)head[67] << 24;
+	pthread_mutex_lock(&self->lock);
+	uint64_t filterFileSize = self->filterFileSize;
+	pthread_mutex_unlock(&self->lock);
+	if (filterPos + BE_FILTER_RECORD_OVERHEAD + length > filterFileSize) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"The filter record at %llu is corrupt.",(unsigned long long)filterPos);
+		return NULL;
+	}
+	CBByteArray * filter = CBNewByteArrayOfSize(length, self->onErrorReceived);
+	if (NOT filter)
+		return NULL;
+	uint8_t tail[4];
+	struct iovec parts[2] = {{CBByteArrayGetData(filter), length}, {tail, 4}};
+	if (preadv(self->filterFd, parts, 2, (off_t)filterPos + sizeof(head)) != length + 4
+		|| BECRC32C(BECRC32C(0, head, sizeof(head)), CBByteArrayGetData(filter), length) != (tail[0] | (uint32_t)tail[1] << 8 | (uint32_t)tail[2] << 16 | (uint32_t)tail[3] << 24)) {
+		CBReleaseObject(filter);
+		self->onErrorReceived(CB_ERROR_GENERAL,"The filter record at %llu is corrupt.",(unsigned long long)filterPos);
+		return NULL;
+	}
+	if (blockHash)
+		memcpy(blockHash, head, 32);
+	if (filterHash)
+		memcpy(filterHash, head + 32, 32);
+	return filter;
+}
+bool BEFilterIndexSyncFilters(BEFilterIndex * self){
+	if (NOT self->unsynced)
+		return true;
+	if (fdatasync(self->filterFd)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not sync the filter file. errno = %i",errno);
+		return false;
+	}
+	self->unsynced = false;
+	return true;
+}
+bool BEFilterIndexTruncate(BEFilterIndex * self, uint32_t numFilters){
+	if (numFilters >= self->numFilters)
+		return true;
+	uint8_t header[32] = {0};
+	uint64_t filterPos;
+	if (numFilters && NOT BEFilterIndexGetEntry(self, numFilters - 1, &filterPos, header)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not read the filter index record for height %u.",numFilters - 1);
+		return false;
+	}
+	pthread_mutex_lock(&self->lock);
+	bool ok = NOT ftruncate(self->indexFd, (off_t)numFilters * BE_FILTER_INDEX_RECORD_SIZE);
+	if (ok) {
+		self->numFilters = numFilters;
+		memcpy(self->lastHeader, header, 32);
+	}
+	pthread_mutex_unlock(&self->lock);
+	if (NOT ok)
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not truncate the filter index. errno = %i",errno);
+	return ok;
+}
@@ -0,0 +1,186 @@
+//
+//  BEFilterIndex.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 12/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Builds BIP158 basic block filters and stores them with their filter headers for serving to light clients by height.
+ */
+
+#ifndef BEFILTERINDEXH
+#define BEFILTERINDEXH
+
+#include "BEConstants.h"
+#include "BECRC32C.h"
+#include "BESipHash.h"
+#include "CBBlock.h"
+#include "CBVarInt.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+/**
+ @brief Structure for BEFilterIndex objects. @see BEFilterIndex.h
+ */
+typedef struct{
+	CBObject base;
+	int filterFd; /**< The file descriptor for the filter file. */
+	int indexFd; /**< The file descriptor for the filter index file. */
+	uint64_t filterFileSize; /**< The length of the filter file, which is where the next filter is written. */
+	bool unsynced; /**< True if filters were written since the filter file was last synced. */
+	uint32_t numFilters; /**< The number of heights in the index, which is the height of the last filter plus one. */
+	uint8_t lastHeader[32]; /**< The filter header of the last height in the index, or zero if the index is empty. */
+	pthread_mutex_t lock; /**< Held while the index is read or changed. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEFilterIndex;
+
+/**
+ @brief Creates a new BEFilterIndex object.
+ @param dataDir The directory of the filter files, ending with a slash.
+ @returns A new BEFilterIndex object.
+ */
+BEFilterIndex * BENewFilterIndex(char * dataDir, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEFilterIndex from another object. Use this to avoid casts.
+ @param self The object to obtain the BEFilterIndex from.
+ @returns The BEFilterIndex object.
+ */
+BEFilterIndex * BEGetFilterIndex(void * self);
+
+/**
+ @brief Initialises a BEFilterIndex object, opening or creating the filter files.
+ @param self The BEFilterIndex object to initialise.
+ @param dataDir The directory of the filter files, ending with a slash.
+ @returns true on success, false on failure.
+ */
+bool BEInitFilterIndex(BEFilterIndex * self, char * dataDir, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEFilterIndex object.
+ @param self The BEFilterIndex object to free.
+ */
+void BEFreeFilterIndex(void * self);
+
+// Functions
+
+/**
+ @brief Writes a filter to the end of the filter file. The filter is not in the index until BEFilterIndexAppend is given its position.
+ @param self The BEFilterIndex object.
+ @param blockHash The hash of the block of the filter.
+ @param filter The filter.
+ @returns The position of the filter in the filter file or BE_NO_FILTER on failure.
+ */
+uint64_t BEFilterIndexAddFilter(BEFilterIndex * self, uint8_t * blockHash, CBByteArray * filter);
+/**
+ @brief Adds a filter from the filter file to the index for the height after the last height, working out its filter header.
+ @param self The BEFilterIndex object.
+ @param filterPos The position of the filter in the filter file.
+ @returns true on success and false on failure.
+ */
+bool BEFilterIndexAppend(BEFilterIndex * self, uint64_t filterPos);
+/**
+ @brief Builds a basic block filter.
+ @param blockHash The hash of the block, which keys the filter.
+ @param scripts The output scripts of the block and the scripts of the outputs spent by the block, without empty scripts or OP_RETURN outputs. Scripts can be given more than once.
+ @param numScripts The number of scripts.
+ @returns The serialised filter or NULL on failure.
+ */
+CBByteArray * BEFilterIndexBuildFilter(uint8_t * blockHash, CBScript ** scripts, uint32_t numScripts, void (*onErrorReceived)(CBError error,char *,...));
+/**
+ @brief Compares two 64 bit integers for sorting.
+ @param a A pointer to the first integer.
+ @param b A pointer to the second integer.
+ @returns A negative number if a is less than b, zero if they are equal and a positive number if a is more than b.
+ */
+int BEFilterIndexCompareValues(const void * a, const void * b);
+/**
+ @brief Gets the filter position and filter header for a height.
+ @param self The BEFilterIndex object.
+ @param height The height.
+ @param filterPos Set to the position of the filter in the filter file.
+ @param header Set to the 32 byte filter header.
+ @returns true on success and false if there is no filter for the height or it could not be read.
+ */
+bool BEFilterIndexGetEntry(BEFilterIndex * self, uint32_t height, uint64_t * filterPos, uint8_t * header);
+/**
+ @brief Reads the filter for a height.
+ @param self The BEFilterIndex object.
+ @param height The height.
+ @param blockHash Set to the hash of the block of the filter.
+ @returns The filter or NULL if there is no filter for the height or it could not be read.
+ */
+CBByteArray * BEFilterIndexGetFilter(BEFilterIndex * self, uint32_t height, uint8_t * blockHash);
+/**
+ @brief Reads the filter headers for a range of heights with one read of the index.
+ @param self The BEFilterIndex object.
+ @param start The first height.
+ @param count The number of heights.
+ @param headers Set to the 32 byte filter headers one after the other.
+ @returns true on success and false if any height has no filter or the headers could not be read.
+ */
+bool BEFilterIndexGetHeaders(BEFilterIndex * self, uint32_t start, uint32_t count, uint8_t * headers);
+/**
+ @brief Checks if an element may be in a filter. Elements not in the filter match with a probability of 1/BE_FILTER_M.
+ @param filter The filter.
+ @param blockHash The hash of the block of the filter.
+ @param element The element, such as an output script.
+ @param length The length of the element.
+ @returns true if the element may be in the filter and false if it is not, or the filter is malformed.
+ */
+bool BEFilterIndexMatch(CBByteArray * filter, uint8_t * blockHash, uint8_t * element, uint32_t length);
+/**
+ @brief Multiplies two 64 bit integers, giving the top 64 bits of the 128 bit result.
+ @param a The first integer.
+ @param b The second integer.
+ @returns The top 64 bits of the product.
+ */
+uint64_t BEFilterIndexMultiplyHigh(uint64_t a, uint64_t b);
+/**
+ @brief Reads a filter record from the filter file, checking its checksum.
+ @param self The BEFilterIndex object.
+ @param filterPos The position of the record.
+ @param blockHash Set to the block hash or NULL.
+ @param filterHash Set to the double SHA-256 of the filter or NULL.
+ @returns The filter or NULL if the record could not be read or is corrupt.
+ */
+CBByteArray * BEFilterIndexReadFilter(BEFilterIndex * self, uint64_t filterPos, uint8_t * blockHash, uint8_t * filterHash);
+/**
+ @brief Syncs the filter file to disk if filters were written since it was last synced.
+ @param self The BEFilterIndex object.
+ @returns true on success and false on failure.
+ */
+bool BEFilterIndexSyncFilters(BEFilterIndex * self);
+/**
+ @brief Removes the heights from a height onwards from the index. The filters stay in the filter file.
+ @param self The BEFilterIndex object.
+ @param numFilters The number of heights to keep.
+ @returns true on success and false on failure.
+ */
+bool BEFilterIndexTruncate(BEFilterIndex * self, uint32_t numFilters);
+
+#endif
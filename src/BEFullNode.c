@@ -63,68 +63,309 @@ bool BEInitFullNode(BEFullNode * self,void (*onErrorReceived)(CBError error,char
 		return false;
 	homeDir = pwd->pw_dir;
 	unsigned long homeLen = strlen(homeDir);
-	// Open or create a new address store
 	unsigned long dataDirLen = strlen(BE_DATA_DIRECTORY);
-	char * addressFilePath = malloc(homeLen + dataDirLen + strlen(BE_ADDRESS_DATA_FILE) + 1);
-	memcpy(addressFilePath, homeDir, homeLen);
-	memcpy(addressFilePath + homeLen, BE_DATA_DIRECTORY, strlen(BE_DATA_DIRECTORY));
-	strcpy(addressFilePath + homeLen + dataDirLen, BE_ADDRESS_DATA_FILE);
-	self->addressFile = fopen(addressFilePath, "rb+");
-	if (self->addressFile) {
-		// The address store exists.
-		free(addressFilePath);
-		// Get the file length
-		fseek(self->addressFile, 0, SEEK_END);
-		unsigned long fileLen = ftell(self->addressFile);
-		fseek(self->addressFile, 0, SEEK_SET);
-		// Read file into a CBByteArray
-		CBByteArray * buffer = CBNewByteArrayOfSize((uint32_t)fileLen, onErrorReceived);
-		if (NOT buffer) {
-			fclose(self->addressFile);
-			return false;
-		}
-		if(fread(CBByteArrayGetData(buffer), fileLen, 1, self->addressFile) != fileLen){
-			CBReleaseObject(buffer);
-			fclose(self->addressFile);
-			return false;
-		}
-		// Create the CBAddressManager
-		CBGetNetworkCommunicator(self)->addresses = CBNewAddressManagerFromData(buffer, onErrorReceived, BEFullNodeOnBadTime);
-		CBReleaseObject(buffer);
-		if (NOT CBAddressManagerDeserialise(CBGetNetworkCommunicator(self)->addresses)){
-			fclose(self->addressFile);
-			CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
-			onErrorReceived(CB_ERROR_INIT_FAIL,"There was an error when deserialising the CBAddressManager for the BEFullNode.");
-			return false;
-		}
-	}else{
-		// The address store does not exist
-		CBGetNetworkCommunicator(self)->addresses = CBNewAddressManager(onErrorReceived, BEFullNodeOnBadTime);
-		if (NOT CBGetNetworkCommunicator(self)->addresses)
-			return false;
-		// Create the file
-		self->addressFile = fopen(addressFilePath, "wb");
-		free(addressFilePath);
-		if (NOT self->addressFile){
-			CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
-			return false;
-		}
+	self->dataDir = malloc(homeLen + dataDirLen + 1);
+	if (NOT self->dataDir) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the data directory in BEInitFullNode.",homeLen + dataDirLen + 1);
+		return false;
+	}
+	memcpy(self->dataDir, homeDir, homeLen);
+	strcpy(self->dataDir + homeLen, BE_DATA_DIRECTORY);
+	// Open or create the address store, which only reads the header, and give the address manager a sample of the stored addresses.
+	self->addressStore = BENewAddressStore(self->dataDir, onErrorReceived);
+	if (NOT self->addressStore) {
+		free(self->dataDir);
+		return false;
+	}
+	CBGetNetworkCommunicator(self)->addresses = CBNewAddressManager(onErrorReceived, BEFullNodeOnBadTime);
+	if (NOT CBGetNetworkCommunicator(self)->addresses) {
+		CBReleaseObject(self->addressStore);
+		free(self->dataDir);
+		return false;
 	}
+	BEFullNodeSeedAddresses(self);
 	// Create block validator
-	
+	self->validator = BENewFullValidator(self->dataDir, onErrorReceived);
+	if (NOT self->validator) {
+		free(self->dataDir);
+		CBReleaseObject(self->addressStore);
+		CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
+		return false;
+	}
+	if (NOT BEFullValidatorLoadValidator(self->validator)) {
+		CBReleaseObject(self->validator);
+		free(self->dataDir);
+		CBReleaseObject(self->addressStore);
+		CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not load the validator for the BEFullNode.");
+		return false;
+	}
+	// Keep the merkle trees of recent blocks for merkle branches. The node works without them if the cache cannot be created.
+	self->validator->merkleCache = BENewMerkleCache(onErrorReceived);
+	// Create the block queue and start the validator thread.
+	self->blockQueueStart = 0;
+	self->blockQueueLength = 0;
+	self->busy = false;
+	self->droppedBlocks = 0;
+	self->droppedBlockListLength = 0;
+	self->transactionQueueStart = 0;
+	self->transactionQueueLength = 0;
+	self->droppedTransactions = 0;
+	self->stopValidator = false;
+	self->onBlockProcessed = NULL;
+	self->onTransactionProcessed = NULL;
+	self->onBusyChanged = NULL;
+	self->onRequestBlock = NULL;
+	memset(&self->compactBlockStats, 0, sizeof(self->compactBlockStats));
+	if (pthread_mutex_init(&self->queueLock, NULL)) {
+		CBReleaseObject(self->validator);
+		free(self->dataDir);
+		CBReleaseObject(self->addressStore);
+		CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the queue lock in BEInitFullNode.");
+		return false;
+	}
+	if (pthread_cond_init(&self->queueCond, NULL)) {
+		pthread_mutex_destroy(&self->queueLock);
+		CBReleaseObject(self->validator);
+		free(self->dataDir);
+		CBReleaseObject(self->addressStore);
+		CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the queue condition in BEInitFullNode.");
+		return false;
+	}
+	if (pthread_create(&self->validatorThread, NULL, BEFullNodeValidatorThread, self)) {
+		pthread_cond_destroy(&self->queueCond);
+		pthread_mutex_destroy(&self->queueLock);
+		CBReleaseObject(self->validator);
+		free(self->dataDir);
+		CBReleaseObject(self->addressStore);
+		CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not start the validator thread in BEInitFullNode.");
+		return false;
+	}
+	// Side branches are validated while the validator thread waits for blocks. Without it reorganisations are slower but still done.
+	BEFullValidatorStartBackgroundValidation(self->validator);
+	CBGetNetworkCommunicator(self)->onMessageReceived = BEFullNodeOnMessageReceived;
 	return true;
 }
 
 //  Destructor
 
-void BEFreeFullNode(void * self){
-	fclose(BEGetFullNode(self)->addressFile);
+void BEFreeFullNode(void * vself){
+	BEFullNode * self = vself;
+	// Stop the validator thread once it has processed the current block.
+	pthread_mutex_lock(&self->queueLock);
+	self->stopValidator = true;
+	pthread_cond_signal(&self->queueCond);
+	pthread_mutex_unlock(&self->queueLock);
+	pthread_join(self->validatorThread, NULL);
+	// Release the blocks and transactions which were not processed.
+	for (uint16_t x = 0; x < self->blockQueueLength; x++) {
+		BEQueuedBlock * queued = self->blockQueue + (self->blockQueueStart + x) % BE_BLOCK_QUEUE_SIZE;
+		CBReleaseObject(queued->block);
+		if (queued->peer)
+			CBReleaseObject(queued->peer);
+	}
+	for (uint16_t x = 0; x < self->droppedBlockListLength; x++)
+		CBReleaseObject(self->droppedBlockList[x].peer);
+	for (uint16_t x = 0; x < self->transactionQueueLength; x++) {
+		BEQueuedTransaction * queued = self->transactionQueue + (self->transactionQueueStart + x) % BE_TRANSACTION_QUEUE_SIZE;
+		CBReleaseObject(queued->tx);
+		if (queued->peer)
+			CBReleaseObject(queued->peer);
+	}
+	pthread_cond_destroy(&self->queueCond);
+	pthread_mutex_destroy(&self->queueLock);
+	CBReleaseObject(self->validator);
+	free(self->dataDir);
+	BEFullNodeSaveAddresses(self);
+	CBReleaseObject(self->addressStore);
 	CBReleaseObject(CBGetNetworkCommunicator(self)->addresses);
 	CBFreeNetworkCommunicator(self);
 }
 
 //  Functions
 
+bool BEFullNodeCompactBlockComplete(BEFullNode * self, BECompactBlock * compact, CBNode * peer, uint64_t now){
+	CBBlock * block = BECompactBlockGetBlock(compact);
+	BECompactBlockStatsRecord(&self->compactBlockStats, compact, block, now);
+	if (NOT block)
+		return false;
+	// The block is validated on the validator thread like any other block.
+	bool queued = BEFullNodeQueueBlock(self, block, peer);
+	CBReleaseObject(block);
+	return queued;
+}
 void BEFullNodeOnBadTime(void * self){
-	
+	(void)self;
+}
+CBOnMessageReceivedAction BEFullNodeOnMessageReceived(void * vself, void * vpeer){
+	BEFullNode * self = vself;
+	CBNode * peer = vpeer;
+	if (peer->receive->type == CB_MESSAGE_TYPE_BLOCK)
+		// A block dropped because the queue is full is given to onRequestBlock once the node is not busy.
+		BEFullNodeQueueBlock(self, CBGetBlock(peer->receive), peer);
+	else if (peer->receive->type == CB_MESSAGE_TYPE_TX)
+		BEFullNodeQueueTransaction(self, CBGetTransaction(peer->receive), peer);
+	else if (peer->receive->type == CB_MESSAGE_TYPE_ADDR)
+		BEFullNodeStoreAddresses(self, CBGetAddressBroadcast(peer->receive));
+	return CB_MESSAGE_ACTION_CONTINUE;
+}
+bool BEFullNodeQueueBlock(BEFullNode * self, CBBlock * block, CBNode * peer){
+	pthread_mutex_lock(&self->queueLock);
+	if (self->blockQueueLength == BE_BLOCK_QUEUE_SIZE) {
+		self->droppedBlocks++;
+		if (peer && self->droppedBlockListLength < BE_DROPPED_BLOCK_LIST_SIZE) {
+			// Remember the block so that it is requested again once the node is not busy.
+			BEDroppedBlock * dropped = self->droppedBlockList + self->droppedBlockListLength++;
+			memcpy(dropped->hash, CBBlockGetHash(block), 32);
+			CBRetainObject(peer);
+			dropped->peer = peer;
+		}
+		pthread_mutex_unlock(&self->queueLock);
+		return false;
+	}
+	BEQueuedBlock * queued = self->blockQueue + (self->blockQueueStart + self->blockQueueLength++) % BE_BLOCK_QUEUE_SIZE;
+	CBRetainObject(block);
+	queued->block = block;
+	if (peer)
+		CBRetainObject(peer);
+	queued->peer = peer;
+	bool becameBusy = self->blockQueueLength == BE_BLOCK_QUEUE_SIZE && NOT self->busy;
+	if (becameBusy)
+		self->busy = true;
+	pthread_cond_signal(&self->queueCond);
+	pthread_mutex_unlock(&self->queueLock);
+	// Tell the node to stop requesting blocks until the validator has caught up. This is done without the lock, so that the callback can queue blocks.
+	if (becameBusy && self->onBusyChanged)
+		self->onBusyChanged(self, true);
+	return true;
+}
+bool BEFullNodeQueueTransaction(BEFullNode * self, CBTransaction * tx, CBNode * peer){
+	pthread_mutex_lock(&self->queueLock);
+	if (self->transactionQueueLength == BE_TRANSACTION_QUEUE_SIZE) {
+		self->droppedTransactions++;
+		pthread_mutex_unlock(&self->queueLock);
+		return false;
+	}
+	BEQueuedTransaction * queued = self->transactionQueue + (self->transactionQueueStart + self->transactionQueueLength++) % BE_TRANSACTION_QUEUE_SIZE;
+	CBRetainObject(tx);
+	queued->tx = tx;
+	if (peer)
+		CBRetainObject(peer);
+	queued->peer = peer;
+	pthread_cond_signal(&self->queueCond);
+	pthread_mutex_unlock(&self->queueLock);
+	return true;
+}
+BECompactBlockStatus BEFullNodeReconstructCompactBlock(BEFullNode * self, BECompactBlock * compact){
+	CBTransaction ** transactions;
+	uint32_t numTransactions = BEMempoolGetTransactions(self->validator->mempool, &transactions);
+	BECompactBlockStatus status = BECompactBlockReconstruct(compact, transactions, numTransactions);
+	for (uint32_t x = 0; x < numTransactions; x++)
+		CBReleaseObject(transactions[x]);
+	free(transactions);
+	return status;
+}
+void BEFullNodeRequestDroppedBlocks(BEFullNode * self){
+	// Take the list under the lock, so that blocks can be dropped again while the blocks are requested.
+	BEDroppedBlock dropped[BE_DROPPED_BLOCK_LIST_SIZE];
+	pthread_mutex_lock(&self->queueLock);
+	uint16_t numDropped = self->droppedBlockListLength;
+	memcpy(dropped, self->droppedBlockList, numDropped * sizeof(*dropped));
+	self->droppedBlockListLength = 0;
+	pthread_mutex_unlock(&self->queueLock);
+	for (uint16_t x = 0; x < numDropped; x++) {
+		if (self->onRequestBlock)
+			self->onRequestBlock(self, dropped[x].peer, dropped[x].hash);
+		CBReleaseObject(dropped[x].peer);
+	}
+}
+bool BEFullNodeSaveAddresses(BEFullNode * self){
+	return BEAddressStoreSave(self->addressStore);
+}
+void BEFullNodeSeedAddresses(BEFullNode * self){
+	// Take addresses from random places in the store. An address found twice is ignored by the address manager.
+	uint64_t random = (uint64_t)time(NULL) << 32 ^ (uint64_t)getpid();
+	BEAddress address;
+	for (uint8_t x = 0; x < BE_ADDRESS_SEED_COUNT; x++) {
+		random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+		if (NOT BEAddressStoreGetRandom(self->addressStore, random >> 16, &address))
+			break;
+		CBByteArray * ip = CBNewByteArrayWithDataCopy(address.ip, 16, self->addressStore->onErrorReceived);
+		if (NOT ip)
+			break;
+		CBNetworkAddress * netAddress = CBNewNetworkAddress(address.lastSeen, ip, address.port, address.services, self->addressStore->onErrorReceived);
+		CBReleaseObject(ip);
+		if (NOT netAddress)
+			break;
+		// The address manager takes the reference.
+		CBAddressManagerTakeAddress(CBGetNetworkCommunicator(self)->addresses, netAddress);
+	}
+}
+void BEFullNodeStoreAddresses(BEFullNode * self, CBAddressBroadcast * broadcast){
+	uint32_t now = (uint32_t)CBNetworkCommunicatorGetNetworkTime(CBGetNetworkCommunicator(self));
+	for (uint8_t x = 0; x < broadcast->addrNum; x++) {
+		CBNetworkAddress * netAddress = broadcast->addresses[x];
+		if (netAddress->ip->length != 16)
+			continue;
+		BEAddress address;
+		memcpy(address.ip, CBByteArrayGetData(netAddress->ip), 16);
+		address.port = netAddress->port;
+		address.services = netAddress->services;
+		// Addresses without a time or with a time in the future are taken as seen now.
+		address.lastSeen = broadcast->timeStamps && netAddress->score < now ? netAddress->score : now;
+		address.attempts = 0;
+		address.flags = 0;
+		BEAddressStoreAdd(self->addressStore, &address, now);
+	}
+}
+void * BEFullNodeValidatorThread(void * vself){
+	BEFullNode * self = vself;
+	pthread_mutex_lock(&self->queueLock);
+	for (;;) {
+		while (NOT self->blockQueueLength && NOT self->transactionQueueLength && NOT self->stopValidator)
+			pthread_cond_wait(&self->queueCond, &self->queueLock);
+		if (self->stopValidator)
+			break;
+		if (NOT self->blockQueueLength) {
+			// Add a transaction to the pool when there are no blocks waiting.
+			BEQueuedTransaction queued = self->transactionQueue[self->transactionQueueStart];
+			self->transactionQueueStart = (self->transactionQueueStart + 1) % BE_TRANSACTION_QUEUE_SIZE;
+			self->transactionQueueLength--;
+			pthread_mutex_unlock(&self->queueLock);
+			BEMempoolStatus status = BEFullValidatorAcceptTransaction(self->validator, queued.tx, CBNetworkCommunicatorGetNetworkTime(CBGetNetworkCommunicator(self)));
+			if (self->onTransactionProcessed)
+				self->onTransactionProcessed(self, queued.tx, queued.peer, status);
+			CBReleaseObject(queued.tx);
+			if (queued.peer)
+				CBReleaseObject(queued.peer);
+			pthread_mutex_lock(&self->queueLock);
+			continue;
+		}
+		BEQueuedBlock queued = self->blockQueue[self->blockQueueStart];
+		self->blockQueueStart = (self->blockQueueStart + 1) % BE_BLOCK_QUEUE_SIZE;
+		self->blockQueueLength--;
+		bool resumed = self->busy && self->blockQueueLength < BE_BLOCK_QUEUE_RESUME;
+		if (resumed)
+			self->busy = false;
+		// Process the block without the queue lock, so that blocks can be queued meanwhile.
+		pthread_mutex_unlock(&self->queueLock);
+		if (resumed) {
+			// Blocks can be requested again, starting with the ones which were dropped.
+			if (self->onBusyChanged)
+				self->onBusyChanged(self, false);
+			BEFullNodeRequestDroppedBlocks(self);
+		}
+		BEBlockStatus status = BEFullValidatorProcessBlock(self->validator, queued.block, CBNetworkCommunicatorGetNetworkTime(CBGetNetworkCommunicator(self)));
+		if (self->onBlockProcessed)
+			self->onBlockProcessed(self, queued.block, queued.peer, status);
+		CBReleaseObject(queued.block);
+		if (queued.peer)
+			CBReleaseObject(queued.peer);
+		pthread_mutex_lock(&self->queueLock);
+	}
+	pthread_mutex_unlock(&self->queueLock);
+	return NULL;
 }
@@ -29,17 +29,67 @@
 #define BEFULLNODEH
 
 #include "BEConstants.h"
+#include "BEAddressStore.h"
+#include "BECompactBlock.h"
+#include "BEFullValidator.h"
 #include "CBNetworkCommunicator.h"
+#include <pthread.h>
 #include <pwd.h>
 #include <unistd.h>
 #include <stdio.h>
 
+/**
+ @brief A received block waiting to be processed.
+ */
+typedef struct{
+	CBBlock * block; /**< The block, which is retained. */
+	CBNode * peer; /**< The peer the block was received from, which is retained. */
+} BEQueuedBlock;
+
+/**
+ @brief A block dropped because the queue was full, which is requested again once the node is not busy.
+ */
+typedef struct{
+	uint8_t hash[32]; /**< The hash of the block. */
+	CBNode * peer; /**< The peer the block was received from, which is retained. */
+} BEDroppedBlock;
+
+/**
+ @brief A received transaction waiting to be added to the transaction pool.
+ */
+typedef struct{
+	CBTransaction * tx; /**< The transaction, which is retained. */
+	CBNode * peer; /**< The peer the transaction was received from, which is retained. */
+} BEQueuedTransaction;
+
 /**
  @brief Structure for BEFullNode objects. @see BEFullNode.h
  */
 typedef struct{
 	CBNetworkCommunicator base;
-	FILE * addressFile;
+	BEAddressStore * addressStore; /**< The stored addresses of peers. Only used on the network thread. */
+	char * dataDir; /**< Data directory path */
+	BEFullValidator * validator; /**< The validator for the received blocks and transactions. Only used by the validator thread once it is started, except for the transaction pool, which has its own lock. */
+	BEQueuedBlock blockQueue[BE_BLOCK_QUEUE_SIZE]; /**< Ring buffer of received blocks waiting to be processed. */
+	uint16_t blockQueueStart; /**< The index of the oldest block in the queue. */
+	uint16_t blockQueueLength; /**< The number of blocks in the queue. */
+	bool busy; /**< True from when the queue becomes full until it has emptied to BE_BLOCK_QUEUE_RESUME blocks. */
+	uint64_t droppedBlocks; /**< The number of blocks dropped because the queue was full. */
+	BEDroppedBlock droppedBlockList[BE_DROPPED_BLOCK_LIST_SIZE]; /**< The dropped blocks to request again once the node is not busy. Blocks dropped once this is full are only counted. */
+	uint16_t droppedBlockListLength; /**< The number of dropped blocks in droppedBlockList. */
+	BEQueuedTransaction transactionQueue[BE_TRANSACTION_QUEUE_SIZE]; /**< Ring buffer of received transactions waiting to be added to the transaction pool. */
+	uint16_t transactionQueueStart; /**< The index of the oldest transaction in the queue. */
+	uint16_t transactionQueueLength; /**< The number of transactions in the queue. */
+	uint64_t droppedTransactions; /**< The number of transactions dropped because the transaction queue was full. */
+	pthread_mutex_t queueLock; /**< Protects the queues, busy, droppedBlocks, the dropped block list, droppedTransactions and stopValidator. */
+	pthread_cond_t queueCond; /**< Signalled when a block or transaction is queued or the validator thread should stop. */
+	pthread_t validatorThread; /**< The thread processing the queued blocks. */
+	bool stopValidator; /**< Set to stop the validator thread. */
+	BECompactBlockStats compactBlockStats; /**< The reconstruction hit rate and latency of compact blocks, updated by BEFullNodeCompactBlockComplete on the network thread. */
+	void (*onBlockProcessed)(void * self, CBBlock * block, CBNode * peer, BEBlockStatus status); /**< Called from the validator thread when a block has been processed, or NULL. */
+	void (*onTransactionProcessed)(void * self, CBTransaction * tx, CBNode * peer, BEMempoolStatus status); /**< Called from the validator thread when a transaction has been processed, or NULL. Transactions which were added should be announced to the other peers. */
+	void (*onBusyChanged)(void * self, bool busy); /**< Called when the node becomes busy or stops being busy, or NULL. It is called without the queue lock held, from the thread which queued or took the block, so it can queue blocks. Blocks should not be requested from peers while the node is busy. */
+	void (*onRequestBlock)(void * self, CBNode * peer, uint8_t * hash); /**< Called from the validator thread for each dropped block once the node is not busy, after onBusyChanged, or NULL. The block with the 32 byte hash should be requested again from the peer. */
 } BEFullNode;
 
 /**
@@ -56,24 +106,91 @@ BEFullNode * BENewFullNode(void (*onErrorReceived)(CBError error,char *,...));
 BEFullNode * BEGetFullNode(void * self);
 
 /**
- @brief Initialises a BEFullNode object
+ @brief Initialises a BEFullNode object, loading the validator and starting the validator thread.
  @param self The BEFullNode object to initialise
  @returns true on success, false on failure.
  */
 bool BEInitFullNode(BEFullNode * self, void (*onErrorReceived)(CBError error,char *,...));
 
 /**
- @brief Frees a BEFullNode object.
+ @brief Frees a BEFullNode object, stopping the validator thread. Blocks and transactions which have not been processed are released.
  @param self The BEFullNode object to free.
  */
 void BEFreeFullNode(void * self);
 
 // Functions
 
+/**
+ @brief Queues a compact block once no transactions are missing, and records it in compactBlockStats. This should be called when BECompactBlockReconstruct or BECompactBlockAddTransactions gives BE_COMPACT_BLOCK_COMPLETE.
+ @param self The BEFullNode object.
+ @param compact The compact block.
+ @param peer The peer the compact block was received from.
+ @param now The current time in milliseconds.
+ @returns true if the block was queued and false if the merkle root does not match or the queue is full, in which case the full block should be requested.
+ */
+bool BEFullNodeCompactBlockComplete(BEFullNode * self, BECompactBlock * compact, CBNode * peer, uint64_t now);
 /**
  @brief Handles an onBadTime event.
  @param self The BEFullNode object.
  */
 void BEFullNodeOnBadTime(void * self);
+/**
+ @brief Handles a message received from a peer. Blocks and transactions are queued for the validator thread and addresses are stored.
+ @param self The BEFullNode object.
+ @param peer The CBNode which sent the message.
+ @returns CB_MESSAGE_ACTION_CONTINUE
+ */
+CBOnMessageReceivedAction BEFullNodeOnMessageReceived(void * self, void * peer);
+/**
+ @brief Queues a block to be processed by the validator thread. This does not wait for the disk or for validation, so it can be called from the network thread.
+ @param self The BEFullNode object.
+ @param block The block, which is retained until it is processed.
+ @param peer The peer the block was received from, which is retained until the block is processed, or NULL.
+ @returns true if the block was queued and false if the queue is full and the block was dropped. A dropped block received from a peer is added to droppedBlockList if there is room.
+ */
+bool BEFullNodeQueueBlock(BEFullNode * self, CBBlock * block, CBNode * peer);
+/**
+ @brief Queues a transaction to be added to the transaction pool by the validator thread.
+ @param self The BEFullNode object.
+ @param tx The transaction, which is retained until it is processed.
+ @param peer The peer the transaction was received from, which is retained until the transaction is processed, or NULL.
+ @returns true if the transaction was queued and false if the transaction queue is full and the transaction was dropped.
+ */
+bool BEFullNodeQueueTransaction(BEFullNode * self, CBTransaction * tx, CBNode * peer);
+/**
+ @brief Fills in the missing transactions of a received compact block from the transaction pool. This does not wait for the validator, so it can be called from the network thread.
+ @param self The BEFullNode object.
+ @param compact The compact block.
+ @returns The result of BECompactBlockReconstruct.
+ */
+BECompactBlockStatus BEFullNodeReconstructCompactBlock(BEFullNode * self, BECompactBlock * compact);
+/**
+ @brief Gives each block in droppedBlockList to onRequestBlock and empties the list. This is called by the validator thread once the node is not busy.
+ @param self The BEFullNode object.
+ */
+void BEFullNodeRequestDroppedBlocks(BEFullNode * self);
+/**
+ @brief Saves the changes to the stored addresses.
+ @param self The BEFullNode object.
+ @returns true on success and false on failure.
+ */
+bool BEFullNodeSaveAddresses(BEFullNode * self);
+/**
+ @brief Gives the address manager BE_ADDRESS_SEED_COUNT addresses from random places in the address store, or fewer if there are not enough.
+ @param self The BEFullNode object.
+ */
+void BEFullNodeSeedAddresses(BEFullNode * self);
+/**
+ @brief Adds the addresses received in an addr message to the address store.
+ @param self The BEFullNode object.
+ @param broadcast The received addresses.
+ */
+void BEFullNodeStoreAddresses(BEFullNode * self, CBAddressBroadcast * broadcast);
+/**
+ @brief Processes the queued blocks and transactions until stopped. This is the function of the validator thread.
+ @param self The BEFullNode object.
+ @returns NULL
+ */
+void * BEFullNodeValidatorThread(void * self);
 
 #endif
@@ -51,73 +51,204 @@ bool BEInitFullValidator(BEFullValidator * self, char * dataDir, void (*onErrorR
 	if (NOT CBInitObject(CBGetObject(self)))
 		return false;
 	self->onErrorReceived = onErrorReceived;
-	// Get maximum file size
-	struct rlimit fileLim;
-	if(getrlimit(RLIMIT_FSIZE,&fileLim)){
-		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not get RLIMIT_FSIZE limits.");
+	self->dataDir = malloc(strlen(dataDir) + 1);
+	if (NOT self->dataDir) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the data directory in BEInitFullValidator.",strlen(dataDir) + 1);
 		return false;
 	}
-	self->fileSizeLimit = fileLim.rlim_cur;
-	// Get the maximum number of allowed files
-	if(getrlimit(RLIMIT_NOFILE,&fileLim)){
-		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not get RLIMIT_NOFILE limits.");
+	strcpy(self->dataDir, dataDir);
+	self->blockStore = BENewBlockStore(self->dataDir, BE_MAX_OPEN_BLOCK_FILES, onErrorReceived);
+	if (NOT self->blockStore) {
+		free(self->dataDir);
 		return false;
 	}
-	// Ensure highest limit. If the OS does not support a high limit, the program may fail. ??? Should code be introduced to close files when limits have been reached? I do not think so because the number of open files is reasonably small and file limits should be increased on the OS size if rlim_max is too small. If it cannot be increased to a reasonable level then the operating system is simply shit.
-	fileLim.rlim_cur = BE_MIN(OPEN_MAX,fileLim.rlim_max); // OPEN_MAX needed for OSX. Surely this is against the POSIX standards? Apple's fault I guess.
-	if(setrlimit(RLIMIT_NOFILE,&fileLim)){
-		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not set RLIMIT_NOFILE limit.");
+	self->orphanPool = BENewOrphanPool(self->dataDir, BE_ORPHAN_POOL_SIZE, BE_ORPHAN_MAX_AGE, onErrorReceived);
+	if (NOT self->orphanPool) {
+		CBReleaseObject(self->blockStore);
+		free(self->dataDir);
 		return false;
 	}
-	self->dataDir = malloc(strlen(dataDir) + 1);
-	if (NOT self->dataDir) {
-		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the data directory in BEInitFullValidator.",strlen(dataDir) + 1);
+	self->mempool = BENewMempool(BE_MEMPOOL_MAX_SIZE, onErrorReceived);
+	if (NOT self->mempool) {
+		CBReleaseObject(self->orphanPool);
+		CBReleaseObject(self->blockStore);
+		free(self->dataDir);
 		return false;
 	}
-	strcpy(self->dataDir, dataDir);
+	self->filterIndex = BENewFilterIndex(self->dataDir, onErrorReceived);
+	if (NOT self->filterIndex) {
+		CBReleaseObject(self->mempool);
+		CBReleaseObject(self->orphanPool);
+		CBReleaseObject(self->blockStore);
+		free(self->dataDir);
+		return false;
+	}
+	if (pthread_mutex_init(&self->lock, NULL)) {
+		CBReleaseObject(self->filterIndex);
+		CBReleaseObject(self->mempool);
+		CBReleaseObject(self->orphanPool);
+		CBReleaseObject(self->blockStore);
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the lock in BEInitFullValidator.");
+		return false;
+	}
+	if (pthread_cond_init(&self->backgroundCond, NULL)) {
+		pthread_mutex_destroy(&self->lock);
+		CBReleaseObject(self->filterIndex);
+		CBReleaseObject(self->mempool);
+		CBReleaseObject(self->orphanPool);
+		CBReleaseObject(self->blockStore);
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the background condition in BEInitFullValidator.");
+		return false;
+	}
+	self->backgroundRunning = false;
+	self->stopBackground = false;
+	self->backgroundValidated = 0;
 	self->validatorFile = NULL;
+	self->pruneTarget = 0;
+	self->pruneDepth = 0;
+	self->txIndex = NULL;
+	self->merkleCache = NULL;
+	self->fileOutputs = NULL;
+	self->fileOutputsLength = 0;
+	self->fileOutputsCounted = false;
+	self->prunedAtNumFiles = 0;
+	memset(self->invalidBlocks, 0, sizeof(self->invalidBlocks));
+	uint8_t key[16];
+	BESipHashRandomKey(key);
+	self->invalidKey0 = BESipHashReadInt64(key);
+	self->invalidKey1 = BESipHashReadInt64(key + 8);
+	self->rejectedKnownInvalid = 0;
+	self->rejectedPreCheck = 0;
+	for (uint8_t x = 0; x < BE_MAX_BRANCH_CACHE; x++) {
+		self->branches[x].numRefs = 0;
+		self->branches[x].references = NULL;
+		self->branches[x].referenceTable = NULL;
+		self->branches[x].numUnspentOutputs = 0;
+		self->branches[x].unspentOutputs = NULL;
+		self->branches[x].numSpentOutputs = 0;
+		self->branches[x].spentOutputs = NULL;
+		self->branches[x].work.data = NULL;
+		self->branches[x].map = NULL;
+		self->branches[x].loaded = BE_BRANCH_NOT_LOADED;
+		self->branches[x].invalid = false;
+	}
 	return true;
 }
 
 //  Destructor
 
-void BEFreeFullValidator(void * self){
+void BEFreeFullValidator(void * vself){
+	BEFullValidator * self = vself;
+	BEFullValidatorStopBackgroundValidation(self);
+	pthread_cond_destroy(&self->backgroundCond);
+	pthread_mutex_destroy(&self->lock);
+	for (uint8_t x = 0; x < BE_MAX_BRANCH_CACHE; x++) {
+		if (self->branches[x].map)
+			munmap(self->branches[x].map, self->branches[x].mapSize);
+		else{
+			free(self->branches[x].references);
+			free(self->branches[x].referenceTable);
+			free(self->branches[x].unspentOutputs);
+			free(self->branches[x].spentOutputs);
+		}
+		free(self->branches[x].work.data);
+	}
+	CBReleaseObject(self->blockStore);
+	CBReleaseObject(self->orphanPool);
+	CBReleaseObject(self->mempool);
+	CBReleaseObject(self->filterIndex);
+	if (self->txIndex)
+		CBReleaseObject(self->txIndex);
+	if (self->merkleCache)
+		CBReleaseObject(self->merkleCache);
+	free(self->fileOutputs);
 	CBFreeObject(self);
 }
 
 //  Functions
 
-bool BEFullValidatorAddBlockToBranch(BEFullValidator * self, uint8_t branch, CBBlock * block, CBBigInt work){
-	// Save block. First find first block file with space.
-	uint16_t fileIndex = 0;
-	uint64_t size;
-	for (; fileIndex < self->branches[branch].numBlockFiles; fileIndex++) {
-		// Use stat.h for fast information
-		char blockFile[strlen(self->dataDir) + 22];
-		sprintf(blockFile, "%sblocks%u-%u.dat",self->dataDir, branch, fileIndex);
-		struct stat st;
-		if(stat(blockFile, &st))
-			return false;
-		size = st.st_size;
-		if (CBGetMessage(block)->bytes->length + 4 <= self->fileSizeLimit - size)
-			// Enough room in this file
+BEMempoolStatus BEFullValidatorAcceptTransaction(BEFullValidator * self, CBTransaction * tx, uint64_t networkTime){
+	if (CBTransactionIsCoinBase(tx))
+		return BE_MEMPOOL_INVALID;
+	if (BEMempoolContains(self->mempool, CBTransactionGetHash(tx)))
+		return BE_MEMPOOL_DUPLICATE;
+	// Do the basic validation
+	uint64_t outputValue;
+	bool err;
+	CBPrevOut * spentOutputs = CBTransactionValidateBasic(tx, false, &outputValue, &err);
+	if (err)
+		return BE_MEMPOOL_ERROR;
+	if (NOT spentOutputs)
+		return BE_MEMPOOL_INVALID;
+	free(spentOutputs);
+	pthread_mutex_lock(&self->lock);
+	// The transaction is validated for the next block on the main branch.
+	uint8_t branch = self->mainBranch;
+	uint32_t height = self->branches[branch].startHeight + self->branches[branch].numRefs;
+	if (NOT CBTransactionIsFinal(tx, networkTime, height)) {
+		pthread_mutex_unlock(&self->lock);
+		return BE_MEMPOOL_INVALID;
+	}
+	BEPrevOutMap prevOuts;
+	if (BEFullValidatorPrefetchTransactionPrevOuts(self, branch, &tx, 1, &prevOuts) != BE_BLOCK_VALIDATION_OK) {
+		pthread_mutex_unlock(&self->lock);
+		return BE_MEMPOOL_ERROR;
+	}
+	BEMempoolStatus status = BE_MEMPOOL_ADDED;
+	uint64_t inputValue = 0;
+	uint32_t sigOps = CBTransactionGetSigOps(tx);
+	for (uint32_t x = 0; x < tx->inputNum && status == BE_MEMPOOL_ADDED; x++) {
+		CBPrevOut * prevOut = &tx->inputs[x]->prevOut;
+		if (BEMempoolIsSpent(self->mempool, CBByteArrayGetData(prevOut->hash), prevOut->index)) {
+			status = BE_MEMPOOL_CONFLICT;
 			break;
+		}
+		// The output is either unspent in the main branch or an output of a transaction in the pool.
+		CBTransactionOutput * output;
+		BEPrefetchedOutput * outRef = BEFullValidatorFindPrefetchedOutput(&prevOuts, CBByteArrayGetData(prevOut->hash), prevOut->index);
+		if (outRef) {
+			if (outRef->coinbase && height - outRef->height < CB_COINBASE_MATURITY) {
+				status = BE_MEMPOOL_INVALID;
+				break;
+			}
+			output = outRef->output;
+			CBRetainObject(output);
+		}else{
+			output = BEMempoolGetOutput(self->mempool, CBByteArrayGetData(prevOut->hash), prevOut->index);
+			if (NOT output) {
+				status = BE_MEMPOOL_MISSING_INPUTS;
+				break;
+			}
+		}
+		BEBlockValidationResult res = BEFullValidatorVerifyInputScript(self, tx, x, output, &sigOps);
+		inputValue += output->value;
+		CBReleaseObject(output);
+		if (res == BE_BLOCK_VALIDATION_BAD)
+			status = BE_MEMPOOL_INVALID;
+		else if (res == BE_BLOCK_VALIDATION_ERR)
+			status = BE_MEMPOOL_ERROR;
 	}
-	FILE * fp = BEFullValidatorGetBlockFile(self, fileIndex, branch);
-	if (NOT fp)
-		return false;
-	// Write block to file
-	fseek(fp, size, SEEK_SET);
-	// Write length
-	uint8_t len[4];
-	len[0] = CBGetMessage(block)->bytes->length;
-	len[1] = CBGetMessage(block)->bytes->length >> 8;
-	len[2] = CBGetMessage(block)->bytes->length >> 16;
-	len[3] = CBGetMessage(block)->bytes->length >> 24;
-	if (fwrite(len, 1, 4, fp) != 4)
+	BEFullValidatorFreePrevOutMap(&prevOuts);
+	if (status == BE_MEMPOOL_ADDED && inputValue < outputValue)
+		status = BE_MEMPOOL_INVALID;
+	if (status == BE_MEMPOOL_ADDED)
+		status = BEMempoolAdd(self->mempool, tx, inputValue - outputValue, sigOps - CBTransactionGetSigOps(tx), networkTime);
+	pthread_mutex_unlock(&self->lock);
+	return status;
+}
+void BEFullValidatorAddInvalidBlock(BEFullValidator * self, uint8_t * hash){
+	memcpy(self->invalidBlocks[BEFullValidatorGetInvalidBlockSlot(self, hash)], hash, 32);
+}
+bool BEFullValidatorAddBlockToBranch(BEFullValidator * self, uint8_t branch, CBBlock * block, CBBigInt work, BEPrevOutMap * prevOuts){
+	// Save block. If the block is already stored, such as when it was in a branch which was removed, the stored block is used. Blocks are not removed on failure as the stored block is found by its hash if the block is received again.
+	BEFileReference blockRef;
+	bool added;
+	if (NOT BEBlockStoreAddBlock(self->blockStore, CBBlockGetHash(block), CBByteArrayGetData(CBGetMessage(block)->bytes), CBGetMessage(block)->bytes->length, &blockRef, &added))
 		return false;
-	// Write block data
-	if (fwrite(CBByteArrayGetData(CBGetMessage(block)->bytes), 1, CBGetMessage(block)->bytes->length, fp) != CBGetMessage(block)->bytes->length)
+	// The arrays are reallocated, so they cannot stay in the mapping of the branch file.
+	if (NOT BEFullValidatorLoadBranch(self, branch, BE_BRANCH_ALL) || NOT BEFullValidatorUnmapBranch(self, branch))
 		return false;
 	// Modify validator information. Insert new reference. This involves adding the reference to the end of the refence data and inserting an index into a lookup table.
 	bool found;
@@ -130,7 +261,6 @@ bool BEFullValidatorAddBlockToBranch(BEFullValidator * self, uint8_t branch, CBB
 	if (NOT temp) {
 		// Failure, reset data
 		self->branches[branch].numRefs--;
-		ftruncate(fileno(fp), size);
 		return false;
 	}
 	self->branches[branch].references = temp;
@@ -139,27 +269,15 @@ bool BEFullValidatorAddBlockToBranch(BEFullValidator * self, uint8_t branch, CBB
 	if (NOT temp2) {
 		// Failure, reset data
 		self->branches[branch].numRefs--;
-		ftruncate(fileno(fp), size);
 		return false;
 	}
 	self->branches[branch].referenceTable = temp2;
-	// Before we insert the reference, adjust size of unspent output information and make sure that is OK.
-	uint32_t temp3 = self->branches[branch].numUnspentOutputs;
-	for (uint32_t x = 0; x < block->transactionNum; x++){
-		// For each input, an output has been spent but only do this for non-coinbase transactions sicne coinbase transactions make new coins.
-		if (x)
-			temp3 -= block->transactions[x]->inputNum;
-		// For each output, we have another unspent output.
-		temp3 += block->transactions[x]->outputNum;
-	}
-	// Reallocate for new size
-	BEOutputReference * temp4 = realloc(self->branches[branch].unspentOutputs, temp3 * sizeof(*self->branches[branch].unspentOutputs));
-	if (NOT temp4) {
+	// The unspent outputs are kept up to the last validated block, so they are only updated for validated blocks. This is done before the reference is inserted so that nothing needs to be undone on failure.
+	if (prevOuts && NOT BEFullValidatorUpdateUnspentOutputs(self, branch, block, blockRef, self->branches[branch].startHeight + refIndex)) {
 		// Failure, reset data
-		ftruncate(fileno(fp), size);
+		self->branches[branch].numRefs--;
 		return false;
 	}
-	self->branches[branch].unspentOutputs = temp4;
 	// Now insert reference index into lookup table
 	if (indexPos < self->branches[branch].numRefs - 1)
 		// Move references up
@@ -172,124 +290,124 @@ bool BEFullValidatorAddBlockToBranch(BEFullValidator * self, uint8_t branch, CBB
 	free(self->branches[branch].work.data);
 	self->branches[branch].work = work;
 	// Insert block data
-	self->branches[branch].references[refIndex].ref.fileID = fileIndex;
-	self->branches[branch].references[refIndex].ref.filePos = size;
+	self->branches[branch].references[refIndex].ref = blockRef;
 	self->branches[branch].references[refIndex].target = block->target;
 	self->branches[branch].references[refIndex].time = block->time;
-	// Update unspent outputs... Go through transactions, removing the prevOut references and adding the outputs for one transaction at a time.
-	uint32_t cursor = 80; // Cursor to find output positions.
-	uint8_t byte = CBByteArrayGetByte(CBGetMessage(block)->bytes, 80);
-	cursor += byte < 253 ? 1 : (byte == 253 ? 2 : (byte == 254 ? 4 : 8));
+	// Build the filter while the scripts of the spent outputs are in memory. Without a filter the block is validated again before its filter can be served.
+	self->branches[branch].references[refIndex].filterPos = prevOuts ? BEFullValidatorAddFilter(self, block, prevOuts) : BE_NO_FILTER;
+	return true;
+}
+void BEFullValidatorAddFileOutput(BEFullValidator * self, uint16_t fileID){
+	if (NOT self->fileOutputsCounted)
+		return;
+	if (fileID >= self->fileOutputsLength) {
+		uint32_t * temp = realloc(self->fileOutputs, sizeof(*self->fileOutputs) * (fileID + 1));
+		if (NOT temp) {
+			// Count again when next pruning.
+			self->fileOutputsCounted = false;
+			return;
+		}
+		self->fileOutputs = temp;
+		memset(self->fileOutputs + self->fileOutputsLength, 0, sizeof(*self->fileOutputs) * (fileID + 1 - self->fileOutputsLength));
+		self->fileOutputsLength = fileID + 1;
+	}
+	self->fileOutputs[fileID]++;
+}
+uint64_t BEFullValidatorAddFilter(BEFullValidator * self, CBBlock * block, BEPrevOutMap * prevOuts){
+	uint32_t maxScripts = 0;
+	for (uint32_t x = 0; x < block->transactionNum; x++)
+		maxScripts += block->transactions[x]->inputNum + block->transactions[x]->outputNum;
+	CBScript ** scripts = malloc(sizeof(*scripts) * BE_MAX(maxScripts, 1));
+	if (NOT scripts) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the filter scripts in BEFullValidatorAddFilter.",sizeof(*scripts) * maxScripts);
+		return BE_NO_FILTER;
+	}
+	uint32_t numScripts = 0;
 	for (uint32_t x = 0; x < block->transactionNum; x++) {
-		bool found;
-		cursor += 4; // Move along version number
-		// Move along input number
-		byte = CBByteArrayGetByte(CBGetMessage(block)->bytes, cursor);
-		cursor += byte < 253 ? 1 : (byte == 253 ? 2 : (byte == 254 ? 4 : 8));
-		// First remove output references than add new outputs.
-		for (uint32_t y = 0; y < block->transactions[x]->inputNum; y++) {
-			if (x) {
-				// Only remove for non-coinbase transactions
-				uint32_t ref = BEFullValidatorFindOutputReference(self->branches[branch].unspentOutputs, self->branches[branch].numUnspentOutputs, CBByteArrayGetData(block->transactions[x]->inputs[y]->prevOut.hash), block->transactions[x]->inputs[y]->prevOut.index, &found);
-				// Remove by overwrite.
-				memmove(self->branches[branch].unspentOutputs + ref, self->branches[branch].unspentOutputs + ref + 1, (self->branches[branch].numUnspentOutputs - ref - 1) * sizeof(*self->branches[branch].unspentOutputs));
-				self->branches[branch].numUnspentOutputs--;
-			}
-			// Move cursor along script varint. We look at byte data in case it is longer than needed.
-			uint8_t byte = CBByteArrayGetByte(CBGetMessage(block)->bytes, cursor);
-			cursor += byte < 253 ? 1 : (byte == 253 ? 2 : (byte == 254 ? 4 : 8));
-			// Move along script and output reference
-			cursor += block->transactions[x]->inputs[y]->scriptObject->length + 36;
-			// Move cursor along sequence
-			cursor += 4;
+		CBTransaction * tx = block->transactions[x];
+		// The scripts of the spent outputs, found as in BEFullValidatorInputValidation. The coinbase input spends nothing.
+		for (uint32_t y = 0; x && y < tx->inputNum; y++) {
+			CBPrevOut * prevOut = &tx->inputs[y]->prevOut;
+			CBTransactionOutput * output = NULL;
+			BEPrefetchedOutput * prefetched = BEFullValidatorFindPrefetchedOutput(prevOuts, CBByteArrayGetData(prevOut->hash), prevOut->index);
+			if (prefetched)
+				output = prefetched->output;
+			else for (uint32_t z = 0; z < x; z++)
+				if (NOT memcmp(CBTransactionGetHash(block->transactions[z]), CBByteArrayGetData(prevOut->hash), 32)) {
+					if (prevOut->index < block->transactions[z]->outputNum)
+						output = block->transactions[z]->outputs[prevOut->index];
+					break;
+				}
+			if (output && output->scriptObject->length)
+				scripts[numScripts++] = output->scriptObject;
 		}
-		// Move cursor past output number to first output
-		byte = CBByteArrayGetByte(CBGetMessage(block)->bytes, cursor);
-		cursor += byte < 253 ? 1 : (byte == 253 ? 2 : (byte == 254 ? 4 : 8));
-		// Now add new outputs
-		for (uint32_t y = 0; y < block->transactions[x]->outputNum; y++) {
-			uint32_t ref = BEFullValidatorFindOutputReference(self->branches[branch].unspentOutputs, self->branches[branch].numUnspentOutputs, CBTransactionGetHash(block->transactions[x]), y, &found);
-			// Insert the output information at the reference point.
-			if (self->branches[branch].numUnspentOutputs > ref)
-				// Move other references up to make room
-				memmove(self->branches[branch].unspentOutputs + ref + 1, self->branches[branch].unspentOutputs + ref, (self->branches[branch].numUnspentOutputs - ref) * sizeof(*self->branches[branch].unspentOutputs));
-			self->branches[branch].numUnspentOutputs++;
-			self->branches[branch].unspentOutputs[ref].branch = branch;
-			self->branches[branch].unspentOutputs[ref].coinbase = NOT x;
-			memcpy(self->branches[branch].unspentOutputs[ref].outputHash,CBTransactionGetHash(block->transactions[x]),32);
-			self->branches[branch].unspentOutputs[ref].outputIndex = y;
-			self->branches[branch].unspentOutputs[ref].ref.fileID = fileIndex;
-			self->branches[branch].unspentOutputs[ref].ref.filePos = cursor + size + 4; // Block cursor plus 4 for the length and the file size
-			// Move cursor past the output
-			uint8_t byte = CBByteArrayGetByte(CBGetMessage(block)->bytes, cursor);
-			cursor += byte < 253 ? 1 : (byte == 253 ? 2 : (byte == 254 ? 4 : 8));
-			cursor += 8;
+		// The output scripts, without OP_RETURN outputs which cannot be spent.
+		for (uint32_t y = 0; y < tx->outputNum; y++) {
+			CBScript * script = tx->outputs[y]->scriptObject;
+			if (script->length && CBByteArrayGetByte(script, 0) != CB_SCRIPT_OP_RETURN)
+				scripts[numScripts++] = script;
 		}
-		// Update size
-		size += 4 + cursor;
-	}
-	// Update validation file.
-	if (NOT BEFullValidatorSaveBranchValidator(self, branch)){
-		// Failure, truncate block data in case the program closes and the files are inconsistent.
-		ftruncate(fileno(fp), size);
-		return true; // Still return true as memory is updated.
 	}
-	// Flush block file
-	fflush(fp);
-	return true;
+	CBByteArray * filter = BEFilterIndexBuildFilter(CBBlockGetHash(block), scripts, numScripts, self->onErrorReceived);
+	free(scripts);
+	if (NOT filter)
+		return BE_NO_FILTER;
+	uint64_t filterPos = BEFilterIndexAddFilter(self->filterIndex, CBBlockGetHash(block), filter);
+	CBReleaseObject(filter);
+	return filterPos;
 }
-bool BEFullValidatorAddBlockToOrphans(BEFullValidator * self, CBBlock * block){
-	// Save orphan.
-	// Add to memory
-	self->orphans[self->numOrphans] = block;
-	CBRetainObject(block);
-	self->numOrphans++;
-	// Write new orphan number
-	fseek(self->validatorFile, 3, SEEK_SET);
-	if (fwrite(&self->numOrphans, 1, 1, self->validatorFile) != 1){
-		// Undo
-		CBReleaseObject(block);
-		self->numOrphans--;
-		return false;
-	}
-	// Write the block
-	for (uint8_t x = 0; x < self->numOrphans; x++)
-		fseek(self->validatorFile, CBGetMessage(self->orphans[x])->bytes->length, SEEK_CUR);
-	if (fwrite(CBByteArrayGetData(CBGetMessage(block)->bytes), 1, CBGetMessage(block)->bytes->length, self->validatorFile) != CBGetMessage(block)->bytes->length){
-		// Undo
-		CBReleaseObject(block);
-		self->numOrphans--;
-		fseek(self->validatorFile, 3, SEEK_SET);
-		fwrite(&self->numOrphans, 1, 1, self->validatorFile);
-		return false;
+void * BEFullValidatorBackgroundValidation(void * vself){
+	BEFullValidator * self = vself;
+	pthread_mutex_lock(&self->lock);
+	while (NOT self->stopBackground) {
+		// Find the side branch with the most work which has blocks to validate, as it is the most likely to become the main branch.
+		uint8_t branch = self->mainBranch;
+		for (uint8_t x = 0; x < self->numBranches; x++) {
+			if (x == self->mainBranch
+				|| self->branches[x].invalid
+				|| NOT self->branches[x].numRefs
+				|| (self->branches[x].lastValidation != BE_NO_VALIDATION && self->branches[x].lastValidation == self->branches[x].numRefs - 1))
+				continue;
+			if (branch == self->mainBranch || CBBigIntCompareToBigInt(&self->branches[x].work, &self->branches[branch].work) == CB_COMPARE_MORE_THAN)
+				branch = x;
+		}
+		if (branch == self->mainBranch) {
+			// Nothing to validate until more blocks are processed.
+			pthread_cond_wait(&self->backgroundCond, &self->lock);
+			continue;
+		}
+		bool done;
+		BEBlockValidationResult res = BEFullValidatorValidateNextBlock(self, branch, &done);
+		if (res == BE_BLOCK_VALIDATION_BAD)
+			self->branches[branch].invalid = true;
+		else if (res == BE_BLOCK_VALIDATION_ERR)
+			// Try again once more blocks are processed rather than failing over and over.
+			pthread_cond_wait(&self->backgroundCond, &self->lock);
+		else if (NOT done)
+			self->backgroundValidated++;
+		// Let blocks be processed between each validated block.
+		pthread_mutex_unlock(&self->lock);
+		sched_yield();
+		pthread_mutex_lock(&self->lock);
 	}
-	// Flush update
-	fflush(self->validatorFile);
-	return true;
+	pthread_mutex_unlock(&self->lock);
+	return NULL;
 }
-BEBlockStatus BEFullValidatorBasicBlockValidation(BEFullValidator * self, CBBlock * block, uint8_t * txHashes, uint64_t networkTime){
+BEBlockStatus BEFullValidatorBasicBlockValidation(BEFullValidator * self, CBBlock * block, uint8_t * txHashes){
 	// Get the block hash
 	uint8_t * hash = CBBlockGetHash(block);
 	// Check if duplicate.
-	for (uint8_t x = 0; x < self->numOrphans; x++)
-		if (NOT memcmp(CBBlockGetHash(self->orphans[x]), hash, 32))
-			return BE_BLOCK_STATUS_DUPLICATE;
+	if (BEOrphanPoolContains(self->orphanPool, hash))
+		return BE_BLOCK_STATUS_DUPLICATE;
 	for (uint8_t x = 0; x < self->numBranches; x++){
 		bool found;
+		if (NOT BEFullValidatorLoadBranch(self, x, BE_BRANCH_REFERENCES))
+			return BE_BLOCK_STATUS_ERROR;
 		BEFullValidatorFindBlockReference(self->branches[x].referenceTable, self->branches[x].numRefs, hash, &found);
 		if (found)
 			return BE_BLOCK_STATUS_DUPLICATE;
 	}
-	// Check block has transactions
-	if (NOT block->transactionNum)
-		return BE_BLOCK_STATUS_BAD;
-	// Check block hash against target and that it is below the maximum allowed target.
-	if (NOT CBValidateProofOfWork(hash, block->target))
-		return BE_BLOCK_STATUS_BAD;
-	// Check the block is within two hours of the network time.
-	if (block->time > networkTime + 7200)
-		return BE_BLOCK_STATUS_BAD_TIME;
-	// Calculate merkle root.
+	// The proof of work, time and number of transactions were checked by BEFullValidatorPreCheckHeader. Calculate merkle root.
 	CBCalculateMerkleRoot(txHashes, block->transactionNum);
 	// Check merkle root
 	int res = memcmp(txHashes, CBByteArrayGetData(block->merkleRoot), 32);
@@ -297,118 +415,180 @@ BEBlockStatus BEFullValidatorBasicBlockValidation(BEFullValidator * self, CBBloc
 		return BE_BLOCK_STATUS_BAD;
 	return BE_BLOCK_STATUS_CONTINUE;
 }
-BEBlockStatus BEFullValidatorBasicBlockValidationCopy(BEFullValidator * self, CBBlock * block, uint8_t * txHashes, uint64_t networkTime){
+BEBlockStatus BEFullValidatorBasicBlockValidationCopy(BEFullValidator * self, CBBlock * block, uint8_t * txHashes){
 	uint8_t * hashes = malloc(block->transactionNum * 32);
 	if (NOT hashes)
 		return BE_BLOCK_STATUS_ERROR;
 	memcpy(hashes, txHashes, block->transactionNum * 32);
-	BEBlockStatus res = BEFullValidatorBasicBlockValidation(self, block, hashes, networkTime);
+	BEBlockStatus res = BEFullValidatorBasicBlockValidation(self, block, hashes);
 	free(hashes);
 	return res;
 }
-BEBlockValidationResult BEFullValidatorCompleteBlockValidation(BEFullValidator * self, uint8_t branch, CBBlock * block, uint8_t * txHashes, uint32_t height){
+BEBlockValidationResult BEFullValidatorCompleteBlockValidation(BEFullValidator * self, uint8_t branch, CBBlock * block, uint8_t * txHashes, uint32_t height, BEPrevOutMap * prevOuts){
 	// Check that the first transaction is a coinbase transaction.
 	if (NOT CBTransactionIsCoinBase(block->transactions[0]))
 		return BE_BLOCK_VALIDATION_BAD;
+	// Read all of the previous outputs for the block together before validating any inputs. They are given back for the block filter.
+	if (BEFullValidatorPrefetchPrevOuts(self, branch, block, prevOuts) != BE_BLOCK_VALIDATION_OK)
+		return BE_BLOCK_VALIDATION_ERR;
 	uint64_t blockReward = CBCalculateBlockReward(height);
 	uint64_t coinbaseOutputValue;
 	uint32_t sigOps = 0;
-	// Do validation for transactions.
+	// Do validation for transactions. The spent outputs of every transaction are kept to check that later transactions do not spend them again.
 	bool err;
 	CBPrevOut ** allSpentOutputs = malloc(sizeof(*allSpentOutputs) * block->transactionNum);
+	if (NOT allSpentOutputs) {
+		BEFullValidatorFreePrevOutMap(prevOuts);
+		return BE_BLOCK_VALIDATION_ERR;
+	}
+	uint32_t numSpentOutputs = 0;
+	BEBlockValidationResult res = BE_BLOCK_VALIDATION_OK;
 	for (uint32_t x = 0; x < block->transactionNum; x++) {
 		// Check that the transaction is final.
-		if (NOT CBTransactionIsFinal(block->transactions[x], block->time, height))
-			return BE_BLOCK_VALIDATION_BAD;
+		if (NOT CBTransactionIsFinal(block->transactions[x], block->time, height)){
+			res = BE_BLOCK_VALIDATION_BAD;
+			break;
+		}
 		// Do the basic validation
 		uint64_t outputValue;
 		allSpentOutputs[x] = CBTransactionValidateBasic(block->transactions[x], NOT x, &outputValue, &err);
 		if (err){
-			for (uint32_t c = 0; c < x; c++)
-				free(allSpentOutputs[c]);
-			return BE_BLOCK_VALIDATION_ERR;
+			res = BE_BLOCK_VALIDATION_ERR;
+			break;
 		}
 		if (NOT allSpentOutputs[x]){
-			for (uint32_t c = 0; c < x; c++)
-				free(allSpentOutputs[c]);
-			return BE_BLOCK_VALIDATION_BAD;
+			res = BE_BLOCK_VALIDATION_BAD;
+			break;
 		}
+		numSpentOutputs++;
 		// Check correct structure for coinbase
 		if (CBTransactionIsCoinBase(block->transactions[x])){
-			if (x)
-				return BE_BLOCK_VALIDATION_BAD;
+			if (x){
+				res = BE_BLOCK_VALIDATION_BAD;
+				break;
+			}
 			coinbaseOutputValue = outputValue;
-		}else if (NOT x)
-			return BE_BLOCK_VALIDATION_BAD;
+		}else if (NOT x){
+			res = BE_BLOCK_VALIDATION_BAD;
+			break;
+		}
 		// Count sigops
 		sigOps += CBTransactionGetSigOps(block->transactions[x]);
-		if (sigOps > CB_MAX_SIG_OPS)
-			return BE_BLOCK_VALIDATION_BAD;
-		// Verify each input and count input values
-		uint64_t inputValue = 0;
-		for (uint32_t y = 1; y < block->transactions[x]->inputNum; y++) {
-			BEBlockValidationResult res = BEFullValidatorInputValidation(self, branch, block, height, x, y, allSpentOutputs, txHashes, &inputValue,&sigOps);
-			if (res != BE_BLOCK_VALIDATION_OK) {
-				for (uint32_t c = 0; c < x; c++)
-					free(allSpentOutputs[c]);
-				return res;
+		if (sigOps > CB_MAX_SIG_OPS){
+			res = BE_BLOCK_VALIDATION_BAD;
+			break;
+		}
+		// Transactions in the pool had their scripts verified when they were added. The hash commits to the outputs spent, which is all the scripts depend upon, so the scripts are not executed again.
+		uint32_t p2shSigOps;
+		bool verified = x && BEMempoolGetVerified(self->mempool, txHashes + 32*x, &p2shSigOps);
+		if (verified) {
+			sigOps += p2shSigOps;
+			if (sigOps > CB_MAX_SIG_OPS){
+				res = BE_BLOCK_VALIDATION_BAD;
+				break;
 			}
 		}
-		// Done now with the spent outputs
-		for (uint32_t c = 0; c < x; c++)
-			free(allSpentOutputs[c]);
+		// Verify each input and count input values. The coinbase input does not spend an output.
+		uint64_t inputValue = 0;
+		for (uint32_t y = 0; x && y < block->transactions[x]->inputNum && res == BE_BLOCK_VALIDATION_OK; y++)
+			res = BEFullValidatorInputValidation(self, block, height, x, y, allSpentOutputs, txHashes, prevOuts, verified, &inputValue, &sigOps);
+		if (res != BE_BLOCK_VALIDATION_OK)
+			break;
 		if (x){
 			// Verify values and add to block reward
-			if (inputValue < outputValue)
-				return BE_BLOCK_VALIDATION_BAD;
+			if (inputValue < outputValue){
+				res = BE_BLOCK_VALIDATION_BAD;
+				break;
+			}
 			blockReward += inputValue - outputValue;
 		}
 	}
+	// Done now with the spent outputs
+	for (uint32_t x = 0; x < numSpentOutputs; x++)
+		free(allSpentOutputs[x]);
+	free(allSpentOutputs);
 	// Verify coinbase output for reward
-	if (coinbaseOutputValue > blockReward)
-		return BE_BLOCK_VALIDATION_BAD;
-	return BE_BLOCK_VALIDATION_OK;
+	if (res == BE_BLOCK_VALIDATION_OK && coinbaseOutputValue > blockReward)
+		res = BE_BLOCK_VALIDATION_BAD;
+	if (res != BE_BLOCK_VALIDATION_OK)
+		BEFullValidatorFreePrevOutMap(prevOuts);
+	return res;
 }
-FILE * BEFullValidatorGetBlockFile(BEFullValidator * self, uint16_t fileID, uint8_t branch){
-	// Look to see if the file descriptor is open. Search using linear search because we are almost certainly dealing with a low number of files. Modern filesystems can have filesizes in many terabytes to exabytes.... providing you have the storage obviously.
-	FILE * fd;
-	for (uint16_t x = 0;; x++) {
-		if (x == self->branches[branch].numBlockFiles || self->branches[branch].blockFiles[x].fileID > fileID) {
-			// Not in list.
-			// Open file.
-			char blockFile[strlen(self->dataDir) + 22];
-			sprintf(blockFile, "%sblocks%u-%u.dat",self->dataDir, branch, fileID);
-			fd = fopen(blockFile, "rb+");
-			if (NOT fd && errno == ENOENT)
-				// Create file if it doesn't exist
-				fd = fopen(blockFile, "wb+");
-			if (NOT fd)
-				// Cannot open file. The first file was closed. Need to plug the gap...
-				return NULL;
-			// Expand list
-			self->branches[branch].numBlockFiles++;
-			self->branches[branch].blockFiles = realloc(self->branches[branch].blockFiles, sizeof(*self->branches[branch].blockFiles) * self->branches[branch].numBlockFiles);
-			if (NOT self->branches[branch].blockFiles){
-				// Unfortunately going to have to cut a file off. Chop chop chop
-				self->branches[branch].numBlockFiles--;
-				fclose(self->branches[branch].blockFiles[self->branches[branch].numBlockFiles].file);
-			}
-			if (x == self->branches[branch].numBlockFiles)
-				// We were going to add to the end but it turns out there is not enough memory! :O
-				x--;
-			if (x != self->branches[branch].numBlockFiles - 1)
-				// Move list up unless we are adding to the end.
-				memmove(self->branches[branch].blockFiles + x + 1, self->branches[branch].blockFiles + x, sizeof(*self->branches[branch].blockFiles) * (self->branches[branch].numBlockFiles - x - 1));
-			// Insert
-			self->branches[branch].blockFiles[x].fileID = fileID;
-			self->branches[branch].blockFiles[x].file = fd;
-			return fd;
-		}else if (self->branches[branch].blockFiles[x].fileID == fileID){
-			// Got it
-			fd = self->branches[branch].blockFiles[x].file;
-			return fd;
-		}
+bool BEFullValidatorCountFileOutputs(BEFullValidator * self){
+	// The unspent outputs of every branch are needed.
+	for (uint8_t x = 0; x < self->numBranches; x++)
+		if (NOT BEFullValidatorLoadBranch(self, x, BE_BRANCH_ALL))
+			return false;
+	uint16_t numFiles = BEBlockStoreGetNumFiles(self->blockStore);
+	uint32_t * temp = realloc(self->fileOutputs, sizeof(*self->fileOutputs) * (numFiles ? numFiles : 1));
+	if (NOT temp) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the block file output counts in BEFullValidatorCountFileOutputs.",sizeof(*self->fileOutputs) * numFiles);
+		return false;
+	}
+	self->fileOutputs = temp;
+	self->fileOutputsLength = numFiles;
+	memset(self->fileOutputs, 0, sizeof(*self->fileOutputs) * numFiles);
+	self->fileOutputsCounted = true;
+	for (uint8_t x = 0; x < self->numBranches; x++) {
+		for (uint32_t y = 0; y < self->branches[x].numUnspentOutputs; y++)
+			BEFullValidatorAddFileOutput(self, self->branches[x].unspentOutputs[y].ref.fileID);
+		// Spent outputs are read again for the unspent outputs of new branches.
+		for (uint32_t y = 0; y < self->branches[x].numSpentOutputs; y++)
+			BEFullValidatorAddFileOutput(self, self->branches[x].spentOutputs[y].output.ref.fileID);
 	}
+	return self->fileOutputsCounted;
+}
+bool BEFullValidatorEnableTxIndex(BEFullValidator * self){
+	pthread_mutex_lock(&self->lock);
+	if (NOT self->txIndex)
+		self->txIndex = BENewTxIndex(self->dataDir, self->onErrorReceived);
+	bool ok = self->txIndex && BEFullValidatorUpdateTxIndex(self, NULL);
+	pthread_mutex_unlock(&self->lock);
+	return ok;
+}
+BEBlockReference * BEFullValidatorGetMainChainReference(BEFullValidator * self, uint32_t height){
+	// Go back through the branches the main branch follows until the branch with the height.
+	uint8_t branch = self->mainBranch;
+	while (height < self->branches[branch].startHeight)
+		branch = self->branches[branch].parentBranch;
+	if (NOT BEFullValidatorLoadBranch(self, branch, BE_BRANCH_REFERENCES))
+		return NULL;
+	return self->branches[branch].references + height - self->branches[branch].startHeight;
+}
+CBTransaction * BEFullValidatorGetTransaction(BEFullValidator * self, uint8_t * txHash, uint32_t * height){
+	pthread_mutex_lock(&self->lock);
+	BETxIndexEntry entry;
+	bool found = self->txIndex && BETxIndexFind(self->txIndex, txHash, &entry);
+	if (found) {
+		// Records can be left for blocks which are no longer in the main chain after a crash, so the main chain block at the height must be the block of the record.
+		BEBlockReference * ref = NULL;
+		found = BEFullValidatorLoadBranch(self, self->mainBranch, BE_BRANCH_REFERENCES)
+			&& entry.height < self->branches[self->mainBranch].startHeight + self->branches[self->mainBranch].numRefs
+			&& (ref = BEFullValidatorGetMainChainReference(self, entry.height))
+			&& ref->ref.fileID == entry.blockRef.fileID && ref->ref.filePos == entry.blockRef.filePos;
+	}
+	pthread_mutex_unlock(&self->lock);
+	if (NOT found)
+		return NULL;
+	// Read the transaction without the lock, as the block store can be read by many threads.
+	CBByteArray * data = CBNewByteArrayOfSize(entry.length, self->onErrorReceived);
+	if (NOT data)
+		return NULL;
+	if (NOT BEBlockStoreRead(self->blockStore, entry.blockRef.fileID, entry.blockRef.filePos + BE_BLOCK_RECORD_HEADER_SIZE + entry.offset, CBByteArrayGetData(data), entry.length)) {
+		CBReleaseObject(data);
+		return NULL;
+	}
+	CBTransaction * tx = CBNewTransactionFromData(data, self->onErrorReceived);
+	CBReleaseObject(data);
+	if (NOT tx)
+		return NULL;
+	if (NOT CBTransactionDeserialise(tx) || memcmp(CBTransactionGetHash(tx), txHash, 32)) {
+		CBReleaseObject(tx);
+		return NULL;
+	}
+	if (height)
+		*height = entry.height;
+	return tx;
 }
 uint32_t BEFullValidatorGetMedianTime(BEFullValidator * self, uint8_t branch, uint32_t prevIndex){
 	uint32_t height = self->branches[branch].startHeight + prevIndex;
@@ -419,16 +599,27 @@ uint32_t BEFullValidatorGetMedianTime(BEFullValidator * self, uint8_t branch, ui
 			prevIndex -= x;
 			return self->branches[branch].references[prevIndex].time;
 		}
+		// Continue from the fork point in the parent branch.
+		x -= prevIndex + 1;
+		prevIndex = self->branches[branch].parentBlockIndex;
 		branch = self->branches[branch].parentBranch;
-		prevIndex = self->branches[branch].numRefs - 1;
-		x -= prevIndex;
 	}
 }
-BEBlockValidationResult BEFullValidatorInputValidation(BEFullValidator * self, uint8_t branch, CBBlock * block, uint32_t blockHeight, uint32_t transactionIndex,uint32_t inputIndex, CBPrevOut ** allSpentOutputs, uint8_t * txHashes, uint64_t * value, uint32_t * sigOps){
+uint32_t BEFullValidatorGetInvalidBlockSlot(BEFullValidator * self, uint8_t * hash){
+	return BESipHash256(self->invalidKey0, self->invalidKey1, hash) & (BE_INVALID_BLOCK_CACHE - 1);
+}
+bool BEFullValidatorIsKnownInvalid(BEFullValidator * self, uint8_t * hash){
+	return NOT memcmp(self->invalidBlocks[BEFullValidatorGetInvalidBlockSlot(self, hash)], hash, 32);
+}
+uint64_t BEFullValidatorGetOutputsOffset(uint32_t numRefs){
+	uint64_t offset = sizeof(BEBranchFileHeader) + (uint64_t)numRefs * (sizeof(BEBlockReference) + sizeof(BEBlockReferenceHashIndex));
+	return (offset + BE_BRANCH_FILE_ALIGNMENT - 1) / BE_BRANCH_FILE_ALIGNMENT * BE_BRANCH_FILE_ALIGNMENT;
+}
+BEBlockValidationResult BEFullValidatorInputValidation(BEFullValidator * self, CBBlock * block, uint32_t blockHeight, uint32_t transactionIndex,uint32_t inputIndex, CBPrevOut ** allSpentOutputs, uint8_t * txHashes, BEPrevOutMap * prevOuts, bool verified, uint64_t * value, uint32_t * sigOps){
 	// Check that the previous output is not already spent by this block.
 	for (uint32_t a = 0; a < transactionIndex; a++)
 		for (uint32_t b = 0; b < block->transactions[a]->inputNum; b++)
-			if (CBByteArrayCompare(allSpentOutputs[transactionIndex][inputIndex].hash, allSpentOutputs[a][b].hash)
+			if (CBByteArrayCompare(allSpentOutputs[transactionIndex][inputIndex].hash, allSpentOutputs[a][b].hash) == CB_COMPARE_EQUAL
 				&& allSpentOutputs[transactionIndex][inputIndex].index == allSpentOutputs[a][b].index)
 				// Duplicate found.
 				return BE_BLOCK_VALIDATION_BAD;
@@ -447,99 +638,28 @@ BEBlockValidationResult BEFullValidatorInputValidation(BEFullValidator * self, u
 		}
 	}
 	if (NOT found) {
-		// Not found in this block. Look in unspent outputs index.
-		BEOutputReference * outRef;
-		bool found;
-		uint32_t i = BEFullValidatorFindOutputReference(self->branches[branch].unspentOutputs, self->branches[branch].numUnspentOutputs,CBByteArrayGetData(allSpentOutputs[transactionIndex][inputIndex].hash),allSpentOutputs[transactionIndex][inputIndex].index,&found);
-		if (NOT found)
+		// Not found in this block. Look in the previous outputs which were read from the unspent outputs of the branch.
+		BEPrefetchedOutput * outRef = BEFullValidatorFindPrefetchedOutput(prevOuts, CBByteArrayGetData(allSpentOutputs[transactionIndex][inputIndex].hash), allSpentOutputs[transactionIndex][inputIndex].index);
+		if (NOT outRef)
 			// No unspent outputs for this input.
 			return BE_BLOCK_VALIDATION_BAD;
-		outRef = self->branches[branch].unspentOutputs + i;
 		// Check coinbase maturity
-		if (outRef->coinbase && blockHeight - outRef->height < CB_COINBASE_MATURITY) 
+		if (outRef->coinbase && blockHeight - outRef->height < CB_COINBASE_MATURITY)
 			return BE_BLOCK_VALIDATION_BAD;
-		// Get the output
-		FILE * fd = BEFullValidatorGetBlockFile(self, outRef->ref.fileID,outRef->branch);
-		if (NOT fd)
-			return BE_BLOCK_VALIDATION_ERR;
-		// Now load the output. Do deserilisation here as we do not know the number of bytes required.
-		uint8_t bytes[9];
-		fseek(fd, outRef->ref.filePos, SEEK_SET);
-		if (fread(bytes, 1, 9, fd) != 9)
-			return BE_BLOCK_VALIDATION_ERR;
-		fseek(fd, 9, SEEK_CUR);
-		uint32_t scriptSize;
-		if (bytes[8] < 253)
-			scriptSize = bytes[8];
-		else{
-			uint8_t varIntSize;
-			if (bytes[8] == 253)
-				varIntSize = 2;
-			else if (bytes[8] == 254)
-				varIntSize = 4;
-			else
-				varIntSize = 8;
-			// Read the script size
-			uint8_t scriptSizeBytes[varIntSize];
-			if (fread(scriptSizeBytes, 1, varIntSize, fd) != varIntSize)
-				return BE_BLOCK_VALIDATION_ERR;
-			// Seek to script
-			fseek(fd, 9, SEEK_CUR);
-			for (uint8_t y = 0; y < varIntSize; y++)
-				scriptSize = scriptSizeBytes[y] << 8*y;
-		}
-		// Get script
-		CBScript * script = CBNewScriptOfSize(scriptSize, self->onErrorReceived);
-		if (fread(CBByteArrayGetData(script), 1, scriptSize, fd) != scriptSize)
-			return BE_BLOCK_VALIDATION_ERR;
-		// Make output
-		prevOut = CBNewTransactionOutput(bytes[0] | (uint64_t)bytes[1] << 8 | (uint64_t)bytes[2] << 16 | (uint64_t)bytes[3] << 24 | (uint64_t)bytes[4] << 32 | (uint64_t)bytes[5] << 40 | (uint64_t)bytes[6] << 48 | (uint64_t)bytes[7] << 56, script, self->onErrorReceived);
-		CBReleaseObject(script);
-	}
-	// We have sucessfully received an output for this input. Verify the input script for the output script.
-	CBScriptStack stack = CBNewEmptyScriptStack();
-	// Execute the input script.
-	CBScriptExecuteReturn res = CBScriptExecute(block->transactions[transactionIndex]->inputs[inputIndex]->scriptObject, &stack, CBTransactionGetInputHashForSignature, block->transactions[transactionIndex], inputIndex, false);
-	if (res == CB_SCRIPT_ERR){
-		CBFreeScriptStack(stack);
-		CBReleaseObject(prevOut);
-		return BE_BLOCK_VALIDATION_ERR;
+		prevOut = outRef->output;
 	}
-	if (res == CB_SCRIPT_INVALID){
-		CBFreeScriptStack(stack);
-		CBReleaseObject(prevOut);
-		return BE_BLOCK_VALIDATION_BAD;
+	if (verified) {
+		*value += prevOut->value;
+		return BE_BLOCK_VALIDATION_OK;
 	}
-	// Verify P2SH inputs.
-	if (CBScriptIsP2SH(prevOut->scriptObject)){
-		if (NOT CBScriptIsPushOnly(prevOut->scriptObject)){
-			CBFreeScriptStack(stack);
-			CBReleaseObject(prevOut);
-			return BE_BLOCK_VALIDATION_BAD;
-		}
-		// Since the output is a P2SH we include the serialised script in the signature operations
-		CBScript * p2shScript = CBNewScriptWithData(stack.elements[stack.length - 1].data, stack.elements[stack.length - 1].length, self->onErrorReceived);
-		*sigOps += CBScriptGetSigOpCount(p2shScript, true);
-		if (*sigOps > CB_MAX_SIG_OPS){
-			CBFreeScriptStack(stack);
-			CBReleaseObject(prevOut);
-			return BE_BLOCK_VALIDATION_BAD;
-		}
-		CBReleaseObject(p2shScript);
-	}
-	// Execute the output script.
-	res = CBScriptExecute(prevOut->scriptObject, &stack, CBTransactionGetInputHashForSignature, block->transactions[transactionIndex], inputIndex, true);
-	// Finished with the stack.
-	CBFreeScriptStack(stack);
+	// Retain the output as it is released when done with, whether it came from the block or from the prefetched outputs.
+	CBRetainObject(prevOut);
+	// We have sucessfully received an output for this input. Verify the input script for the output script.
+	BEBlockValidationResult res = BEFullValidatorVerifyInputScript(self, block->transactions[transactionIndex], inputIndex, prevOut, sigOps);
 	// Increment the value with the input value then be done with the output
 	*value += prevOut->value;
 	CBReleaseObject(prevOut);
-	// Check the result of the output script
-	if (res == CB_SCRIPT_ERR)
-		return BE_BLOCK_VALIDATION_ERR;
-	if (res == CB_SCRIPT_INVALID)
-		return BE_BLOCK_VALIDATION_BAD;
-	return BE_BLOCK_VALIDATION_OK;
+	return res;
 }
 uint32_t BEFullValidatorFindBlockReference(BEBlockReferenceHashIndex * lookupTable, uint32_t refNum, uint8_t * hash, bool * found){
 	// Block branch block reference lists and the unspent output reference list, use sorted lists, therefore this uses an interpolation search which is an optimsation on binary search.
@@ -630,146 +750,103 @@ uint32_t BEFullValidatorFindOutputReference(BEOutputReference * refs, uint32_t r
 			right = pos - 1;
 	}
 }
-CBBlock * BEFullValidatorLoadBlock(BEFullValidator * self, BEBlockReference blockRef, uint32_t branch){
-	// Get the file
-	FILE * fd = BEFullValidatorGetBlockFile(self, blockRef.ref.fileID, branch);
-	if (NOT fd)
-		return NULL;
-	// Now we have the file and it is open we need the block. Get the length of the block.
-	uint8_t length[4];
-	fseek(fd, blockRef.ref.filePos, SEEK_SET);
-	if (fread(length, 1, 4, fd) != 4)
-		return NULL;
-	CBByteArray * data = CBNewByteArrayOfSize(length[3] << 24 | length[2] << 16 | length[1] << 8 | length[0], self->onErrorReceived);
-	// Now read block data
-	if (fread(CBByteArrayGetData(data), 1, data->length, fd) != data->length) {
-		CBReleaseObject(data);
-		return NULL;
+int BEFullValidatorComparePrefetchedOutputs(const void * a, const void * b){
+	const BEPrefetchedOutput * outA = a;
+	const BEPrefetchedOutput * outB = b;
+	int res = memcmp(outA->outputHash, outB->outputHash, 32);
+	if (res)
+		return res;
+	if (outA->outputIndex != outB->outputIndex)
+		return outA->outputIndex < outB->outputIndex ? -1 : 1;
+	return 0;
+}
+int BEFullValidatorComparePrefetchedOutputPositions(const void * a, const void * b){
+	const BEPrefetchedOutput * outA = a;
+	const BEPrefetchedOutput * outB = b;
+	if (outA->ref.fileID != outB->ref.fileID)
+		return outA->ref.fileID < outB->ref.fileID ? -1 : 1;
+	if (outA->ref.filePos != outB->ref.filePos)
+		return outA->ref.filePos < outB->ref.filePos ? -1 : 1;
+	return 0;
+}
+int BEFullValidatorCompareSpentOutputs(const void * a, const void * b){
+	const BESpentOutput * outA = a;
+	const BESpentOutput * outB = b;
+	int res = memcmp(outA->output.outputHash, outB->output.outputHash, 32);
+	if (res)
+		return res;
+	if (outA->output.outputIndex != outB->output.outputIndex)
+		return outA->output.outputIndex < outB->output.outputIndex ? -1 : 1;
+	return 0;
+}
+BEPrefetchedOutput * BEFullValidatorFindPrefetchedOutput(BEPrevOutMap * prevOuts, uint8_t * hash, uint32_t index){
+	BEPrefetchedOutput key;
+	memcpy(key.outputHash, hash, 32);
+	key.outputIndex = index;
+	return bsearch(&key, prevOuts->outputs, prevOuts->numOutputs, sizeof(*prevOuts->outputs), BEFullValidatorComparePrefetchedOutputs);
+}
+void BEFullValidatorFreePrevOutMap(BEPrevOutMap * prevOuts){
+	for (uint32_t x = 0; x < prevOuts->numOutputs; x++)
+		if (prevOuts->outputs[x].output)
+			CBReleaseObject(prevOuts->outputs[x].output);
+	free(prevOuts->outputs);
+	prevOuts->outputs = NULL;
+	prevOuts->numOutputs = 0;
+}
+bool BEFullValidatorLoadBranch(BEFullValidator * self, uint8_t branch, BEBranchLoadState state){
+	BEBlockBranch * branchData = self->branches + branch;
+	if (branchData->loaded >= state)
+		return true;
+	if (branchData->loaded == BE_BRANCH_NOT_LOADED && NOT BEFullValidatorLoadBranchValidator(self, branch))
+		return false;
+	// The initial data for the first branch is created fully loaded.
+	if (branchData->loaded >= state)
+		return true;
+	// Branches which are not fully loaded are mapped.
+	BEBranchFileHeader * header = (BEBranchFileHeader *)branchData->map;
+	uint64_t tableEnd = sizeof(*header) + (uint64_t)header->numRefs * (sizeof(BEBlockReference) + sizeof(BEBlockReferenceHashIndex));
+	if (state >= BE_BRANCH_REFERENCES && branchData->loaded < BE_BRANCH_REFERENCES) {
+		if (BECRC32C(0, branchData->map + sizeof(*header), tableEnd - sizeof(*header)) != header->referencesChecksum) {
+			self->onErrorReceived(CB_ERROR_INIT_FAIL,"The block references for branch %u are corrupt.",branch);
+			return false;
+		}
+		branchData->loaded = BE_BRANCH_REFERENCES;
+	}
+	if (state == BE_BRANCH_ALL && branchData->loaded < BE_BRANCH_ALL) {
+		uint64_t workOffset = header->length - header->workLength;
+		if (BECRC32C(0, branchData->map + tableEnd, workOffset - tableEnd) != header->outputsChecksum) {
+			self->onErrorReceived(CB_ERROR_INIT_FAIL,"The unspent outputs for branch %u are corrupt.",branch);
+			return false;
+		}
+		branchData->loaded = BE_BRANCH_ALL;
 	}
+	return true;
+}
+CBBlock * BEFullValidatorLoadBlock(BEFullValidator * self, BEBlockReference blockRef){
+	// Read the block data
+	CBByteArray * data = BEBlockStoreReadBlock(self->blockStore, blockRef.ref.fileID, blockRef.ref.filePos);
+	if (NOT data)
+		return NULL;
 	// Make and return the block
 	CBBlock * block = CBNewBlockFromData(data, self->onErrorReceived);
 	CBReleaseObject(data);
 	return block;
 }
 bool BEFullValidatorLoadBranchValidator(BEFullValidator * self, uint8_t branch){
+	if (self->branches[branch].loaded != BE_BRANCH_NOT_LOADED)
+		return true;
 	if (self->numBranches && self->numBranches <= BE_MAX_BRANCH_CACHE) {
 		// Open branch data file
 		unsigned long dataDirLen = strlen(self->dataDir);
 		char * branchFilePath = malloc(dataDirLen + strlen(BE_ADDRESS_DATA_FILE) + 1);
 		sprintf(branchFilePath, "%sbranch%u.dat",self->dataDir, branch);
-		self->branches[branch].branchValidationFile = fopen(branchFilePath, "rb+");
-		if (self->branches[branch].branchValidationFile) {
-			// The validator file exists.
-			free(branchFilePath);
-			// Get the file length
-			fseek(self->branches[branch].branchValidationFile, 0, SEEK_END);
-			unsigned long fileLen = ftell(self->branches[branch].branchValidationFile);
-			fseek(self->branches[branch].branchValidationFile, 0, SEEK_SET);
-			// Copy file contents into buffer.
-			CBByteArray * buffer = CBNewByteArrayOfSize((uint32_t)fileLen, self->onErrorReceived);
-			if (NOT buffer) {
-				fclose(self->branches[branch].branchValidationFile);
-				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create buffer of size %u.",fileLen);
-				return false;
-			}
-			size_t res = fread(CBByteArrayGetData(buffer), 1, fileLen, self->branches[branch].branchValidationFile);
-			if(res != fileLen){
-				CBReleaseObject(buffer);
-				fclose(self->validatorFile);
-				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not read %u bytes of data into buffer. fread returned %u",fileLen,res);
-				return false;
-			}
-			// Deserailise data
-			if (buffer->length >= 26){
-				self->branches[branch].numRefs = CBByteArrayReadInt32(buffer, 0);
-				if (buffer->length >= 26 + self->branches[branch].numRefs*54) {
-					self->branches[branch].references = malloc(sizeof(*self->branches[branch].references) * self->branches[branch].numRefs);
-					if (self->branches[branch].references) {
-						self->branches[branch].referenceTable = malloc(sizeof(*self->branches[branch].referenceTable) * self->branches[branch].numRefs);
-						if (self->branches[branch].referenceTable) {
-							uint32_t cursor = 4;
-							for (uint32_t x = 0; x < self->branches[branch].numRefs; x++) {
-								// Load block reference
-								self->branches[branch].references[x].ref.fileID = CBByteArrayReadInt16(buffer, cursor);
-								cursor += 2;
-								self->branches[branch].references[x].ref.filePos = CBByteArrayReadInt64(buffer, cursor);
-								cursor += 8;
-								self->branches[branch].references[x].target = CBByteArrayReadInt32(buffer, cursor);
-								cursor += 4;
-								self->branches[branch].references[x].time = CBByteArrayReadInt32(buffer, cursor);
-								cursor += 4;
-								// Load block reference index
-								memcpy(self->branches[branch].referenceTable[x].blockHash, CBByteArrayGetData(buffer) + cursor, 32);
-								cursor += 32;
-								self->branches[branch].referenceTable[x].index = CBByteArrayReadInt32(buffer, cursor);
-								cursor += 4;
-							}
-							self->branches[branch].lastRetargetTime = CBByteArrayReadInt32(buffer, cursor);
-							cursor += 4;
-							self->branches[branch].parentBranch = CBByteArrayGetByte(buffer, cursor);
-							cursor++;
-							self->branches[branch].parentBlockIndex = CBByteArrayReadInt32(buffer, cursor);
-							cursor+= 4;
-							self->branches[branch].startHeight = CBByteArrayReadInt32(buffer, cursor);
-							cursor+= 4;
-							self->branches[branch].lastValidation = CBByteArrayReadInt32(buffer, cursor);
-							cursor+= 4;
-							self->branches[branch].numUnspentOutputs = CBByteArrayReadInt32(buffer, cursor);
-							cursor += 4;
-							if (buffer->length >= cursor + self->branches[branch].numUnspentOutputs*52 + 1) {
-								self->branches[branch].unspentOutputs = malloc(sizeof(*self->branches[branch].unspentOutputs) * self->branches[branch].numUnspentOutputs);
-								if (self->branches[branch].unspentOutputs) {
-									for (uint32_t x = 0; x < self->branches[branch].numUnspentOutputs; x++) {
-										memcpy(self->branches[branch].unspentOutputs[x].outputHash, CBByteArrayGetData(buffer) + cursor, 32);
-										cursor += 32;
-										self->branches[branch].unspentOutputs[x].outputIndex = CBByteArrayReadInt32(buffer, cursor);
-										cursor += 4;
-										self->branches[branch].unspentOutputs[x].ref.fileID = CBByteArrayReadInt16(buffer, cursor);
-										cursor += 2;
-										self->branches[branch].unspentOutputs[x].ref.filePos = CBByteArrayReadInt64(buffer, cursor);
-										cursor += 8;
-										self->branches[branch].unspentOutputs[x].height = CBByteArrayReadInt32(buffer, cursor);
-										cursor += 4;
-										self->branches[branch].unspentOutputs[x].coinbase = CBByteArrayGetByte(buffer, cursor);
-										cursor += 1;
-										self->branches[branch].unspentOutputs[x].branch = CBByteArrayGetByte(buffer, cursor);
-										cursor += 1;
-									}
-									// Get work
-									self->branches[branch].work.length = CBByteArrayGetByte(buffer, cursor);
-									cursor++;
-									if (buffer->length >= cursor + self->branches[branch].work.length) {
-										// Allocate bigint
-										if (CBBigIntAlloc(&self->branches[branch].work, self->branches[branch].work.length)) {
-											memcpy(self->branches[branch].work.data, CBByteArrayGetData(buffer) + cursor,self->branches[branch].work.length);
-											return true;
-										}else
-											self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"CBBigIntAloc failed in BEFullValidatorLoadBranchValidator for %u bytes", self->branches[branch].work.length);
-									}else
-										self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"Not enough data for the branch work %u < %u",buffer->length, cursor + self->branches[branch].work.length);
-								}else
-									self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for unspent outputs in BEFullValidatorLoadBranchValidator for branch",sizeof(*self->branches[branch].unspentOutputs) * self->branches[branch].numUnspentOutputs);
-							}else
-								self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"There is not enough data for the unspent outputs. %i < %i",buffer->length, cursor + self->branches[branch].numUnspentOutputs*52 + 1);
-						}else
-							self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the reference table in BEFullValidatorLoadBranchValidator.",sizeof(*self->branches[branch].referenceTable) * self->branches[branch].numRefs);
-						free(self->branches[branch].references);
-					}else
-						self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for references in BEFullValidatorLoadBranchValidator.",sizeof(*self->branches[branch].references) * self->branches[branch].numRefs);
-				}else
-					self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"Not enough data for the references %u < %u",buffer->length, 26 + self->branches[branch].numRefs*54);
-			}else
-				self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"Not enough data for the number of references %u < 26",buffer->length);
-			CBReleaseObject(buffer);
-			return false;
-		}else if (NOT branch){
-			// The branch file does not exist. Create the file.
-			self->branches[branch].branchValidationFile = fopen(branchFilePath, "wb+");
-			free(branchFilePath);
-			if (NOT self->branches[branch].branchValidationFile) {
-				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the branch validator file BEFullValidatorLoadBranchValidator.");
-				return false;
-			}
+		int fd = open(branchFilePath, O_RDONLY);
+		free(branchFilePath);
+		if (fd != -1)
+			// The branch file exists, so use the data in place.
+			return BEFullValidatorMapBranch(self, branch, fd);
+		if (NOT branch){
+			// The branch file does not exist. It is created when the initial data is saved.
 			// Allocate data
 			self->branches[0].references = malloc(sizeof(*self->branches[0].references));
 			if (NOT self->branches[0].references) {
@@ -797,10 +874,10 @@ bool BEFullValidatorLoadBranchValidator(BEFullValidator * self, uint8_t branch){
 			self->branches[0].numRefs = 1;
 			self->branches[0].lastValidation = 0;
 			uint8_t genesisHash[32] = {0x6F,0xE2,0x8C,0x0A,0xB6,0xF1,0xB3,0x72,0xC1,0xA6,0xA2,0x46,0xAE,0x63,0xF7,0x4F,0x93,0x1E,0x83,0x65,0xE1,0x5A,0x08,0x9C,0x68,0xD6,0x19,0x00,0x00,0x00,0x00,0x00};
-			self->branches[0].references[0].ref.fileID = 0;
-			self->branches[0].references[0].ref.filePos = 0;
 			self->branches[0].references[0].target = CB_MAX_TARGET;
 			self->branches[0].references[0].time = 1231006505;
+			// The genesis block is not validated, so its filter is built when the filter index is first updated.
+			self->branches[0].references[0].filterPos = BE_NO_FILTER;
 			self->branches[0].work.length = 1;
 			self->branches[0].work.data = malloc(1);
 			if (NOT self->branches[0].work.data) {
@@ -819,42 +896,9 @@ bool BEFullValidatorLoadBranchValidator(BEFullValidator * self, uint8_t branch){
 			self->branches[0].unspentOutputs[0].height = 0;
 			uint8_t genesisCoinbaseHash[32] = {0x3b,0xa3,0xed,0xfd,0x7a,0x7b,0x12,0xb2,0x7a,0xc7,0x2c,0x3e,0x67,0x76,0x8f,0x61,0x7f,0xc8,0x1b,0xc3,0x88,0x8a,0x51,0x32,0x3a,0x9f,0xb8,0xaa,0x4b,0x1e,0x5e,0x4a};
 			memcpy(self->branches[0].unspentOutputs[0].outputHash,genesisCoinbaseHash,32);
-			self->branches[0].unspentOutputs[0].ref.fileID = 0;
-			self->branches[0].unspentOutputs[0].ref.filePos = 209;
-			// Write genesis block to the first block file
-			char * blockFilePath = malloc(dataDirLen + 14);
-			if (NOT blockFilePath) {
-				self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u byte of memory for the first block file path in BEFullValidatorLoadBranchValidator.",dataDirLen + 12);
-				free(self->branches[0].references);
-				free(self->branches[0].referenceTable);
-				free(self->branches[0].unspentOutputs);
-				return false;
-			}
-			memcpy(blockFilePath, self->dataDir, dataDirLen);
-			strcpy(blockFilePath + dataDirLen, "blocks0-0.dat");
-			self->branches[0].blockFiles = malloc(sizeof(*self->branches[0].blockFiles));
-			if (NOT self->branches[0].blockFiles) {
-				free(blockFilePath);
-				self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u byte of memory for the blockFiles list in BEFullValidatorLoadBranchValidator.",sizeof(*self->branches[0].blockFiles));
-				free(self->branches[0].references);
-				free(self->branches[0].referenceTable);
-				free(self->branches[0].unspentOutputs);
-				return false;
-			}
-			self->branches[0].blockFiles[0].fileID = 0;
-			self->branches[0].blockFiles[0].file = BEFullValidatorGetBlockFile(self, 0, 0);
-			if (NOT self->branches[0].blockFiles[0].file) {
-				free(self->branches[0].blockFiles);
-				free(blockFilePath);
-				free(self->branches[0].references);
-				free(self->branches[0].referenceTable);
-				free(self->branches[0].unspentOutputs);
-				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the first block file in BEFullValidatorLoadBranchValidator.");
-				return false;
-			}
-			// Write genesis block data. Begins with length.
-			if(fwrite((uint8_t []){
-				0x1D,0x01,0x00,0x00, // The Length of the block is 285 bytes or 0x11D
+			// Add the genesis block to the block store, which will use the stored genesis block if there is one. The length of the block is 285 bytes or 0x11D
+			bool added;
+			if (NOT BEBlockStoreAddBlock(self->blockStore, genesisHash, (uint8_t []){
 				0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
 				0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x3B,0xA3,0xED,0xFD,0x7A,0x7B,0x12,0xB2,0x7A,0xC7,0x2C,0x3E,0x67,0x76,
 				0x8F,0x61,0x7F,0xC8,0x1B,0xC3,0x88,0x8A,0x51,0x32,0x3A,0x9F,0xB8,0xAA,0x4B,0x1E,0x5E,0x4A,0x29,0xAB,0x5F,0x49,0xFF,0xFF,0x00,
@@ -866,30 +910,25 @@ bool BEFullValidatorLoadBranchValidator(BEFullValidator * self, uint8_t branch){
 				0xFF,0xFF,0xFF,0xFF,0x01,0x00,0xF2,0x05,0x2A,0x01,0x00,0x00,0x00,0x43,0x41,0x04,0x67,0x8A,0xFD,0xB0,0xFE,0x55,0x48,0x27,0x19,
 				0x67,0xF1,0xA6,0x71,0x30,0xB7,0x10,0x5C,0xD6,0xA8,0x28,0xE0,0x39,0x09,0xA6,0x79,0x62,0xE0,0xEA,0x1F,0x61,0xDE,0xB6,0x49,0xF6,
 				0xBC,0x3F,0x4C,0xEF,0x38,0xC4,0xF3,0x55,0x04,0xE5,0x1E,0xC1,0x12,0xDE,0x5C,0x38,0x4D,0xF7,0xBA,0x0B,0x8D,0x57,0x8A,0x4C,0x70,
-				0x2B,0x6B,0xF1,0x1D,0x5F,0xAC,0x00,0x00,0x00,0x00}, 1, 289, self->branches[0].blockFiles[0].file) != 289){
-				fclose(self->branches[0].blockFiles[0].file);
-				free(self->branches[0].blockFiles);
-				free(blockFilePath);
+				0x2B,0x6B,0xF1,0x1D,0x5F,0xAC,0x00,0x00,0x00,0x00}, 285, &self->branches[0].references[0].ref, &added)){
 				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not write the genesis block in BEFullValidatorLoadBranchValidator.");
 				free(self->branches[0].references);
 				free(self->branches[0].referenceTable);
 				free(self->branches[0].unspentOutputs);
 				return false;
 			}
+			self->branches[0].loaded = BE_BRANCH_ALL;
+			self->branches[0].unspentOutputs[0].ref.fileID = self->branches[0].references[0].ref.fileID;
+			self->branches[0].unspentOutputs[0].ref.filePos = self->branches[0].references[0].ref.filePos + BE_BLOCK_RECORD_HEADER_SIZE + 205; // The output is 205 bytes into the genesis block.
 			// Write to the branch file
 			if(NOT BEFullValidatorSaveBranchValidator(self, branch)){
-				fclose(self->branches[0].blockFiles[0].file);
-				free(self->branches[0].blockFiles);
-				free(blockFilePath);
 				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not write the validation data in BEFullValidatorLoadBranchValidator.");
+				self->branches[0].loaded = BE_BRANCH_NOT_LOADED;
 				free(self->branches[0].references);
 				free(self->branches[0].referenceTable);
 				free(self->branches[0].unspentOutputs);
 				return false;
 			}
-			// Flush data
-			fflush(self->branches[0].blockFiles[0].file);
-			free(blockFilePath);
 			return true;
 		}
 	}
@@ -901,7 +940,7 @@ bool BEFullValidatorLoadValidator(BEFullValidator * self){
 		char * validatorFilePath = malloc(dataDirLen + strlen(BE_VALIDATION_DATA_FILE) + 1);
 		memcpy(validatorFilePath, self->dataDir, dataDirLen);
 		strcpy(validatorFilePath + dataDirLen, BE_VALIDATION_DATA_FILE);
-		self->validatorFile = fopen(validatorFilePath, "rb+");
+		self->validatorFile = fopen(validatorFilePath, "rb");
 		if (self->validatorFile) {
 			// Validation data exists
 			free(validatorFilePath);
@@ -924,64 +963,16 @@ bool BEFullValidatorLoadValidator(BEFullValidator * self){
 				return false;
 			}
 			// Deserailise data
-			if (buffer->length >= 3){
-				self->mainBranch = CBByteArrayGetByte(buffer, 0);
-				self->numBranches = CBByteArrayGetByte(buffer, 1);
-				// Now do orhpans
-				self->numOrphans = CBByteArrayGetByte(buffer, 2);
-				uint8_t cursor = 3;
-				if (buffer->length >= cursor + self->numOrphans*82){
-					for (uint8_t x = 0; x < self->numOrphans; x++) {
-						bool err = false;
-						CBByteArray * data = CBNewByteArraySubReference(buffer, cursor, buffer->length - 56);
-						if (data) {
-							self->orphans[x] = CBNewBlockFromData(data, self->onErrorReceived);
-							if (self->orphans[x]) {
-								// Deserialise
-								uint32_t len = CBBlockDeserialise(self->orphans[x], true);
-								if (len) {
-									data->length = len;
-									// Make orhpan block data a copy of the subreference.
-									CBGetMessage(self->orphans[x])->bytes = CBByteArrayCopy(data);
-									if (CBGetMessage(self->orphans[x])->bytes) {
-										CBReleaseObject(data);
-										CBReleaseObject(data);
-									}else{
-										self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create byte copy for orphan %u",x);
-										err = true;
-									}
-								}else{
-									self->onErrorReceived(CB_ERROR_MESSAGE_SERIALISATION_BAD_BYTES,"Could not deserailise orphan %u",x);
-									err = true;
-								}
-								if (err)
-									CBReleaseObject(self->orphans[x]);
-							}else{
-								self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create block object for orphan %u",x);
-								err = true;
-							}
-							if (err)
-								CBReleaseObject(data);
-						}else{
-							self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create byte reference for orphan %u",x);
-							err = true;
-						}
-						if (err){
-							for (uint8_t y = 0; y < x; y++)
-								CBReleaseObject(self->orphans[y]);
-							CBReleaseObject(buffer);
-							fclose(self->validatorFile);
-							return false;
-						}
-					}
-					// Success
+			if (buffer->length >= BE_VALIDATION_HEADER_SIZE){
+				if (BECRC32C(0, CBByteArrayGetData(buffer), 2) == CBByteArrayReadInt32(buffer, 2)) {
+					self->mainBranch = CBByteArrayGetByte(buffer, 0);
+					self->numBranches = CBByteArrayGetByte(buffer, 1);
 					CBReleaseObject(buffer);
-					// All done
 					return true;
 				}else
-					self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"There is not enough data for the orhpans. %i < %i",buffer->length, cursor + self->numOrphans*82);
+					self->onErrorReceived(CB_ERROR_INIT_FAIL,"The validation data does not have the right checksum.");
 			}else
-				self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"Not enough data for the minimum required data %u < 3",buffer->length);
+				self->onErrorReceived(CB_ERROR_MESSAGE_DESERIALISATION_BAD_BYTES,"Not enough data for the minimum required data %u < %u",buffer->length, BE_VALIDATION_HEADER_SIZE);
 			CBReleaseObject(buffer);
 			fclose(self->validatorFile);
 			return false;
@@ -994,29 +985,319 @@ bool BEFullValidatorLoadValidator(BEFullValidator * self){
 					self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create the data directory.");
 					return false;
 				}
-			// Open validator file
-			self->validatorFile = fopen(validatorFilePath, "wb");
-			free(validatorFilePath);
-			if (NOT self->validatorFile){
-				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the validator file.");
-				return false;
-			}
-			self->numOrphans = 0;
 			self->numBranches = 1;
 			self->mainBranch = 0;
 			// Write initial validator data
 			if(NOT BEFullValidatorSaveValidator(self)){
-				fclose(self->validatorFile);
+				free(validatorFilePath);
 				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not write initial data to the valdiator file.");
 				return false;
 			}
+			// Open validator file
+			self->validatorFile = fopen(validatorFilePath, "rb");
+			free(validatorFilePath);
+			if (NOT self->validatorFile){
+				self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the validator file.");
+				return false;
+			}
 			return true;
 		}
 	}
 	return false;
 }
+bool BEFullValidatorMapBranch(BEFullValidator * self, uint8_t branch, int fd){
+	struct stat st;
+	if (fstat(fd, &st) || (uint64_t)st.st_size < sizeof(BEBranchFileHeader)) {
+		close(fd);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"The file for branch %u is too short.",branch);
+		return false;
+	}
+	// Map privately so that changes to the data are not written to the file, which is only replaced when saving.
+	uint8_t * map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not map the file for branch %u. errno = %i",branch, errno);
+		return false;
+	}
+	BEBranchFileHeader * header = (BEBranchFileHeader *)map;
+	if (memcmp(header->magic, "BEBR", 4) || header->version != BE_BRANCH_FILE_VERSION) {
+		munmap(map, st.st_size);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"The file for branch %u is not a version %u branch file.",branch, BE_BRANCH_FILE_VERSION);
+		return false;
+	}
+	// The data is used directly, so it must have been saved with the same layout.
+	if (header->byteOrder != BE_BRANCH_FILE_BYTE_ORDER || header->referenceSize != sizeof(BEBlockReference)
+		|| header->tableEntrySize != sizeof(BEBlockReferenceHashIndex) || header->outputSize != sizeof(BEOutputReference)) {
+		munmap(map, st.st_size);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"The file for branch %u was saved with a different data layout.",branch);
+		return false;
+	}
+	// Only the header and work are checked here, so that the rest of the file is not read until it is needed.
+	uint64_t outputsOffset = BEFullValidatorGetOutputsOffset(header->numRefs);
+	uint64_t spentOffset = outputsOffset + (uint64_t)header->numUnspentOutputs * sizeof(BEOutputReference);
+	uint64_t workOffset = spentOffset + (uint64_t)header->numSpentOutputs * sizeof(BESpentOutput);
+	if (BECRC32C(0, map, offsetof(BEBranchFileHeader, headerChecksum)) != header->headerChecksum
+		|| header->length != (uint64_t)st.st_size || workOffset + header->workLength != header->length
+		|| BECRC32C(0, map + workOffset, header->workLength) != header->workChecksum) {
+		munmap(map, st.st_size);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"The file for branch %u is corrupt.",branch);
+		return false;
+	}
+	// The work is replaced when blocks are added, so it is copied.
+	BEBlockBranch * branchData = self->branches + branch;
+	if (NOT CBBigIntAlloc(&branchData->work, header->workLength)) {
+		munmap(map, st.st_size);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"CBBigIntAloc failed in BEFullValidatorMapBranch for %u bytes", header->workLength);
+		return false;
+	}
+	branchData->work.length = header->workLength;
+	memcpy(branchData->work.data, map + workOffset, header->workLength);
+	branchData->numRefs = header->numRefs;
+	branchData->references = (BEBlockReference *)(map + sizeof(BEBranchFileHeader));
+	branchData->referenceTable = (BEBlockReferenceHashIndex *)(map + sizeof(BEBranchFileHeader) + (uint64_t)header->numRefs * sizeof(BEBlockReference));
+	branchData->numUnspentOutputs = header->numUnspentOutputs;
+	branchData->unspentOutputs = (BEOutputReference *)(map + outputsOffset);
+	branchData->numSpentOutputs = header->numSpentOutputs;
+	branchData->spentOutputs = (BESpentOutput *)(map + spentOffset);
+	branchData->lastRetargetTime = header->lastRetargetTime;
+	branchData->parentBranch = header->parentBranch;
+	branchData->parentBlockIndex = header->parentBlockIndex;
+	branchData->startHeight = header->startHeight;
+	branchData->lastValidation = header->lastValidation;
+	branchData->map = map;
+	branchData->mapSize = st.st_size;
+	branchData->loaded = BE_BRANCH_SUMMARY;
+	return true;
+}
+BEBlockStatus BEFullValidatorPreCheckHeader(BEFullValidator * self, CBBlock * block, uint64_t networkTime){
+	uint8_t * hash = CBBlockGetHash(block);
+	if (BEFullValidatorIsKnownInvalid(self, hash)) {
+		self->rejectedKnownInvalid++;
+		return BE_BLOCK_STATUS_BAD;
+	}
+	// Check block hash against target and that it is below the maximum allowed target.
+	if (NOT CBValidateProofOfWork(hash, block->target)) {
+		BEFullValidatorAddInvalidBlock(self, hash);
+		self->rejectedPreCheck++;
+		return BE_BLOCK_STATUS_BAD;
+	}
+	// Check the block is within two hours of the network time. The block may become valid later, so it is not remembered.
+	if (block->time > networkTime + 7200) {
+		self->rejectedPreCheck++;
+		return BE_BLOCK_STATUS_BAD_TIME;
+	}
+	// Check block has transactions and not more than can fit in a block. The transactions are not part of the header, so the block is not remembered.
+	if (NOT block->transactionNum || block->transactionNum > BE_MAX_BLOCK_TRANSACTIONS) {
+		self->rejectedPreCheck++;
+		return BE_BLOCK_STATUS_BAD;
+	}
+	return BE_BLOCK_STATUS_CONTINUE;
+}
+BEBlockValidationResult BEFullValidatorPrefetchPrevOuts(BEFullValidator * self, uint8_t branch, CBBlock * block, BEPrevOutMap * prevOuts){
+	// Skip the coinbase transaction.
+	return BEFullValidatorPrefetchTransactionPrevOuts(self, branch, block->transactions + 1, block->transactionNum - 1, prevOuts);
+}
+BEBlockValidationResult BEFullValidatorPrefetchTransactionPrevOuts(BEFullValidator * self, uint8_t branch, CBTransaction ** transactions, uint32_t numTransactions, BEPrevOutMap * prevOuts){
+	prevOuts->numOutputs = 0;
+	prevOuts->outputs = NULL;
+	if (NOT BEFullValidatorLoadBranch(self, branch, BE_BRANCH_ALL))
+		return BE_BLOCK_VALIDATION_ERR;
+	// Count the inputs.
+	uint32_t numInputs = 0;
+	for (uint32_t x = 0; x < numTransactions; x++)
+		numInputs += transactions[x]->inputNum;
+	if (NOT numInputs)
+		return BE_BLOCK_VALIDATION_OK;
+	prevOuts->outputs = malloc(sizeof(*prevOuts->outputs) * numInputs);
+	if (NOT prevOuts->outputs) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the previous outputs in BEFullValidatorPrefetchTransactionPrevOuts.",sizeof(*prevOuts->outputs) * numInputs);
+		return BE_BLOCK_VALIDATION_ERR;
+	}
+	// Collect the previous outputs which are unspent in the branch. Outputs which are not found are either in the same block or pool, or the input is invalid, which is left for the input validation.
+	for (uint32_t x = 0; x < numTransactions; x++) {
+		for (uint32_t y = 0; y < transactions[x]->inputNum; y++) {
+			bool found;
+			CBPrevOut * prevOut = &transactions[x]->inputs[y]->prevOut;
+			uint32_t i = BEFullValidatorFindOutputReference(self->branches[branch].unspentOutputs, self->branches[branch].numUnspentOutputs, CBByteArrayGetData(prevOut->hash), prevOut->index, &found);
+			if (NOT found)
+				continue;
+			BEOutputReference * outRef = self->branches[branch].unspentOutputs + i;
+			BEPrefetchedOutput * prefetched = prevOuts->outputs + prevOuts->numOutputs++;
+			memcpy(prefetched->outputHash, outRef->outputHash, 32);
+			prefetched->outputIndex = outRef->outputIndex;
+			prefetched->ref = outRef->ref;
+			prefetched->height = outRef->height;
+			prefetched->coinbase = outRef->coinbase;
+			prefetched->output = NULL;
+		}
+	}
+	// Sort by position so that reads are made in file order and nearby outputs can be read together.
+	qsort(prevOuts->outputs, prevOuts->numOutputs, sizeof(*prevOuts->outputs), BEFullValidatorComparePrefetchedOutputPositions);
+	// Advise the kernel of every read first so that they are all queued with the disk before we wait on any of them.
+	for (uint32_t x = 0; x < prevOuts->numOutputs; x++)
+		BEBlockStoreAdvise(self->blockStore, prevOuts->outputs[x].ref.fileID, prevOuts->outputs[x].ref.filePos, BE_PREFETCH_OUTPUT_SIZE);
+	// Now read the outputs, merging reads which are close together in the same file.
+	uint8_t * buffer = NULL;
+	uint64_t bufferSize = 0;
+	for (uint32_t x = 0; x < prevOuts->numOutputs;) {
+		// Find the outputs that can be covered by this read.
+		uint32_t end = x + 1;
+		uint64_t readStart = prevOuts->outputs[x].ref.filePos;
+		uint64_t readEnd = readStart + BE_PREFETCH_OUTPUT_SIZE;
+		for (; end < prevOuts->numOutputs; end++) {
+			if (prevOuts->outputs[end].ref.fileID != prevOuts->outputs[x].ref.fileID
+				|| prevOuts->outputs[end].ref.filePos > readEnd + BE_PREFETCH_MAX_GAP)
+				break;
+			readEnd = prevOuts->outputs[end].ref.filePos + BE_PREFETCH_OUTPUT_SIZE;
+		}
+		if (bufferSize < readEnd - readStart) {
+			uint8_t * temp = realloc(buffer, readEnd - readStart);
+			if (NOT temp) {
+				free(buffer);
+				BEFullValidatorFreePrevOutMap(prevOuts);
+				return BE_BLOCK_VALIDATION_ERR;
+			}
+			buffer = temp;
+			bufferSize = readEnd - readStart;
+		}
+		// Do not read past the end of the file.
+		uint16_t runFileID = prevOuts->outputs[x].ref.fileID;
+		uint64_t fileSize = BEBlockStoreGetFileSize(self->blockStore, runFileID);
+		uint64_t readLen = BE_MIN(readEnd, fileSize) - readStart;
+		if (readStart >= fileSize) {
+			free(buffer);
+			BEFullValidatorFreePrevOutMap(prevOuts);
+			return BE_BLOCK_VALIDATION_ERR;
+		}
+		// Use the data straight from the mapping if the file is finished, else read it.
+		uint8_t * runData;
+		bool borrowed = BEBlockStoreBorrow(self->blockStore, runFileID, readStart, (uint32_t)readLen, &runData);
+		if (NOT borrowed) {
+			if (NOT BEBlockStoreRead(self->blockStore, runFileID, readStart, buffer, (uint32_t)readLen)) {
+				free(buffer);
+				BEFullValidatorFreePrevOutMap(prevOuts);
+				return BE_BLOCK_VALIDATION_ERR;
+			}
+			runData = buffer;
+		}
+		// Deserialise each output from the read data.
+		for (; x < end; x++) {
+			uint8_t * bytes = runData + (prevOuts->outputs[x].ref.filePos - readStart);
+			uint64_t available = readStart + readLen > prevOuts->outputs[x].ref.filePos ? readStart + readLen - prevOuts->outputs[x].ref.filePos : 0;
+			if (available < 9) {
+				if (borrowed)
+					BEBlockStoreReturnBlock(self->blockStore, runFileID);
+				free(buffer);
+				BEFullValidatorFreePrevOutMap(prevOuts);
+				return BE_BLOCK_VALIDATION_ERR;
+			}
+			// Get the script size from the var int after the value.
+			uint8_t varIntSize = bytes[8] < 253 ? 0 : (bytes[8] == 253 ? 2 : (bytes[8] == 254 ? 4 : 8));
+			uint32_t scriptSize;
+			if (NOT varIntSize)
+				scriptSize = bytes[8];
+			else{
+				if (available < 9u + varIntSize) {
+					if (borrowed)
+						BEBlockStoreReturnBlock(self->blockStore, runFileID);
+					free(buffer);
+					BEFullValidatorFreePrevOutMap(prevOuts);
+					return BE_BLOCK_VALIDATION_ERR;
+				}
+				scriptSize = 0;
+				for (uint8_t y = 0; y < varIntSize && y < 4; y++)
+					scriptSize |= (uint32_t)bytes[9 + y] << 8*y;
+			}
+			uint64_t scriptPos = 9 + varIntSize;
+			CBScript * script = CBNewScriptOfSize(scriptSize, self->onErrorReceived);
+			if (NOT script) {
+				if (borrowed)
+					BEBlockStoreReturnBlock(self->blockStore, runFileID);
+				free(buffer);
+				BEFullValidatorFreePrevOutMap(prevOuts);
+				return BE_BLOCK_VALIDATION_ERR;
+			}
+			if (available >= scriptPos + scriptSize)
+				memcpy(CBByteArrayGetData(script), bytes + scriptPos, scriptSize);
+			else if (NOT BEBlockStoreRead(self->blockStore, prevOuts->outputs[x].ref.fileID, prevOuts->outputs[x].ref.filePos + scriptPos, CBByteArrayGetData(script), scriptSize)){
+				// A non-standard script which is larger than the prefetched bytes could not be read.
+				CBReleaseObject(script);
+				if (borrowed)
+					BEBlockStoreReturnBlock(self->blockStore, runFileID);
+				free(buffer);
+				BEFullValidatorFreePrevOutMap(prevOuts);
+				return BE_BLOCK_VALIDATION_ERR;
+			}
+			prevOuts->outputs[x].output = CBNewTransactionOutput(bytes[0] | (uint64_t)bytes[1] << 8 | (uint64_t)bytes[2] << 16 | (uint64_t)bytes[3] << 24 | (uint64_t)bytes[4] << 32 | (uint64_t)bytes[5] << 40 | (uint64_t)bytes[6] << 48 | (uint64_t)bytes[7] << 56, script, self->onErrorReceived);
+			CBReleaseObject(script);
+			if (NOT prevOuts->outputs[x].output) {
+				if (borrowed)
+					BEBlockStoreReturnBlock(self->blockStore, runFileID);
+				free(buffer);
+				BEFullValidatorFreePrevOutMap(prevOuts);
+				return BE_BLOCK_VALIDATION_ERR;
+			}
+		}
+		if (borrowed)
+			BEBlockStoreReturnBlock(self->blockStore, runFileID);
+	}
+	free(buffer);
+	// Sort by the output hash and index for lookups during the input validation.
+	qsort(prevOuts->outputs, prevOuts->numOutputs, sizeof(*prevOuts->outputs), BEFullValidatorComparePrefetchedOutputs);
+	return BE_BLOCK_VALIDATION_OK;
+}
 BEBlockStatus BEFullValidatorProcessBlock(BEFullValidator * self, CBBlock * block, uint64_t networkTime){
+	pthread_mutex_lock(&self->lock);
+	BEBlockStatus res = BEFullValidatorProcessBlockWithoutOrphans(self, block, networkTime);
+	if (res != BE_BLOCK_STATUS_MAIN && res != BE_BLOCK_STATUS_SIDE) {
+		pthread_mutex_unlock(&self->lock);
+		return res;
+	}
+	// Connect the orphans which follow the block, breadth first. The queue holds the hashes of the connected blocks whose orphans have not been taken yet.
+	uint32_t queueStart = 0;
+	uint32_t queueEnd = 1;
+	uint32_t queueSize = 8;
+	uint8_t * queue = malloc(32 * queueSize);
+	if (NOT queue) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for the orphan queue in BEFullValidatorProcessBlock.");
+		pthread_cond_signal(&self->backgroundCond);
+		pthread_mutex_unlock(&self->lock);
+		return res;
+	}
+	memcpy(queue, CBBlockGetHash(block), 32);
+	while (queueStart < queueEnd) {
+		CBBlock * orphan;
+		while ((orphan = BEOrphanPoolTakeChild(self->orphanPool, queue + 32*queueStart))) {
+			BEBlockStatus orphanRes = BEFullValidatorProcessBlockWithoutOrphans(self, orphan, networkTime);
+			if (orphanRes == BE_BLOCK_STATUS_MAIN || orphanRes == BE_BLOCK_STATUS_SIDE) {
+				if (queueEnd == queueSize) {
+					uint8_t * temp = realloc(queue, 32 * queueSize * 2);
+					if (NOT temp) {
+						// The orphans which follow this orphan are left in the pool.
+						CBReleaseObject(orphan);
+						continue;
+					}
+					queue = temp;
+					queueSize *= 2;
+				}
+				memcpy(queue + 32*queueEnd++, CBBlockGetHash(orphan), 32);
+			}
+			CBReleaseObject(orphan);
+		}
+		queueStart++;
+	}
+	free(queue);
+	// Side branches may have blocks to validate in the background.
+	pthread_cond_signal(&self->backgroundCond);
+	pthread_mutex_unlock(&self->lock);
+	return res;
+}
+BEBlockStatus BEFullValidatorProcessBlockWithoutOrphans(BEFullValidator * self, CBBlock * block, uint64_t networkTime){
 	bool found;
+	// Reject bad blocks from the header before allocating anything.
+	BEBlockStatus preCheck = BEFullValidatorPreCheckHeader(self, block, networkTime);
+	if (preCheck != BE_BLOCK_STATUS_CONTINUE)
+		return preCheck;
 	// Get transaction hashes.
 	uint8_t * txHashes = malloc(32 * block->transactionNum);
 	if (NOT txHashes)
@@ -1028,6 +1309,10 @@ BEBlockStatus BEFullValidatorProcessBlock(BEFullValidator * self, CBBlock * bloc
 	uint8_t prevBranch = 0;
 	uint32_t prevBlockIndex;
 	for (; prevBranch < self->numBranches; prevBranch++){
+		if (NOT BEFullValidatorLoadBranch(self, prevBranch, BE_BRANCH_REFERENCES)) {
+			free(txHashes);
+			return BE_BLOCK_STATUS_ERROR;
+		}
 		uint32_t refIndex = BEFullValidatorFindBlockReference(self->branches[prevBranch].referenceTable, self->branches[prevBranch].numRefs, CBByteArrayGetData(block->prevBlockHash),&found);
 		if (found){
 			// The block is extending this branch or creating a side branch to this branch
@@ -1037,26 +1322,27 @@ BEBlockStatus BEFullValidatorProcessBlock(BEFullValidator * self, CBBlock * bloc
 	}
 	if (prevBranch == self->numBranches){
 		// Orphan block. End here.
-		if (self->numOrphans == BE_MAX_ORPHAN_CACHE){
+		if (CBGetMessage(block)->bytes->length > self->orphanPool->maxSize){
 			free(txHashes);
 			return BE_BLOCK_STATUS_MAX_CACHE;
 		}
 		// Do basic validation
-		BEBlockStatus res = BEFullValidatorBasicBlockValidation(self, block, txHashes, networkTime);
+		BEBlockStatus res = BEFullValidatorBasicBlockValidation(self, block, txHashes);
 		free(txHashes);
 		if (res != BE_BLOCK_STATUS_CONTINUE)
 			return res;
 		// Add block to orphans
-		if(BEFullValidatorAddBlockToOrphans(self,block))
+		if(BEOrphanPoolAdd(self->orphanPool, block, networkTime))
 			return BE_BLOCK_STATUS_ORPHAN;
 		return BE_BLOCK_STATUS_ERROR;
 	}
 	// Not an orphan. See if this is an extention or new branch.
 	uint8_t branch;
-	if (prevBlockIndex == self->branches[prevBranch].numRefs - 1) {
+	bool newBranch = prevBlockIndex != self->branches[prevBranch].numRefs - 1;
+	if (NOT newBranch) {
 		// Extension
 		// Do basic validation with a copy of the transaction hashes.
-		BEBlockStatus res = BEFullValidatorBasicBlockValidationCopy(self, block, txHashes, networkTime);
+		BEBlockStatus res = BEFullValidatorBasicBlockValidationCopy(self, block, txHashes);
 		if (res != BE_BLOCK_STATUS_CONTINUE){
 			free(txHashes);
 			return res;
@@ -1070,7 +1356,7 @@ BEBlockStatus BEFullValidatorProcessBlock(BEFullValidator * self, CBBlock * bloc
 			return BE_BLOCK_STATUS_MAX_CACHE;
 		}
 		// Do basic validation with a copy of the transaction hashes.
-		BEBlockStatus res = BEFullValidatorBasicBlockValidationCopy(self, block, txHashes, networkTime);
+		BEBlockStatus res = BEFullValidatorBasicBlockValidationCopy(self, block, txHashes);
 		if (res != BE_BLOCK_STATUS_CONTINUE){
 			free(txHashes);
 			return res;
@@ -1080,6 +1366,8 @@ BEBlockStatus BEFullValidatorProcessBlock(BEFullValidator * self, CBBlock * bloc
 		// Record parent branch.
 		self->branches[branch].parentBranch = prevBranch;
 		self->branches[branch].parentBlockIndex = prevBlockIndex;
+		// The branch starts after the fork point.
+		self->branches[branch].startHeight = self->branches[prevBranch].startHeight + prevBlockIndex + 1;
 		// Set retarget time
 		self->branches[branch].lastRetargetTime = self->branches[prevBranch].lastRetargetTime;
 		// Calculate the work
@@ -1098,42 +1386,30 @@ BEBlockStatus BEFullValidatorProcessBlock(BEFullValidator * self, CBBlock * bloc
 			free(tempWork.data); 
 		}
 		self->branches[branch].lastValidation = BE_NO_VALIDATION;
+		self->branches[branch].map = NULL;
+		self->branches[branch].loaded = BE_BRANCH_ALL;
+		self->branches[branch].invalid = self->branches[prevBranch].invalid;
 		self->numBranches++;
 	}
 	// Got branch ready for block. Now process into the branch.
-	BEBlockStatus res = BEFullValidatorProcessIntoBranch(self, block, networkTime, branch, prevBranch, prevBlockIndex, txHashes);
+	BEBlockStatus res = BEFullValidatorProcessIntoBranch(self, block, branch, prevBranch, prevBlockIndex, txHashes);
 	free(txHashes);
-	// Now go through any orphans
-	for (uint8_t x = 0; x < self->numOrphans; x++){
-		if (NOT memcmp(CBBlockGetHash(block), CBByteArrayGetData(self->orphans[x]->prevBlockHash), 32)) {
-			// Moving onto this block.
-			// Make transaction hashes.
-			txHashes = malloc(32 * self->orphans[x]->transactionNum);
-			if (NOT txHashes)
-				break;
-			// Put the hashes for transactions into a list.
-			for (uint32_t x = 0; x < self->orphans[x]->transactionNum; x++)
-				memcpy(txHashes + 32*x, CBTransactionGetHash(self->orphans[x]->transactions[x]), 32);
-			// Process into the branch.
-			if (BEFullValidatorProcessIntoBranch(self, self->orphans[x], networkTime, branch, branch, self->branches[branch].numRefs - 1, txHashes) == BE_BLOCK_STATUS_ERROR)
-				break;
-			// Remove orphan now we are done.
-			CBReleaseObject(self->orphans[x]);
-			self->numOrphans--;
-			if (self->numOrphans > x)
-				// Move orphans down
-				memmove(self->orphans + x, self->orphans + x + 1, sizeof(*self->orphans) * (self->numOrphans - x));
-			// Reset x and set the block as we will now go through the orphans again until no more can be satisfied for this branch.
-			x = 0;
-			block = self->orphans[x];
-		}
+	// The number of branches is saved after the file of the new branch. A new main branch was saved with the validation data already.
+	if (newBranch && res == BE_BLOCK_STATUS_SIDE && NOT BEFullValidatorSaveValidator(self)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not save the new branch in BEFullValidatorProcessBlockWithoutOrphans.");
+		res = BE_BLOCK_STATUS_ERROR;
 	}
+	// The new branch is only kept if the block was added to it.
+	if (newBranch && res != BE_BLOCK_STATUS_SIDE && res != BE_BLOCK_STATUS_MAIN && branch != self->mainBranch)
+		BEFullValidatorRemoveBranch(self, branch);
 	return res;
 }
-BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock * block, uint64_t networkTime, uint8_t branch, uint8_t prevBranch, uint32_t prevBlockIndex, uint8_t * txHashes){
-	// Check timestamp
-	if (block->time <= BEFullValidatorGetMedianTime(self, prevBranch, prevBlockIndex))
+BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock * block, uint8_t branch, uint8_t prevBranch, uint32_t prevBlockIndex, uint8_t * txHashes){
+	// Check timestamp. This and the target only depend on the header and the previous blocks, so failing blocks are remembered.
+	if (block->time <= BEFullValidatorGetMedianTime(self, prevBranch, prevBlockIndex)) {
+		BEFullValidatorAddInvalidBlock(self, CBBlockGetHash(block));
 		return BE_BLOCK_STATUS_BAD;
+	}
 	uint32_t target;
 	bool change = NOT ((self->branches[prevBranch].startHeight + prevBlockIndex + 1) % 2016);
 	if (change)
@@ -1142,8 +1418,10 @@ BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock *
 	else
 		target = self->branches[prevBranch].references[prevBlockIndex].target;
 	// Check target
-	if (block->target != target)
+	if (block->target != target) {
+		BEFullValidatorAddInvalidBlock(self, CBBlockGetHash(block));
 		return BE_BLOCK_STATUS_BAD;
+	}
 	// Calculate total work
 	CBBigInt work;
 	if (NOT CBCalculateBlockWork(&work, block->target))
@@ -1154,82 +1432,34 @@ BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock *
 		// Check if the block is adding to a side branch without becoming the main branch
 		if (CBBigIntCompareToBigInt(&work,&self->branches[self->mainBranch].work) != CB_COMPARE_MORE_THAN){
 			// Add to branch without complete validation
-			if (NOT BEFullValidatorAddBlockToBranch(self, branch, block, work))
+			if (NOT BEFullValidatorAddBlockToBranch(self, branch, block, work, NULL))
 				// Failure in adding block.
 				return BE_BLOCK_STATUS_ERROR;
+			// On failure the old branch file is kept, which is consistent with the block files, and the branch is saved with the next block. A new branch has no old file, so the block fails.
+			if (NOT BEFullValidatorSaveBranchValidator(self, branch) && self->branches[branch].numRefs == 1)
+				return BE_BLOCK_STATUS_ERROR;
 			return BE_BLOCK_STATUS_SIDE;
 		}
-		// Potential block-chain reorganisation. Validate the side branch. THIS NEEDS TO START AT THE FIRST BRANCH BACK WHERE VALIDATION IS NOT COMPLETE AND GO UP THROUGH THE BLOCKS VALIDATING THEM. Includes Prior Branches!
-		uint8_t tempBranch = prevBranch;
-		uint32_t lastBlocks[3]; // Used to store the last blocks in each branch going to the branch we are validating for.
-		uint8_t lastBlocksIndex = 3; // The starting point of lastBlocks. If 3 then we are only validating the branch we added to.
-		uint8_t branches[3]; // Branches to go to after the last blocks.
-		// Go back until we find the branch with validated blocks in it.
-		uint32_t tempBlockIndex;
-		for (;;){
-			if (self->branches[tempBranch].lastValidation == BE_NO_VALIDATION){
-				// No validation on this branch
-				if (self->branches[self->branches[tempBranch].parentBranch].lastValidation >= self->branches[tempBranch].parentBlockIndex) {
-					// Parent fully validated upto last index, start at begining of the this branch.
-					tempBlockIndex = 0;
-					break;
-				}
-				branches[--lastBlocksIndex] = tempBranch;
-				tempBranch = self->branches[tempBranch].parentBranch;
-				lastBlocks[lastBlocksIndex] = self->branches[tempBranch].parentBlockIndex;
-			}else{
-				// Not fully validated. Start at last validation plus one.
-				tempBlockIndex = self->branches[tempBranch].lastValidation + 1;
-				break;
-			}
-		}
-		// Now validate all blocks going up.
-		uint8_t * txHashes2 = NULL;
-		uint32_t txHashes2AllocSize = 0;
-		while (tempBlockIndex != self->branches[branch].numRefs - 1 || tempBranch != branch) {
-			// Get block
-			CBBlock * tempBlock = BEFullValidatorLoadBlock(self, self->branches[tempBranch].references[tempBlockIndex],tempBranch);
-			if (NOT tempBlock){
-				free(txHashes2);
-				return BE_BLOCK_STATUS_ERROR;
-			}
-			// Get transaction hashes
-			if (txHashes2AllocSize < tempBlock->transactionNum * 32) {
-				txHashes2AllocSize = tempBlock->transactionNum * 32;
-				uint8_t * temp = realloc(txHashes2, txHashes2AllocSize);
-				if (NOT temp){
-					free(txHashes2);
-					return BE_BLOCK_STATUS_ERROR;
-				}
-				txHashes2 = temp;
-			}
-			for (uint32_t x = 0; x < tempBlock->transactionNum; x++)
-				memcpy(txHashes2 + 32*x, CBTransactionGetHash(tempBlock->transactions[x]), 32);
-			// Validate block
-			BEBlockValidationResult res = BEFullValidatorCompleteBlockValidation(self, tempBranch, tempBlock, txHashes2, self->branches[tempBranch].startHeight + tempBlockIndex);
+		// Potential block-chain reorganisation. Validate the blocks of the side branch, and of the branches it follows, which have not been validated. Blocks validated in the background are not validated again.
+		if (self->branches[branch].invalid)
+			return BE_BLOCK_STATUS_BAD;
+		for (bool done = false; NOT done;) {
+			BEBlockValidationResult res = BEFullValidatorValidateNextBlock(self, branch, &done);
 			if (res == BE_BLOCK_VALIDATION_BAD){
-				free(txHashes2);
+				self->branches[branch].invalid = true;
 				return BE_BLOCK_STATUS_BAD;
 			}
-			if (res == BE_BLOCK_VALIDATION_ERR){
-				free(txHashes2);
+			if (res == BE_BLOCK_VALIDATION_ERR)
 				return BE_BLOCK_STATUS_ERROR;
-			}
-			// This block passed validation. Move onto next block.
-			if (tempBlockIndex == lastBlocks[lastBlocksIndex]) {
-				// Came to the last block in the branch
-				tempBranch = branches[lastBlocksIndex];
-				tempBlockIndex = 0;
-				lastBlocksIndex++;
-			}else
-				tempBlockIndex++;
-			CBReleaseObject(tempBlock);
 		}
-		free(txHashes2);
 		// Now we validate the block for the new main chain.
 	}
 	// We are just validating a new block on the main chain
-	BEBlockValidationResult res = BEFullValidatorCompleteBlockValidation(self, branch, block, txHashes, self->branches[branch].startHeight + self->branches[branch].numRefs);
+	// A new branch starts from the unspent outputs at the fork, now that the branches it follows are validated.
+	if (self->branches[branch].lastValidation == BE_NO_VALIDATION && NOT BEFullValidatorSetForkOutputs(self, branch))
+		return BE_BLOCK_STATUS_ERROR;
+	BEPrevOutMap prevOuts;
+	BEBlockValidationResult res = BEFullValidatorCompleteBlockValidation(self, branch, block, txHashes, self->branches[branch].startHeight + self->branches[branch].numRefs, &prevOuts);
 	switch (res) {
 		case BE_BLOCK_VALIDATION_BAD:
 			return BE_BLOCK_STATUS_BAD;
@@ -1238,80 +1468,612 @@ BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock *
 		case BE_BLOCK_VALIDATION_OK:
 			// Update branch and unspent outputs.
 			self->branches[branch].lastValidation = self->branches[branch].numRefs;
-			if (NOT BEFullValidatorAddBlockToBranch(self, branch, block, work))
+			bool added = BEFullValidatorAddBlockToBranch(self, branch, block, work, &prevOuts);
+			BEFullValidatorFreePrevOutMap(&prevOuts);
+			if (NOT added)
 				// Failure in adding block.
 				return BE_BLOCK_STATUS_ERROR;
+			if (branch != self->mainBranch) {
+				// The side branch has become the main branch. The transaction pool was validated against the old main branch, so it is cleared. The transactions of the blocks taken off the main branch are not returned to the pool.
+				self->mainBranch = branch;
+				BEMempoolClear(self->mempool);
+				// The branch is saved before the validation data refers to it as the main branch.
+				if (NOT BEFullValidatorSaveBranchValidator(self, branch) || NOT BEFullValidatorSaveValidator(self)) {
+					self->onErrorReceived(CB_ERROR_GENERAL,"Could not save the new main branch in BEFullValidatorProcessIntoBranch.");
+					return BE_BLOCK_STATUS_ERROR;
+				}
+			}else{
+				// As for side branches, the old branch file is kept on failure.
+				BEFullValidatorSaveBranchValidator(self, branch);
+				BEMempoolRemoveBlock(self->mempool, block, txHashes);
+			}
+			// Keep the merkle tree for merkle branches. Failing to keep it does not affect the block.
+			if (self->merkleCache)
+				BEMerkleCacheAdd(self->merkleCache, CBBlockGetHash(block), txHashes, block->transactionNum);
+			// Failing to update the filter index does not affect the block. It is updated again with the next block.
+			BEFullValidatorUpdateFilterIndex(self);
+			if (self->txIndex)
+				BEFullValidatorUpdateTxIndex(self, block);
+			// Remove old block data if the block started a new block file. Failing to prune does not affect the block.
+			BEFullValidatorPrune(self);
 			return BE_BLOCK_STATUS_MAIN;
 	}
 }
+bool BEFullValidatorPrune(BEFullValidator * self){
+	if (NOT self->pruneTarget && NOT self->pruneDepth)
+		return true;
+	// Only finished files are pruned, so there is only more to prune once a file is started.
+	uint16_t numFiles = BEBlockStoreGetNumFiles(self->blockStore);
+	if (numFiles == self->prunedAtNumFiles)
+		return true;
+	if (NOT self->fileOutputsCounted && NOT BEFullValidatorCountFileOutputs(self))
+		return false;
+	// Find the height of the highest block of any branch in each file.
+	uint32_t * fileHeights = calloc(numFiles, sizeof(*fileHeights));
+	if (NOT fileHeights) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the block file heights in BEFullValidatorPrune.",sizeof(*fileHeights) * numFiles);
+		return false;
+	}
+	for (uint8_t x = 0; x < self->numBranches; x++)
+		for (uint32_t y = 0; y < self->branches[x].numRefs; y++) {
+			uint16_t fileID = self->branches[x].references[y].ref.fileID;
+			if (fileID < numFiles && self->branches[x].startHeight + y > fileHeights[fileID])
+				fileHeights[fileID] = self->branches[x].startHeight + y;
+		}
+	// Keep the blocks in the reorganisation window.
+	uint32_t tipHeight = self->branches[self->mainBranch].startHeight + self->branches[self->mainBranch].numRefs - 1;
+	uint32_t depth = BE_MAX(self->pruneDepth, BE_PRUNE_MIN_DEPTH);
+	uint32_t sizeDepth = BE_PRUNE_MIN_DEPTH;
+	uint64_t usage = self->pruneTarget ? BEBlockStoreGetDiskUsage(self->blockStore) : 0;
+	bool ok = true;
+	// Go through the finished files from the oldest.
+	for (uint16_t x = 0; x + 1 < numFiles; x++) {
+		// Files with unspent outputs are needed for input validation.
+		if (x < self->fileOutputsLength && self->fileOutputs[x])
+			continue;
+		bool prune = self->pruneDepth && fileHeights[x] + depth <= tipHeight;
+		if (NOT prune && self->pruneTarget && usage > (uint64_t)self->pruneTarget * 1048576)
+			prune = fileHeights[x] + sizeDepth <= tipHeight;
+		if (NOT prune)
+			continue;
+		if (NOT BEBlockStorePruneFile(self->blockStore, x)) {
+			ok = false;
+			continue;
+		}
+		if (self->pruneTarget)
+			usage = BEBlockStoreGetDiskUsage(self->blockStore);
+	}
+	free(fileHeights);
+	self->prunedAtNumFiles = numFiles;
+	return ok;
+}
+void BEFullValidatorRemoveBranch(BEFullValidator * self, uint8_t branch){
+	// New branches are never mapped.
+	BEBlockBranch * branchData = self->branches + branch;
+	for (uint32_t x = 0; x < branchData->numUnspentOutputs; x++)
+		BEFullValidatorRemoveFileOutput(self, branchData->unspentOutputs[x].ref.fileID);
+	for (uint32_t x = 0; x < branchData->numSpentOutputs; x++)
+		BEFullValidatorRemoveFileOutput(self, branchData->spentOutputs[x].output.ref.fileID);
+	free(branchData->references);
+	free(branchData->referenceTable);
+	free(branchData->unspentOutputs);
+	free(branchData->spentOutputs);
+	free(branchData->work.data);
+	branchData->numRefs = 0;
+	branchData->references = NULL;
+	branchData->referenceTable = NULL;
+	branchData->numUnspentOutputs = 0;
+	branchData->unspentOutputs = NULL;
+	branchData->numSpentOutputs = 0;
+	branchData->spentOutputs = NULL;
+	branchData->work.data = NULL;
+	branchData->loaded = BE_BRANCH_NOT_LOADED;
+	self->numBranches--;
+}
+void BEFullValidatorRemoveFileOutput(BEFullValidator * self, uint16_t fileID){
+	if (self->fileOutputsCounted && fileID < self->fileOutputsLength && self->fileOutputs[fileID])
+		self->fileOutputs[fileID]--;
+}
+bool BEFullValidatorReplaceFile(BEFullValidator * self, char * fileName, struct iovec * parts, uint8_t numParts){
+	// Write and sync a temporary file before renaming it over the old file, so that the file has either the old data or the new data. Mappings of the old file are not affected.
+	char filePath[strlen(self->dataDir) + strlen(fileName) + 1];
+	char tempPath[strlen(self->dataDir) + strlen(fileName) + 5];
+	sprintf(filePath, "%s%s", self->dataDir, fileName);
+	sprintf(tempPath, "%s.tmp", filePath);
+	int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not open %s. errno = %i",tempPath, errno);
+		return false;
+	}
+	bool ok = true;
+	for (uint8_t x = 0; ok && x < numParts; x++) {
+		uint8_t * data = parts[x].iov_base;
+		for (size_t written = 0; ok && written < parts[x].iov_len;) {
+			ssize_t res = write(fd, data + written, parts[x].iov_len - written);
+			if (res == -1 && errno == EINTR)
+				continue;
+			ok = res > 0;
+			written += res;
+		}
+	}
+	ok = ok && NOT fsync(fd);
+	close(fd);
+	ok = ok && NOT rename(tempPath, filePath);
+	// Sync the directory so that the rename is durable.
+	if (ok) {
+		int dirFd = open(self->dataDir, O_RDONLY);
+		ok = dirFd != -1 && NOT fsync(dirFd);
+		if (dirFd != -1)
+			close(dirFd);
+	}
+	if (NOT ok)
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not replace %s. errno = %i",filePath, errno);
+	return ok;
+}
 bool BEFullValidatorSaveBranchValidator(BEFullValidator * self, uint8_t branch){
-	// Serailise into byte array and then write the byte array to the file.
-	CBByteArray * data = CBNewByteArrayOfSize(self->branches[branch].numRefs*54 + self->branches[branch].numUnspentOutputs*52 + 26 + self->branches[branch].work.length, self->onErrorReceived);
-	if (NOT data)
+	// The file has the same layout as the data in memory, so the arrays are written as they are. The arrays are checked first so that corrupt data is not saved with new checksums.
+	if (NOT BEFullValidatorLoadBranch(self, branch, BE_BRANCH_ALL))
+		return false;
+	BEBlockBranch * branchData = self->branches + branch;
+	BEBranchFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "BEBR", 4);
+	header.version = BE_BRANCH_FILE_VERSION;
+	header.byteOrder = BE_BRANCH_FILE_BYTE_ORDER;
+	header.referenceSize = sizeof(BEBlockReference);
+	header.tableEntrySize = sizeof(BEBlockReferenceHashIndex);
+	header.outputSize = sizeof(BEOutputReference);
+	header.parentBranch = branchData->parentBranch;
+	header.workLength = branchData->work.length;
+	header.numRefs = branchData->numRefs;
+	header.numUnspentOutputs = branchData->numUnspentOutputs;
+	header.numSpentOutputs = branchData->numSpentOutputs;
+	header.lastRetargetTime = branchData->lastRetargetTime;
+	header.parentBlockIndex = branchData->parentBlockIndex;
+	header.startHeight = branchData->startHeight;
+	header.lastValidation = branchData->lastValidation;
+	uint64_t tableEnd = sizeof(header) + (uint64_t)branchData->numRefs * (sizeof(BEBlockReference) + sizeof(BEBlockReferenceHashIndex));
+	uint64_t outputsOffset = BEFullValidatorGetOutputsOffset(branchData->numRefs);
+	header.length = outputsOffset + (uint64_t)branchData->numUnspentOutputs * sizeof(BEOutputReference) + (uint64_t)branchData->numSpentOutputs * sizeof(BESpentOutput) + branchData->work.length;
+	uint8_t padding[BE_BRANCH_FILE_ALIGNMENT] = {0};
+	struct iovec parts[7] = {
+		{&header, sizeof(header)},
+		{branchData->references, (size_t)branchData->numRefs * sizeof(BEBlockReference)},
+		{branchData->referenceTable, (size_t)branchData->numRefs * sizeof(BEBlockReferenceHashIndex)},
+		{padding, outputsOffset - tableEnd},
+		{branchData->unspentOutputs, (size_t)branchData->numUnspentOutputs * sizeof(BEOutputReference)},
+		{branchData->spentOutputs, (size_t)branchData->numSpentOutputs * sizeof(BESpentOutput)},
+		{branchData->work.data, branchData->work.length},
+	};
+	header.referencesChecksum = BECRC32C(BECRC32C(0, parts[1].iov_base, parts[1].iov_len), parts[2].iov_base, parts[2].iov_len);
+	header.outputsChecksum = BECRC32C(BECRC32C(BECRC32C(0, parts[3].iov_base, parts[3].iov_len), parts[4].iov_base, parts[4].iov_len), parts[5].iov_base, parts[5].iov_len);
+	header.workChecksum = BECRC32C(0, parts[6].iov_base, parts[6].iov_len);
+	header.headerChecksum = BECRC32C(0, (uint8_t *)&header, offsetof(BEBranchFileHeader, headerChecksum));
+	// The branch refers to blocks and filters, so make them durable before the branch.
+	if (NOT BEBlockStoreSync(self->blockStore) || NOT BEFilterIndexSyncFilters(self->filterIndex))
+		return false;
+	// Replace the branch file.
+	char fileName[16];
+	sprintf(fileName, "branch%u.dat", branch);
+	return BEFullValidatorReplaceFile(self, fileName, parts, 7);
+}
+bool BEFullValidatorSaveValidator(BEFullValidator * self){
+	uint8_t header[BE_VALIDATION_HEADER_SIZE] = {self->mainBranch,self->numBranches};
+	uint32_t crc = BECRC32C(0, header, 2);
+	for (uint8_t x = 0; x < 4; x++)
+		header[2 + x] = crc >> 8*x;
+	// Replace the file so that it refers either to the old branches or to the new branches, which are saved first.
+	struct iovec part = {header, BE_VALIDATION_HEADER_SIZE};
+	return BEFullValidatorReplaceFile(self, BE_VALIDATION_DATA_FILE, &part, 1);
+}
+bool BEFullValidatorSetForkOutputs(BEFullValidator * self, uint8_t branch){
+	BEBlockBranch * branchData = self->branches + branch;
+	BEBlockBranch * parentData = self->branches + branchData->parentBranch;
+	if (NOT BEFullValidatorLoadBranch(self, branchData->parentBranch, BE_BRANCH_ALL)
+		|| NOT BEFullValidatorLoadBranch(self, branch, BE_BRANCH_ALL)
+		|| NOT BEFullValidatorUnmapBranch(self, branch))
+		return false;
+	// The outputs of the branch it follows are at its last validated block. Going back to the fork needs the outputs spent since the fork.
+	uint32_t forkHeight = parentData->startHeight + branchData->parentBlockIndex;
+	uint32_t validatedHeight = parentData->startHeight + parentData->lastValidation;
+	if (parentData->lastValidation == BE_NO_VALIDATION || validatedHeight < forkHeight || validatedHeight - forkHeight > BE_SPENT_OUTPUT_DEPTH) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"The unspent outputs at the fork of branch %u cannot be found from branch %u in BEFullValidatorSetForkOutputs.",branch, branchData->parentBranch);
 		return false;
-	CBByteArraySetInt32(data, 0, self->branches[branch].numRefs);
-	uint32_t cursor = 4;
-	for (uint32_t x = 0; x < self->branches[branch].numRefs; x++) {
-		// Data for block reference
-		CBByteArraySetInt16(data, cursor, self->branches[branch].references[x].ref.fileID);
-		cursor += 2;
-		CBByteArraySetInt64(data, cursor, self->branches[branch].references[x].ref.filePos);
-		cursor += 8;
-		CBByteArraySetInt32(data, cursor, self->branches[branch].references[x].target);
-		cursor += 4;
-		CBByteArraySetInt32(data, cursor, self->branches[branch].references[x].time);
-		cursor += 4;
-		// Data for block reference index
-		CBByteArraySetBytes(data, cursor, self->branches[branch].referenceTable[x].blockHash, 32);
-		cursor += 32;
-		CBByteArraySetInt32(data, cursor, self->branches[branch].referenceTable[x].index);
-		cursor += 4;
 	}
-	CBByteArraySetInt32(data, cursor, self->branches[branch].lastRetargetTime);
-	cursor += 4;
-	CBByteArraySetByte(data, cursor, self->branches[branch].parentBranch);
-	cursor++;
-	CBByteArraySetInt32(data, cursor, self->branches[branch].parentBlockIndex);
-	cursor+= 4;
-	CBByteArraySetInt32(data, cursor, self->branches[branch].startHeight);
-	cursor+= 4;
-	CBByteArraySetInt32(data, cursor, self->branches[branch].lastValidation);
-	cursor+= 4;
-	CBByteArraySetInt32(data, cursor, self->branches[branch].numUnspentOutputs);
-	cursor += 4;
-	for (uint32_t x = 0; x < self->branches[branch].numUnspentOutputs; x++) {
-		CBByteArraySetBytes(data, cursor, self->branches[branch].unspentOutputs[x].outputHash, 32);
-		cursor += 32;
-		CBByteArraySetInt32(data, cursor, self->branches[branch].unspentOutputs[x].outputIndex);
-		cursor += 4;
-		CBByteArraySetInt16(data, cursor, self->branches[branch].unspentOutputs[x].ref.fileID);
-		cursor += 2;
-		CBByteArraySetInt64(data, cursor, self->branches[branch].unspentOutputs[x].ref.filePos);
-		cursor += 8;
-		CBByteArraySetInt32(data, cursor, self->branches[branch].unspentOutputs[x].height);
-		cursor += 4;
-		CBByteArraySetByte(data, cursor, self->branches[branch].unspentOutputs[x].coinbase);
-		cursor += 1;
-		CBByteArraySetInt32(data, cursor, self->branches[branch].unspentOutputs[x].branch);
-		cursor += 1;
-	}
-	CBByteArraySetByte(data, cursor, self->branches[branch].work.length);
-	cursor++;
-	CBByteArraySetBytes(data, cursor, self->branches[branch].work.data, self->branches[branch].work.length);
-	// Write data to file.
-	fseek(self->branches[0].branchValidationFile, 0, SEEK_SET);
-	size_t res = fwrite(CBByteArrayGetData(data), 1, data->length, self->branches[0].branchValidationFile);
-	CBReleaseObject(data);
-	if (res != cursor + self->branches[branch].work.length)
+	// Find the outputs which were unspent at the fork but were spent after it, sorted to be merged with the outputs which are still unspent.
+	uint32_t numForkSpent = 0;
+	for (uint32_t x = 0; x < parentData->numSpentOutputs; x++)
+		if (parentData->spentOutputs[x].output.height <= forkHeight && parentData->spentOutputs[x].spentHeight > forkHeight)
+			numForkSpent++;
+	BESpentOutput * forkSpent = malloc(sizeof(*forkSpent) * BE_MAX(numForkSpent, 1));
+	BEOutputReference * unspentOutputs = realloc(branchData->unspentOutputs, sizeof(*unspentOutputs) * BE_MAX(parentData->numUnspentOutputs + numForkSpent, 1));
+	if (NOT forkSpent || NOT unspentOutputs) {
+		free(forkSpent);
+		if (unspentOutputs)
+			branchData->unspentOutputs = unspentOutputs;
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for the unspent outputs at the fork in BEFullValidatorSetForkOutputs.");
 		return false;
-	// Flush data
-	fflush(self->branches[0].branchValidationFile);
+	}
+	branchData->unspentOutputs = unspentOutputs;
+	numForkSpent = 0;
+	for (uint32_t x = 0; x < parentData->numSpentOutputs; x++)
+		if (parentData->spentOutputs[x].output.height <= forkHeight && parentData->spentOutputs[x].spentHeight > forkHeight)
+			forkSpent[numForkSpent++] = parentData->spentOutputs[x];
+	qsort(forkSpent, numForkSpent, sizeof(*forkSpent), BEFullValidatorCompareSpentOutputs);
+	// Replace the outputs of an earlier attempt which failed to validate the first block.
+	for (uint32_t x = 0; x < branchData->numUnspentOutputs; x++)
+		BEFullValidatorRemoveFileOutput(self, branchData->unspentOutputs[x].ref.fileID);
+	branchData->numUnspentOutputs = 0;
+	// Merge the outputs from before the fork which are still unspent with the spent outputs.
+	uint32_t spentIndex = 0;
+	for (uint32_t x = 0; x < parentData->numUnspentOutputs || spentIndex < numForkSpent;) {
+		BEOutputReference * output;
+		if (spentIndex == numForkSpent)
+			output = parentData->unspentOutputs + x++;
+		else if (x == parentData->numUnspentOutputs)
+			output = &forkSpent[spentIndex++].output;
+		else{
+			int res = memcmp(parentData->unspentOutputs[x].outputHash, forkSpent[spentIndex].output.outputHash, 32);
+			if (res < 0 || (NOT res && parentData->unspentOutputs[x].outputIndex < forkSpent[spentIndex].output.outputIndex))
+				output = parentData->unspentOutputs + x++;
+			else
+				output = &forkSpent[spentIndex++].output;
+		}
+		if (output->height > forkHeight)
+			// Added after the fork.
+			continue;
+		branchData->unspentOutputs[branchData->numUnspentOutputs++] = *output;
+		BEFullValidatorAddFileOutput(self, output->ref.fileID);
+	}
+	free(forkSpent);
 	return true;
 }
-bool BEFullValidatorSaveValidator(BEFullValidator * self){
-	fseek(self->validatorFile, 0, SEEK_SET);
-	if (fwrite((uint8_t []){self->mainBranch,self->numBranches,self->numOrphans}, 1, 3, self->validatorFile) != 3)
+bool BEFullValidatorStartBackgroundValidation(BEFullValidator * self){
+	if (self->backgroundRunning)
+		return true;
+	self->stopBackground = false;
+	if (pthread_create(&self->backgroundThread, NULL, BEFullValidatorBackgroundValidation, self)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not start the background validation thread.");
 		return false;
-	fflush(self->validatorFile);
+	}
+	self->backgroundRunning = true;
 	return true;
 }
+void BEFullValidatorStopBackgroundValidation(BEFullValidator * self){
+	if (NOT self->backgroundRunning)
+		return;
+	pthread_mutex_lock(&self->lock);
+	self->stopBackground = true;
+	pthread_cond_signal(&self->backgroundCond);
+	pthread_mutex_unlock(&self->lock);
+	pthread_join(self->backgroundThread, NULL);
+	self->backgroundRunning = false;
+}
+bool BEFullValidatorUnmapBranch(BEFullValidator * self, uint8_t branch){
+	BEBlockBranch * branchData = self->branches + branch;
+	if (NOT branchData->map)
+		return true;
+	// Allocate at least one element so that NULL only means failure.
+	BEBlockReference * references = malloc(sizeof(*references) * BE_MAX(branchData->numRefs, 1));
+	BEBlockReferenceHashIndex * referenceTable = malloc(sizeof(*referenceTable) * BE_MAX(branchData->numRefs, 1));
+	BEOutputReference * unspentOutputs = malloc(sizeof(*unspentOutputs) * BE_MAX(branchData->numUnspentOutputs, 1));
+	BESpentOutput * spentOutputs = malloc(sizeof(*spentOutputs) * BE_MAX(branchData->numSpentOutputs, 1));
+	if (NOT references || NOT referenceTable || NOT unspentOutputs || NOT spentOutputs) {
+		free(references);
+		free(referenceTable);
+		free(unspentOutputs);
+		free(spentOutputs);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory to copy the data for branch %u in BEFullValidatorUnmapBranch.",branch);
+		return false;
+	}
+	memcpy(references, branchData->references, sizeof(*references) * branchData->numRefs);
+	memcpy(referenceTable, branchData->referenceTable, sizeof(*referenceTable) * branchData->numRefs);
+	memcpy(unspentOutputs, branchData->unspentOutputs, sizeof(*unspentOutputs) * branchData->numUnspentOutputs);
+	memcpy(spentOutputs, branchData->spentOutputs, sizeof(*spentOutputs) * branchData->numSpentOutputs);
+	munmap(branchData->map, branchData->mapSize);
+	branchData->references = references;
+	branchData->referenceTable = referenceTable;
+	branchData->unspentOutputs = unspentOutputs;
+	branchData->spentOutputs = spentOutputs;
+	branchData->map = NULL;
+	return true;
+}
+bool BEFullValidatorUpdateFilterIndex(BEFullValidator * self){
+	if (NOT BEFullValidatorLoadBranch(self, self->mainBranch, BE_BRANCH_REFERENCES))
+		return false;
+	uint32_t numBlocks = self->branches[self->mainBranch].startHeight + self->branches[self->mainBranch].numRefs;
+	// Remove heights from the end of the index until the filter is the filter of the main chain block. Filter positions are never reused, so they identify the blocks. Usually only the last height is checked.
+	BEFilterIndex * index = self->filterIndex;
+	while (index->numFilters) {
+		uint32_t height = index->numFilters - 1;
+		uint64_t filterPos;
+		uint8_t header[32];
+		if (height < numBlocks && BEFilterIndexGetEntry(index, height, &filterPos, header)) {
+			BEBlockReference * ref = BEFullValidatorGetMainChainReference(self, height);
+			if (NOT ref)
+				return false;
+			if (ref->filterPos == filterPos)
+				break;
+		}
+		if (NOT BEFilterIndexTruncate(index, height))
+			return false;
+	}
+	// Add the filters of the main chain blocks after the index.
+	while (index->numFilters < numBlocks) {
+		BEBlockReference * ref = BEFullValidatorGetMainChainReference(self, index->numFilters);
+		if (NOT ref)
+			return false;
+		if (ref->filterPos == BE_NO_FILTER && NOT index->numFilters) {
+			// The genesis block only has a coinbase transaction, so its filter needs no previous outputs.
+			CBBlock * genesis = BEFullValidatorLoadBlock(self, *ref);
+			if (NOT genesis)
+				return false;
+			BEPrevOutMap prevOuts = {0, NULL};
+			if (CBBlockDeserialise(genesis, true))
+				ref->filterPos = BEFullValidatorAddFilter(self, genesis, &prevOuts);
+			CBReleaseObject(genesis);
+		}
+		if (ref->filterPos == BE_NO_FILTER)
+			// The block has not been validated, or building its filter failed.
+			return false;
+		if (NOT BEFilterIndexAppend(index, ref->filterPos))
+			return false;
+	}
+	return true;
+}
+bool BEFullValidatorUpdateTxIndex(BEFullValidator * self, CBBlock * block){
+	if (NOT BEFullValidatorLoadBranch(self, self->mainBranch, BE_BRANCH_REFERENCES))
+		return false;
+	uint32_t numBlocks = self->branches[self->mainBranch].startHeight + self->branches[self->mainBranch].numRefs;
+	// Remove the last blocks of the index until the last block is in the main chain. Blocks are stored once and never moved, so their positions identify them.
+	BETxIndex * index = self->txIndex;
+	while (index->numBlocks) {
+		uint32_t height = index->numBlocks - 1;
+		if (height < numBlocks) {
+			BEBlockReference * ref = BEFullValidatorGetMainChainReference(self, height);
+			if (NOT ref)
+				return false;
+			if (ref->ref.fileID == index->tipRef.fileID && ref->ref.filePos == index->tipRef.filePos)
+				break;
+		}
+		BEBlockReference tipRef = {.ref = index->tipRef};
+		CBBlock * removed = BEFullValidatorLoadBlock(self, tipRef);
+		if (NOT removed)
+			return false;
+		BEFileReference prevRef = {0, 0};
+		bool ok = CBBlockDeserialise(removed, true)
+			&& (NOT height || BEBlockStoreFindBlock(self->blockStore, CBByteArrayGetData(removed->prevBlockHash), &prevRef))
+			&& BETxIndexRemoveBlock(index, removed, prevRef);
+		CBReleaseObject(removed);
+		if (NOT ok) {
+			self->onErrorReceived(CB_ERROR_GENERAL,"Could not remove the transactions of the block at height %u from the transaction index.",height);
+			return false;
+		}
+	}
+	// Add the transactions of the main chain blocks after the index.
+	while (index->numBlocks < numBlocks) {
+		BEBlockReference * ref = BEFullValidatorGetMainChainReference(self, index->numBlocks);
+		if (NOT ref)
+			return false;
+		CBBlock * added = block && index->numBlocks == numBlocks - 1 ? block : BEFullValidatorLoadBlock(self, *ref);
+		if (NOT added)
+			return false;
+		bool ok = (added == block || CBBlockDeserialise(added, true)) && BETxIndexAddBlock(index, added, ref->ref);
+		if (added != block)
+			CBReleaseObject(added);
+		if (NOT ok) {
+			self->onErrorReceived(CB_ERROR_GENERAL,"Could not add the transactions of the block at height %u to the transaction index.",index->numBlocks);
+			return false;
+		}
+	}
+	return true;
+}
+bool BEFullValidatorUpdateUnspentOutputs(BEFullValidator * self, uint8_t branch, CBBlock * block, BEFileReference blockRef, uint32_t height){
+	BEBlockBranch * branchData = self->branches + branch;
+	// Make room for the new unspent outputs and the spent outputs first so that nothing is changed on failure. Outputs are added before the outputs spent by the next transaction are removed, so the inputs are not taken off.
+	uint32_t numUnspentOutputs = branchData->numUnspentOutputs;
+	uint32_t numSpentOutputs = branchData->numSpentOutputs;
+	for (uint32_t x = 0; x < block->transactionNum; x++) {
+		numUnspentOutputs += block->transactions[x]->outputNum;
+		if (x)
+			numSpentOutputs += block->transactions[x]->inputNum;
+	}
+	BEOutputReference * unspentOutputs = realloc(branchData->unspentOutputs, sizeof(*unspentOutputs) * BE_MAX(numUnspentOutputs, 1));
+	if (NOT unspentOutputs) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the unspent outputs in BEFullValidatorUpdateUnspentOutputs.",sizeof(*unspentOutputs) * numUnspentOutputs);
+		return false;
+	}
+	branchData->unspentOutputs = unspentOutputs;
+	BESpentOutput * spentOutputs = realloc(branchData->spentOutputs, sizeof(*spentOutputs) * BE_MAX(numSpentOutputs, 1));
+	if (NOT spentOutputs) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the spent outputs in BEFullValidatorUpdateUnspentOutputs.",sizeof(*spentOutputs) * numSpentOutputs);
+		return false;
+	}
+	branchData->spentOutputs = spentOutputs;
+	// Update unspent outputs... Go through transactions, removing the prevOut references and adding the outputs for one transaction at a time.
+	uint8_t * bytes = CBByteArrayGetData(CBGetMessage(block)->bytes);
+	uint32_t cursor = 80; // Cursor to find output positions.
+	cursor += bytes[cursor] < 253 ? 1 : (bytes[cursor] == 253 ? 3 : (bytes[cursor] == 254 ? 5 : 9));
+	for (uint32_t x = 0; x < block->transactionNum; x++) {
+		bool found;
+		cursor += 4; // Move along version number
+		// Move along input number
+		cursor += bytes[cursor] < 253 ? 1 : (bytes[cursor] == 253 ? 3 : (bytes[cursor] == 254 ? 5 : 9));
+		// First remove output references than add new outputs.
+		for (uint32_t y = 0; y < block->transactions[x]->inputNum; y++) {
+			if (x) {
+				// Only remove for non-coinbase transactions
+				uint32_t ref = BEFullValidatorFindOutputReference(branchData->unspentOutputs, branchData->numUnspentOutputs, CBByteArrayGetData(block->transactions[x]->inputs[y]->prevOut.hash), block->transactions[x]->inputs[y]->prevOut.index, &found);
+				// Keep the output as a spent output and remove by overwrite. The output stays counted for its block file until the spent output is forgotten.
+				if (found) {
+					BESpentOutput * spent = branchData->spentOutputs + branchData->numSpentOutputs++;
+					spent->output = branchData->unspentOutputs[ref];
+					spent->spentHeight = height;
+					memmove(branchData->unspentOutputs + ref, branchData->unspentOutputs + ref + 1, (branchData->numUnspentOutputs - ref - 1) * sizeof(*branchData->unspentOutputs));
+					branchData->numUnspentOutputs--;
+				}
+			}
+			// Move along output reference
+			cursor += 36;
+			// Move cursor along script varint. We look at byte data in case it is longer than needed.
+			cursor += bytes[cursor] < 253 ? 1 : (bytes[cursor] == 253 ? 3 : (bytes[cursor] == 254 ? 5 : 9));
+			// Move along script and sequence
+			cursor += block->transactions[x]->inputs[y]->scriptObject->length + 4;
+		}
+		// Move cursor past output number to first output
+		cursor += bytes[cursor] < 253 ? 1 : (bytes[cursor] == 253 ? 3 : (bytes[cursor] == 254 ? 5 : 9));
+		// Now add new outputs
+		for (uint32_t y = 0; y < block->transactions[x]->outputNum; y++) {
+			uint32_t ref = BEFullValidatorFindOutputReference(branchData->unspentOutputs, branchData->numUnspentOutputs, CBTransactionGetHash(block->transactions[x]), y, &found);
+			// Insert the output information at the reference point.
+			if (branchData->numUnspentOutputs > ref)
+				// Move other references up to make room
+				memmove(branchData->unspentOutputs + ref + 1, branchData->unspentOutputs + ref, (branchData->numUnspentOutputs - ref) * sizeof(*branchData->unspentOutputs));
+			branchData->numUnspentOutputs++;
+			branchData->unspentOutputs[ref].branch = branch;
+			branchData->unspentOutputs[ref].coinbase = NOT x;
+			branchData->unspentOutputs[ref].height = height;
+			memcpy(branchData->unspentOutputs[ref].outputHash,CBTransactionGetHash(block->transactions[x]),32);
+			branchData->unspentOutputs[ref].outputIndex = y;
+			branchData->unspentOutputs[ref].ref.fileID = blockRef.fileID;
+			branchData->unspentOutputs[ref].ref.filePos = blockRef.filePos + BE_BLOCK_RECORD_HEADER_SIZE + cursor;
+			BEFullValidatorAddFileOutput(self, blockRef.fileID);
+			// Move cursor past the value and the script var int.
+			cursor += 8;
+			cursor += bytes[cursor] < 253 ? 1 : (bytes[cursor] == 253 ? 3 : (bytes[cursor] == 254 ? 5 : 9));
+			// Move cursor past the script
+			cursor += block->transactions[x]->outputs[y]->scriptObject->length;
+		}
+		// Move cursor past the lock time
+		cursor += 4;
+	}
+	// Forget the outputs spent by blocks which are too deep for a new branch to be validated from.
+	uint32_t forget = 0;
+	while (forget < branchData->numSpentOutputs && branchData->spentOutputs[forget].spentHeight + BE_SPENT_OUTPUT_DEPTH <= height)
+		BEFullValidatorRemoveFileOutput(self, branchData->spentOutputs[forget++].output.ref.fileID);
+	if (forget) {
+		branchData->numSpentOutputs -= forget;
+		memmove(branchData->spentOutputs, branchData->spentOutputs + forget, branchData->numSpentOutputs * sizeof(*branchData->spentOutputs));
+	}
+	return true;
+}
+BEBlockValidationResult BEFullValidatorValidateNextBlock(BEFullValidator * self, uint8_t branch, bool * done){
+	// Go back through the branches until the blocks are validated up to where the later branch starts. The first block to validate is just after that.
+	uint8_t validateBranch = branch;
+	uint32_t validateIndex = 0;
+	bool found = false;
+	uint8_t tempBranch = branch;
+	// The number of blocks needed in the branch. The tip for the first branch and up to the fork for the branches it follows.
+	uint32_t needed = self->branches[branch].numRefs;
+	for (uint8_t x = 0; x < BE_MAX_BRANCH_CACHE; x++) {
+		BEBlockBranch * branchData = self->branches + tempBranch;
+		if (needed && branchData->lastValidation != BE_NO_VALIDATION && branchData->lastValidation + 1 >= needed)
+			// Validated up to where needed.
+			break;
+		if (needed) {
+			validateBranch = tempBranch;
+			found = true;
+			if (branchData->lastValidation != BE_NO_VALIDATION) {
+				// Partly validated, so the branches before are validated.
+				validateIndex = branchData->lastValidation + 1;
+				break;
+			}
+			validateIndex = 0;
+		}
+		if (NOT tempBranch && NOT branchData->parentBranch)
+			// The first branch has no branches before it.
+			break;
+		needed = branchData->parentBlockIndex + 1;
+		tempBranch = branchData->parentBranch;
+	}
+	*done = NOT found;
+	if (NOT found)
+		return BE_BLOCK_VALIDATION_OK;
+	if (NOT BEFullValidatorLoadBranch(self, validateBranch, BE_BRANCH_REFERENCES))
+		return BE_BLOCK_VALIDATION_ERR;
+	// The first block of a branch is validated with the unspent outputs at the fork, as the branches it follows are validated up to there.
+	if (self->branches[validateBranch].lastValidation == BE_NO_VALIDATION && NOT BEFullValidatorSetForkOutputs(self, validateBranch))
+		return BE_BLOCK_VALIDATION_ERR;
+	// Blocks are validated in order so advise sequential access, going back to random access once the next block is in another file.
+	BEBlockBranch * branchData = self->branches + validateBranch;
+	uint16_t fileID = branchData->references[validateIndex].ref.fileID;
+	BEBlockStoreSetAccess(self->blockStore, fileID, BE_BLOCK_STORE_ACCESS_SEQUENTIAL);
+	CBBlock * block = BEFullValidatorLoadBlock(self, branchData->references[validateIndex]);
+	if (NOT block){
+		BEBlockStoreSetAccess(self->blockStore, fileID, BE_BLOCK_STORE_ACCESS_RANDOM);
+		return BE_BLOCK_VALIDATION_ERR;
+	}
+	if (validateIndex + 1 == branchData->numRefs || branchData->references[validateIndex + 1].ref.fileID != fileID)
+		BEBlockStoreSetAccess(self->blockStore, fileID, BE_BLOCK_STORE_ACCESS_RANDOM);
+	// The block is loaded as bytes, so read the header and transactions from them.
+	if (NOT CBBlockDeserialise(block, true)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not deserialise the block at height %u in BEFullValidatorValidateNextBlock.",branchData->startHeight + validateIndex);
+		CBReleaseObject(block);
+		return BE_BLOCK_VALIDATION_ERR;
+	}
+	// Get transaction hashes
+	uint8_t * txHashes = malloc(block->transactionNum * 32);
+	if (NOT txHashes) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the transaction hashes in BEFullValidatorValidateNextBlock.",block->transactionNum * 32);
+		CBReleaseObject(block);
+		return BE_BLOCK_VALIDATION_ERR;
+	}
+	for (uint32_t x = 0; x < block->transactionNum; x++)
+		memcpy(txHashes + 32*x, CBTransactionGetHash(block->transactions[x]), 32);
+	BEPrevOutMap prevOuts;
+	BEBlockValidationResult res = BEFullValidatorCompleteBlockValidation(self, validateBranch, block, txHashes, branchData->startHeight + validateIndex, &prevOuts);
+	free(txHashes);
+	if (res == BE_BLOCK_VALIDATION_OK) {
+		// The unspent outputs are advanced with the last validation.
+		if (NOT BEFullValidatorUnmapBranch(self, validateBranch)
+			|| NOT BEFullValidatorUpdateUnspentOutputs(self, validateBranch, block, branchData->references[validateIndex].ref, branchData->startHeight + validateIndex)) {
+			BEFullValidatorFreePrevOutMap(&prevOuts);
+			CBReleaseObject(block);
+			return BE_BLOCK_VALIDATION_ERR;
+		}
+		// The filter is kept with the reference until the block is in the main chain.
+		branchData->references[validateIndex].filterPos = BEFullValidatorAddFilter(self, block, &prevOuts);
+		BEFullValidatorFreePrevOutMap(&prevOuts);
+		branchData->lastValidation = validateIndex;
+	}
+	CBReleaseObject(block);
+	return res;
+}
+BEBlockValidationResult BEFullValidatorVerifyInputScript(BEFullValidator * self, CBTransaction * tx, uint32_t inputIndex, CBTransactionOutput * prevOut, uint32_t * sigOps){
+	CBScriptStack stack = CBNewEmptyScriptStack();
+	// Execute the input script.
+	CBScriptExecuteReturn res = CBScriptExecute(tx->inputs[inputIndex]->scriptObject, &stack, CBTransactionGetInputHashForSignature, tx, inputIndex, false);
+	if (res == CB_SCRIPT_ERR){
+		CBFreeScriptStack(stack);
+		return BE_BLOCK_VALIDATION_ERR;
+	}
+	if (res == CB_SCRIPT_INVALID){
+		CBFreeScriptStack(stack);
+		return BE_BLOCK_VALIDATION_BAD;
+	}
+	// Verify P2SH inputs.
+	if (CBScriptIsP2SH(prevOut->scriptObject)){
+		if (NOT CBScriptIsPushOnly(prevOut->scriptObject)){
+			CBFreeScriptStack(stack);
+			return BE_BLOCK_VALIDATION_BAD;
+		}
+		// Since the output is a P2SH we include the serialised script in the signature operations
+		CBScript * p2shScript = CBNewScriptWithData(stack.elements[stack.length - 1].data, stack.elements[stack.length - 1].length, self->onErrorReceived);
+		*sigOps += CBScriptGetSigOpCount(p2shScript, true);
+		if (*sigOps > CB_MAX_SIG_OPS){
+			CBFreeScriptStack(stack);
+			return BE_BLOCK_VALIDATION_BAD;
+		}
+		CBReleaseObject(p2shScript);
+	}
+	// Execute the output script.
+	res = CBScriptExecute(prevOut->scriptObject, &stack, CBTransactionGetInputHashForSignature, tx, inputIndex, true);
+	// Finished with the stack.
+	CBFreeScriptStack(stack);
+	// Check the result of the output script
+	if (res == CB_SCRIPT_ERR)
+		return BE_BLOCK_VALIDATION_ERR;
+	if (res == CB_SCRIPT_INVALID)
+		return BE_BLOCK_VALIDATION_BAD;
+	return BE_BLOCK_VALIDATION_OK;
+}
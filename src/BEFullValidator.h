@@ -29,24 +29,27 @@
 #define BEFULLVALIDATORH
 
 #include "BEConstants.h"
+#include "BEBlockStore.h"
+#include "BEFilterIndex.h"
+#include "BEMerkleCache.h"
+#include "BETxIndex.h"
+#include "BEOrphanPool.h"
+#include "BEMempool.h"
+#include "BESipHash.h"
 #include "CBBlock.h"
 #include "CBBigInt.h"
 #include "CBValidationFunctions.h"
 #include "stdio.h"
 #include "string.h"
-#include <sys/resource.h>
-#include <sys/syslimits.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <unistd.h>
-
-/**
- @brief References a part of block storage.
- */
-typedef struct{
-	uint16_t fileID; /**< The file being referenced. */
-	uint64_t filePos; /**< The position in the file which is being referenced. */
-} BEFileReference;
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
 
 /**
  @brief References an output in the block storage.
@@ -60,6 +63,14 @@ typedef struct{
 	uint8_t branch; /**< The branch this output belongs to. */
 }BEOutputReference;
 
+/**
+ @brief An output spent by a validated block of a branch, so that the unspent outputs at an earlier block can be found for a new branch.
+ */
+typedef struct{
+	BEOutputReference output; /**< The spent output. */
+	uint32_t spentHeight; /**< The height of the block which spent the output. */
+}BESpentOutput;
+
 /**
  @brief References a block in the block storage.
  */
@@ -67,6 +78,7 @@ typedef struct{
 	BEFileReference ref; /**< The file reference for the block */
 	uint32_t target; /** The target for this block */
 	uint32_t time; /**< The block's timestamp */
+	uint64_t filterPos; /**< The position of the block filter in the filter file, or BE_NO_FILTER if the block has not been validated. */
 }BEBlockReference;
 
 /**
@@ -78,12 +90,24 @@ typedef struct{
 } BEBlockReferenceHashIndex;
 
 /**
- @brief A FILE object for block storage and the index of this file.
+ @brief A previous output which has been read from block storage ahead of input validation.
  */
 typedef struct{
-	FILE * file;
-	uint16_t fileID;
-}BEBlockFile;
+	uint8_t outputHash[32]; /**< The transaction hash for the output */
+	uint32_t outputIndex; /**< The index for the output */
+	BEFileReference ref; /**< The file reference for the output */
+	uint32_t height; /**< Block height of the output */
+	bool coinbase; /**< True if a coinbase output */
+	CBTransactionOutput * output; /**< The output read from storage. */
+}BEPrefetchedOutput;
+
+/**
+ @brief The previous outputs for a block, read from block storage in one batch and sorted by the output hash and index.
+ */
+typedef struct{
+	uint32_t numOutputs; /**< The number of prefetched outputs. */
+	BEPrefetchedOutput * outputs; /**< The prefetched outputs. */
+}BEPrevOutMap;
 
 /**
  @brief Represents a block branch.
@@ -99,26 +123,75 @@ typedef struct{
 	uint32_t lastValidation; /**< The index of the last block in this branch that has been fully validated. */
 	uint32_t numUnspentOutputs; /**< The number of unspent outputs for this branch upto the last validated block. */
 	BEOutputReference * unspentOutputs; /**< A list of unspent outputs for this branch upto the last validated block. */
+	uint32_t numSpentOutputs; /**< The number of spent outputs. */
+	BESpentOutput * spentOutputs; /**< The outputs spent by the last BE_SPENT_OUTPUT_DEPTH validated blocks of this branch, in the order they were spent. */
 	CBBigInt work; /**< The total work for this branch. The branch with the highest work is the winner! */
-	BEBlockFile * blockFiles; /**< Open block files for this branch. */
-	uint16_t numBlockFiles; /**< Number of open block files for this branch. */
-	FILE * branchValidationFile; /** The file for the branch validation data, NULL if not open */
+	uint8_t * map; /**< The private mapping of the branch file which the references, lookup table and unspent outputs are in, or NULL if they are allocated. */
+	uint64_t mapSize; /**< The length of the mapping. */
+	BEBranchLoadState loaded; /**< How much of the branch has been loaded. Branches which are not mapped are always fully loaded. */
+	bool invalid; /**< True if a block in the branch, or in the branches it follows, failed validation. The branch cannot become the main branch. This is not saved, so the block is found again after loading. */
 } BEBlockBranch;
 
+/**
+ @brief The start of a branch file, followed by the block references, the lookup table, padding to the alignment, the unspent outputs, the spent outputs and the work.
+ */
+typedef struct{
+	uint8_t magic[4]; /**< "BEBR" */
+	uint32_t version; /**< BE_BRANCH_FILE_VERSION */
+	uint32_t byteOrder; /**< BE_BRANCH_FILE_BYTE_ORDER */
+	uint16_t referenceSize; /**< The size of BEBlockReference. */
+	uint16_t tableEntrySize; /**< The size of BEBlockReferenceHashIndex. */
+	uint16_t outputSize; /**< The size of BEOutputReference. */
+	uint8_t parentBranch; /**< The branch this branch is connected to. */
+	uint8_t workLength; /**< The length of the branch work. */
+	uint32_t numRefs; /**< The number of block references. */
+	uint32_t numUnspentOutputs; /**< The number of unspent outputs. */
+	uint32_t lastRetargetTime; /**< The block timestamp at the last retarget. */
+	uint32_t parentBlockIndex; /**< The block index in the parent branch which this branch is connected to */
+	uint32_t startHeight; /**< The starting height where this branch begins */
+	uint32_t lastValidation; /**< The index of the last block in this branch that has been fully validated. */
+	uint32_t numSpentOutputs; /**< The number of spent outputs. */
+	uint64_t length; /**< The length of the file. */
+	uint32_t referencesChecksum; /**< The CRC32C checksum of the block references and lookup table. */
+	uint32_t outputsChecksum; /**< The CRC32C checksum of the padding, unspent outputs and spent outputs. */
+	uint32_t workChecksum; /**< The CRC32C checksum of the work. */
+	uint32_t headerChecksum; /**< The CRC32C checksum of the header before this field. */
+} BEBranchFileHeader;
+
 /**
  @brief Structure for BEFullValidator objects. @see BEFullValidator.h
  */
 typedef struct{
 	CBObject base;
 	FILE * validatorFile; /**< The file for the validation data */
-	uint8_t numOrphans; /**< The number of orhpans */
-	CBBlock * orphans[BE_MAX_ORPHAN_CACHE]; /**< The ophan block references */
+	BEOrphanPool * orphanPool; /**< The orphan blocks. */
+	BEMempool * mempool; /**< The transactions validated against the main branch. */
+	BEFilterIndex * filterIndex; /**< The block filters of the main chain by height. */
+	BETxIndex * txIndex; /**< The transactions of the main chain by transaction hash, or NULL if they are not indexed. @see BEFullValidatorEnableTxIndex */
+	BEMerkleCache * merkleCache; /**< The merkle trees of recent main chain blocks, or NULL to not keep them. Set after the validator is created and released with the validator. */
 	uint8_t mainBranch; /**< The index for the main branch */
 	uint8_t numBranches; /**< The number of block-chain branches. Cannot exceed BE_MAX_BRANCH_CACHE */
 	BEBlockBranch branches[BE_MAX_BRANCH_CACHE]; /**< The block-chain branches. */
 	char * dataDir; /**< Data directory path */
 	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
-	uint64_t fileSizeLimit; /**< The maximum allowed filesize */
+	BEBlockStore * blockStore; /**< The storage for the blocks of all branches. Blocks are stored once and the branches refer to their positions. */
+	uint32_t pruneTarget; /**< Block files are pruned until the block files use no more than this many megabytes. Zero for no size target. */
+	uint32_t pruneDepth; /**< Block files are pruned when all of their blocks are at least this deep in the main chain. Zero for no depth target. */
+	uint32_t * fileOutputs; /**< The number of unspent outputs of all branches in each block file. */
+	uint16_t fileOutputsLength; /**< The number of block files in fileOutputs. */
+	bool fileOutputsCounted; /**< True if fileOutputs has been counted and is being kept up to date. */
+	uint16_t prunedAtNumFiles; /**< The number of block files when pruning was last tried. */
+	uint8_t invalidBlocks[BE_INVALID_BLOCK_CACHE][32]; /**< The hashes of blocks with invalid headers, each in the slot given by BEFullValidatorGetInvalidBlockSlot so that a new hash replaces an old one in the same slot. Empty slots are zero. */
+	uint64_t invalidKey0; /**< The first half of the random SipHash key for the invalid block slots. */
+	uint64_t invalidKey1; /**< The second half of the random SipHash key for the invalid block slots. */
+	uint64_t rejectedKnownInvalid; /**< The number of blocks rejected because they were known to be invalid. */
+	uint64_t rejectedPreCheck; /**< The number of blocks rejected by the header pre-check. */
+	pthread_mutex_t lock; /**< Held while processing blocks and while the background thread validates a block, so that they do not change the branches at the same time. */
+	pthread_cond_t backgroundCond; /**< Signalled when blocks are processed or the background thread should stop. */
+	pthread_t backgroundThread; /**< The thread validating side branches in the background. */
+	bool backgroundRunning; /**< True while the background thread is running. */
+	bool stopBackground; /**< Set to stop the background thread. Protected by the lock. */
+	uint64_t backgroundValidated; /**< The number of blocks validated by the background thread. */
 } BEFullValidator;
 
 /**
@@ -151,35 +224,62 @@ void BEFreeFullValidator(void * self);
 // Functions
 
 /**
- @brief Adds a block to a branch.
+ @brief Remembers that a block has an invalid header.
+ @param self The BEFullValidator object.
+ @param hash The block hash.
+ */
+void BEFullValidatorAddInvalidBlock(BEFullValidator * self, uint8_t * hash);
+/**
+ @brief Validates a relayed transaction against the unspent outputs of the main branch and the transactions in the pool, and adds it to the pool. The scripts are executed with the lock held, so that the main branch does not change meanwhile.
+ @param self The BEFullValidator object.
+ @param tx The transaction.
+ @param networkTime The network time.
+ @returns BE_MEMPOOL_ADDED if the transaction was added, otherwise the reason it was not added.
+ */
+BEMempoolStatus BEFullValidatorAcceptTransaction(BEFullValidator * self, CBTransaction * tx, uint64_t networkTime);
+/**
+ @brief Adds a block to a branch in memory. The branch is saved by the caller with BEFullValidatorSaveBranchValidator.
  @param self The BEFullValidator object.
  @param branch The index of the branch to add the block to.
  @param block The block to add.
  @param work The new branch work. This is not the block work but the total work upto this block. This is taken by the function and the old work is freed.
+ @param prevOuts The previous outputs read to validate the block, which are used to build the block filter, or NULL if the block was not validated. The unspent outputs are only updated for validated blocks.
  @returns true on success and false on error.
  */
-bool BEFullValidatorAddBlockToBranch(BEFullValidator * self, uint8_t branch, CBBlock * block, CBBigInt work);
+bool BEFullValidatorAddBlockToBranch(BEFullValidator * self, uint8_t branch, CBBlock * block, CBBigInt work, BEPrevOutMap * prevOuts);
 /**
- @brief Adds a block to the orphans.
+ @brief Counts an unspent output which was added to a block file if the outputs are being counted.
  @param self The BEFullValidator object.
- @param block The block to add.
- @returns true on success and false on error.
+ @param fileID The block file of the output.
  */
-bool BEFullValidatorAddBlockToOrphans(BEFullValidator * self, CBBlock * block);
+void BEFullValidatorAddFileOutput(BEFullValidator * self, uint16_t fileID);
+/**
+ @brief Builds the filter of a validated block and writes it to the filter file.
+ @param self The BEFullValidator object.
+ @param block The block.
+ @param prevOuts The previous outputs read to validate the block. Outputs spent in the same block are found in the block.
+ @returns The position of the filter in the filter file or BE_NO_FILTER on failure.
+ */
+uint64_t BEFullValidatorAddFilter(BEFullValidator * self, CBBlock * block, BEPrevOutMap * prevOuts);
+/**
+ @brief Validates side branches until stopped. This is the function of the background thread.
+ @param self The BEFullValidator object.
+ @returns NULL
+ */
+void * BEFullValidatorBackgroundValidation(void * self);
 /**
  @brief Does basic validation on a block 
  @param self The BEFullValidator object.
  @param block The block to valdiate.
  @param txHashes 32 byte double Sha-256 hashes for the transactions in the block, one after the other. These will be modified by this function.
- @param networkTime The network time.
  @returns The block status.
  */
-BEBlockStatus BEFullValidatorBasicBlockValidation(BEFullValidator * self, CBBlock * block, uint8_t * txHashes, uint64_t networkTime);
+BEBlockStatus BEFullValidatorBasicBlockValidation(BEFullValidator * self, CBBlock * block, uint8_t * txHashes);
 /**
  @brief Same as BEFullValidatorBasicBlockValidation but copies the "txHashes" so that the original data is not modified.
  @see BEFullValidatorBasicBlockValidation
  */
-BEBlockStatus BEFullValidatorBasicBlockValidationCopy(BEFullValidator * self, CBBlock * block, uint8_t * txHashes, uint64_t networkTime);
+BEBlockStatus BEFullValidatorBasicBlockValidationCopy(BEFullValidator * self, CBBlock * block, uint8_t * txHashes);
 /**
  @brief Completes the validation for a block during main branch extention or reorganisation.
  @param self The BEFullValidator object.
@@ -187,22 +287,71 @@ BEBlockStatus BEFullValidatorBasicBlockValidationCopy(BEFullValidator * self, CB
  @param block The block to complete validation for.
  @param txHashes 32 byte double Sha-256 hashes for the transactions in the block, one after the other.
  @param height The height of the block.
+ @param prevOuts Set to the previous outputs read for the block if the block passed validation, which should be freed with BEFullValidatorFreePrevOutMap.
  @returns BE_BLOCK_VALIDATION_OK if the block passed validation, BE_BLOCK_VALIDATION_BAD if the block failed validation and BE_BLOCK_VALIDATION_ERR on an error.
  */
-BEBlockValidationResult BEFullValidatorCompleteBlockValidation(BEFullValidator * self, uint8_t branch, CBBlock * block, uint8_t * txHashes,uint32_t height);
+BEBlockValidationResult BEFullValidatorCompleteBlockValidation(BEFullValidator * self, uint8_t branch, CBBlock * block, uint8_t * txHashes,uint32_t height, BEPrevOutMap * prevOuts);
 /**
- @brief Ensures a file can be opened.
+ @brief Counts the unspent outputs of all branches in each block file.
  @param self The BEFullValidator object.
+ @returns true on success and false on failure.
  */
-void BEFullValidatorEnsureCanOpen(BEFullValidator * self);
+bool BEFullValidatorCountFileOutputs(BEFullValidator * self);
 /**
- @brief Gets the file descriptor for a block file.
+ @brief Opens or creates the transaction index and brings it up to the tip of the main chain, which for a new index reads every block. Transactions of pruned blocks cannot be read, so the index is for nodes which are not pruned.
  @param self The BEFullValidator object.
- @param fileID The id of the file.
- @param branch The branch to find the block file for.
- @returns The file descriptor on success, or NULL on failure.
+ @returns true on success and false on failure. The index is kept if it was opened, and is brought up to date with the next main chain block.
+ */
+bool BEFullValidatorEnableTxIndex(BEFullValidator * self);
+/**
+ @brief Gets the block reference of the main chain at a height, loading the references of the branches on the way.
+ @param self The BEFullValidator object.
+ @param height The height, which must not be more than the height of the main branch.
+ @returns The block reference or NULL on failure.
+ */
+BEBlockReference * BEFullValidatorGetMainChainReference(BEFullValidator * self, uint32_t height);
+/**
+ @brief Gets a transaction of the main chain with the transaction index. Holds the lock while the index is used.
+ @param self The BEFullValidator object.
+ @param txHash The transaction hash.
+ @param height Set to the height of the block of the transaction, or NULL.
+ @returns The deserialised transaction or NULL if the transaction is not in the main chain, the transactions are not indexed or the transaction could not be read.
+ */
+CBTransaction * BEFullValidatorGetTransaction(BEFullValidator * self, uint8_t * txHash, uint32_t * height);
+/**
+ @brief Finds a prefetched previous output.
+ @param prevOuts The previous outputs from BEFullValidatorPrefetchPrevOuts.
+ @param hash The transaction hash of the output to search for.
+ @param index The index of the output.
+ @returns The prefetched output or NULL if it is not in the map.
  */
-FILE * BEFullValidatorGetBlockFile(BEFullValidator * self, uint16_t fileID, uint8_t branch);
+BEPrefetchedOutput * BEFullValidatorFindPrefetchedOutput(BEPrevOutMap * prevOuts, uint8_t * hash, uint32_t index);
+/**
+ @brief Compares two BEPrefetchedOutputs by the output hash and index. For use with qsort.
+ @param a The first BEPrefetchedOutput.
+ @param b The second BEPrefetchedOutput.
+ @returns Less than, equal to or greater than zero as with memcmp.
+ */
+int BEFullValidatorComparePrefetchedOutputs(const void * a, const void * b);
+/**
+ @brief Compares two BEPrefetchedOutputs by the branch, file and position in the file. For use with qsort.
+ @param a The first BEPrefetchedOutput.
+ @param b The second BEPrefetchedOutput.
+ @returns Less than, equal to or greater than zero as with memcmp.
+ */
+int BEFullValidatorComparePrefetchedOutputPositions(const void * a, const void * b);
+/**
+ @brief Compares two BESpentOutputs by the output hash and index. For use with qsort.
+ @param a The first BESpentOutput.
+ @param b The second BESpentOutput.
+ @returns Less than, equal to or greater than zero as with memcmp.
+ */
+int BEFullValidatorCompareSpentOutputs(const void * a, const void * b);
+/**
+ @brief Frees the outputs of a BEPrevOutMap.
+ @param prevOuts The map to free.
+ */
+void BEFullValidatorFreePrevOutMap(BEPrevOutMap * prevOuts);
 /**
  @brief Gets the mimimum time minus one allowed for a new block onto a branch.
  @param self The BEFullValidator object.
@@ -213,18 +362,19 @@ uint32_t BEFullValidatorGetMedianTime(BEFullValidator * self, uint8_t branch, ui
 /**
  @brief Validates a transaction input.
  @param self The BEFullValidator object.
- @param branch The branch being validated.
  @param block The block begin validated.
  @param blockHeight The height of the block being validated
  @param transactionIndex The index of the transaction to validate.
  @param inputIndex The index of the input to validate.
  @param allSpentOutputs The previous outputs returned from CBTransactionValidateBasic
  @param txHashes 32 byte double Sha-256 hashes for the transactions in the block, one after the other.
+ @param prevOuts The previous outputs for the block from BEFullValidatorPrefetchPrevOuts.
+ @param verified True if the scripts of the transaction were verified by the transaction pool, in which case they are not executed.
  @param value Pointer to the total value of the transaction. This will be incremented by this function with the input value.
  @param sigOps Pointer to the total number of signature operations. This is increased by the signature operations for the input and verified to be less that the maximum allowed signature operations.
  @returns BE_BLOCK_VALIDATION_OK if the transaction passed validation, BE_BLOCK_VALIDATION_BAD if the transaction failed validation and BE_BLOCK_VALIDATION_ERR on an error.
  */
-BEBlockValidationResult BEFullValidatorInputValidation(BEFullValidator * self, uint8_t branch, CBBlock * block, uint32_t blockHeight, uint32_t transactionIndex,uint32_t inputIndex, CBPrevOut ** allSpentOutputs, uint8_t * txHashes, uint64_t * value, uint32_t * sigOps);
+BEBlockValidationResult BEFullValidatorInputValidation(BEFullValidator * self, CBBlock * block, uint32_t blockHeight, uint32_t transactionIndex,uint32_t inputIndex, CBPrevOut ** allSpentOutputs, uint8_t * txHashes, BEPrevOutMap * prevOuts, bool verified, uint64_t * value, uint32_t * sigOps);
 /**
  @brief Finds a block reference ad returns the index or finds the insertion point if the reference was no found.
  @param lookupTable The table of references to search.
@@ -244,16 +394,43 @@ uint32_t BEFullValidatorFindBlockReference(BEBlockReferenceHashIndex * lookupTab
  @returns The index of the matching reference or the index of where the reference should go in the case the reference was not found.
  */
 uint32_t BEFullValidatorFindOutputReference(BEOutputReference * refs, uint32_t refNum, uint8_t * hash, uint32_t index, bool * found);
+/**
+ @brief Gets the slot of the invalid block cache for a block hash. The hash is keyed with SipHash so that peers cannot choose blocks which all replace the same slot.
+ @param self The BEFullValidator object.
+ @param hash The block hash.
+ @returns The slot.
+ */
+uint32_t BEFullValidatorGetInvalidBlockSlot(BEFullValidator * self, uint8_t * hash);
+/**
+ @brief Determines if a block is known to have an invalid header.
+ @param self The BEFullValidator object.
+ @param hash The block hash.
+ @returns true if the block is known to be invalid, false otherwise.
+ */
+bool BEFullValidatorIsKnownInvalid(BEFullValidator * self, uint8_t * hash);
+/**
+ @brief Gets the position of the unspent outputs in a branch file.
+ @param numRefs The number of block references in the branch.
+ @returns The position of the unspent outputs, which follow the references and lookup table at the next aligned position.
+ */
+uint64_t BEFullValidatorGetOutputsOffset(uint32_t numRefs);
+/**
+ @brief Loads a branch up to a state if it has not been loaded that far already. The branch data must be loaded with this before it is used.
+ @param self The BEFullValidator object.
+ @param branch The branch.
+ @param state The state to load the branch to.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorLoadBranch(BEFullValidator * self, uint8_t branch, BEBranchLoadState state);
 /**
  @brief Loads a block from storage.
  @param self The BEFullValidator object.
  @param blockRef A reference to the block in storage.
- @param branch The branch the block belongs to.
  @returns A new CBBlockObject with serailised block data which has not been deserialised or NULL on failure.
  */
-CBBlock * BEFullValidatorLoadBlock(BEFullValidator * self, BEBlockReference blockRef, uint32_t branch);
+CBBlock * BEFullValidatorLoadBlock(BEFullValidator * self, BEBlockReference blockRef);
 /**
- @brief Loads the validation data for a block-chain branch. This only loads data if the validator file for the branch has not been opened already.
+ @brief Loads the summary of a block-chain branch by mapping the branch file, or creates the data for the genesis block if there is no file for the first branch. Nothing is done if the branch is already loaded. The rest of the branch is loaded with BEFullValidatorLoadBranch.
  @param self The BEFullValidator object.
  @param branch The index of the branch to load the data for.
  @returns true of success and false on failure.
@@ -266,7 +443,42 @@ bool BEFullValidatorLoadBranchValidator(BEFullValidator * self, uint8_t branch);
  */
 bool BEFullValidatorLoadValidator(BEFullValidator * self);
 /**
- @brief Processes a block. Block headers are validated, ensuring the integrity of the transaction data is OK, checking the block's proof of work and calculating the total branch work to the genesis block. If the block extends the main branch complete validation is done. If the block extends a branch to become the new main branch because it has the most work, a re-organisation of the block-chain is done.
+ @brief Maps a branch file and uses the branch data in place, loading the summary after checking the header and work. The block references and unspent outputs are checked by BEFullValidatorLoadBranch.
+ @param self The BEFullValidator object.
+ @param branch The branch.
+ @param fd The open branch file, which is closed.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorMapBranch(BEFullValidator * self, uint8_t branch, int fd);
+/**
+ @brief Checks a block with the header alone before anything is allocated. Blocks with bad proof of work are remembered as invalid.
+ @param self The BEFullValidator object.
+ @param block The block to check.
+ @param networkTime The network time.
+ @returns BE_BLOCK_STATUS_CONTINUE if the block passed, otherwise BE_BLOCK_STATUS_BAD or BE_BLOCK_STATUS_BAD_TIME.
+ */
+BEBlockStatus BEFullValidatorPreCheckHeader(BEFullValidator * self, CBBlock * block, uint64_t networkTime);
+/**
+ @brief Reads the previous outputs spent by a block from the unspent outputs of the branch before the inputs are validated. The reads are made together in file order.
+ @param self The BEFullValidator object.
+ @param branch The branch being validated.
+ @param block The block to read the previous outputs for.
+ @param prevOuts The map to fill with the previous outputs. Free with BEFullValidatorFreePrevOutMap.
+ @returns BE_BLOCK_VALIDATION_OK on success and BE_BLOCK_VALIDATION_ERR on an error.
+ */
+BEBlockValidationResult BEFullValidatorPrefetchPrevOuts(BEFullValidator * self, uint8_t branch, CBBlock * block, BEPrevOutMap * prevOuts);
+/**
+ @brief Reads the previous outputs spent by transactions which are unspent in a branch, as for BEFullValidatorPrefetchPrevOuts.
+ @param self The BEFullValidator object.
+ @param branch The branch to find the unspent outputs in.
+ @param transactions The transactions.
+ @param numTransactions The number of transactions.
+ @param prevOuts The map to fill with the previous outputs. Free with BEFullValidatorFreePrevOutMap.
+ @returns BE_BLOCK_VALIDATION_OK on success and BE_BLOCK_VALIDATION_ERR on an error.
+ */
+BEBlockValidationResult BEFullValidatorPrefetchTransactionPrevOuts(BEFullValidator * self, uint8_t branch, CBTransaction ** transactions, uint32_t numTransactions, BEPrevOutMap * prevOuts);
+/**
+ @brief Processes a block. Block headers are validated, ensuring the integrity of the transaction data is OK, checking the block's proof of work and calculating the total branch work to the genesis block. If the block extends the main branch complete validation is done. If the block extends a branch to become the new main branch because it has the most work, a re-organisation of the block-chain is done. Orphans which follow the block are then connected. Holds the lock so that this can be called while the background thread is running.
  @param self The BEFullValidator object.
  @param block The block to process.
  @param networkTime The network time.
@@ -274,17 +486,51 @@ bool BEFullValidatorLoadValidator(BEFullValidator * self);
  */
 BEBlockStatus BEFullValidatorProcessBlock(BEFullValidator * self, CBBlock * block, uint64_t networkTime);
 /**
- @brief Processes a block into a branch. This is used once basic validation is done on a blocka nd it is determined what branch it needs to go into and when this branch is ready to receive the block.
+ @brief Processes a block without connecting any orphans which follow it. Orphans are added to the orphan pool.
  @param self The BEFullValidator object.
  @param block The block to process.
  @param networkTime The network time.
+ @return The status of the block.
+ */
+BEBlockStatus BEFullValidatorProcessBlockWithoutOrphans(BEFullValidator * self, CBBlock * block, uint64_t networkTime);
+/**
+ @brief Processes a block into a branch. This is used once basic validation is done on a blocka nd it is determined what branch it needs to go into and when this branch is ready to receive the block.
+ @param self The BEFullValidator object.
+ @param block The block to process.
  @param branch The branch to add to.
  @param prevBranch The branch of the previous block.
  @param prevBlockIndex The index of the previous block.
  @param txHashes The transaction hashes for the block.
  @return The status of the block.
  */
-BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock * block, uint64_t networkTime, uint8_t branch, uint8_t prevBranch, uint32_t prevBlockIndex, uint8_t * txHashes);
+BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock * block, uint8_t branch, uint8_t prevBranch, uint32_t prevBlockIndex, uint8_t * txHashes);
+/**
+ @brief Prunes block files which are not needed if a prune target is set and a block file was started since pruning was last tried.
+ @param self The BEFullValidator object.
+ @returns true on success or if there was nothing to prune, false if a file could not be pruned.
+ */
+bool BEFullValidatorPrune(BEFullValidator * self);
+/**
+ @brief Removes the last branch after a block could not be added to it as a new branch.
+ @param self The BEFullValidator object.
+ @param branch The index of the branch, which must be the last branch.
+ */
+void BEFullValidatorRemoveBranch(BEFullValidator * self, uint8_t branch);
+/**
+ @brief Removes an unspent output from the count for its block file if the outputs are being counted.
+ @param self The BEFullValidator object.
+ @param fileID The block file of the output.
+ */
+void BEFullValidatorRemoveFileOutput(BEFullValidator * self, uint16_t fileID);
+/**
+ @brief Replaces a file in the data directory with new data so that the file has either the old or the new data if the program or system stops.
+ @param self The BEFullValidator object.
+ @param fileName The name of the file.
+ @param parts The parts of the new data, which are written one after the other.
+ @param numParts The number of parts.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorReplaceFile(BEFullValidator * self, char * fileName, struct iovec * parts, uint8_t numParts);
 /**
  @brief Saves the validation data for a branch.
  @param self The BEFullValidator object.
@@ -293,10 +539,76 @@ BEBlockStatus BEFullValidatorProcessIntoBranch(BEFullValidator * self, CBBlock *
  */
 bool BEFullValidatorSaveBranchValidator(BEFullValidator * self, uint8_t branch);
 /**
- @brief Saves the validator data, does not write orphan data
+ @brief Saves the validator data.
  @param self The BEFullValidator object.
  @returns true of success and false on failure.
  */
 bool BEFullValidatorSaveValidator(BEFullValidator * self);
+/**
+ @brief Sets the unspent outputs of a branch without validated blocks to those of the branch it follows at the fork. The branch it follows must be validated up to the fork.
+ @param self The BEFullValidator object.
+ @param branch The index of the branch.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorSetForkOutputs(BEFullValidator * self, uint8_t branch);
+/**
+ @brief Starts the thread which validates side branches in the background. Nothing is done if it is already running. Blocks should only be processed with BEFullValidatorProcessBlock while the thread is running.
+ @param self The BEFullValidator object.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorStartBackgroundValidation(BEFullValidator * self);
+/**
+ @brief Stops the background thread and waits for it to finish the block it is validating.
+ @param self The BEFullValidator object.
+ */
+void BEFullValidatorStopBackgroundValidation(BEFullValidator * self);
+/**
+ @brief Copies the data of a branch out of the mapping of the branch file into allocated memory, so that it can be reallocated. Nothing is done if the branch is not mapped.
+ @param self The BEFullValidator object.
+ @param branch The branch.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorUnmapBranch(BEFullValidator * self, uint8_t branch);
+/**
+ @brief Executes the input script of a transaction input and the output script it spends.
+ @param self The BEFullValidator object.
+ @param tx The transaction.
+ @param inputIndex The index of the input.
+ @param prevOut The output spent by the input.
+ @param sigOps Pointer to the total number of signature operations. This is increased by the signature operations of a P2SH script and verified to be less that the maximum allowed signature operations.
+ @returns BE_BLOCK_VALIDATION_OK if the scripts passed, BE_BLOCK_VALIDATION_BAD if they failed and BE_BLOCK_VALIDATION_ERR on an error.
+ */
+BEBlockValidationResult BEFullValidatorVerifyInputScript(BEFullValidator * self, CBTransaction * tx, uint32_t inputIndex, CBTransactionOutput * prevOut, uint32_t * sigOps);
+/**
+ @brief Makes the filter index follow the main chain, removing the heights of blocks which are no longer in the main chain and adding the filters of the blocks after them. Adding stops at a block without a filter.
+ @param self The BEFullValidator object.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorUpdateFilterIndex(BEFullValidator * self);
+/**
+ @brief Makes the transaction index follow the main chain, removing the transactions of the blocks which are no longer in the main chain and adding the transactions of the blocks after them.
+ @param self The BEFullValidator object.
+ @param block The block at the tip of the main chain, so that it is not read again, or NULL.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorUpdateTxIndex(BEFullValidator * self, CBBlock * block);
+/**
+ @brief Updates the unspent outputs of a branch for a validated block, keeping the outputs which the block spends as spent outputs. Nothing is changed on failure. The branch must not be mapped.
+ @param self The BEFullValidator object.
+ @param branch The index of the branch.
+ @param block The validated block.
+ @param blockRef The position of the block in the block store.
+ @param height The height of the block.
+ @returns true on success and false on failure.
+ */
+bool BEFullValidatorUpdateUnspentOutputs(BEFullValidator * self, uint8_t branch, CBBlock * block, BEFileReference blockRef, uint32_t height);
+/**
+ @brief Validates the first block which has not been validated on the way to the tip of a branch, starting from the branches it follows. The last validation and unspent outputs of the branch of the block are advanced if the block is valid.
+ @param self The BEFullValidator object.
+ @param branch The branch to validate up to the tip of.
+ @param done Set to true if all of the blocks were already validated, in which case nothing is validated.
+ @returns BE_BLOCK_VALIDATION_OK if the block is valid or there was nothing to validate, BE_BLOCK_VALIDATION_BAD if the block is invalid and BE_BLOCK_VALIDATION_ERR on failure.
+ */
+BEBlockValidationResult BEFullValidatorValidateNextBlock(BEFullValidator * self, uint8_t branch, bool * done);
 
 #endif
@@ -0,0 +1,529 @@
+//
+//  BEMempool.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 31/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BEMempool.h"
+
+//  Constructor
+
+BEMempool * BENewMempool(uint64_t maxSize, void (*onErrorReceived)(CBError error,char *,...)){
+	BEMempool * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewMempool\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeMempool;
+	if (BEInitMempool(self, maxSize, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEMempool * BEGetMempool(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitMempool(BEMempool * self, uint64_t maxSize, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	self->maxSize = maxSize;
+	self->entries = NULL;
+	self->numSlots = 0;
+	self->numEntries = 0;
+	self->freeHead = -1;
+	self->hashBuckets = NULL;
+	self->numBuckets = 0;
+	uint8_t key[16];
+	BESipHashRandomKey(key);
+	self->key0 = BESipHashReadInt64(key);
+	self->key1 = BESipHashReadInt64(key + 8);
+	self->spends = NULL;
+	self->numSpendSlots = 0;
+	self->numSpends = 0;
+	self->spendFreeHead = -1;
+	self->spendBuckets = NULL;
+	self->numSpendBuckets = 0;
+	self->byFeeRate = NULL;
+	self->visited = NULL;
+	self->mark = 0;
+	self->size = 0;
+	self->added = 0;
+	self->mined = 0;
+	self->conflicts = 0;
+	self->evictions = 0;
+	self->reused = 0;
+	if (NOT BEMempoolGrowBuckets(self, BE_MEMPOOL_MIN_BUCKETS))
+		return false;
+	if (NOT BEMempoolGrowSpendBuckets(self, BE_MEMPOOL_MIN_BUCKETS)) {
+		free(self->hashBuckets);
+		return false;
+	}
+	if (pthread_mutex_init(&self->lock, NULL)) {
+		free(self->hashBuckets);
+		free(self->spendBuckets);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the lock in BEInitMempool.");
+		return false;
+	}
+	return true;
+}
+
+//  Destructor
+
+void BEFreeMempool(void * vself){
+	BEMempool * self = vself;
+	for (uint32_t x = 0; x < self->numSlots; x++) {
+		if (NOT self->entries[x].tx)
+			continue;
+		CBReleaseObject(self->entries[x].tx);
+		free(self->entries[x].parents);
+		free(self->entries[x].inputSpends);
+	}
+	pthread_mutex_destroy(&self->lock);
+	free(self->entries);
+	free(self->hashBuckets);
+	free(self->spends);
+	free(self->spendBuckets);
+	free(self->byFeeRate);
+	free(self->visited);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+BEMempoolStatus BEMempoolAdd(BEMempool * self, CBTransaction * tx, uint64_t fee, uint32_t p2shSigOps, uint64_t time){
+	uint8_t * hash = CBTransactionGetHash(tx);
+	uint32_t size = CBGetMessage(tx)->bytes->length;
+	uint64_t feeRate = fee * 1000 / size;
+	pthread_mutex_lock(&self->lock);
+	if (BEMempoolFind(self, hash) != -1) {
+		pthread_mutex_unlock(&self->lock);
+		return BE_MEMPOOL_DUPLICATE;
+	}
+	for (uint32_t x = 0; x < tx->inputNum; x++) {
+		if (BEMempoolFindSpend(self, CBByteArrayGetData(tx->inputs[x]->prevOut.hash), tx->inputs[x]->prevOut.index) != -1) {
+			pthread_mutex_unlock(&self->lock);
+			return BE_MEMPOOL_CONFLICT;
+		}
+	}
+	// Do not add a transaction which would be the first to be removed to make room for itself.
+	if (size > self->maxSize
+		|| (self->size + size > self->maxSize && self->numEntries && self->entries[self->byFeeRate[self->numEntries - 1]].feeRate >= feeRate)) {
+		pthread_mutex_unlock(&self->lock);
+		return BE_MEMPOOL_REJECTED;
+	}
+	// Make room for the transaction and its spends before anything is changed.
+	if (self->freeHead == -1) {
+		uint32_t numSlots = self->numSlots ? self->numSlots * 2 : BE_MEMPOOL_MIN_BUCKETS;
+		BEMempoolEntry * entries = realloc(self->entries, sizeof(*entries) * numSlots);
+		if (entries)
+			self->entries = entries;
+		int32_t * byFeeRate = entries ? realloc(self->byFeeRate, sizeof(*byFeeRate) * numSlots) : NULL;
+		if (byFeeRate)
+			self->byFeeRate = byFeeRate;
+		int32_t * visited = byFeeRate ? realloc(self->visited, sizeof(*visited) * numSlots) : NULL;
+		if (visited)
+			self->visited = visited;
+		if (NOT visited) {
+			pthread_mutex_unlock(&self->lock);
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u transactions in BEMempoolAdd.",numSlots);
+			return BE_MEMPOOL_ERROR;
+		}
+		if (numSlots > self->numBuckets && NOT BEMempoolGrowBuckets(self, numSlots)) {
+			pthread_mutex_unlock(&self->lock);
+			return BE_MEMPOOL_ERROR;
+		}
+		for (uint32_t x = self->numSlots; x < numSlots; x++) {
+			self->entries[x].tx = NULL;
+			self->entries[x].mark = 0;
+			self->entries[x].hashNext = x + 1 < numSlots ? (int32_t)x + 1 : -1;
+		}
+		self->freeHead = self->numSlots;
+		self->numSlots = numSlots;
+	}
+	if (self->numSpends + tx->inputNum > self->numSpendSlots) {
+		uint32_t numSpendSlots = self->numSpendSlots ? self->numSpendSlots * 2 : BE_MEMPOOL_MIN_BUCKETS;
+		while (numSpendSlots < self->numSpends + tx->inputNum)
+			numSpendSlots *= 2;
+		BEMempoolSpend * spends = realloc(self->spends, sizeof(*spends) * numSpendSlots);
+		if (NOT spends) {
+			pthread_mutex_unlock(&self->lock);
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u spent outputs in BEMempoolAdd.",numSpendSlots);
+			return BE_MEMPOOL_ERROR;
+		}
+		self->spends = spends;
+		if (numSpendSlots > self->numSpendBuckets && NOT BEMempoolGrowSpendBuckets(self, numSpendSlots)) {
+			pthread_mutex_unlock(&self->lock);
+			return BE_MEMPOOL_ERROR;
+		}
+		// Put the new slots at the front of the unused slots.
+		for (uint32_t x = self->numSpendSlots; x < numSpendSlots; x++) {
+			self->spends[x].entry = -1;
+			self->spends[x].next = x + 1 < numSpendSlots ? (int32_t)x + 1 : self->spendFreeHead;
+		}
+		self->spendFreeHead = self->numSpendSlots;
+		self->numSpendSlots = numSpendSlots;
+	}
+	int32_t * parents = malloc(sizeof(*parents) * tx->inputNum);
+	int32_t * inputSpends = malloc(sizeof(*inputSpends) * tx->inputNum);
+	if (NOT parents || NOT inputSpends) {
+		free(parents);
+		free(inputSpends);
+		pthread_mutex_unlock(&self->lock);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for the parents of a transaction in BEMempoolAdd.");
+		return BE_MEMPOOL_ERROR;
+	}
+	// Find the parents, and then the rest of the ancestors through the parents of the ancestors.
+	uint32_t numParents = 0;
+	uint32_t numAncestors = 0;
+	self->mark++;
+	for (uint32_t x = 0; x < tx->inputNum; x++) {
+		int32_t parent = BEMempoolFind(self, CBByteArrayGetData(tx->inputs[x]->prevOut.hash));
+		if (parent == -1 || self->entries[parent].mark == self->mark)
+			continue;
+		self->entries[parent].mark = self->mark;
+		parents[numParents++] = parent;
+		self->visited[numAncestors++] = parent;
+	}
+	uint64_t ancestorSize = size;
+	uint64_t ancestorFee = fee;
+	for (uint32_t x = 0; x < numAncestors; x++) {
+		BEMempoolEntry * ancestor = self->entries + self->visited[x];
+		ancestorSize += ancestor->size;
+		ancestorFee += ancestor->fee;
+		for (uint32_t y = 0; y < ancestor->numParents; y++) {
+			if (self->entries[ancestor->parents[y]].mark == self->mark)
+				continue;
+			self->entries[ancestor->parents[y]].mark = self->mark;
+			self->visited[numAncestors++] = ancestor->parents[y];
+		}
+	}
+	if (numAncestors + 1 > BE_MEMPOOL_MAX_ANCESTORS) {
+		free(parents);
+		free(inputSpends);
+		pthread_mutex_unlock(&self->lock);
+		return BE_MEMPOOL_REJECTED;
+	}
+	// Add the transaction.
+	int32_t index = self->freeHead;
+	BEMempoolEntry * entry = self->entries + index;
+	self->freeHead = entry->hashNext;
+	CBRetainObject(tx);
+	entry->tx = tx;
+	memcpy(entry->hash, hash, 32);
+	entry->size = size;
+	entry->fee = fee;
+	entry->feeRate = feeRate;
+	entry->p2shSigOps = p2shSigOps;
+	entry->time = time;
+	entry->parents = parents;
+	entry->numParents = numParents;
+	entry->inputSpends = inputSpends;
+	entry->numAncestors = numAncestors + 1;
+	entry->ancestorSize = ancestorSize;
+	entry->ancestorFee = ancestorFee;
+	uint32_t bucket = BEMempoolGetBucket(self, hash);
+	entry->hashNext = self->hashBuckets[bucket];
+	self->hashBuckets[bucket] = index;
+	for (uint32_t x = 0; x < tx->inputNum; x++) {
+		int32_t spendIndex = self->spendFreeHead;
+		BEMempoolSpend * spend = self->spends + spendIndex;
+		self->spendFreeHead = spend->next;
+		memcpy(spend->hash, CBByteArrayGetData(tx->inputs[x]->prevOut.hash), 32);
+		spend->index = tx->inputs[x]->prevOut.index;
+		spend->entry = index;
+		bucket = BEMempoolGetSpendBucket(self, spend->hash, spend->index);
+		spend->next = self->spendBuckets[bucket];
+		self->spendBuckets[bucket] = spendIndex;
+		inputSpends[x] = spendIndex;
+	}
+	self->numSpends += tx->inputNum;
+	uint32_t pos = BEMempoolFindFeeRatePosition(self, index);
+	memmove(self->byFeeRate + pos + 1, self->byFeeRate + pos, sizeof(*self->byFeeRate) * (self->numEntries - pos));
+	self->byFeeRate[pos] = index;
+	self->numEntries++;
+	self->size += size;
+	// Remove the transactions with the lowest fee rates until the pool is within its size limit. The transaction is removed if it spends from one of them.
+	while (self->size > self->maxSize)
+		self->evictions += BEMempoolRemoveWithDescendants(self, self->byFeeRate[self->numEntries - 1]);
+	BEMempoolStatus status = entry->tx ? BE_MEMPOOL_ADDED : BE_MEMPOOL_REJECTED;
+	if (status == BE_MEMPOOL_ADDED)
+		self->added++;
+	pthread_mutex_unlock(&self->lock);
+	return status;
+}
+void BEMempoolClear(BEMempool * self){
+	pthread_mutex_lock(&self->lock);
+	for (uint32_t x = 0; x < self->numSlots; x++) {
+		if (self->entries[x].tx) {
+			CBReleaseObject(self->entries[x].tx);
+			free(self->entries[x].parents);
+			free(self->entries[x].inputSpends);
+			self->entries[x].tx = NULL;
+		}
+		self->entries[x].hashNext = x + 1 < self->numSlots ? (int32_t)x + 1 : -1;
+	}
+	for (uint32_t x = 0; x < self->numSpendSlots; x++) {
+		self->spends[x].entry = -1;
+		self->spends[x].next = x + 1 < self->numSpendSlots ? (int32_t)x + 1 : -1;
+	}
+	self->freeHead = self->numSlots ? 0 : -1;
+	self->spendFreeHead = self->numSpendSlots ? 0 : -1;
+	memset(self->hashBuckets, 0xFF, sizeof(*self->hashBuckets) * self->numBuckets);
+	memset(self->spendBuckets, 0xFF, sizeof(*self->spendBuckets) * self->numSpendBuckets);
+	self->numEntries = 0;
+	self->numSpends = 0;
+	self->size = 0;
+	pthread_mutex_unlock(&self->lock);
+}
+int BEMempoolCompareFeeRate(BEMempool * self, int32_t a, int32_t b){
+	BEMempoolEntry * entryA = self->entries + a;
+	BEMempoolEntry * entryB = self->entries + b;
+	if (entryA->feeRate != entryB->feeRate)
+		return entryA->feeRate > entryB->feeRate ? -1 : 1;
+	return memcmp(entryA->hash, entryB->hash, 32);
+}
+bool BEMempoolContains(BEMempool * self, uint8_t * hash){
+	pthread_mutex_lock(&self->lock);
+	bool found = BEMempoolFind(self, hash) != -1;
+	pthread_mutex_unlock(&self->lock);
+	return found;
+}
+int32_t BEMempoolFind(BEMempool * self, uint8_t * hash){
+	for (int32_t x = self->hashBuckets[BEMempoolGetBucket(self, hash)]; x != -1; x = self->entries[x].hashNext)
+		if (NOT memcmp(self->entries[x].hash, hash, 32))
+			return x;
+	return -1;
+}
+uint32_t BEMempoolFindFeeRatePosition(BEMempool * self, int32_t entry){
+	uint32_t left = 0;
+	uint32_t right = self->numEntries;
+	while (left < right) {
+		uint32_t mid = (left + right) / 2;
+		int cmp = BEMempoolCompareFeeRate(self, self->byFeeRate[mid], entry);
+		if (NOT cmp)
+			return mid;
+		if (cmp < 0)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+	return left;
+}
+int32_t BEMempoolFindSpend(BEMempool * self, uint8_t * hash, uint32_t index){
+	for (int32_t x = self->spendBuckets[BEMempoolGetSpendBucket(self, hash, index)]; x != -1; x = self->spends[x].next)
+		if (self->spends[x].index == index && NOT memcmp(self->spends[x].hash, hash, 32))
+			return x;
+	return -1;
+}
+uint32_t BEMempoolGetBucket(BEMempool * self, uint8_t * hash){
+	return BESipHash256(self->key0, self->key1, hash) & (self->numBuckets - 1);
+}
+uint32_t BEMempoolGetDescendants(BEMempool * self, int32_t entry){
+	// Search breadth first through the transactions spending the outputs of each transaction found.
+	self->mark++;
+	self->entries[entry].mark = self->mark;
+	self->visited[0] = entry;
+	uint32_t numVisited = 1;
+	for (uint32_t x = 0; x < numVisited; x++) {
+		BEMempoolEntry * parent = self->entries + self->visited[x];
+		for (uint32_t y = 0; y < parent->tx->outputNum; y++) {
+			int32_t spend = BEMempoolFindSpend(self, parent->hash, y);
+			if (spend == -1 || self->entries[self->spends[spend].entry].mark == self->mark)
+				continue;
+			self->entries[self->spends[spend].entry].mark = self->mark;
+			self->visited[numVisited++] = self->spends[spend].entry;
+		}
+	}
+	return numVisited;
+}
+CBTransactionOutput * BEMempoolGetOutput(BEMempool * self, uint8_t * hash, uint32_t index){
+	pthread_mutex_lock(&self->lock);
+	CBTransactionOutput * output = NULL;
+	int32_t entry = BEMempoolFind(self, hash);
+	if (entry != -1 && index < self->entries[entry].tx->outputNum) {
+		output = self->entries[entry].tx->outputs[index];
+		CBRetainObject(output);
+	}
+	pthread_mutex_unlock(&self->lock);
+	return output;
+}
+uint32_t BEMempoolGetSpendBucket(BEMempool * self, uint8_t * hash, uint32_t index){
+	uint8_t output[36];
+	memcpy(output, hash, 32);
+	output[32] = index;
+	output[33] = index >> 8;
+	output[34] = index >> 16;
+	output[35] = index >> 24;
+	return BESipHash(self->key0, self->key1, output, 36) & (self->numSpendBuckets - 1);
+}
+uint32_t BEMempoolGetTransactions(BEMempool * self, CBTransaction *** transactions){
+	pthread_mutex_lock(&self->lock);
+	uint32_t numTransactions = self->numEntries;
+	*transactions = NULL;
+	if (numTransactions) {
+		*transactions = malloc(sizeof(**transactions) * numTransactions);
+		if (NOT *transactions) {
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u transactions in BEMempoolGetTransactions.",numTransactions);
+			numTransactions = 0;
+		}
+		for (uint32_t x = 0; x < numTransactions; x++) {
+			(*transactions)[x] = self->entries[self->byFeeRate[x]].tx;
+			CBRetainObject((*transactions)[x]);
+		}
+	}
+	pthread_mutex_unlock(&self->lock);
+	return numTransactions;
+}
+bool BEMempoolGetVerified(BEMempool * self, uint8_t * hash, uint32_t * p2shSigOps){
+	pthread_mutex_lock(&self->lock);
+	int32_t entry = BEMempoolFind(self, hash);
+	if (entry != -1) {
+		*p2shSigOps = self->entries[entry].p2shSigOps;
+		self->reused++;
+	}
+	pthread_mutex_unlock(&self->lock);
+	return entry != -1;
+}
+bool BEMempoolGrowBuckets(BEMempool * self, uint32_t numBuckets){
+	int32_t * hashBuckets = malloc(sizeof(*hashBuckets) * numBuckets);
+	if (NOT hashBuckets) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u transaction hash table buckets in BEMempoolGrowBuckets.",numBuckets);
+		return false;
+	}
+	memset(hashBuckets, 0xFF, sizeof(*hashBuckets) * numBuckets);
+	free(self->hashBuckets);
+	self->hashBuckets = hashBuckets;
+	self->numBuckets = numBuckets;
+	for (uint32_t x = 0; x < self->numSlots; x++) {
+		if (NOT self->entries[x].tx)
+			continue;
+		uint32_t bucket = BEMempoolGetBucket(self, self->entries[x].hash);
+		self->entries[x].hashNext = hashBuckets[bucket];
+		hashBuckets[bucket] = x;
+	}
+	return true;
+}
+bool BEMempoolGrowSpendBuckets(BEMempool * self, uint32_t numBuckets){
+	int32_t * spendBuckets = malloc(sizeof(*spendBuckets) * numBuckets);
+	if (NOT spendBuckets) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u spent output hash table buckets in BEMempoolGrowSpendBuckets.",numBuckets);
+		return false;
+	}
+	memset(spendBuckets, 0xFF, sizeof(*spendBuckets) * numBuckets);
+	free(self->spendBuckets);
+	self->spendBuckets = spendBuckets;
+	self->numSpendBuckets = numBuckets;
+	for (uint32_t x = 0; x < self->numSpendSlots; x++) {
+		if (self->spends[x].entry == -1)
+			continue;
+		uint32_t bucket = BEMempoolGetSpendBucket(self, self->spends[x].hash, self->spends[x].index);
+		self->spends[x].next = spendBuckets[bucket];
+		spendBuckets[bucket] = x;
+	}
+	return true;
+}
+bool BEMempoolIsSpent(BEMempool * self, uint8_t * hash, uint32_t index){
+	pthread_mutex_lock(&self->lock);
+	bool spent = BEMempoolFindSpend(self, hash, index) != -1;
+	pthread_mutex_unlock(&self->lock);
+	return spent;
+}
+void BEMempoolRemove(BEMempool * self, int32_t entry){
+	BEMempoolEntry * entryData = self->entries + entry;
+	// Remove from the hash table.
+	int32_t * next = self->hashBuckets + BEMempoolGetBucket(self, entryData->hash);
+	while (*next != entry)
+		next = &self->entries[*next].hashNext;
+	*next = entryData->hashNext;
+	// Remove the spent outputs.
+	for (uint32_t x = 0; x < entryData->tx->inputNum; x++) {
+		int32_t spend = entryData->inputSpends[x];
+		BEMempoolSpend * spendData = self->spends + spend;
+		next = self->spendBuckets + BEMempoolGetSpendBucket(self, spendData->hash, spendData->index);
+		while (*next != spend)
+			next = &self->spends[*next].next;
+		*next = spendData->next;
+		spendData->entry = -1;
+		spendData->next = self->spendFreeHead;
+		self->spendFreeHead = spend;
+	}
+	self->numSpends -= entryData->tx->inputNum;
+	// Remove from the fee rate order.
+	uint32_t pos = BEMempoolFindFeeRatePosition(self, entry);
+	memmove(self->byFeeRate + pos, self->byFeeRate + pos + 1, sizeof(*self->byFeeRate) * (self->numEntries - pos - 1));
+	self->numEntries--;
+	self->size -= entryData->size;
+	CBReleaseObject(entryData->tx);
+	free(entryData->parents);
+	free(entryData->inputSpends);
+	entryData->tx = NULL;
+	entryData->hashNext = self->freeHead;
+	self->freeHead = entry;
+}
+void BEMempoolRemoveBlock(BEMempool * self, CBBlock * block, uint8_t * txHashes){
+	pthread_mutex_lock(&self->lock);
+	// Skip the coinbase transaction, which is never in the pool.
+	for (uint32_t x = 1; x < block->transactionNum; x++) {
+		int32_t entry = BEMempoolFind(self, txHashes + 32*x);
+		if (entry != -1) {
+			BEMempoolRemoveMined(self, entry);
+			self->mined++;
+		}
+		// Transactions left spending the same outputs are double spends of the block.
+		CBTransaction * tx = block->transactions[x];
+		for (uint32_t y = 0; y < tx->inputNum; y++) {
+			int32_t spend = BEMempoolFindSpend(self, CBByteArrayGetData(tx->inputs[y]->prevOut.hash), tx->inputs[y]->prevOut.index);
+			if (spend != -1)
+				self->conflicts += BEMempoolRemoveWithDescendants(self, self->spends[spend].entry);
+		}
+	}
+	pthread_mutex_unlock(&self->lock);
+}
+void BEMempoolRemoveMined(BEMempool * self, int32_t entry){
+	BEMempoolEntry * mined = self->entries + entry;
+	uint32_t numDescendants = BEMempoolGetDescendants(self, entry);
+	for (uint32_t x = 1; x < numDescendants; x++) {
+		BEMempoolEntry * descendant = self->entries + self->visited[x];
+		descendant->numAncestors--;
+		descendant->ancestorSize -= mined->size;
+		descendant->ancestorFee -= mined->fee;
+		for (uint32_t y = 0; y < descendant->numParents; y++) {
+			if (descendant->parents[y] == entry) {
+				descendant->parents[y] = descendant->parents[--descendant->numParents];
+				break;
+			}
+		}
+	}
+	BEMempoolRemove(self, entry);
+}
+uint32_t BEMempoolRemoveWithDescendants(BEMempool * self, int32_t entry){
+	uint32_t numDescendants = BEMempoolGetDescendants(self, entry);
+	for (uint32_t x = 0; x < numDescendants; x++)
+		BEMempoolRemove(self, self->visited[x]);
+	return numDescendants;
+}
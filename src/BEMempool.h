@@ -0,0 +1,291 @@
+//
+//  BEMempool.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 31/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Holds relayed transactions which have been validated against the main branch, until they are in a block.
+ */
+
+#ifndef BEMEMPOOLH
+#define BEMEMPOOLH
+
+#include "BEConstants.h"
+#include "BESipHash.h"
+#include "CBBlock.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+/**
+ @brief The result of adding a transaction to the pool.
+ */
+typedef enum{
+	BE_MEMPOOL_ADDED, /**< The transaction was added. */
+	BE_MEMPOOL_DUPLICATE, /**< The transaction is already in the pool. */
+	BE_MEMPOOL_CONFLICT, /**< The transaction spends an output spent by a transaction in the pool. */
+	BE_MEMPOOL_MISSING_INPUTS, /**< An output the transaction spends was not found. The transaction may spend a transaction which has not been received, or an output which was spent. */
+	BE_MEMPOOL_REJECTED, /**< The transaction is valid but its fee rate is too low, it has too many ancestors in the pool or it is too large. */
+	BE_MEMPOOL_INVALID, /**< The transaction is invalid. */
+	BE_MEMPOOL_ERROR, /**< There was an error. */
+} BEMempoolStatus;
+
+/**
+ @brief A transaction in the pool.
+ */
+typedef struct{
+	CBTransaction * tx; /**< The transaction, which is retained, or NULL for an unused slot. */
+	uint8_t hash[32]; /**< The transaction hash. */
+	uint32_t size; /**< The size of the serialised transaction. */
+	uint64_t fee; /**< The fee of the transaction. */
+	uint64_t feeRate; /**< The fee in satoshis for each 1000 bytes. */
+	uint32_t p2shSigOps; /**< The signature operations of the P2SH inputs, which are counted when the scripts are executed. */
+	uint64_t time; /**< The time the transaction was added. */
+	int32_t * parents; /**< The indexes of the transactions in the pool which this transaction spends outputs of. */
+	uint32_t numParents; /**< The number of parents. */
+	int32_t * inputSpends; /**< The index of the spend for each input. */
+	uint32_t numAncestors; /**< The number of transactions in the pool this transaction depends on, including itself. */
+	uint64_t ancestorSize; /**< The total size of the ancestors, including this transaction. */
+	uint64_t ancestorFee; /**< The total fee of the ancestors, including this transaction. */
+	uint32_t mark; /**< Set to the mark of the pool when the transaction is visited while finding ancestors or descendants. */
+	int32_t hashNext; /**< The index of the next transaction in the same hash bucket or -1. For unused slots this is the next unused slot. */
+} BEMempoolEntry;
+
+/**
+ @brief An output spent by a transaction in the pool.
+ */
+typedef struct{
+	uint8_t hash[32]; /**< The hash of the transaction with the output. */
+	uint32_t index; /**< The index of the output. */
+	int32_t entry; /**< The index of the transaction spending the output or -1 for an unused slot. */
+	int32_t next; /**< The index of the next spend in the same bucket or -1. For unused slots this is the next unused slot. */
+} BEMempoolSpend;
+
+/**
+ @brief Structure for BEMempool objects. @see BEMempool.h
+ */
+typedef struct{
+	CBObject base;
+	BEMempoolEntry * entries; /**< Slots for the transactions. Slots are reused but not moved, so transactions are referred to by their index. */
+	uint32_t numSlots; /**< The number of transaction slots. */
+	uint32_t numEntries; /**< The number of transactions. */
+	int32_t freeHead; /**< The index of the first unused transaction slot or -1. */
+	int32_t * hashBuckets; /**< Hash table of the first transaction index for each bucket by the transaction hash or -1. */
+	uint32_t numBuckets; /**< The number of transaction hash buckets, a power of two which is at least the number of transaction slots. */
+	BEMempoolSpend * spends; /**< Slots for the spent outputs. */
+	uint32_t numSpendSlots; /**< The number of spend slots. */
+	uint32_t numSpends; /**< The number of spent outputs. */
+	int32_t spendFreeHead; /**< The index of the first unused spend slot or -1. */
+	int32_t * spendBuckets; /**< Hash table of the first spend index for each bucket by the output or -1. */
+	uint32_t numSpendBuckets; /**< The number of spend buckets, a power of two which is at least the number of spend slots. */
+	uint64_t key0; /**< The first half of the random SipHash key for the hash tables. */
+	uint64_t key1; /**< The second half of the random SipHash key for the hash tables. */
+	int32_t * byFeeRate; /**< The indexes of the transactions from the highest fee rate to the lowest. Transactions with the same fee rate are in order of their hash. */
+	int32_t * visited; /**< Room for the index of every transaction slot, for finding ancestors and descendants. */
+	uint32_t mark; /**< Incremented for each search of ancestors or descendants. */
+	uint64_t size; /**< The total size of the transactions. */
+	uint64_t maxSize; /**< The maximum total size of the transactions. */
+	uint64_t added; /**< The number of transactions added. */
+	uint64_t mined; /**< The number of transactions removed because they were in a block. */
+	uint64_t conflicts; /**< The number of transactions removed because a block spent the same outputs. */
+	uint64_t evictions; /**< The number of transactions removed because of the size limit. */
+	uint64_t reused; /**< The number of transactions found by BEMempoolGetVerified. */
+	pthread_mutex_t lock; /**< Held by each function which is not documented as needing the lock to be held. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEMempool;
+
+/**
+ @brief Creates a new BEMempool object.
+ @param maxSize The maximum total size of the transactions.
+ @returns A new BEMempool object.
+ */
+BEMempool * BENewMempool(uint64_t maxSize, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEMempool from another object. Use this to avoid casts.
+ @param self The object to obtain the BEMempool from.
+ @returns The BEMempool object.
+ */
+BEMempool * BEGetMempool(void * self);
+
+/**
+ @brief Initialises a BEMempool object.
+ @param self The BEMempool object to initialise.
+ @param maxSize The maximum total size of the transactions.
+ @returns true on success, false on failure.
+ */
+bool BEInitMempool(BEMempool * self, uint64_t maxSize, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEMempool object, releasing the transactions.
+ @param self The BEMempool object to free.
+ */
+void BEFreeMempool(void * self);
+
+// Functions
+
+/**
+ @brief Adds a transaction which has been validated against the main branch and the transactions in the pool. Transactions with the lowest fee rates are removed if the pool is over its size limit.
+ @param self The BEMempool object.
+ @param tx The transaction, which is retained.
+ @param fee The fee of the transaction.
+ @param p2shSigOps The signature operations of the P2SH inputs.
+ @param time The current time.
+ @returns BE_MEMPOOL_ADDED if the transaction was added, otherwise the reason it was not added.
+ */
+BEMempoolStatus BEMempoolAdd(BEMempool * self, CBTransaction * tx, uint64_t fee, uint32_t p2shSigOps, uint64_t time);
+/**
+ @brief Removes all of the transactions.
+ @param self The BEMempool object.
+ */
+void BEMempoolClear(BEMempool * self);
+/**
+ @brief Compares the fee rates of two transactions in the pool for the fee rate order. The lock must be held.
+ @param self The BEMempool object.
+ @param a The index of the first transaction.
+ @param b The index of the second transaction.
+ @returns Less than zero if a comes first, greater than zero if b comes first and zero if they are the same transaction.
+ */
+int BEMempoolCompareFeeRate(BEMempool * self, int32_t a, int32_t b);
+/**
+ @brief Determines if a transaction is in the pool.
+ @param self The BEMempool object.
+ @param hash The transaction hash.
+ @returns true if the transaction is in the pool, false otherwise.
+ */
+bool BEMempoolContains(BEMempool * self, uint8_t * hash);
+/**
+ @brief Finds a transaction by its hash. The lock must be held.
+ @param self The BEMempool object.
+ @param hash The transaction hash.
+ @returns The index of the transaction or -1 if it is not in the pool.
+ */
+int32_t BEMempoolFind(BEMempool * self, uint8_t * hash);
+/**
+ @brief Finds the position of a transaction in the fee rate order. The lock must be held.
+ @param self The BEMempool object.
+ @param entry The index of the transaction.
+ @returns The position of the transaction or where it should be inserted if it is not in the order.
+ */
+uint32_t BEMempoolFindFeeRatePosition(BEMempool * self, int32_t entry);
+/**
+ @brief Finds the spend of an output by a transaction in the pool. The lock must be held.
+ @param self The BEMempool object.
+ @param hash The hash of the transaction with the output.
+ @param index The index of the output.
+ @returns The index of the spend or -1 if no transaction in the pool spends the output.
+ */
+int32_t BEMempoolFindSpend(BEMempool * self, uint8_t * hash, uint32_t index);
+/**
+ @brief Gets the hash table bucket for a transaction hash. The hash is keyed with SipHash so that peers cannot choose transactions which all go in one bucket.
+ @param self The BEMempool object.
+ @param hash The transaction hash.
+ @returns The bucket.
+ */
+uint32_t BEMempoolGetBucket(BEMempool * self, uint8_t * hash);
+/**
+ @brief Finds the descendants of a transaction, which are the transactions spending its outputs and their descendants. The lock must be held.
+ @param self The BEMempool object.
+ @param entry The index of the transaction.
+ @returns The number of indexes in visited. The first index is the transaction itself.
+ */
+uint32_t BEMempoolGetDescendants(BEMempool * self, int32_t entry);
+/**
+ @brief Gets an output of a transaction in the pool.
+ @param self The BEMempool object.
+ @param hash The transaction hash.
+ @param index The index of the output.
+ @returns The output, which should be released, or NULL if the transaction is not in the pool or has no such output.
+ */
+CBTransactionOutput * BEMempoolGetOutput(BEMempool * self, uint8_t * hash, uint32_t index);
+/**
+ @brief Gets the hash table bucket for a spent output, from the SipHash of the transaction hash and output index.
+ @param self The BEMempool object.
+ @param hash The hash of the transaction with the output.
+ @param index The index of the output.
+ @returns The bucket.
+ */
+uint32_t BEMempoolGetSpendBucket(BEMempool * self, uint8_t * hash, uint32_t index);
+/**
+ @brief Gets the transactions in the pool, such as to reconstruct compact blocks.
+ @param self The BEMempool object.
+ @param transactions Set to an allocated list of the transactions from the highest fee rate to the lowest, which are retained. Free the list and release the transactions when done. Set to NULL if there are no transactions.
+ @returns The number of transactions or zero if the list could not be allocated.
+ */
+uint32_t BEMempoolGetTransactions(BEMempool * self, CBTransaction *** transactions);
+/**
+ @brief Determines if a transaction had its scripts verified when it was added to the pool, so that the scripts do not need to be executed again during block validation.
+ @param self The BEMempool object.
+ @param hash The transaction hash.
+ @param p2shSigOps Set to the signature operations of the P2SH inputs of the transaction, which are not counted without executing the scripts.
+ @returns true if the transaction is in the pool, false otherwise.
+ */
+bool BEMempoolGetVerified(BEMempool * self, uint8_t * hash, uint32_t * p2shSigOps);
+/**
+ @brief Makes the transaction hash table larger and puts the transactions in the new buckets. The lock must be held.
+ @param self The BEMempool object.
+ @param numBuckets The new number of buckets, a power of two.
+ @returns true on success and false on failure.
+ */
+bool BEMempoolGrowBuckets(BEMempool * self, uint32_t numBuckets);
+/**
+ @brief Makes the spend hash table larger and puts the spends in the new buckets. The lock must be held.
+ @param self The BEMempool object.
+ @param numBuckets The new number of buckets, a power of two.
+ @returns true on success and false on failure.
+ */
+bool BEMempoolGrowSpendBuckets(BEMempool * self, uint32_t numBuckets);
+/**
+ @brief Determines if an output is spent by a transaction in the pool.
+ @param self The BEMempool object.
+ @param hash The hash of the transaction with the output.
+ @param index The index of the output.
+ @returns true if the output is spent in the pool, false otherwise.
+ */
+bool BEMempoolIsSpent(BEMempool * self, uint8_t * hash, uint32_t index);
+/**
+ @brief Removes a transaction from the pool, releasing it. The transactions which spend from it must be removed first or have it removed from their parents. The lock must be held.
+ @param self The BEMempool object.
+ @param entry The index of the transaction.
+ */
+void BEMempoolRemove(BEMempool * self, int32_t entry);
+/**
+ @brief Removes the transactions of a block added to the main branch, and the transactions which spend the same outputs along with their descendants.
+ @param self The BEMempool object.
+ @param block The block.
+ @param txHashes 32 byte double Sha-256 hashes for the transactions in the block, one after the other.
+ */
+void BEMempoolRemoveBlock(BEMempool * self, CBBlock * block, uint8_t * txHashes);
+/**
+ @brief Removes a transaction which is in a block. The transactions which spend from it no longer have it as an ancestor. The lock must be held.
+ @param self The BEMempool object.
+ @param entry The index of the transaction.
+ */
+void BEMempoolRemoveMined(BEMempool * self, int32_t entry);
+/**
+ @brief Removes a transaction and its descendants. The lock must be held.
+ @param self The BEMempool object.
+ @param entry The index of the transaction.
+ @returns The number of transactions removed.
+ */
+uint32_t BEMempoolRemoveWithDescendants(BEMempool * self, int32_t entry);
+
+#endif
@@ -0,0 +1,209 @@
+//
+//  BEMerkleCache.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 16/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BEMerkleCache.h"
+
+//  Constructor
+
+BEMerkleCache * BENewMerkleCache(void (*onErrorReceived)(CBError error,char *,...)){
+	BEMerkleCache * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewMerkleCache\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeMerkleCache;
+	if (BEInitMerkleCache(self, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEMerkleCache * BEGetMerkleCache(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitMerkleCache(BEMerkleCache * self, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	if (pthread_mutex_init(&self->lock, NULL)) {
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not initialise the lock in BEInitMerkleCache.");
+		return false;
+	}
+	for (uint8_t x = 0; x < BE_MERKLE_CACHE_BLOCKS; x++)
+		self->trees[x].levels = NULL;
+	self->useCounter = 0;
+	self->hits = 0;
+	self->misses = 0;
+	return true;
+}
+
+//  Destructor
+
+void BEFreeMerkleCache(void * vself){
+	BEMerkleCache * self = vself;
+	for (uint8_t x = 0; x < BE_MERKLE_CACHE_BLOCKS; x++)
+		free(self->trees[x].levels);
+	pthread_mutex_destroy(&self->lock);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+bool BEMerkleCacheAdd(BEMerkleCache * self, uint8_t * blockHash, uint8_t * txHashes, uint32_t numTxs){
+	uint8_t * levels = BEMerkleCacheBuildTree(txHashes, numTxs, self->onErrorReceived);
+	if (NOT levels)
+		return false;
+	BEMerkleCacheAddTree(self, blockHash, levels, numTxs);
+	return true;
+}
+void BEMerkleCacheAddTree(BEMerkleCache * self, uint8_t * blockHash, uint8_t * levels, uint32_t numTxs){
+	pthread_mutex_lock(&self->lock);
+	if (BEMerkleCacheFind(self, blockHash) != -1) {
+		pthread_mutex_unlock(&self->lock);
+		free(levels);
+		return;
+	}
+	// Replace an unused slot or the tree used least recently.
+	uint8_t replace = 0;
+	for (uint8_t x = 0; x < BE_MERKLE_CACHE_BLOCKS; x++) {
+		if (NOT self->trees[x].levels) {
+			replace = x;
+			break;
+		}
+		if (self->trees[x].lastUsed < self->trees[replace].lastUsed)
+			replace = x;
+	}
+	BEMerkleTree * tree = self->trees + replace;
+	free(tree->levels);
+	memcpy(tree->blockHash, blockHash, 32);
+	tree->numTxs = numTxs;
+	tree->levels = levels;
+	tree->lastUsed = self->useCounter++;
+	pthread_mutex_unlock(&self->lock);
+}
+uint8_t * BEMerkleCacheBuildTree(uint8_t * txHashes, uint32_t numTxs, void (*onErrorReceived)(CBError error,char *,...)){
+	// Count the hashes of every level.
+	uint64_t numHashes = numTxs;
+	for (uint32_t levelSize = numTxs; levelSize > 1; levelSize = (levelSize + 1) / 2)
+		numHashes += (levelSize + 1) / 2;
+	uint8_t * levels = malloc(32 * numHashes);
+	if (NOT levels) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %llu bytes of memory for a merkle tree in BEMerkleCacheBuildTree.",(unsigned long long)(32 * numHashes));
+		return NULL;
+	}
+	memcpy(levels, txHashes, 32 * numTxs);
+	uint8_t * level = levels;
+	for (uint32_t levelSize = numTxs; levelSize > 1; levelSize = (levelSize + 1) / 2) {
+		uint8_t * nextLevel = level + 32 * levelSize;
+		for (uint32_t x = 0; x < levelSize; x += 2) {
+			// The last hash of an odd level is paired with itself.
+			uint8_t pair[64], hash[32];
+			memcpy(pair, level + 32*x, 32);
+			memcpy(pair + 32, level + 32*(x + 1 < levelSize ? x + 1 : x), 32);
+			CBSha256(pair, 64, hash);
+			CBSha256(hash, 32, nextLevel + 32*(x/2));
+		}
+		level = nextLevel;
+	}
+	return levels;
+}
+int32_t BEMerkleCacheFind(BEMerkleCache * self, uint8_t * blockHash){
+	for (uint8_t x = 0; x < BE_MERKLE_CACHE_BLOCKS; x++)
+		if (self->trees[x].levels && NOT memcmp(self->trees[x].blockHash, blockHash, 32))
+			return x;
+	return -1;
+}
+bool BEMerkleCacheGetBranch(BEMerkleCache * self, CBBlock * block, uint32_t txIndex, uint8_t * branch){
+	return BEMerkleCacheGetBranches(self, block, &txIndex, 1, branch);
+}
+bool BEMerkleCacheGetBranches(BEMerkleCache * self, CBBlock * block, uint32_t * txIndexes, uint32_t numIndexes, uint8_t * branches){
+	uint32_t depth = BEMerkleCacheGetDepth(block->transactionNum);
+	for (uint32_t x = 0; x < numIndexes; x++)
+		if (txIndexes[x] >= block->transactionNum)
+			return false;
+	uint8_t * hash = CBBlockGetHash(block);
+	pthread_mutex_lock(&self->lock);
+	int32_t index = BEMerkleCacheFind(self, hash);
+	if (index != -1) {
+		BEMerkleTree * tree = self->trees + index;
+		tree->lastUsed = self->useCounter++;
+		self->hits++;
+		for (uint32_t x = 0; x < numIndexes; x++)
+			BEMerkleCacheReadBranch(tree->levels, tree->numTxs, txIndexes[x], branches + 32 * depth * x);
+		pthread_mutex_unlock(&self->lock);
+		return true;
+	}
+	self->misses++;
+	pthread_mutex_unlock(&self->lock);
+	// Build the tree without holding the lock and keep it for later requests.
+	uint8_t * txHashes = malloc(32 * block->transactionNum);
+	if (NOT txHashes) {
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the transaction hashes in BEMerkleCacheGetBranches.",32 * block->transactionNum);
+		return false;
+	}
+	for (uint32_t x = 0; x < block->transactionNum; x++)
+		memcpy(txHashes + 32*x, CBTransactionGetHash(block->transactions[x]), 32);
+	uint8_t * levels = BEMerkleCacheBuildTree(txHashes, block->transactionNum, self->onErrorReceived);
+	free(txHashes);
+	if (NOT levels)
+		return false;
+	for (uint32_t x = 0; x < numIndexes; x++)
+		BEMerkleCacheReadBranch(levels, block->transactionNum, txIndexes[x], branches + 32 * depth * x);
+	BEMerkleCacheAddTree(self, hash, levels, block->transactionNum);
+	return true;
+}
+uint8_t BEMerkleCacheGetDepth(uint32_t numTxs){
+	uint8_t depth = 0;
+	for (uint32_t levelSize = numTxs; levelSize > 1; levelSize = (levelSize + 1) / 2)
+		depth++;
+	return depth;
+}
+void BEMerkleCacheReadBranch(uint8_t * levels, uint32_t numTxs, uint32_t txIndex, uint8_t * branch){
+	uint8_t * level = levels;
+	for (uint32_t levelSize = numTxs; levelSize > 1; levelSize = (levelSize + 1) / 2) {
+		uint32_t pair = txIndex ^ 1;
+		if (pair >= levelSize)
+			pair = txIndex;
+		memcpy(branch, level + 32*pair, 32);
+		branch += 32;
+		level += 32 * levelSize;
+		txIndex /= 2;
+	}
+}
+void BEMerkleCacheRootFromBranch(uint8_t * txHash, uint32_t txIndex, uint8_t * branch, uint8_t depth, uint8_t * merkleRoot){
+	memcpy(merkleRoot, txHash, 32);
+	for (uint8_t x = 0; x < depth; x++, txIndex /= 2) {
+		// The hash is on the right when the index at this level is odd.
+		uint8_t pair[64], hash[32];
+		memcpy(pair + (txIndex & 1 ? 32 : 0), merkleRoot, 32);
+		memcpy(pair + (txIndex & 1 ? 0 : 32), branch + 32*x, 32);
+		CBSha256(pair, 64, hash);
+		CBSha256(hash, 32, merkleRoot);
+	}
+}
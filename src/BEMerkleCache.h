@@ -0,0 +1,163 @@
+//
+//  BEMerkleCache.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 16/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Gives merkle branches proving that transactions are in blocks, keeping the merkle trees of recent blocks.
+ */
+
+#ifndef BEMERKLECACHEH
+#define BEMERKLECACHEH
+
+#include "BEConstants.h"
+#include "CBBlock.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/**
+ @brief The merkle tree of a block.
+ */
+typedef struct{
+	uint8_t blockHash[32]; /**< The block hash. */
+	uint32_t numTxs; /**< The number of transactions in the block. */
+	uint8_t * levels; /**< The hashes of every level from the transaction hashes to the merkle root, or NULL for an unused slot. */
+	uint64_t lastUsed; /**< The value of the use counter when the tree was last used. */
+} BEMerkleTree;
+
+/**
+ @brief Structure for BEMerkleCache objects. @see BEMerkleCache.h
+ */
+typedef struct{
+	CBObject base;
+	BEMerkleTree trees[BE_MERKLE_CACHE_BLOCKS]; /**< The cached trees. */
+	uint64_t useCounter; /**< Counts uses of the cache to find the tree used least recently. */
+	uint64_t hits; /**< The number of requests for branches which found the tree in the cache. */
+	uint64_t misses; /**< The number of requests for branches which built the tree. */
+	pthread_mutex_t lock; /**< Held while the trees are read or changed. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEMerkleCache;
+
+/**
+ @brief Creates a new BEMerkleCache object.
+ @returns A new BEMerkleCache object.
+ */
+BEMerkleCache * BENewMerkleCache(void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEMerkleCache from another object. Use this to avoid casts.
+ @param self The object to obtain the BEMerkleCache from.
+ @returns The BEMerkleCache object.
+ */
+BEMerkleCache * BEGetMerkleCache(void * self);
+
+/**
+ @brief Initialises a BEMerkleCache object.
+ @param self The BEMerkleCache object to initialise.
+ @returns true on success, false on failure.
+ */
+bool BEInitMerkleCache(BEMerkleCache * self, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEMerkleCache object.
+ @param self The BEMerkleCache object to free.
+ */
+void BEFreeMerkleCache(void * self);
+
+// Functions
+
+/**
+ @brief Builds the merkle tree of a block and keeps it, replacing the tree used least recently. A tree already kept for the block is kept instead.
+ @param self The BEMerkleCache object.
+ @param blockHash The block hash.
+ @param txHashes The transaction hashes one after the other, which are not changed.
+ @param numTxs The number of transactions.
+ @returns true on success and false on failure.
+ */
+bool BEMerkleCacheAdd(BEMerkleCache * self, uint8_t * blockHash, uint8_t * txHashes, uint32_t numTxs);
+/**
+ @brief Keeps a built merkle tree, replacing the tree used least recently, unless a tree is already kept for the block.
+ @param self The BEMerkleCache object.
+ @param blockHash The block hash.
+ @param levels The levels from BEMerkleCacheBuildTree, which are taken by the cache and freed if not kept.
+ @param numTxs The number of transactions.
+ */
+void BEMerkleCacheAddTree(BEMerkleCache * self, uint8_t * blockHash, uint8_t * levels, uint32_t numTxs);
+/**
+ @brief Builds all of the levels of a merkle tree.
+ @param txHashes The transaction hashes one after the other, which are not changed.
+ @param numTxs The number of transactions, which must be at least one.
+ @returns The hashes of every level from the transaction hashes to the merkle root, which is the last hash, or NULL on failure. Free with free().
+ */
+uint8_t * BEMerkleCacheBuildTree(uint8_t * txHashes, uint32_t numTxs, void (*onErrorReceived)(CBError error,char *,...));
+/**
+ @brief Finds the kept merkle tree of a block.
+ @param self The BEMerkleCache object.
+ @param blockHash The block hash.
+ @returns The index of the tree or -1 if it is not kept.
+ */
+int32_t BEMerkleCacheFind(BEMerkleCache * self, uint8_t * blockHash);
+/**
+ @brief Gets the merkle branch for a transaction in a block.
+ @param self The BEMerkleCache object.
+ @param block The block with its transactions deserialised.
+ @param txIndex The index of the transaction in the block.
+ @param branch Set to the BEMerkleCacheGetDepth hashes of the branch, from the bottom of the tree to the top.
+ @returns true on success and false on failure.
+ */
+bool BEMerkleCacheGetBranch(BEMerkleCache * self, CBBlock * block, uint32_t txIndex, uint8_t * branch);
+/**
+ @brief Gets the merkle branches for many transactions in a block, using the tree of the block once.
+ @param self The BEMerkleCache object.
+ @param block The block with its transactions deserialised.
+ @param txIndexes The indexes of the transactions in the block.
+ @param numIndexes The number of transactions.
+ @param branches Set to the branches one after the other, each of BEMerkleCacheGetDepth hashes from the bottom of the tree to the top.
+ @returns true on success and false if an index is not in the block or the tree could not be built.
+ */
+bool BEMerkleCacheGetBranches(BEMerkleCache * self, CBBlock * block, uint32_t * txIndexes, uint32_t numIndexes, uint8_t * branches);
+/**
+ @brief Gets the number of hashes in the merkle branches of a block.
+ @param numTxs The number of transactions in the block.
+ @returns The number of levels of the merkle tree below the root.
+ */
+uint8_t BEMerkleCacheGetDepth(uint32_t numTxs);
+/**
+ @brief Copies the merkle branch for a transaction out of a merkle tree.
+ @param levels The levels of the tree.
+ @param numTxs The number of transactions.
+ @param txIndex The index of the transaction, which must be less than numTxs.
+ @param branch Set to the BEMerkleCacheGetDepth hashes of the branch.
+ */
+void BEMerkleCacheReadBranch(uint8_t * levels, uint32_t numTxs, uint32_t txIndex, uint8_t * branch);
+/**
+ @brief Works out the merkle root from a transaction hash and its merkle branch, to check a branch against a block header.
+ @param txHash The transaction hash.
+ @param txIndex The index of the transaction in the block.
+ @param branch The hashes of the branch.
+ @param depth The number of hashes in the branch.
+ @param merkleRoot Set to the merkle root.
+ */
+void BEMerkleCacheRootFromBranch(uint8_t * txHash, uint32_t txIndex, uint8_t * branch, uint8_t depth, uint8_t * merkleRoot);
+
+#endif
@@ -0,0 +1,423 @@
+//
+//  BEOrphanPool.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 12/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BEOrphanPool.h"
+
+//  Constructor
+
+BEOrphanPool * BENewOrphanPool(char * dataDir, uint64_t maxSize, uint64_t maxAge, void (*onErrorReceived)(CBError error,char *,...)){
+	BEOrphanPool * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewOrphanPool\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeOrphanPool;
+	if (BEInitOrphanPool(self, dataDir, maxSize, maxAge, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BEOrphanPool * BEGetOrphanPool(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitOrphanPool(BEOrphanPool * self, char * dataDir, uint64_t maxSize, uint64_t maxAge, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	self->dataDir = malloc(strlen(dataDir) + 1);
+	if (NOT self->dataDir) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the data directory in BEInitOrphanPool.",strlen(dataDir) + 1);
+		return false;
+	}
+	strcpy(self->dataDir, dataDir);
+	self->maxSize = maxSize;
+	self->maxAge = maxAge;
+	self->orphans = NULL;
+	self->numSlots = 0;
+	self->numOrphans = 0;
+	self->freeHead = -1;
+	self->hashBuckets = NULL;
+	self->prevBuckets = NULL;
+	self->numBuckets = 0;
+	uint8_t key[16];
+	BESipHashRandomKey(key);
+	self->key0 = BESipHashReadInt64(key);
+	self->key1 = BESipHashReadInt64(key + 8);
+	self->oldest = -1;
+	self->newest = -1;
+	self->size = 0;
+	self->evictions = 0;
+	self->fileSize = 0;
+	self->fileOrphanBytes = 0;
+	if (NOT BEOrphanPoolGrowBuckets(self, BE_ORPHAN_POOL_MIN_BUCKETS)) {
+		free(self->dataDir);
+		return false;
+	}
+	if (NOT BEOrphanPoolLoad(self)) {
+		for (int32_t x = self->oldest; x != -1; x = self->orphans[x].newer)
+			CBReleaseObject(self->orphans[x].block);
+		free(self->orphans);
+		free(self->hashBuckets);
+		free(self->prevBuckets);
+		free(self->dataDir);
+		return false;
+	}
+	return true;
+}
+
+//  Destructor
+
+void BEFreeOrphanPool(void * vself){
+	BEOrphanPool * self = vself;
+	for (int32_t x = self->oldest; x != -1; x = self->orphans[x].newer)
+		CBReleaseObject(self->orphans[x].block);
+	close(self->fd);
+	free(self->orphans);
+	free(self->hashBuckets);
+	free(self->prevBuckets);
+	free(self->dataDir);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+bool BEOrphanPoolAdd(BEOrphanPool * self, CBBlock * block, uint64_t received){
+	CBByteArray * bytes = CBGetMessage(block)->bytes;
+	// Make room for the orphan, first by removing old orphans and then by removing the oldest orphans.
+	bool ok = BEOrphanPoolRemoveOld(self, received);
+	while (self->oldest != -1 && self->size + bytes->length > self->maxSize) {
+		ok &= BEOrphanPoolRemove(self, self->oldest, true);
+		self->evictions++;
+	}
+	if (NOT ok)
+		return false;
+	// Save the orphan before adding it, so that it is not in the pool if it cannot be saved.
+	uint8_t receivedData[8];
+	for (uint8_t x = 0; x < 8; x++)
+		receivedData[x] = received >> 8*x;
+	if (NOT BEOrphanPoolWriteRecord(self, BE_ORPHAN_RECORD_ADD, (struct iovec []){{receivedData, 8}, {CBByteArrayGetData(bytes), bytes->length}}, 2))
+		return false;
+	return BEOrphanPoolAddToPool(self, block, received, BE_ORPHAN_RECORD_OVERHEAD + 8 + bytes->length);
+}
+bool BEOrphanPoolAddToPool(BEOrphanPool * self, CBBlock * block, uint64_t received, uint32_t recordSize){
+	if (self->freeHead == -1) {
+		// Double the number of slots.
+		uint32_t numSlots = self->numSlots ? self->numSlots * 2 : BE_ORPHAN_POOL_MIN_BUCKETS;
+		BEOrphan * temp = realloc(self->orphans, sizeof(*self->orphans) * numSlots);
+		if (NOT temp) {
+			self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate %u bytes of memory for the orphans in BEOrphanPoolAddToPool.",sizeof(*self->orphans) * numSlots);
+			return false;
+		}
+		self->orphans = temp;
+		if (numSlots > self->numBuckets && NOT BEOrphanPoolGrowBuckets(self, numSlots))
+			return false;
+		for (uint32_t x = self->numSlots; x < numSlots; x++) {
+			self->orphans[x].block = NULL;
+			self->orphans[x].hashNext = x + 1 < numSlots ? (int32_t)x + 1 : -1;
+		}
+		self->freeHead = self->numSlots;
+		self->numSlots = numSlots;
+	}
+	int32_t index = self->freeHead;
+	BEOrphan * orphan = self->orphans + index;
+	self->freeHead = orphan->hashNext;
+	orphan->block = block;
+	CBRetainObject(block);
+	memcpy(orphan->hash, CBBlockGetHash(block), 32);
+	orphan->size = CBGetMessage(block)->bytes->length;
+	orphan->received = received;
+	// Add to both hash tables.
+	uint32_t bucket = BEOrphanPoolGetBucket(self, orphan->hash);
+	orphan->hashNext = self->hashBuckets[bucket];
+	self->hashBuckets[bucket] = index;
+	bucket = BEOrphanPoolGetBucket(self, CBByteArrayGetData(block->prevBlockHash));
+	orphan->prevNext = self->prevBuckets[bucket];
+	self->prevBuckets[bucket] = index;
+	// Add as the newest orphan.
+	orphan->older = self->newest;
+	orphan->newer = -1;
+	if (self->newest == -1)
+		self->oldest = index;
+	else
+		self->orphans[self->newest].newer = index;
+	self->newest = index;
+	self->numOrphans++;
+	self->size += orphan->size;
+	self->fileOrphanBytes += recordSize;
+	return true;
+}
+bool BEOrphanPoolCompact(BEOrphanPool * self){
+	if (self->fileSize < BE_ORPHAN_FILE_MIN_COMPACT || self->fileSize < self->fileOrphanBytes * 2)
+		return true;
+	// Write the orphans in the pool to a new file, from the oldest so that they are loaded in the same order.
+	char filePath[strlen(self->dataDir) + strlen(BE_ORPHAN_DATA_FILE) + 1];
+	char tempPath[strlen(self->dataDir) + strlen(BE_ORPHAN_DATA_FILE) + 5];
+	sprintf(filePath, "%s%s", self->dataDir, BE_ORPHAN_DATA_FILE);
+	sprintf(tempPath, "%s.tmp", filePath);
+	int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not open %s. errno = %i",tempPath, errno);
+		return false;
+	}
+	int oldFd = self->fd;
+	uint64_t oldFileSize = self->fileSize;
+	self->fd = fd;
+	self->fileSize = 0;
+	bool ok = true;
+	for (int32_t x = self->oldest; ok && x != -1; x = self->orphans[x].newer) {
+		uint8_t receivedData[8];
+		for (uint8_t y = 0; y < 8; y++)
+			receivedData[y] = self->orphans[x].received >> 8*y;
+		CBByteArray * bytes = CBGetMessage(self->orphans[x].block)->bytes;
+		ok = BEOrphanPoolWriteRecord(self, BE_ORPHAN_RECORD_ADD, (struct iovec []){{receivedData, 8}, {CBByteArrayGetData(bytes), bytes->length}}, 2);
+	}
+	// The new file must be complete before it replaces the old file, or a crash could leave an empty or partly written file.
+	ok = ok && NOT fdatasync(fd);
+	if (NOT ok || rename(tempPath, filePath)) {
+		// Keep using the old file.
+		close(fd);
+		unlink(tempPath);
+		self->fd = oldFd;
+		self->fileSize = oldFileSize;
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not rewrite the orphan file.");
+		return false;
+	}
+	close(oldFd);
+	self->fileOrphanBytes = self->fileSize;
+	// Sync the directory so that the rename is durable.
+	int dirFd = open(self->dataDir, O_RDONLY);
+	ok = dirFd != -1 && NOT fsync(dirFd);
+	if (dirFd != -1)
+		close(dirFd);
+	if (NOT ok) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not sync the data directory after rewriting the orphan file. errno = %i",errno);
+		return false;
+	}
+	return true;
+}
+bool BEOrphanPoolContains(BEOrphanPool * self, uint8_t * hash){
+	return BEOrphanPoolFind(self, hash) != -1;
+}
+int32_t BEOrphanPoolFind(BEOrphanPool * self, uint8_t * hash){
+	for (int32_t x = self->hashBuckets[BEOrphanPoolGetBucket(self, hash)]; x != -1; x = self->orphans[x].hashNext)
+		if (NOT memcmp(self->orphans[x].hash, hash, 32))
+			return x;
+	return -1;
+}
+uint32_t BEOrphanPoolGetBucket(BEOrphanPool * self, uint8_t * hash){
+	return BESipHash256(self->key0, self->key1, hash) & (self->numBuckets - 1);
+}
+bool BEOrphanPoolGrowBuckets(BEOrphanPool * self, uint32_t numBuckets){
+	int32_t * hashBuckets = malloc(sizeof(*hashBuckets) * numBuckets);
+	int32_t * prevBuckets = malloc(sizeof(*prevBuckets) * numBuckets);
+	if (NOT hashBuckets || NOT prevBuckets) {
+		free(hashBuckets);
+		free(prevBuckets);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for %u orphan hash table buckets in BEOrphanPoolGrowBuckets.",numBuckets);
+		return false;
+	}
+	memset(hashBuckets, 0xFF, sizeof(*hashBuckets) * numBuckets);
+	memset(prevBuckets, 0xFF, sizeof(*prevBuckets) * numBuckets);
+	free(self->hashBuckets);
+	free(self->prevBuckets);
+	self->hashBuckets = hashBuckets;
+	self->prevBuckets = prevBuckets;
+	self->numBuckets = numBuckets;
+	// Put the orphans into the new buckets.
+	for (int32_t x = self->oldest; x != -1; x = self->orphans[x].newer) {
+		uint32_t bucket = BEOrphanPoolGetBucket(self, self->orphans[x].hash);
+		self->orphans[x].hashNext = hashBuckets[bucket];
+		hashBuckets[bucket] = x;
+		bucket = BEOrphanPoolGetBucket(self, CBByteArrayGetData(self->orphans[x].block->prevBlockHash));
+		self->orphans[x].prevNext = prevBuckets[bucket];
+		prevBuckets[bucket] = x;
+	}
+	return true;
+}
+bool BEOrphanPoolLoad(BEOrphanPool * self){
+	char filePath[strlen(self->dataDir) + strlen(BE_ORPHAN_DATA_FILE) + 1];
+	sprintf(filePath, "%s%s", self->dataDir, BE_ORPHAN_DATA_FILE);
+	self->fd = open(filePath, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (self->fd == -1) {
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the orphan file %s. errno = %i",filePath, errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(self->fd, &st)) {
+		close(self->fd);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not get the size of the orphan file.");
+		return false;
+	}
+	if (NOT st.st_size)
+		return true;
+	CBByteArray * buffer = CBNewByteArrayOfSize((uint32_t)st.st_size, self->onErrorReceived);
+	if (NOT buffer) {
+		close(self->fd);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create buffer of size %u.",st.st_size);
+		return false;
+	}
+	if (pread(self->fd, CBByteArrayGetData(buffer), st.st_size, 0) != st.st_size) {
+		CBReleaseObject(buffer);
+		close(self->fd);
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not read the orphan file.");
+		return false;
+	}
+	// Replay the records up to the first incomplete or corrupt record.
+	uint8_t * data = CBByteArrayGetData(buffer);
+	uint64_t cursor = 0;
+	while (cursor + BE_ORPHAN_RECORD_OVERHEAD <= (uint64_t)st.st_size) {
+		uint8_t type = data[cursor];
+		uint32_t len = data[cursor + 1] | (uint32_t)data[cursor + 2] << 8 | (uint32_t)data[cursor + 3] << 16 | (uint32_t)data[cursor + 4] << 24;
+		if (cursor + BE_ORPHAN_RECORD_OVERHEAD + len > (uint64_t)st.st_size)
+			break;
+		uint8_t * crcData = data + cursor + 5 + len;
+		uint32_t crc = crcData[0] | (uint32_t)crcData[1] << 8 | (uint32_t)crcData[2] << 16 | (uint32_t)crcData[3] << 24;
+		if (BECRC32C(0, data + cursor, 5 + len) != crc)
+			break;
+		if (type == BE_ORPHAN_RECORD_ADD && len > 8) {
+			uint64_t received = 0;
+			for (uint8_t x = 0; x < 8; x++)
+				received |= (uint64_t)data[cursor + 5 + x] << 8*x;
+			CBByteArray * blockData = CBNewByteArrayWithDataCopy(data + cursor + 13, len - 8, self->onErrorReceived);
+			if (NOT blockData) {
+				CBReleaseObject(buffer);
+				close(self->fd);
+				return false;
+			}
+			CBBlock * block = CBNewBlockFromData(blockData, self->onErrorReceived);
+			CBReleaseObject(blockData);
+			if (NOT block) {
+				CBReleaseObject(buffer);
+				close(self->fd);
+				return false;
+			}
+			// The checksum was right, so a block which cannot be deserialised was saved wrongly and is skipped.
+			if (CBBlockDeserialise(block, true) == len - 8 && BEOrphanPoolFind(self, CBBlockGetHash(block)) == -1
+				&& NOT BEOrphanPoolAddToPool(self, block, received, BE_ORPHAN_RECORD_OVERHEAD + len)) {
+				CBReleaseObject(block);
+				CBReleaseObject(buffer);
+				close(self->fd);
+				return false;
+			}
+			CBReleaseObject(block);
+		}else if (type == BE_ORPHAN_RECORD_REMOVE && len == 32) {
+			int32_t orphan = BEOrphanPoolFind(self, data + cursor + 5);
+			if (orphan != -1)
+				BEOrphanPoolRemove(self, orphan, false);
+		}
+		cursor += BE_ORPHAN_RECORD_OVERHEAD + len;
+	}
+	CBReleaseObject(buffer);
+	if (cursor != (uint64_t)st.st_size) {
+		// Remove the incomplete or corrupt data so that new records follow the complete records.
+		self->onErrorReceived(CB_ERROR_GENERAL,"The orphan file is corrupt after %llu bytes, so the rest of the file is removed.",cursor);
+		if (ftruncate(self->fd, cursor)) {
+			close(self->fd);
+			self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not truncate the orphan file. errno = %i",errno);
+			return false;
+		}
+	}
+	self->fileSize = cursor;
+	return true;
+}
+bool BEOrphanPoolRemove(BEOrphanPool * self, int32_t orphan, bool save){
+	BEOrphan * orphanData = self->orphans + orphan;
+	// Remove from the hash tables.
+	int32_t * next = self->hashBuckets + BEOrphanPoolGetBucket(self, orphanData->hash);
+	while (*next != orphan)
+		next = &self->orphans[*next].hashNext;
+	*next = orphanData->hashNext;
+	next = self->prevBuckets + BEOrphanPoolGetBucket(self, CBByteArrayGetData(orphanData->block->prevBlockHash));
+	while (*next != orphan)
+		next = &self->orphans[*next].prevNext;
+	*next = orphanData->prevNext;
+	// Remove from the age list.
+	if (orphanData->older == -1)
+		self->oldest = orphanData->newer;
+	else
+		self->orphans[orphanData->older].newer = orphanData->newer;
+	if (orphanData->newer == -1)
+		self->newest = orphanData->older;
+	else
+		self->orphans[orphanData->newer].older = orphanData->older;
+	self->numOrphans--;
+	self->size -= orphanData->size;
+	self->fileOrphanBytes -= BE_ORPHAN_RECORD_OVERHEAD + 8 + orphanData->size;
+	CBReleaseObject(orphanData->block);
+	orphanData->block = NULL;
+	orphanData->hashNext = self->freeHead;
+	self->freeHead = orphan;
+	if (NOT save)
+		return true;
+	// If the removal is not saved the orphan is loaded again, which does no harm.
+	return BEOrphanPoolWriteRecord(self, BE_ORPHAN_RECORD_REMOVE, (struct iovec []){{orphanData->hash, 32}}, 1)
+		&& BEOrphanPoolCompact(self);
+}
+bool BEOrphanPoolRemoveOld(BEOrphanPool * self, uint64_t now){
+	bool ok = true;
+	while (self->oldest != -1 && self->orphans[self->oldest].received + self->maxAge < now) {
+		ok &= BEOrphanPoolRemove(self, self->oldest, true);
+		self->evictions++;
+	}
+	return ok;
+}
+CBBlock * BEOrphanPoolTakeChild(BEOrphanPool * self, uint8_t * prevHash){
+	for (int32_t x = self->prevBuckets[BEOrphanPoolGetBucket(self, prevHash)]; x != -1; x = self->orphans[x].prevNext) {
+		CBBlock * block = self->orphans[x].block;
+		if (memcmp(CBByteArrayGetData(block->prevBlockHash), prevHash, 32))
+			continue;
+		CBRetainObject(block);
+		// The orphan is taken even if the removal cannot be saved, as an orphan in the file again is only loaded again.
+		BEOrphanPoolRemove(self, x, true);
+		return block;
+	}
+	return NULL;
+}
+bool BEOrphanPoolWriteRecord(BEOrphanPool * self, BEOrphanRecordType type, struct iovec * parts, uint8_t numParts){
+	uint32_t len = 0;
+	for (uint8_t x = 0; x < numParts; x++)
+		len += parts[x].iov_len;
+	uint8_t header[5] = {type, len, len >> 8, len >> 16, len >> 24};
+	uint32_t crc = BECRC32C(0, header, 5);
+	for (uint8_t x = 0; x < numParts; x++)
+		crc = BECRC32C(crc, parts[x].iov_base, parts[x].iov_len);
+	uint8_t crcData[4] = {crc, crc >> 8, crc >> 16, crc >> 24};
+	struct iovec record[4] = {{header, 5}};
+	memcpy(record + 1, parts, sizeof(*parts) * numParts);
+	record[numParts + 1] = (struct iovec){crcData, 4};
+	// Write at the end of the complete records, so a partially written record is overwritten by the next record.
+	uint64_t length = BE_ORPHAN_RECORD_OVERHEAD + len;
+	if (pwritev(self->fd, record, numParts + 2, self->fileSize) != (ssize_t)length) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not write to the orphan file. errno = %i",errno);
+		return false;
+	}
+	self->fileSize += length;
+	return true;
+}
@@ -0,0 +1,215 @@
+//
+//  BEOrphanPool.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 12/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Holds orphan blocks, which are blocks whose previous block has not been received, until they can be connected.
+ */
+
+#ifndef BEORPHANPOOLH
+#define BEORPHANPOOLH
+
+#include "BEConstants.h"
+#include "BECRC32C.h"
+#include "BESipHash.h"
+#include "CBBlock.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ @brief The types of records in the orphan file.
+ */
+typedef enum{
+	BE_ORPHAN_RECORD_ADD, /**< An orphan was added. */
+	BE_ORPHAN_RECORD_REMOVE, /**< An orphan was removed. */
+} BEOrphanRecordType;
+
+/**
+ @brief An orphan in the pool.
+ */
+typedef struct{
+	CBBlock * block; /**< The orphan block or NULL for an unused slot. */
+	uint8_t hash[32]; /**< The block hash. */
+	uint32_t size; /**< The size of the serialised block. */
+	uint64_t received; /**< The time the orphan was received. */
+	int32_t hashNext; /**< The index of the next orphan in the same block hash bucket or -1. For unused slots this is the next unused slot. */
+	int32_t prevNext; /**< The index of the next orphan in the same previous block hash bucket or -1. */
+	int32_t older; /**< The index of the orphan received before this one or -1. */
+	int32_t newer; /**< The index of the orphan received after this one or -1. */
+} BEOrphan;
+
+/**
+ @brief Structure for BEOrphanPool objects. @see BEOrphanPool.h
+ */
+typedef struct{
+	CBObject base;
+	char * dataDir; /**< Data directory path */
+	BEOrphan * orphans; /**< Slots for the orphans. Slots are reused but not moved, so orphans are referred to by their index. */
+	uint32_t numSlots; /**< The number of slots. */
+	uint32_t numOrphans; /**< The number of orphans. */
+	int32_t freeHead; /**< The index of the first unused slot or -1. */
+	int32_t * hashBuckets; /**< Hash table of the first orphan index for each bucket by the block hash or -1. */
+	int32_t * prevBuckets; /**< Hash table of the first orphan index for each bucket by the previous block hash or -1. */
+	uint32_t numBuckets; /**< The number of buckets in each hash table, a power of two which is at least the number of slots. */
+	uint64_t key0; /**< The first half of the random SipHash key for the hash tables. */
+	uint64_t key1; /**< The second half of the random SipHash key for the hash tables. */
+	int32_t oldest; /**< The index of the oldest orphan or -1. */
+	int32_t newest; /**< The index of the newest orphan or -1. */
+	uint64_t size; /**< The total size of the orphans. */
+	uint64_t maxSize; /**< The maximum total size of the orphans. */
+	uint64_t maxAge; /**< Orphans are removed once they are older than this many seconds. */
+	uint64_t evictions; /**< The number of orphans removed because of the size or age limits. */
+	int fd; /**< The file descriptor for the orphan file. */
+	uint64_t fileSize; /**< The length of the orphan file. */
+	uint64_t fileOrphanBytes; /**< The number of bytes of records in the orphan file for the orphans in the pool. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BEOrphanPool;
+
+/**
+ @brief Creates a new BEOrphanPool object, loading the orphans saved in the data directory.
+ @param dataDir The directory for the orphan file.
+ @param maxSize The maximum total size of the orphans.
+ @param maxAge The number of seconds orphans are kept for.
+ @returns A new BEOrphanPool object.
+ */
+BEOrphanPool * BENewOrphanPool(char * dataDir, uint64_t maxSize, uint64_t maxAge, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BEOrphanPool from another object. Use this to avoid casts.
+ @param self The object to obtain the BEOrphanPool from.
+ @returns The BEOrphanPool object.
+ */
+BEOrphanPool * BEGetOrphanPool(void * self);
+
+/**
+ @brief Initialises a BEOrphanPool object.
+ @param self The BEOrphanPool object to initialise.
+ @param dataDir The directory for the orphan file.
+ @param maxSize The maximum total size of the orphans.
+ @param maxAge The number of seconds orphans are kept for.
+ @returns true on success, false on failure.
+ */
+bool BEInitOrphanPool(BEOrphanPool * self, char * dataDir, uint64_t maxSize, uint64_t maxAge, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BEOrphanPool object.
+ @param self The BEOrphanPool object to free.
+ */
+void BEFreeOrphanPool(void * self);
+
+// Functions
+
+/**
+ @brief Adds an orphan to the pool and saves it. Orphans older than the maximum age and then the oldest orphans are removed to make room for the orphan.
+ @param self The BEOrphanPool object.
+ @param block The orphan, which is retained. It must not be larger than the maximum total size.
+ @param received The time the orphan was received, which is also used as the current time to find old orphans.
+ @returns true on success and false on failure.
+ */
+bool BEOrphanPoolAdd(BEOrphanPool * self, CBBlock * block, uint64_t received);
+/**
+ @brief Adds a loaded orphan to the pool without saving it.
+ @param self The BEOrphanPool object.
+ @param block The orphan, which is retained.
+ @param received The time the orphan was received.
+ @param recordSize The size of the record for the orphan in the orphan file.
+ @returns true on success and false on failure.
+ */
+bool BEOrphanPoolAddToPool(BEOrphanPool * self, CBBlock * block, uint64_t received, uint32_t recordSize);
+/**
+ @brief Rewrites the orphan file with only the orphans in the pool if most of the file is for removed orphans.
+ @param self The BEOrphanPool object.
+ @returns true on success or if the file did not need rewriting, false on failure.
+ */
+bool BEOrphanPoolCompact(BEOrphanPool * self);
+/**
+ @brief Determines if an orphan is in the pool.
+ @param self The BEOrphanPool object.
+ @param hash The block hash.
+ @returns true if the orphan is in the pool, false otherwise.
+ */
+bool BEOrphanPoolContains(BEOrphanPool * self, uint8_t * hash);
+/**
+ @brief Finds an orphan by its block hash.
+ @param self The BEOrphanPool object.
+ @param hash The block hash.
+ @returns The index of the orphan or -1 if it is not in the pool.
+ */
+int32_t BEOrphanPoolFind(BEOrphanPool * self, uint8_t * hash);
+/**
+ @brief Gets the hash table bucket for a hash. The hash is hashed again with a random key, as peers can choose the previous block hash of an orphan and so could otherwise put every orphan in one bucket.
+ @param self The BEOrphanPool object.
+ @param hash The 32 byte hash.
+ @returns The bucket.
+ */
+uint32_t BEOrphanPoolGetBucket(BEOrphanPool * self, uint8_t * hash);
+/**
+ @brief Makes the hash tables larger and puts the orphans in the new buckets.
+ @param self The BEOrphanPool object.
+ @param numBuckets The new number of buckets, a power of two.
+ @returns true on success and false on failure.
+ */
+bool BEOrphanPoolGrowBuckets(BEOrphanPool * self, uint32_t numBuckets);
+/**
+ @brief Loads the orphans from the orphan file.
+ @param self The BEOrphanPool object.
+ @returns true on success and false on failure.
+ */
+bool BEOrphanPoolLoad(BEOrphanPool * self);
+/**
+ @brief Removes an orphan from the pool, releasing the block.
+ @param self The BEOrphanPool object.
+ @param orphan The index of the orphan.
+ @param save If true a record of the removal is written to the orphan file.
+ @returns true on success and false if the removal could not be saved. The orphan is always removed from the pool.
+ */
+bool BEOrphanPoolRemove(BEOrphanPool * self, int32_t orphan, bool save);
+/**
+ @brief Removes orphans which are older than the maximum age.
+ @param self The BEOrphanPool object.
+ @param now The current time.
+ @returns true on success and false on failure.
+ */
+bool BEOrphanPoolRemoveOld(BEOrphanPool * self, uint64_t now);
+/**
+ @brief Removes an orphan which follows a block from the pool. Call this until it returns NULL to get all of the orphans which follow a block.
+ @param self The BEOrphanPool object.
+ @param prevHash The hash of the block which the orphan follows.
+ @returns The orphan, which should be released, or NULL if no orphans follow the block.
+ */
+CBBlock * BEOrphanPoolTakeChild(BEOrphanPool * self, uint8_t * prevHash);
+/**
+ @brief Appends a record to the orphan file.
+ @param self The BEOrphanPool object.
+ @param type The type of the record.
+ @param parts The parts of the record data.
+ @param numParts The number of parts, which is at most two.
+ @returns true on success and false on failure.
+ */
+bool BEOrphanPoolWriteRecord(BEOrphanPool * self, BEOrphanRecordType type, struct iovec * parts, uint8_t numParts);
+
+#endif
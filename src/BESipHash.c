@@ -0,0 +1,96 @@
+//
+//  BESipHash.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 27/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BESipHash.h"
+
+uint64_t BESipHash(uint64_t key0, uint64_t key1, uint8_t * data, size_t length){
+	uint64_t v0 = 0x736f6d6570736575ULL ^ key0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ key1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ key0;
+	uint64_t v3 = 0x7465646279746573ULL ^ key1;
+	size_t end = length & ~(size_t)7;
+	for (size_t x = 0; x < end; x += 8) {
+		uint64_t m = BESipHashReadInt64(data + x);
+		v3 ^= m;
+		BESipHashRound(v0, v1, v2, v3)
+		BESipHashRound(v0, v1, v2, v3)
+		v0 ^= m;
+	}
+	// The last block has the remaining bytes and the length in the top byte.
+	uint64_t m = (uint64_t)length << 56;
+	for (size_t x = end; x < length; x++)
+		m |= (uint64_t)data[x] << (8 * (x - end));
+	v3 ^= m;
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	v0 ^= m;
+	v2 ^= 0xFF;
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+uint64_t BESipHash256(uint64_t key0, uint64_t key1, uint8_t * hash){
+	uint64_t v0 = 0x736f6d6570736575ULL ^ key0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ key1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ key0;
+	uint64_t v3 = 0x7465646279746573ULL ^ key1;
+	for (uint8_t x = 0; x < 32; x += 8) {
+		uint64_t m = BESipHashReadInt64(hash + x);
+		v3 ^= m;
+		BESipHashRound(v0, v1, v2, v3)
+		BESipHashRound(v0, v1, v2, v3)
+		v0 ^= m;
+	}
+	// The last block only has the length.
+	v3 ^= (uint64_t)32 << 56;
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	v0 ^= (uint64_t)32 << 56;
+	v2 ^= 0xFF;
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	BESipHashRound(v0, v1, v2, v3)
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+void BESipHashRandomKey(uint8_t * key){
+	int random = open("/dev/urandom", O_RDONLY);
+	bool keyed = random != -1 && read(random, key, 16) == 16;
+	if (random != -1)
+		close(random);
+	if (keyed)
+		return;
+	uint64_t seed = (uint64_t)time(NULL) ^ (uint64_t)getpid() << 32;
+	for (uint8_t x = 0; x < 16; x++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key[x] = seed >> 56;
+	}
+}
+uint64_t BESipHashReadInt64(uint8_t * data){
+	return (uint64_t)data[0] | (uint64_t)data[1] << 8 | (uint64_t)data[2] << 16 | (uint64_t)data[3] << 24
+		| (uint64_t)data[4] << 32 | (uint64_t)data[5] << 40 | (uint64_t)data[6] << 48 | (uint64_t)data[7] << 56;
+}
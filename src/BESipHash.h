@@ -0,0 +1,77 @@
+//
+//  BESipHash.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 27/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+
+/**
+ @file
+ @brief Calculates SipHash-2-4, a keyed hash used where an attacker must not be able to find collisions without the key, such as the short transaction IDs of compact blocks.
+ */
+
+#ifndef BESIPHASHH
+#define BESIPHASHH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#define BESipHashRotate(x,b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define BESipHashRound(v0,v1,v2,v3) \
+	v0 += v1; v1 = BESipHashRotate(v1, 13); v1 ^= v0; v0 = BESipHashRotate(v0, 32); \
+	v2 += v3; v3 = BESipHashRotate(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = BESipHashRotate(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = BESipHashRotate(v1, 17); v1 ^= v2; v2 = BESipHashRotate(v2, 32);
+
+// Functions
+
+/**
+ @brief Calculates the SipHash-2-4 of data.
+ @param key0 The first 8 bytes of the key as a little-endian integer.
+ @param key1 The last 8 bytes of the key as a little-endian integer.
+ @param data The data.
+ @param length The length of the data.
+ @returns The hash.
+ */
+uint64_t BESipHash(uint64_t key0, uint64_t key1, uint8_t * data, size_t length);
+/**
+ @brief Calculates the SipHash-2-4 of a 32 byte hash, as BESipHash does but faster.
+ @param key0 The first 8 bytes of the key as a little-endian integer.
+ @param key1 The last 8 bytes of the key as a little-endian integer.
+ @param hash The 32 byte hash.
+ @returns The hash.
+ */
+uint64_t BESipHash256(uint64_t key0, uint64_t key1, uint8_t * hash);
+/**
+ @brief Makes a random key, so that peers cannot make data which all goes in the same hash table slots. The key is read from /dev/urandom, or else made from the time and process ID.
+ @param key The 16 byte key.
+ */
+void BESipHashRandomKey(uint8_t * key);
+/**
+ @brief Reads a little-endian 64 bit integer.
+ @param data The 8 bytes.
+ @returns The integer.
+ */
+uint64_t BESipHashReadInt64(uint8_t * data);
+
+#endif
@@ -0,0 +1,433 @@
+//
+//  BETxIndex.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 21/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+//  SEE HEADER FILE FOR DOCUMENTATION
+
+#include "BETxIndex.h"
+
+//  Constructor
+
+BETxIndex * BENewTxIndex(char * dataDir, void (*onErrorReceived)(CBError error,char *,...)){
+	BETxIndex * self = malloc(sizeof(*self));
+	if (NOT self) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Cannot allocate %i bytes of memory in BENewTxIndex\n",sizeof(*self));
+		return NULL;
+	}
+	CBGetObject(self)->free = BEFreeTxIndex;
+	if (BEInitTxIndex(self, dataDir, onErrorReceived))
+		return self;
+	free(self);
+	return NULL;
+}
+
+//  Object Getter
+
+BETxIndex * BEGetTxIndex(void * self){
+	return self;
+}
+
+//  Initialiser
+
+bool BEInitTxIndex(BETxIndex * self, char * dataDir, void (*onErrorReceived)(CBError error,char *,...)){
+	if (NOT CBInitObject(CBGetObject(self)))
+		return false;
+	self->onErrorReceived = onErrorReceived;
+	self->dataDir = malloc(strlen(dataDir) + 1);
+	if (NOT self->dataDir) {
+		onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for the data directory in BEInitTxIndex.");
+		return false;
+	}
+	strcpy(self->dataDir, dataDir);
+	char indexFile[strlen(dataDir) + strlen(BE_TX_INDEX_FILE) + 1];
+	sprintf(indexFile, "%s%s", dataDir, BE_TX_INDEX_FILE);
+	self->fd = open(indexFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (self->fd == -1) {
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not open the transaction index file %s. errno = %i",indexFile, errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(self->fd, &st)) {
+		close(self->fd);
+		free(self->dataDir);
+		onErrorReceived(CB_ERROR_INIT_FAIL,"Could not get the size of the transaction index file.");
+		return false;
+	}
+	uint8_t header[51];
+	bool valid = st.st_size >= BE_TX_INDEX_HEADER_SIZE
+		&& pread(self->fd, header, 51, 0) == 51
+		&& (header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24) == BE_TX_INDEX_FILE_VERSION
+		&& BECRC32C(0, header, 47) == (header[47] | (uint32_t)header[48] << 8 | (uint32_t)header[49] << 16 | (uint32_t)header[50] << 24);
+	if (valid) {
+		self->key0 = BESipHashReadInt64(header + 4);
+		self->key1 = BESipHashReadInt64(header + 12);
+		self->numSlots = header[20] | (uint32_t)header[21] << 8 | (uint32_t)header[22] << 16 | (uint32_t)header[23] << 24;
+		self->numUsed = header[24] | (uint32_t)header[25] << 8 | (uint32_t)header[26] << 16 | (uint32_t)header[27] << 24;
+		self->numDeleted = header[28] | (uint32_t)header[29] << 8 | (uint32_t)header[30] << 16 | (uint32_t)header[31] << 24;
+		self->numBlocks = header[32] | (uint32_t)header[33] << 8 | (uint32_t)header[34] << 16 | (uint32_t)header[35] << 24;
+		self->tipRef.fileID = header[36] | (uint16_t)header[37] << 8;
+		self->tipRef.filePos = BESipHashReadInt64(header + 38);
+		self->clean = header[46];
+		valid = self->numSlots >= BE_TX_INDEX_MIN_SLOTS && NOT (self->numSlots & (self->numSlots - 1))
+			&& (uint64_t)st.st_size == BE_TX_INDEX_HEADER_SIZE + (uint64_t)self->numSlots * BE_TX_INDEX_RECORD_SIZE;
+	}
+	if (NOT valid) {
+		// The index can be made again from the blocks.
+		if (st.st_size)
+			onErrorReceived(CB_ERROR_GENERAL,"The transaction index file is not a valid transaction index file and is replaced with an empty one.");
+		if (NOT BETxIndexCreate(self, BE_TX_INDEX_MIN_SLOTS)) {
+			close(self->fd);
+			free(self->dataDir);
+			return false;
+		}
+	}
+	if (NOT BETxIndexMap(self)) {
+		close(self->fd);
+		free(self->dataDir);
+		return false;
+	}
+	return true;
+}
+
+//  Destructor
+
+void BEFreeTxIndex(void * vself){
+	BETxIndex * self = vself;
+	BETxIndexSync(self);
+	munmap(self->map, self->mapSize);
+	close(self->fd);
+	free(self->dirty);
+	free(self->dataDir);
+	CBFreeObject(self);
+}
+
+//  Functions
+
+bool BETxIndexAdd(BETxIndex * self, uint8_t * txHash, BETxIndexEntry * entry){
+	if ((uint64_t)(self->numUsed + self->numDeleted + 1) * 4 > (uint64_t)self->numSlots * 3 && NOT BETxIndexGrow(self))
+		return false;
+	bool found;
+	uint32_t slot = BETxIndexFindSlot(self, txHash, &found);
+	if (slot == self->numSlots) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"The transaction index is full.");
+		return false;
+	}
+	uint8_t * record = self->map + BE_TX_INDEX_HEADER_SIZE + (uint64_t)slot * BE_TX_INDEX_RECORD_SIZE;
+	BETxIndexEntry oldEntry;
+	BETxIndexState state = BETxIndexReadRecord(record, &oldEntry);
+	if (NOT BETxIndexSetDirty(self, slot))
+		return false;
+	BETxIndexWriteRecord(record, txHash, entry, BE_TX_INDEX_USED);
+	if (NOT found) {
+		if (state == BE_TX_INDEX_DELETED)
+			self->numDeleted--;
+		self->numUsed++;
+	}
+	return true;
+}
+bool BETxIndexAddBlock(BETxIndex * self, CBBlock * block, BEFileReference blockRef){
+	// The transactions follow the header and the number of transactions. Look at the byte data in case the number is longer than needed.
+	uint8_t * bytes = CBByteArrayGetData(CBGetMessage(block)->bytes);
+	BETxIndexEntry entry = {blockRef, 80, 0, self->numBlocks};
+	entry.offset += bytes[80] < 253 ? 1 : (bytes[80] == 253 ? 3 : (bytes[80] == 254 ? 5 : 9));
+	for (uint32_t x = 0; x < block->transactionNum; x++) {
+		entry.length = CBGetMessage(block->transactions[x])->bytes->length;
+		if (NOT BETxIndexAdd(self, CBTransactionGetHash(block->transactions[x]), &entry))
+			return false;
+		entry.offset += entry.length;
+	}
+	self->numBlocks++;
+	self->tipRef = blockRef;
+	if (self->numDirty >= BE_TX_INDEX_MAX_DIRTY_PAGES)
+		return BETxIndexSync(self);
+	return true;
+}
+bool BETxIndexCreate(BETxIndex * self, uint32_t numSlots){
+	// The key must not be guessed by peers, or they could make transactions which all go in the same slots.
+	uint8_t key[16];
+	BESipHashRandomKey(key);
+	self->key0 = BESipHashReadInt64(key);
+	self->key1 = BESipHashReadInt64(key + 8);
+	self->numSlots = numSlots;
+	self->numUsed = 0;
+	self->numDeleted = 0;
+	self->numBlocks = 0;
+	self->tipRef = (BEFileReference){0, 0};
+	self->clean = true;
+	// Empty the file before setting the length, so that the records are zeros without writing them.
+	if (ftruncate(self->fd, 0) || ftruncate(self->fd, BE_TX_INDEX_HEADER_SIZE + (off_t)numSlots * BE_TX_INDEX_RECORD_SIZE)) {
+		self->onErrorReceived(CB_ERROR_INIT_FAIL,"Could not create the transaction index file. errno = %i",errno);
+		return false;
+	}
+	return BETxIndexWriteHeader(self, self->fd, true);
+}
+bool BETxIndexFind(BETxIndex * self, uint8_t * txHash, BETxIndexEntry * entry){
+	bool found;
+	uint32_t slot = BETxIndexFindSlot(self, txHash, &found);
+	if (NOT found)
+		return false;
+	BETxIndexReadRecord(self->map + BE_TX_INDEX_HEADER_SIZE + (uint64_t)slot * BE_TX_INDEX_RECORD_SIZE, entry);
+	return true;
+}
+uint32_t BETxIndexFindSlot(BETxIndex * self, uint8_t * txHash, bool * found){
+	uint32_t mask = self->numSlots - 1;
+	uint32_t slot = BESipHash256(self->key0, self->key1, txHash) & mask;
+	uint32_t freeSlot = self->numSlots;
+	*found = false;
+	for (uint32_t x = 0; x < self->numSlots; x++, slot = (slot + 1) & mask) {
+		uint8_t * record = self->map + BE_TX_INDEX_HEADER_SIZE + (uint64_t)slot * BE_TX_INDEX_RECORD_SIZE;
+		BETxIndexEntry entry;
+		BETxIndexState state = BETxIndexReadRecord(record, &entry);
+		if (state == BE_TX_INDEX_EMPTY)
+			return freeSlot == self->numSlots ? slot : freeSlot;
+		if (state == BE_TX_INDEX_DELETED) {
+			if (freeSlot == self->numSlots)
+				freeSlot = slot;
+		}else if (NOT memcmp(record, txHash, 32)) {
+			*found = true;
+			return slot;
+		}
+	}
+	return freeSlot;
+}
+bool BETxIndexGrow(BETxIndex * self){
+	// Build the new table in a new file which is synced before it replaces the old file, so that the file always has a whole table.
+	uint32_t numSlots = self->numSlots * 2;
+	uint64_t mapSize = BE_TX_INDEX_HEADER_SIZE + (uint64_t)numSlots * BE_TX_INDEX_RECORD_SIZE;
+	char filePath[strlen(self->dataDir) + strlen(BE_TX_INDEX_FILE) + 1];
+	char tempPath[strlen(self->dataDir) + strlen(BE_TX_INDEX_FILE) + 5];
+	sprintf(filePath, "%s%s", self->dataDir, BE_TX_INDEX_FILE);
+	sprintf(tempPath, "%s.tmp", filePath);
+	int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not open %s. errno = %i",tempPath, errno);
+		return false;
+	}
+	uint8_t * map = MAP_FAILED;
+	bool ok = NOT ftruncate(fd, (off_t)mapSize)
+		&& (map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED;
+	if (ok) {
+		// Copy the used records to their new slots, leaving out the deleted records.
+		uint32_t mask = numSlots - 1;
+		for (uint32_t x = 0; x < self->numSlots; x++) {
+			uint8_t * record = self->map + BE_TX_INDEX_HEADER_SIZE + (uint64_t)x * BE_TX_INDEX_RECORD_SIZE;
+			BETxIndexEntry entry;
+			if (BETxIndexReadRecord(record, &entry) != BE_TX_INDEX_USED)
+				continue;
+			uint32_t slot = BESipHash256(self->key0, self->key1, record) & mask;
+			while (map[BE_TX_INDEX_HEADER_SIZE + (uint64_t)slot * BE_TX_INDEX_RECORD_SIZE + 54] != BE_TX_INDEX_EMPTY)
+				slot = (slot + 1) & mask;
+			memcpy(map + BE_TX_INDEX_HEADER_SIZE + (uint64_t)slot * BE_TX_INDEX_RECORD_SIZE, record, BE_TX_INDEX_RECORD_SIZE);
+		}
+		ok = NOT msync(map, mapSize, MS_SYNC);
+		munmap(map, mapSize);
+	}
+	uint32_t oldNumSlots = self->numSlots;
+	uint32_t oldNumDeleted = self->numDeleted;
+	self->numSlots = numSlots;
+	self->numDeleted = 0;
+	ok = ok && BETxIndexWriteHeader(self, fd, true) && NOT rename(tempPath, filePath);
+	if (ok) {
+		// Sync the directory so that the rename is durable.
+		int dirFd = open(self->dataDir, O_RDONLY);
+		ok = dirFd != -1 && NOT fsync(dirFd);
+		if (dirFd != -1)
+			close(dirFd);
+	}
+	if (NOT ok) {
+		close(fd);
+		self->numSlots = oldNumSlots;
+		self->numDeleted = oldNumDeleted;
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not grow the transaction index. errno = %i",errno);
+		return false;
+	}
+	// Every change is in the new file, so the old mapping and its changes are dropped.
+	munmap(self->map, self->mapSize);
+	close(self->fd);
+	free(self->dirty);
+	self->fd = fd;
+	self->clean = true;
+	return BETxIndexMap(self);
+}
+bool BETxIndexMap(BETxIndex * self){
+	self->mapSize = BE_TX_INDEX_HEADER_SIZE + (uint64_t)self->numSlots * BE_TX_INDEX_RECORD_SIZE;
+	self->map = mmap(NULL, self->mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, self->fd, 0);
+	if (self->map == MAP_FAILED) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not map the transaction index file. errno = %i",errno);
+		return false;
+	}
+	self->dirty = calloc(self->mapSize / BE_TX_INDEX_PAGE_SIZE / 8 + 1, 1);
+	if (NOT self->dirty) {
+		munmap(self->map, self->mapSize);
+		self->onErrorReceived(CB_ERROR_OUT_OF_MEMORY,"Could not allocate memory for the changed pages of the transaction index.");
+		return false;
+	}
+	self->numDirty = 0;
+	if (NOT self->clean) {
+		// Pages may have been written without the header, so count the records again.
+		self->numUsed = 0;
+		self->numDeleted = 0;
+		for (uint32_t x = 0; x < self->numSlots; x++) {
+			BETxIndexEntry entry;
+			BETxIndexState state = BETxIndexReadRecord(self->map + BE_TX_INDEX_HEADER_SIZE + (uint64_t)x * BE_TX_INDEX_RECORD_SIZE, &entry);
+			if (state == BE_TX_INDEX_USED)
+				self->numUsed++;
+			else if (state == BE_TX_INDEX_DELETED)
+				self->numDeleted++;
+		}
+	}
+	return true;
+}
+BETxIndexState BETxIndexReadRecord(uint8_t * record, BETxIndexEntry * entry){
+	if (BECRC32C(0, record, 55) != (record[55] | (uint32_t)record[56] << 8 | (uint32_t)record[57] << 16 | (uint32_t)record[58] << 24)) {
+		// Empty slots are zeros. Other records with bad checksums were not completely written.
+		for (uint8_t x = 0; x < BE_TX_INDEX_RECORD_SIZE; x++)
+			if (record[x])
+				return BE_TX_INDEX_DELETED;
+		return BE_TX_INDEX_EMPTY;
+	}
+	entry->blockRef.fileID = record[32] | (uint16_t)record[33] << 8;
+	entry->blockRef.filePos = BESipHashReadInt64(record + 34);
+	entry->offset = record[42] | (uint32_t)record[43] << 8 | (uint32_t)record[44] << 16 | (uint32_t)record[45] << 24;
+	entry->length = record[46] | (uint32_t)record[47] << 8 | (uint32_t)record[48] << 16 | (uint32_t)record[49] << 24;
+	entry->height = record[50] | (uint32_t)record[51] << 8 | (uint32_t)record[52] << 16 | (uint32_t)record[53] << 24;
+	return record[54] == BE_TX_INDEX_USED ? BE_TX_INDEX_USED : BE_TX_INDEX_DELETED;
+}
+bool BETxIndexRemove(BETxIndex * self, uint8_t * txHash, BEFileReference blockRef){
+	bool found;
+	uint32_t slot = BETxIndexFindSlot(self, txHash, &found);
+	if (NOT found)
+		return true;
+	uint8_t * record = self->map + BE_TX_INDEX_HEADER_SIZE + (uint64_t)slot * BE_TX_INDEX_RECORD_SIZE;
+	BETxIndexEntry entry;
+	BETxIndexReadRecord(record, &entry);
+	// A transaction hash can be in more than one block, in which case the record is for the last block added.
+	if (entry.blockRef.fileID != blockRef.fileID || entry.blockRef.filePos != blockRef.filePos)
+		return true;
+	if (NOT BETxIndexSetDirty(self, slot))
+		return false;
+	BETxIndexWriteRecord(record, txHash, &entry, BE_TX_INDEX_DELETED);
+	self->numUsed--;
+	self->numDeleted++;
+	return true;
+}
+bool BETxIndexRemoveBlock(BETxIndex * self, CBBlock * block, BEFileReference prevRef){
+	for (uint32_t x = block->transactionNum; x--;)
+		if (NOT BETxIndexRemove(self, CBTransactionGetHash(block->transactions[x]), self->tipRef))
+			return false;
+	self->numBlocks--;
+	self->tipRef = prevRef;
+	if (self->numDirty >= BE_TX_INDEX_MAX_DIRTY_PAGES)
+		return BETxIndexSync(self);
+	return true;
+}
+bool BETxIndexSetDirty(BETxIndex * self, uint32_t slot){
+	if (self->clean) {
+		// Clear the flag before any page can reach the file.
+		if (NOT BETxIndexWriteHeader(self, self->fd, false))
+			return false;
+		self->clean = false;
+	}
+	uint32_t page = (uint32_t)((BE_TX_INDEX_HEADER_SIZE + (uint64_t)slot * BE_TX_INDEX_RECORD_SIZE) / BE_TX_INDEX_PAGE_SIZE);
+	if (NOT (self->dirty[page / 8] & (1 << page % 8))) {
+		self->dirty[page / 8] |= 1 << page % 8;
+		self->numDirty++;
+	}
+	return true;
+}
+bool BETxIndexSync(BETxIndex * self){
+	if (self->clean)
+		return true;
+	// Write each run of changed pages at once.
+	uint32_t numPages = (uint32_t)(self->mapSize / BE_TX_INDEX_PAGE_SIZE);
+	bool ok = true;
+	for (uint32_t x = 0; x < numPages && ok;) {
+		if (NOT (self->dirty[x / 8] & (1 << x % 8))) {
+			x++;
+			continue;
+		}
+		uint32_t end = x + 1;
+		while (end < numPages && self->dirty[end / 8] & (1 << end % 8))
+			end++;
+		size_t length = (size_t)(end - x) * BE_TX_INDEX_PAGE_SIZE;
+		ok = pwrite(self->fd, self->map + (uint64_t)x * BE_TX_INDEX_PAGE_SIZE, length, (off_t)x * BE_TX_INDEX_PAGE_SIZE) == (ssize_t)length;
+		x = end;
+	}
+	// Sync the pages before the header, so that the header never counts blocks whose records are not on disk.
+	if (NOT ok || fdatasync(self->fd)) {
+		// The pages stay changed so that they are written by the next sync.
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not sync the transaction index. errno = %i",errno);
+		return false;
+	}
+	if (NOT BETxIndexWriteHeader(self, self->fd, true))
+		return false;
+	// The file has the changes, so drop the private copies of the pages.
+	for (uint32_t x = 0; x < numPages; x++)
+		if (self->dirty[x / 8] & (1 << x % 8))
+			madvise(self->map + (uint64_t)x * BE_TX_INDEX_PAGE_SIZE, BE_TX_INDEX_PAGE_SIZE, MADV_DONTNEED);
+	memset(self->dirty, 0, numPages / 8 + 1);
+	self->numDirty = 0;
+	self->clean = true;
+	return true;
+}
+bool BETxIndexWriteHeader(BETxIndex * self, int fd, bool clean){
+	uint8_t header[51];
+	for (uint8_t x = 0; x < 4; x++) {
+		header[x] = BE_TX_INDEX_FILE_VERSION >> 8*x;
+		header[20 + x] = self->numSlots >> 8*x;
+		header[24 + x] = self->numUsed >> 8*x;
+		header[28 + x] = self->numDeleted >> 8*x;
+		header[32 + x] = self->numBlocks >> 8*x;
+	}
+	for (uint8_t x = 0; x < 8; x++) {
+		header[4 + x] = self->key0 >> 8*x;
+		header[12 + x] = self->key1 >> 8*x;
+		header[38 + x] = self->tipRef.filePos >> 8*x;
+	}
+	header[36] = self->tipRef.fileID;
+	header[37] = self->tipRef.fileID >> 8;
+	header[46] = clean;
+	uint32_t crc = BECRC32C(0, header, 47);
+	for (uint8_t x = 0; x < 4; x++)
+		header[47 + x] = crc >> 8*x;
+	if (pwrite(fd, header, 51, 0) != 51 || fdatasync(fd)) {
+		self->onErrorReceived(CB_ERROR_GENERAL,"Could not write the transaction index header. errno = %i",errno);
+		return false;
+	}
+	return true;
+}
+void BETxIndexWriteRecord(uint8_t * record, uint8_t * txHash, BETxIndexEntry * entry, BETxIndexState state){
+	memmove(record, txHash, 32);
+	record[32] = entry->blockRef.fileID;
+	record[33] = entry->blockRef.fileID >> 8;
+	for (uint8_t x = 0; x < 8; x++)
+		record[34 + x] = entry->blockRef.filePos >> 8*x;
+	for (uint8_t x = 0; x < 4; x++) {
+		record[42 + x] = entry->offset >> 8*x;
+		record[46 + x] = entry->length >> 8*x;
+		record[50 + x] = entry->height >> 8*x;
+	}
+	record[54] = state;
+	uint32_t crc = BECRC32C(0, record, 55);
+	for (uint8_t x = 0; x < 4; x++)
+		record[55 + x] = crc >> 8*x;
+}
@@ -0,0 +1,221 @@
+//
+//  BETxIndex.h
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 21/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ @file
+ @brief Finds the transactions of the main chain by transaction hash, as a hash table on disk which is memory mapped.
+ */
+
+#ifndef BETXINDEXH
+#define BETXINDEXH
+
+#include "BEConstants.h"
+#include "BEBlockStore.h"
+#include "BECRC32C.h"
+#include "BESipHash.h"
+#include "CBBlock.h"
+#include "CBVarInt.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ @brief The states of transaction index records.
+ */
+typedef enum{
+	BE_TX_INDEX_EMPTY, /**< The slot has never been used. Probing stops here. */
+	BE_TX_INDEX_USED, /**< The record holds a transaction. */
+	BE_TX_INDEX_DELETED, /**< The record held a transaction which has been removed. Probing carries on past it. */
+} BETxIndexState;
+
+/**
+ @brief The position of an indexed transaction.
+ */
+typedef struct{
+	BEFileReference blockRef; /**< The position of the block in the block store. */
+	uint32_t offset; /**< The offset of the transaction in the block data. */
+	uint32_t length; /**< The length of the transaction. */
+	uint32_t height; /**< The height of the block. */
+} BETxIndexEntry;
+
+/**
+ @brief Structure for BETxIndex objects. @see BETxIndex.h
+ */
+typedef struct{
+	CBObject base;
+	char * dataDir; /**< Data directory path */
+	int fd; /**< The file descriptor for the transaction index file. */
+	uint8_t * map; /**< The private mapping of the file. */
+	uint64_t mapSize; /**< The length of the mapping. */
+	uint64_t key0; /**< The first half of the SipHash key. */
+	uint64_t key1; /**< The second half of the SipHash key. */
+	uint32_t numSlots; /**< The number of record slots, a power of two. */
+	uint32_t numUsed; /**< The number of used records. */
+	uint32_t numDeleted; /**< The number of deleted records. */
+	uint32_t numBlocks; /**< The number of main chain blocks indexed, which is the height of the last block indexed plus one. */
+	BEFileReference tipRef; /**< The position of the last block indexed. */
+	uint8_t * dirty; /**< One bit for each page of records, set when the page has changed since the last sync. */
+	uint32_t numDirty; /**< The number of changed pages. */
+	bool clean; /**< True if the flag in the header on disk says every record is written. */
+	void (*onErrorReceived)(CBError error,char *,...); /**< Pointer to error callback */
+} BETxIndex;
+
+/**
+ @brief Creates a new BETxIndex object, opening or creating the transaction index file.
+ @param dataDir The directory of the transaction index file, ending with a slash.
+ @returns A new BETxIndex object.
+ */
+BETxIndex * BENewTxIndex(char * dataDir, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Gets a BETxIndex from another object. Use this to avoid casts.
+ @param self The object to obtain the BETxIndex from.
+ @returns The BETxIndex object.
+ */
+BETxIndex * BEGetTxIndex(void * self);
+
+/**
+ @brief Initialises a BETxIndex object.
+ @param self The BETxIndex object to initialise.
+ @param dataDir The directory of the transaction index file, ending with a slash.
+ @returns true on success, false on failure.
+ */
+bool BEInitTxIndex(BETxIndex * self, char * dataDir, void (*onErrorReceived)(CBError error,char *,...));
+
+/**
+ @brief Frees a BETxIndex object, syncing the changes.
+ @param self The BETxIndex object to free.
+ */
+void BEFreeTxIndex(void * self);
+
+// Functions
+
+/**
+ @brief Adds a transaction, replacing any record with the same transaction hash.
+ @param self The BETxIndex object.
+ @param txHash The transaction hash.
+ @param entry The position of the transaction.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexAdd(BETxIndex * self, uint8_t * txHash, BETxIndexEntry * entry);
+/**
+ @brief Adds the transactions of the block after the last block indexed. The changes are synced once there are BE_TX_INDEX_MAX_DIRTY_PAGES changed pages.
+ @param self The BETxIndex object.
+ @param block The block with its transactions deserialised.
+ @param blockRef The position of the block, which must be durable in the block store.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexAddBlock(BETxIndex * self, CBBlock * block, BEFileReference blockRef);
+/**
+ @brief Makes the transaction index file empty with a new key.
+ @param self The BETxIndex object.
+ @param numSlots The number of record slots, a power of two.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexCreate(BETxIndex * self, uint32_t numSlots);
+/**
+ @brief Finds a transaction.
+ @param self The BETxIndex object.
+ @param txHash The transaction hash.
+ @param entry Set to the position of the transaction.
+ @returns true if the transaction was found and false otherwise.
+ */
+bool BETxIndexFind(BETxIndex * self, uint8_t * txHash, BETxIndexEntry * entry);
+/**
+ @brief Finds the slot of a transaction, or the slot to add it in.
+ @param self The BETxIndex object.
+ @param txHash The transaction hash.
+ @param found Set to true if the transaction is in the slot.
+ @returns The slot, which is the first deleted or empty slot probed if the transaction was not found, or numSlots if there is no such slot.
+ */
+uint32_t BETxIndexFindSlot(BETxIndex * self, uint8_t * txHash, bool * found);
+/**
+ @brief Rebuilds the transaction index with twice the slots and without deleted records. The new file replaces the old file once it is synced.
+ @param self The BETxIndex object.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexGrow(BETxIndex * self);
+/**
+ @brief Maps the transaction index file privately and checks or counts the records.
+ @param self The BETxIndex object.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexMap(BETxIndex * self);
+/**
+ @brief Reads a record.
+ @param record The record.
+ @param entry Set to the position of the transaction.
+ @returns The state of the record, with BE_TX_INDEX_DELETED for records with bad checksums.
+ */
+BETxIndexState BETxIndexReadRecord(uint8_t * record, BETxIndexEntry * entry);
+/**
+ @brief Removes a transaction if it is indexed in a block.
+ @param self The BETxIndex object.
+ @param txHash The transaction hash.
+ @param blockRef The position of the block. A record for the same transaction in another block is kept.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexRemove(BETxIndex * self, uint8_t * txHash, BEFileReference blockRef);
+/**
+ @brief Removes the transactions of the last block indexed.
+ @param self The BETxIndex object.
+ @param block The block with its transactions deserialised.
+ @param prevRef The position of the block before the removed block, which becomes the last block indexed.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexRemoveBlock(BETxIndex * self, CBBlock * block, BEFileReference prevRef);
+/**
+ @brief Marks the page of a record as changed, clearing the flag in the header on disk before the first change after a sync.
+ @param self The BETxIndex object.
+ @param slot The slot of the record.
+ @returns true on success and false if the header could not be written.
+ */
+bool BETxIndexSetDirty(BETxIndex * self, uint32_t slot);
+/**
+ @brief Writes the changed pages, syncs them and then writes the header with the blocks indexed.
+ @param self The BETxIndex object.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexSync(BETxIndex * self);
+/**
+ @brief Writes and syncs the header.
+ @param self The BETxIndex object.
+ @param fd The file to write to.
+ @param clean True if every record is written.
+ @returns true on success and false on failure.
+ */
+bool BETxIndexWriteHeader(BETxIndex * self, int fd, bool clean);
+/**
+ @brief Writes a record.
+ @param record The record.
+ @param txHash The transaction hash.
+ @param entry The position of the transaction.
+ @param state The state of the record.
+ */
+void BETxIndexWriteRecord(uint8_t * record, uint8_t * txHash, BETxIndexEntry * entry, BETxIndexState state);
+
+#endif
@@ -0,0 +1,192 @@
+//
+//  benchmarkBEBlockStore.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 04/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEBlockStore.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCHMARK_BLOCKS 2000
+#define BENCHMARK_READS 20000
+#define BENCHMARK_MAX_BLOCK 60000
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+uint32_t lengths[BENCHMARK_BLOCKS];
+
+void benchmarkRandom(uint8_t * data, uint32_t len);
+void benchmarkRandom(uint8_t * data, uint32_t len){
+	for (uint32_t x = 0; x < len; x++)
+		data[x] = rand();
+}
+
+uint32_t benchmarkFillBlock(uint8_t * data, uint32_t x);
+uint32_t benchmarkFillBlock(uint8_t * data, uint32_t x){
+	// Make something like a block: a header and transactions spending previous outputs to pay-to-pubkey-hash outputs.
+	srand(x + 1);
+	uint32_t len = 80;
+	benchmarkRandom(data, 80);
+	uint32_t numTxs = 1 + rand() % (BENCHMARK_MAX_BLOCK / 300);
+	for (uint32_t y = 0; y < numTxs; y++) {
+		// Version and one input
+		memcpy(data + len, (uint8_t []){1, 0, 0, 0, 1}, 5);
+		len += 5;
+		// Previous output hash and index, which are random.
+		benchmarkRandom(data + len, 36);
+		len += 36;
+		// Signature script with a signature and public key.
+		data[len++] = 106;
+		data[len++] = 71;
+		memcpy(data + len, (uint8_t []){0x30, 0x44, 0x02, 0x20}, 4);
+		benchmarkRandom(data + len + 4, 32);
+		memcpy(data + len + 36, (uint8_t []){0x02, 0x20}, 2);
+		benchmarkRandom(data + len + 38, 33);
+		len += 71;
+		data[len++] = 33;
+		data[len++] = 2 + rand() % 2;
+		benchmarkRandom(data + len, 32);
+		len += 32;
+		memset(data + len, 0xFF, 4);
+		len += 4;
+		// Two outputs
+		data[len++] = 2;
+		for (uint8_t z = 0; z < 2; z++) {
+			uint64_t value = (uint64_t)(rand() % 100000) * 1000;
+			for (uint8_t w = 0; w < 8; w++)
+				data[len++] = value >> 8*w;
+			memcpy(data + len, (uint8_t []){25, 0x76, 0xA9, 0x14}, 4);
+			benchmarkRandom(data + len + 4, 20);
+			memcpy(data + len + 24, (uint8_t []){0x88, 0xAC}, 2);
+			len += 26;
+		}
+		// Lock time
+		memset(data + len, 0, 4);
+		len += 4;
+	}
+	return len;
+}
+
+double benchmarkTime(void);
+double benchmarkTime(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint64_t benchmarkDiskSize(char * dir);
+uint64_t benchmarkDiskSize(char * dir){
+	uint64_t size = 0;
+	char path[64];
+	struct stat st;
+	for (uint16_t x = 0;; x++) {
+		sprintf(path, "%sblocks%u.dat", dir, x);
+		if (stat(path, &st))
+			break;
+		size += st.st_size;
+		sprintf(path, "%sblocks%u.idx", dir, x);
+		if (NOT stat(path, &st))
+			size += st.st_size;
+	}
+	return size;
+}
+
+bool benchmarkStore(char * dir, bool compress);
+bool benchmarkStore(char * dir, bool compress){
+	char command[64];
+	sprintf(command, "rm -rf %s", dir);
+	system(command);
+	mkdir(dir, S_IRWXU);
+	BEBlockStore * store = BENewBlockStore(dir, BE_MAX_OPEN_BLOCK_FILES, onErrorReceived);
+	if (NOT store) {
+		printf("NEW STORE FAIL\n");
+		return false;
+	}
+	store->compress = compress;
+	store->targetFileSize = 16777216;
+	uint8_t * data = malloc(BENCHMARK_MAX_BLOCK + 1000);
+	uint8_t hash[32];
+	uint64_t rawSize = 0;
+	BEFileReference refs[BENCHMARK_BLOCKS];
+	bool added;
+	double start = benchmarkTime();
+	for (uint32_t x = 0; x < BENCHMARK_BLOCKS; x++) {
+		lengths[x] = benchmarkFillBlock(data, x);
+		memcpy(hash, data, 32);
+		if (NOT BEBlockStoreAddBlock(store, hash, data, lengths[x], refs + x, &added) || NOT added) {
+			printf("ADD FAIL AT %u\n", x);
+			return false;
+		}
+		rawSize += BE_BLOCK_RECORD_HEADER_SIZE + lengths[x];
+	}
+	double writeTime = benchmarkTime() - start;
+	uint64_t diskSize = benchmarkDiskSize(dir);
+	// Random reads of whole blocks, checking the data.
+	srand(1);
+	uint32_t * order = malloc(sizeof(*order) * BENCHMARK_READS);
+	for (uint32_t x = 0; x < BENCHMARK_READS; x++)
+		order[x] = rand() % BENCHMARK_BLOCKS;
+	start = benchmarkTime();
+	for (uint32_t x = 0; x < BENCHMARK_READS; x++) {
+		CBByteArray * block = BEBlockStoreReadBlock(store, refs[order[x]].fileID, refs[order[x]].filePos);
+		if (NOT block || block->length != lengths[order[x]]) {
+			printf("READ FAIL AT %u\n", order[x]);
+			return false;
+		}
+		CBReleaseObject(block);
+	}
+	double readTime = benchmarkTime() - start;
+	for (uint32_t x = 0; x < BENCHMARK_BLOCKS; x += 97) {
+		CBByteArray * block = BEBlockStoreReadBlock(store, refs[x].fileID, refs[x].filePos);
+		benchmarkFillBlock(data, x);
+		if (NOT block || memcmp(CBByteArrayGetData(block), data, lengths[x])) {
+			printf("READ DATA FAIL AT %u\n", x);
+			return false;
+		}
+		CBReleaseObject(block);
+	}
+	printf("%s: %llu bytes of blocks in %llu bytes on disk (ratio %.3f), written in %.3fs, %.2fus per random block read\n",
+		   compress ? "LZ4" : "Raw", (unsigned long long)rawSize, (unsigned long long)diskSize, (double)diskSize / rawSize, writeTime, readTime * 1e6 / BENCHMARK_READS);
+	free(order);
+	free(data);
+	CBReleaseObject(store);
+	system(command);
+	return true;
+}
+
+int main(){
+	if (NOT benchmarkStore("./benchmarkRaw/", false))
+		return 1;
+#ifdef BE_LZ4
+	if (NOT benchmarkStore("./benchmarkLZ4/", true))
+		return 1;
+#else
+	printf("Compile with BE_LZ4 to compare with compressed block files.\n");
+#endif
+	return 0;
+}
@@ -0,0 +1,193 @@
+//
+//  benchmarkBEBlockStoreSend.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 03/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEBlockStore.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define BENCHMARK_BLOCKS 96
+#define BENCHMARK_BLOCK_SIZE 1000000
+#define BENCHMARK_SENDS 1000
+#define BENCHMARK_RECEIVE_BUFFER 262144
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+uint8_t hashes[BENCHMARK_BLOCKS][32];
+BEFileReference refs[BENCHMARK_BLOCKS];
+
+double benchmarkTime(void);
+double benchmarkTime(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double benchmarkThreadTime(void);
+double benchmarkThreadTime(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void * benchmarkReceive(void * vfd);
+void * benchmarkReceive(void * vfd){
+	// Take everything until the connection is closed, as a peer downloading blocks would.
+	int fd = *(int *)vfd;
+	uint8_t * buffer = malloc(BENCHMARK_RECEIVE_BUFFER);
+	uint64_t * received = malloc(sizeof(*received));
+	*received = 0;
+	ssize_t res;
+	while ((res = read(fd, buffer, BENCHMARK_RECEIVE_BUFFER)) > 0)
+		*received += res;
+	free(buffer);
+	close(fd);
+	return received;
+}
+
+bool benchmarkSendBlock(BEBlockStore * store, uint32_t x, int fd, bool sendfile);
+bool benchmarkSendBlock(BEBlockStore * store, uint32_t x, int fd, bool sendfile){
+	if (sendfile) {
+		BEBlockSend blockSend;
+		if (NOT BEBlockStoreStartSend(store, hashes[x], 0xD9B4BEF9, &blockSend))
+			return false;
+		bool ok = BEBlockStoreContinueSend(store, &blockSend, fd) == BE_BLOCK_SEND_DONE;
+		BEBlockStoreEndSend(store, &blockSend);
+		return ok;
+	}
+	// Load the block into memory and checksum it for the message header, as a block message would be sent otherwise.
+	CBByteArray * block = BEBlockStoreReadBlock(store, refs[x].fileID, refs[x].filePos);
+	if (NOT block)
+		return false;
+	uint8_t header[BE_MESSAGE_HEADER_SIZE] = {0xF9,0xBE,0xB4,0xD9,'b','l','o','c','k'};
+	for (uint8_t y = 0; y < 4; y++)
+		header[16 + y] = block->length >> 8*y;
+	uint8_t checksum[32];
+	CBSha256(CBByteArrayGetData(block), block->length, checksum);
+	CBSha256(checksum, 32, checksum);
+	memcpy(header + 20, checksum, 4);
+	bool ok = write(fd, header, BE_MESSAGE_HEADER_SIZE) == BE_MESSAGE_HEADER_SIZE;
+	for (uint32_t sent = 0; ok && sent < block->length;) {
+		ssize_t res = write(fd, CBByteArrayGetData(block) + sent, block->length - sent);
+		ok = res > 0;
+		sent += res;
+	}
+	CBReleaseObject(block);
+	return ok;
+}
+
+bool benchmarkServe(BEBlockStore * store, bool sendfile);
+bool benchmarkServe(BEBlockStore * store, bool sendfile){
+	// Connect to ourselves over loopback.
+	int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = 0};
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLength = sizeof(address);
+	if (bind(listenFd, (struct sockaddr *)&address, addressLength) || listen(listenFd, 1)
+		|| getsockname(listenFd, (struct sockaddr *)&address, &addressLength)) {
+		printf("LISTEN FAIL\n");
+		return false;
+	}
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(fd, (struct sockaddr *)&address, addressLength)) {
+		printf("CONNECT FAIL\n");
+		return false;
+	}
+	int receiveFd = accept(listenFd, NULL, NULL);
+	close(listenFd);
+	pthread_t receiver;
+	pthread_create(&receiver, NULL, benchmarkReceive, &receiveFd);
+	// Serve the blocks in a random order, as peers ask for historical blocks.
+	srand(1);
+	uint64_t sent = 0;
+	double start = benchmarkTime();
+	double startCPU = benchmarkThreadTime();
+	for (uint32_t x = 0; x < BENCHMARK_SENDS; x++) {
+		uint32_t block = rand() % BENCHMARK_BLOCKS;
+		if (NOT benchmarkSendBlock(store, block, fd, sendfile)) {
+			printf("SEND FAIL AT %u\n", block);
+			return false;
+		}
+		sent += BE_MESSAGE_HEADER_SIZE + BENCHMARK_BLOCK_SIZE;
+	}
+	double cpuTime = benchmarkThreadTime() - startCPU;
+	close(fd);
+	uint64_t * received;
+	pthread_join(receiver, (void **)&received);
+	double time = benchmarkTime() - start;
+	if (*received != sent) {
+		printf("RECEIVE FAIL: %llu of %llu bytes\n", (unsigned long long)*received, (unsigned long long)sent);
+		return false;
+	}
+	free(received);
+	printf("%s: %.0f MB/s, %.3fs of sending CPU time per GB\n", sendfile ? "sendfile" : "Read and write", sent / time / 1e6, cpuTime * 1e9 / sent);
+	return true;
+}
+
+int main(){
+	system("rm -rf ./benchmarkSend/");
+	mkdir("./benchmarkSend/", S_IRWXU);
+	BEBlockStore * store = BENewBlockStore("./benchmarkSend/", BE_MAX_OPEN_BLOCK_FILES, onErrorReceived);
+	if (NOT store) {
+		printf("NEW STORE FAIL\n");
+		return 1;
+	}
+	// Blocks can only be sent from uncompressed files. Use small files so that most of the blocks are in finished files.
+	store->compress = false;
+	store->targetFileSize = 16000000;
+	uint8_t * data = malloc(BENCHMARK_BLOCK_SIZE);
+	bool added;
+	srand(1);
+	for (uint32_t x = 0; x < BENCHMARK_BLOCKS; x++) {
+		for (uint32_t y = 0; y < BENCHMARK_BLOCK_SIZE; y++)
+			data[y] = rand();
+		memcpy(hashes[x], data, 32);
+		if (NOT BEBlockStoreAddBlock(store, hashes[x], data, BENCHMARK_BLOCK_SIZE, refs + x, &added) || NOT added) {
+			printf("ADD FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	free(data);
+	// Read the files into the page cache, so that both ways are measured without the disk.
+	for (uint32_t x = 0; x < BENCHMARK_BLOCKS; x++) {
+		CBByteArray * block = BEBlockStoreReadBlock(store, refs[x].fileID, refs[x].filePos);
+		if (NOT block) {
+			printf("READ FAIL AT %u\n", x);
+			return 1;
+		}
+		CBReleaseObject(block);
+	}
+	if (NOT benchmarkServe(store, false) || NOT benchmarkServe(store, true))
+		return 1;
+	CBReleaseObject(store);
+	system("rm -rf ./benchmarkSend/");
+	return 0;
+}
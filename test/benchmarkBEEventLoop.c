@@ -0,0 +1,168 @@
+//
+//  benchmarkBEEventLoop.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 19/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEEventLoop.h"
+#include <stdarg.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#define BENCHMARK_MESSAGE_SIZE 24 // The size of a message header.
+#define BENCHMARK_BUFFER_SIZE 4096
+#define BENCHMARK_SECONDS 2
+#define BENCHMARK_PING 500
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+typedef struct{
+	BEEventLoop * loop;
+	uint64_t messages;
+	uint64_t pings;
+	uint32_t connected;
+	double cpuTime;
+} BenchmarkSide;
+
+void benchmarkOnConnected(void * vside, int32_t peer);
+void benchmarkOnConnected(void * vside, int32_t peer){
+	BenchmarkSide * side = vside;
+	side->connected++;
+	BEEventLoopSetTimer(side->loop, peer, BENCHMARK_PING);
+}
+
+void benchmarkOnReadable(void * vside, int32_t peer);
+void benchmarkOnReadable(void * vside, int32_t peer){
+	// Echo each whole message, as a pong would be sent for a ping.
+	BenchmarkSide * side = vside;
+	uint8_t message[BENCHMARK_MESSAGE_SIZE];
+	while (side->loop->peers[peer].readLength >= BENCHMARK_MESSAGE_SIZE) {
+		BEEventLoopPeek(side->loop, peer, message, BENCHMARK_MESSAGE_SIZE);
+		BEEventLoopConsume(side->loop, peer, BENCHMARK_MESSAGE_SIZE);
+		side->messages++;
+		if (NOT BEEventLoopSend(side->loop, peer, message, BENCHMARK_MESSAGE_SIZE))
+			return;
+	}
+}
+
+void benchmarkOnTimeout(void * vside, int32_t peer);
+void benchmarkOnTimeout(void * vside, int32_t peer){
+	BenchmarkSide * side = vside;
+	side->pings++;
+	BEEventLoopSetTimer(side->loop, peer, BENCHMARK_PING);
+}
+
+void * benchmarkRun(void * vside);
+void * benchmarkRun(void * vside){
+	BenchmarkSide * side = vside;
+	BEEventLoopRun(side->loop);
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	side->cpuTime = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	return NULL;
+}
+
+bool benchmarkPeers(uint32_t numPeers);
+bool benchmarkPeers(uint32_t numPeers){
+	BenchmarkSide server = {.loop = BENewEventLoop(BENCHMARK_BUFFER_SIZE, onErrorReceived)};
+	BenchmarkSide client = {.loop = BENewEventLoop(BENCHMARK_BUFFER_SIZE, onErrorReceived)};
+	if (NOT server.loop || NOT client.loop) {
+		printf("NEW LOOP FAIL\n");
+		return false;
+	}
+	BenchmarkSide * sides[2] = {&server, &client};
+	for (uint8_t x = 0; x < 2; x++) {
+		sides[x]->loop->callbackHandler = sides[x];
+		sides[x]->loop->onConnected = benchmarkOnConnected;
+		sides[x]->loop->onReadable = benchmarkOnReadable;
+		sides[x]->loop->onTimeout = benchmarkOnTimeout;
+	}
+	struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = 0};
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLength = sizeof(address);
+	if (NOT BEEventLoopListen(server.loop, (struct sockaddr *)&address, addressLength)
+		|| getsockname(server.loop->listenFd, (struct sockaddr *)&address, &addressLength)) {
+		printf("LISTEN FAIL\n");
+		return false;
+	}
+	// Each client peer sends a message and then echoes what comes back, so the messages keep going round.
+	uint8_t message[BENCHMARK_MESSAGE_SIZE] = {0xF9,0xBE,0xB4,0xD9,'p','i','n','g'};
+	for (uint32_t x = 0; x < numPeers; x++) {
+		int32_t peer = BEEventLoopConnect(client.loop, (struct sockaddr *)&address, addressLength);
+		if (peer == -1 || NOT BEEventLoopSend(client.loop, peer, message, BENCHMARK_MESSAGE_SIZE)) {
+			printf("CONNECT FAIL AT %u\n", x);
+			return false;
+		}
+	}
+	pthread_t threads[2];
+	pthread_create(threads, NULL, benchmarkRun, &server);
+	pthread_create(threads + 1, NULL, benchmarkRun, &client);
+	// Wait for the connections before measuring.
+	uint64_t start = BEEventLoopGetTime();
+	while (server.connected < numPeers && BEEventLoopGetTime() - start < 10000) {
+		struct timespec wait = {0, 10000000};
+		nanosleep(&wait, NULL);
+	}
+	uint64_t startMessages = server.messages;
+	start = BEEventLoopGetTime();
+	sleep(BENCHMARK_SECONDS);
+	uint64_t messages = server.messages - startMessages;
+	double seconds = (BEEventLoopGetTime() - start) / 1000.0;
+	BEEventLoopStop(server.loop);
+	BEEventLoopStop(client.loop);
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+	if (server.connected != numPeers || client.connected != numPeers || NOT messages || NOT server.pings) {
+		printf("BENCHMARK FAIL: %u of %u peers connected, %llu messages, %llu pings\n", server.connected, numPeers, (unsigned long long)messages, (unsigned long long)server.pings);
+		return false;
+	}
+	// The clients are on one other thread, so the server thread may not be fully used. The messages per second of CPU time is what one core sustains.
+	double runSeconds = (BEEventLoopGetTime() - server.loop->startTime) / 1000.0;
+	printf("%u peers: %.0f messages/s echoed, server thread %.0f%% busy, %.0f messages per second of server CPU time, %llu ping timers\n",
+		   numPeers, messages / seconds, server.cpuTime * 100 / runSeconds, server.messages / server.cpuTime, (unsigned long long)server.pings);
+	CBReleaseObject(server.loop);
+	CBReleaseObject(client.loop);
+	return true;
+}
+
+int main(){
+	// Each peer needs a socket on each side.
+	struct rlimit fileLim;
+	getrlimit(RLIMIT_NOFILE, &fileLim);
+	fileLim.rlim_cur = fileLim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &fileLim);
+	uint32_t peerCounts[4] = {10, 100, 1000, 5000};
+	for (uint8_t x = 0; x < 4; x++) {
+		if (peerCounts[x] * 2 + 16 > fileLim.rlim_cur) {
+			printf("Not enough file descriptors for %u peers.\n", peerCounts[x]);
+			break;
+		}
+		if (NOT benchmarkPeers(peerCounts[x]))
+			return 1;
+	}
+	return 0;
+}
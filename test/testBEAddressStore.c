@@ -0,0 +1,195 @@
+//
+//  testBEAddressStore.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 07/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEAddressStore.h"
+#include <stdarg.h>
+
+#define TEST_ADDRESSES 2000
+#define TEST_NOW 1350000000
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+void testMakeAddress(BEAddress * address, uint32_t x);
+void testMakeAddress(BEAddress * address, uint32_t x){
+	// IPv4 addresses spread over many /16 groups.
+	memset(address->ip, 0, 10);
+	address->ip[10] = 0xFF;
+	address->ip[11] = 0xFF;
+	address->ip[12] = 10 + x % 200;
+	address->ip[13] = x / 200;
+	address->ip[14] = x;
+	address->ip[15] = x >> 8;
+	address->port = 8333;
+	address->services = 1;
+	address->lastSeen = TEST_NOW - x;
+	address->attempts = 0;
+	address->flags = 0;
+}
+
+int main(){
+	remove("./addresses.dat");
+	BEAddressStore * store = BENewAddressStore("./", onErrorReceived);
+	if (NOT store) {
+		printf("NEW STORE FAIL\n");
+		return 1;
+	}
+	BEAddress address;
+	if (BEAddressStoreGetRandom(store, 12345, &address) || store->numDirty) {
+		printf("EMPTY FAIL\n");
+		return 1;
+	}
+	// Add addresses. A few may lose their place to an earlier address.
+	bool added[TEST_ADDRESSES];
+	uint32_t numAdded = 0;
+	for (uint32_t x = 0; x < TEST_ADDRESSES; x++) {
+		testMakeAddress(&address, x);
+		added[x] = BEAddressStoreAdd(store, &address, TEST_NOW);
+		numAdded += added[x];
+	}
+	if (numAdded < TEST_ADDRESSES * 9 / 10 || NOT store->numDirty) {
+		printf("ADD FAIL: %u added\n", numAdded);
+		return 1;
+	}
+	BEAddress found;
+	for (uint32_t x = 0; x < TEST_ADDRESSES; x++) {
+		testMakeAddress(&address, x);
+		if (BEAddressStoreFind(store, address.ip, address.port, &found) != added[x]
+			|| (added[x] && (found.lastSeen != address.lastSeen || found.flags != BE_ADDRESS_USED))) {
+			printf("FIND FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	if (NOT BEAddressStoreGetRandom(store, 12345, &address) || NOT (address.flags & BE_ADDRESS_USED)) {
+		printf("GET RANDOM FAIL\n");
+		return 1;
+	}
+	uint16_t numDirty = store->numDirty;
+	if (NOT BEAddressStoreSave(store) || store->numDirty || store->savedBuckets != numDirty) {
+		printf("SAVE FAIL\n");
+		return 1;
+	}
+	// An address which has not changed leaves its bucket clean, and a changed address only dirties its bucket.
+	uint32_t first = 0;
+	while (NOT added[first])
+		first++;
+	testMakeAddress(&address, first);
+	if (NOT BEAddressStoreAdd(store, &address, TEST_NOW) || store->numDirty) {
+		printf("UNCHANGED FAIL\n");
+		return 1;
+	}
+	address.lastSeen = TEST_NOW + 100;
+	if (NOT BEAddressStoreAdd(store, &address, TEST_NOW) || store->numDirty != 1
+		|| NOT BEAddressStoreSave(store) || store->savedBuckets != (uint64_t)numDirty + 1) {
+		printf("UPDATE FAIL\n");
+		return 1;
+	}
+	// Find another address in the same place, which does not replace the address until the address has failed too often.
+	BEAddress other;
+	testMakeAddress(&other, first);
+	uint16_t bucket;
+	uint8_t * record = BEAddressStoreGetRecord(store, address.ip, address.port, &bucket);
+	do
+		other.port++;
+	while (BEAddressStoreGetRecord(store, other.ip, other.port, &bucket) != record);
+	if (BEAddressStoreAdd(store, &other, TEST_NOW)) {
+		printf("REPLACE FAIL\n");
+		return 1;
+	}
+	for (uint8_t x = 0; x < BE_ADDRESS_MAX_ATTEMPTS; x++)
+		BEAddressStoreMarkAttempt(store, address.ip, address.port, false, TEST_NOW);
+	if (NOT BEAddressStoreAdd(store, &other, TEST_NOW) || BEAddressStoreFind(store, address.ip, address.port, &found)
+		|| NOT BEAddressStoreFind(store, other.ip, other.port, &found)) {
+		printf("REPLACE FAILED ADDRESS FAIL\n");
+		return 1;
+	}
+	if (NOT BEAddressStoreMarkAttempt(store, other.ip, other.port, true, TEST_NOW + 5)
+		|| NOT BEAddressStoreFind(store, other.ip, other.port, &found)
+		|| found.flags != (BE_ADDRESS_USED | BE_ADDRESS_TRIED) || found.lastSeen != TEST_NOW + 5 || found.attempts) {
+		printf("MARK ATTEMPT FAIL\n");
+		return 1;
+	}
+	// Remove an address and save, and change another address without saving.
+	uint32_t second = first + 1;
+	while (NOT added[second])
+		second++;
+	testMakeAddress(&address, second);
+	if (NOT BEAddressStoreRemove(store, address.ip, address.port) || BEAddressStoreRemove(store, address.ip, address.port)
+		|| NOT BEAddressStoreSave(store)) {
+		printf("REMOVE FAIL\n");
+		return 1;
+	}
+	uint32_t third = second + 1;
+	while (NOT added[third])
+		third++;
+	testMakeAddress(&address, third);
+	BEAddressStoreMarkAttempt(store, address.ip, address.port, false, TEST_NOW);
+	CBReleaseObject(store);
+	// Reopen and find the saved addresses.
+	store = BENewAddressStore("./", onErrorReceived);
+	for (uint32_t x = 0; x < TEST_ADDRESSES; x++) {
+		testMakeAddress(&address, x);
+		bool expected = added[x] && x != first && x != second;
+		if (BEAddressStoreFind(store, address.ip, address.port, &found) != expected || (expected && found.attempts)) {
+			printf("REOPEN FIND FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	if (NOT BEAddressStoreFind(store, other.ip, other.port, &found) || found.flags != (BE_ADDRESS_USED | BE_ADDRESS_TRIED) || store->numDirty) {
+		printf("REOPEN SAVED CHANGES FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	// A corrupt bucket is emptied when it is used.
+	testMakeAddress(&address, third);
+	store = BENewAddressStore("./", onErrorReceived);
+	BEAddressStoreGetRecord(store, address.ip, address.port, &bucket);
+	CBReleaseObject(store);
+	FILE * file = fopen("./addresses.dat", "r+b");
+	fseek(file, BE_ADDRESS_HEADER_SIZE + bucket * BE_ADDRESS_BUCKET_SIZE * BE_ADDRESS_RECORD_SIZE + 5, SEEK_SET);
+	fputc(0xAA, file);
+	fclose(file);
+	store = BENewAddressStore("./", onErrorReceived);
+	if (BEAddressStoreFind(store, address.ip, address.port, &found) || store->numDirty != 1 || NOT store->dirty[bucket]) {
+		printf("CORRUPT BUCKET FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	// A file which is not an address file is replaced.
+	truncate("./addresses.dat", 100);
+	store = BENewAddressStore("./", onErrorReceived);
+	struct stat st;
+	stat("./addresses.dat", &st);
+	if (NOT store || st.st_size != BE_ADDRESS_FILE_SIZE || BEAddressStoreGetRandom(store, 0, &found)) {
+		printf("REPLACE FILE FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	remove("./addresses.dat");
+	return 0;
+}
@@ -0,0 +1,230 @@
+//
+//  testBEBlockDownloader.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 23/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEBlockDownloader.h"
+#include <stdarg.h>
+
+#define TEST_BLOCK_SIZE 143
+#define TEST_NUM_BLOCKS 400
+#define TEST_NUM_PEERS 4
+#define TEST_MAX_EVENTS 4096
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+CBBlock * testMakeBlock(uint8_t * prevHash, uint8_t x);
+CBBlock * testMakeBlock(uint8_t * prevHash, uint8_t x){
+	// A block with only a coinbase transaction, made different by x.
+	uint8_t data[TEST_BLOCK_SIZE] = {0x01,0x00,0x00,0x00};
+	memcpy(data + 4, prevHash, 32);
+	memset(data + 36, x, 32);
+	data[80] = 1;
+	uint8_t * tx = data + 81;
+	tx[0] = 1;
+	tx[4] = 1;
+	memset(tx + 37, 0xFF, 4);
+	tx[41] = 2;
+	tx[42] = x;
+	tx[43] = x;
+	memset(tx + 44, 0xFF, 4);
+	tx[48] = 1;
+	memcpy(tx + 49, (uint8_t []){0x00,0xF2,0x05,0x2A,0x01,0x00,0x00,0x00}, 8);
+	CBByteArray * bytes = CBNewByteArrayWithDataCopy(data, TEST_BLOCK_SIZE, onErrorReceived);
+	CBBlock * block = CBNewBlockFromData(bytes, onErrorReceived);
+	CBReleaseObject(bytes);
+	CBBlockDeserialise(block, true);
+	return block;
+}
+
+// Simulated peers send blocks one at a time at their bandwidth, after the request and before the block cross the link with the latency.
+typedef struct{
+	int32_t index;
+	uint32_t bandwidth; // Bytes per millisecond
+	uint32_t latency; // Milliseconds each way
+	bool stalls;
+	bool removed;
+	uint64_t busyUntil;
+	uint32_t requested;
+} TestPeer;
+
+typedef struct{
+	TestPeer * peer;
+	uint32_t block;
+	uint64_t deliverAt;
+	bool done;
+} TestEvent;
+
+CBBlock * chain[TEST_NUM_BLOCKS];
+TestEvent events[TEST_MAX_EVENTS];
+uint32_t numEvents = 0;
+uint64_t now = 0;
+uint32_t delivered = 0;
+bool orderFail = false;
+bool requestFail = false;
+
+void testRequestBlocks(void * callbackHandler, void * vpeer, uint8_t * hashes, uint32_t numHashes);
+void testRequestBlocks(void * callbackHandler, void * vpeer, uint8_t * hashes, uint32_t numHashes){
+	TestPeer * peer = vpeer;
+	BEBlockDownloader * downloader = callbackHandler;
+	if (downloader->paused)
+		requestFail = true;
+	peer->requested += numHashes;
+	if (peer->stalls)
+		return;
+	for (uint32_t x = 0; x < numHashes; x++) {
+		uint32_t y = 0;
+		while (y < TEST_NUM_BLOCKS && memcmp(CBBlockGetHash(chain[y]), hashes + 32*x, 32))
+			y++;
+		if (y == TEST_NUM_BLOCKS || numEvents == TEST_MAX_EVENTS) {
+			requestFail = true;
+			return;
+		}
+		uint64_t start = BE_MAX(now + peer->latency, peer->busyUntil);
+		peer->busyUntil = start + (TEST_BLOCK_SIZE + peer->bandwidth - 1) / peer->bandwidth;
+		events[numEvents++] = (TestEvent){peer, y, peer->busyUntil + peer->latency, false};
+	}
+}
+
+void testOnBlock(void * callbackHandler, CBBlock * block);
+void testOnBlock(void * callbackHandler, CBBlock * block){
+	(void)callbackHandler;
+	if (block != chain[delivered])
+		orderFail = true;
+	delivered++;
+}
+
+int main(){
+	uint8_t prevHash[32] = {0};
+	uint8_t * hashes = malloc(32 * TEST_NUM_BLOCKS);
+	for (uint32_t x = 0; x < TEST_NUM_BLOCKS; x++) {
+		chain[x] = testMakeBlock(x ? CBBlockGetHash(chain[x-1]) : prevHash, x);
+		memcpy(hashes + 32*x, CBBlockGetHash(chain[x]), 32);
+	}
+	BEBlockDownloader * downloader = BENewBlockDownloader(onErrorReceived);
+	if (NOT downloader) {
+		printf("NEW DOWNLOADER FAIL\n");
+		return 1;
+	}
+	downloader->callbackHandler = downloader;
+	downloader->requestBlocks = testRequestBlocks;
+	downloader->onBlock = testOnBlock;
+	// A fast peer, a slow peer, a peer which never sends blocks and a peer which is removed.
+	TestPeer peers[TEST_NUM_PEERS] = {
+		{.bandwidth = TEST_BLOCK_SIZE, .latency = 20},
+		{.bandwidth = 15, .latency = 20},
+		{.bandwidth = TEST_BLOCK_SIZE, .latency = 20, .stalls = true},
+		{.bandwidth = 48, .latency = 50},
+	};
+	for (uint8_t x = 0; x < TEST_NUM_PEERS; x++) {
+		peers[x].index = BEBlockDownloaderAddPeer(downloader, peers + x);
+		if (peers[x].index != x) {
+			printf("ADD PEER FAIL\n");
+			return 1;
+		}
+	}
+	// Add half of the hashes, and the rest when more than half of those have been given out.
+	if (NOT BEBlockDownloaderAddHashes(downloader, hashes, TEST_NUM_BLOCKS / 2)) {
+		printf("ADD HASHES FAIL\n");
+		return 1;
+	}
+	// Nothing is requested while paused.
+	downloader->paused = true;
+	BEBlockDownloaderTick(downloader, now);
+	for (uint8_t x = 0; x < TEST_NUM_PEERS; x++) {
+		if (peers[x].requested) {
+			printf("PAUSE FAIL\n");
+			return 1;
+		}
+	}
+	downloader->paused = false;
+	// Without requestBlocks nothing is requested and the blocks stay wanted.
+	downloader->requestBlocks = NULL;
+	BEBlockDownloaderRequest(downloader, now);
+	for (uint32_t x = downloader->start; x < downloader->numBlocks; x++) {
+		if (downloader->blocks[x].state != BE_DOWNLOAD_WANTED) {
+			printf("NO REQUEST CALLBACK FAIL\n");
+			return 1;
+		}
+	}
+	downloader->requestBlocks = testRequestBlocks;
+	bool addedRest = false;
+	for (; delivered < TEST_NUM_BLOCKS && now < 20000; now++) {
+		for (uint32_t x = 0; x < numEvents; x++) {
+			TestEvent * event = events + x;
+			if (event->done || event->deliverAt > now || event->peer->removed)
+				continue;
+			event->done = true;
+			if (NOT BEBlockDownloaderReceived(downloader, event->peer->index, chain[event->block], now)) {
+				printf("RECEIVED FAIL\n");
+				return 1;
+			}
+		}
+		if (NOT addedRest && delivered > TEST_NUM_BLOCKS / 4) {
+			if (NOT BEBlockDownloaderAddHashes(downloader, hashes + 32 * (TEST_NUM_BLOCKS / 2), TEST_NUM_BLOCKS - TEST_NUM_BLOCKS / 2)
+				|| downloader->start != 0) {
+				printf("ADD MORE HASHES FAIL\n");
+				return 1;
+			}
+			addedRest = true;
+		}
+		if (now == 100) {
+			// The removed peer's requests go to the other peers.
+			peers[3].removed = true;
+			BEBlockDownloaderRemovePeer(downloader, peers[3].index);
+		}
+		BEBlockDownloaderTick(downloader, now);
+	}
+	if (delivered != TEST_NUM_BLOCKS || orderFail || requestFail || downloader->delivered != TEST_NUM_BLOCKS) {
+		printf("DOWNLOAD FAIL: %u of %u blocks at %llu ms\n", delivered, TEST_NUM_BLOCKS, (unsigned long long)now);
+		return 1;
+	}
+	// The peer which never sends blocks stalls and its blocks come from the others.
+	BEDownloadPeer * fast = downloader->peers;
+	BEDownloadPeer * slow = downloader->peers + 1;
+	BEDownloadPeer * stalled = downloader->peers + 2;
+	if (NOT downloader->stalls || stalled->stalls != peers[2].requested || stalled->window != 1 || stalled->blocks) {
+		printf("STALL FAIL\n");
+		return 1;
+	}
+	// The fast peer is given more blocks and a window covering its latency.
+	if (fast->blocks <= slow->blocks * 2 || fast->window <= 8 || slow->window >= fast->window || fast->bytes != fast->blocks * TEST_BLOCK_SIZE) {
+		printf("WINDOW FAIL\n");
+		return 1;
+	}
+	// Blocks which have been given out are no longer used.
+	if (BEBlockDownloaderReceived(downloader, 0, chain[0], now)) {
+		printf("GIVEN OUT BLOCK FAIL\n");
+		return 1;
+	}
+	// Free data
+	CBReleaseObject(downloader);
+	for (uint32_t x = 0; x < TEST_NUM_BLOCKS; x++)
+		CBReleaseObject(chain[x]);
+	free(hashes);
+	return 0;
+}
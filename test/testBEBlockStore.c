@@ -0,0 +1,508 @@
+//
+//  testBEBlockStore.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 01/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEBlockStore.h"
+#include <stdarg.h>
+#include <sys/socket.h>
+
+#define TEST_BLOCKS 200
+#define TEST_READERS 4
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+BEBlockStore * store;
+uint64_t positions[TEST_BLOCKS];
+volatile uint32_t numWritten = 0;
+volatile bool readFail = false;
+
+void testFillBlock(uint8_t * data, uint32_t len, uint32_t x);
+void testFillBlock(uint8_t * data, uint32_t len, uint32_t x){
+	for (uint32_t y = 0; y < len; y++)
+		data[y] = (uint8_t)(x * 31 + y);
+}
+
+void testBlockHash(uint8_t * hash, uint32_t x);
+void testBlockHash(uint8_t * hash, uint32_t x){
+	for (uint8_t y = 0; y < 32; y++)
+		hash[y] = (uint8_t)(x * 7 + y * 13);
+	hash[0] = x;
+	hash[1] = x >> 8;
+}
+
+void * testReader(void * arg);
+void * testReader(void * arg){
+	(void)arg;
+	uint8_t data[1000];
+	uint8_t expected[1000];
+	// Keep reading written blocks while the appender is writing more.
+	while (numWritten < TEST_BLOCKS) {
+		uint32_t written = numWritten;
+		for (uint32_t x = 0; x < written; x++) {
+			uint32_t len = 100 + x;
+			if (NOT BEBlockStoreRead(store, 0, positions[x] + BE_BLOCK_RECORD_HEADER_SIZE, data, len)) {
+				readFail = true;
+				return NULL;
+			}
+			testFillBlock(expected, len, x);
+			if (memcmp(data, expected, len)) {
+				readFail = true;
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+bool testSendBlock(uint32_t hashNum, uint32_t fillNum, uint32_t len, bool fromFile);
+bool testSendBlock(uint32_t hashNum, uint32_t fillNum, uint32_t len, bool fromFile){
+	// Send the block to a socket as a block message and check the message.
+	int fds[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	uint8_t hash[32];
+	testBlockHash(hash, hashNum);
+	BEBlockSend blockSend;
+	if (NOT BEBlockStoreStartSend(store, hash, 0xD9B4BEF9, &blockSend))
+		return false;
+	bool ok = blockSend.length == len && (blockSend.file != NULL) == fromFile
+		&& BEBlockStoreContinueSend(store, &blockSend, fds[0]) == BE_BLOCK_SEND_DONE && blockSend.sent == BE_MESSAGE_HEADER_SIZE + len;
+	BEBlockStoreEndSend(store, &blockSend);
+	close(fds[0]);
+	uint8_t message[BE_MESSAGE_HEADER_SIZE + 1000];
+	uint32_t got = 0;
+	ssize_t res;
+	while ((res = read(fds[1], message + got, sizeof(message) - got)) > 0)
+		got += res;
+	close(fds[1]);
+	uint8_t data[1000];
+	uint8_t checksum[32];
+	testFillBlock(data, len, fillNum);
+	CBSha256(data, len, checksum);
+	CBSha256(checksum, 32, checksum);
+	return ok && got == BE_MESSAGE_HEADER_SIZE + len
+		&& NOT memcmp(message, (uint8_t []){0xF9,0xBE,0xB4,0xD9,'b','l','o','c','k',0,0,0,0,0,0,0,len,len >> 8,0,0}, 20)
+		&& NOT memcmp(message + 20, checksum, 4) && NOT memcmp(message + BE_MESSAGE_HEADER_SIZE, data, len);
+}
+
+int main(){
+	remove("./blocks0.dat");
+	remove("./blocks1.dat");
+	remove("./blocks2.dat");
+	remove("./blockindex.dat");
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	if (NOT store) {
+		printf("NEW STORE FAIL\n");
+		return 1;
+	}
+	// Compressed files cannot be borrowed from, so test uncompressed files first.
+	store->compress = false;
+	if (BEBlockStoreGetNumFiles(store)) {
+		printf("NUM FILES EMPTY FAIL\n");
+		return 1;
+	}
+	// Start readers and add blocks at the same time.
+	pthread_t readers[TEST_READERS];
+	for (uint8_t x = 0; x < TEST_READERS; x++)
+		pthread_create(readers + x, NULL, testReader, NULL);
+	uint8_t data[1000];
+	uint8_t hash[32];
+	BEFileReference ref;
+	bool added;
+	for (uint32_t x = 0; x < TEST_BLOCKS; x++) {
+		testFillBlock(data, 100 + x, x);
+		testBlockHash(hash, x);
+		if (NOT BEBlockStoreAddBlock(store, hash, data, 100 + x, &ref, &added) || NOT added || ref.fileID) {
+			printf("ADD FAIL AT %u\n", x);
+			return 1;
+		}
+		positions[x] = ref.filePos;
+		numWritten = x + 1;
+	}
+	for (uint8_t x = 0; x < TEST_READERS; x++)
+		pthread_join(readers[x], NULL);
+	if (readFail) {
+		printf("CONCURRENT READ FAIL\n");
+		return 1;
+	}
+	if (BEBlockStoreGetNumFiles(store) != 1) {
+		printf("NUM FILES FAIL\n");
+		return 1;
+	}
+	// Blocks are only stored once.
+	uint64_t size = BEBlockStoreGetFileSize(store, 0);
+	testFillBlock(data, 107, 7);
+	testBlockHash(hash, 7);
+	if (NOT BEBlockStoreAddBlock(store, hash, data, 107, &ref, &added) || added || ref.fileID || ref.filePos != positions[7] || BEBlockStoreGetFileSize(store, 0) != size) {
+		printf("ADD DUPLICATE FAIL\n");
+		return 1;
+	}
+	// Find blocks by hash
+	testBlockHash(hash, 150);
+	if (NOT BEBlockStoreFindBlock(store, hash, &ref) || ref.fileID || ref.filePos != positions[150]) {
+		printf("FIND BLOCK FAIL\n");
+		return 1;
+	}
+	testBlockHash(hash, TEST_BLOCKS);
+	if (BEBlockStoreFindBlock(store, hash, &ref)) {
+		printf("FIND MISSING BLOCK FAIL\n");
+		return 1;
+	}
+	// Read a whole block
+	CBByteArray * block = BEBlockStoreReadBlock(store, 0, positions[7]);
+	testFillBlock(data, 107, 7);
+	if (NOT block || block->length != 107 || memcmp(CBByteArrayGetData(block), data, 107)) {
+		printf("READ BLOCK FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	// Reads past the end of the complete data should fail.
+	if (BEBlockStoreRead(store, 0, size - 1, data, 2)) {
+		printf("READ PAST END FAIL\n");
+		return 1;
+	}
+	// Truncate the last block, which removes it from the index.
+	if (NOT BEBlockStoreTruncate(store, 0, positions[TEST_BLOCKS - 1]) || BEBlockStoreGetFileSize(store, 0) != positions[TEST_BLOCKS - 1]) {
+		printf("TRUNCATE FAIL\n");
+		return 1;
+	}
+	testBlockHash(hash, TEST_BLOCKS - 1);
+	if (BEBlockStoreFindBlock(store, hash, &ref)) {
+		printf("TRUNCATE INDEX FAIL\n");
+		return 1;
+	}
+	// The file is not finished so blocks cannot be borrowed
+	uint8_t * borrowed;
+	uint32_t borrowedLen;
+	if (BEBlockStoreBorrowBlock(store, 0, positions[7], &borrowed, &borrowedLen)) {
+		printf("BORROW UNFINISHED FAIL\n");
+		return 1;
+	}
+	// Blocks go into the last file until it reaches the target size.
+	if (BEBlockStoreGetAppendFile(store, 10)) {
+		printf("APPEND FILE FAIL\n");
+		return 1;
+	}
+	store->targetFileSize = positions[TEST_BLOCKS - 1] + 10;
+	if (BEBlockStoreGetAppendFile(store, 10) != 1) {
+		printf("APPEND FILE ROLL FAIL\n");
+		return 1;
+	}
+	// Adding a block starts the next file, so that the first is finished.
+	if (NOT BEBlockStoreAddBlock(store, hash, data, 10, &ref, &added) || NOT added || ref.fileID != 1 || ref.filePos) {
+		printf("ADD SECOND FILE FAIL\n");
+		return 1;
+	}
+	if (NOT BEBlockStoreBorrowBlock(store, 0, positions[7], &borrowed, &borrowedLen)) {
+		printf("BORROW FAIL\n");
+		return 1;
+	}
+	testFillBlock(data, 107, 7);
+	if (borrowedLen != 107 || memcmp(borrowed, data, 107)) {
+		printf("BORROW DATA FAIL\n");
+		return 1;
+	}
+	BEBlockStoreReturnBlock(store, 0);
+	// Sequential replay through the mapping.
+	BEBlockStoreSetAccess(store, 0, BE_BLOCK_STORE_ACCESS_SEQUENTIAL);
+	for (uint32_t x = 0; x < TEST_BLOCKS - 1; x++) {
+		block = BEBlockStoreReadBlock(store, 0, positions[x]);
+		testFillBlock(data, 100 + x, x);
+		if (NOT block || block->length != 100 + x || memcmp(CBByteArrayGetData(block), data, 100 + x)) {
+			printf("SEQUENTIAL READ FAIL AT %u\n", x);
+			return 1;
+		}
+		CBReleaseObject(block);
+	}
+	// Only two files are kept open. Opening a third closes the least recently used, which is file 1.
+	uint64_t opens = store->opens;
+	BEBlockStoreGetFileSize(store, 2);
+	if (store->opens != opens + 1 || store->evictions != 1 || store->numFiles != 2) {
+		printf("EVICT FAIL\n");
+		return 1;
+	}
+	// File 0 is still open.
+	uint64_t hits = store->hits;
+	if (NOT BEBlockStoreRead(store, 0, positions[3] + BE_BLOCK_RECORD_HEADER_SIZE, data, 103) || store->hits != hits + 1 || store->opens != opens + 1) {
+		printf("HIT FAIL\n");
+		return 1;
+	}
+	// Files with borrowed data are not closed.
+	if (NOT BEBlockStoreBorrowBlock(store, 0, positions[7], &borrowed, &borrowedLen)) {
+		printf("BORROW BEFORE EVICT FAIL\n");
+		return 1;
+	}
+	if (BEBlockStoreGetFileSize(store, 1) != 18 || BEBlockStoreGetFileSize(store, 2) || store->evictions != 3) {
+		printf("REOPEN AFTER EVICT FAIL\n");
+		return 1;
+	}
+	testFillBlock(data, 107, 7);
+	if (borrowedLen != 107 || memcmp(borrowed, data, 107)) {
+		printf("BORROW AFTER EVICT FAIL\n");
+		return 1;
+	}
+	BEBlockStoreReturnBlock(store, 0);
+	// Blocks in finished files are sent from the file, after the checksum is worked out from the mapping the first time. The block in file 1 has the first 10 bytes of block 7.
+	if (NOT testSendBlock(7, 7, 107, true) || NOT testSendBlock(7, 7, 107, true) || NOT testSendBlock(TEST_BLOCKS - 1, 7, 10, true)) {
+		printf("SEND FAIL\n");
+		return 1;
+	}
+	BEBlockSend blockSend;
+	testBlockHash(hash, TEST_BLOCKS);
+	if (BEBlockStoreStartSend(store, hash, 0xD9B4BEF9, &blockSend)) {
+		printf("SEND MISSING BLOCK FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	// Reopen and check the size and the index are loaded from the files.
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	if (BEBlockStoreGetFileSize(store, 0) != positions[TEST_BLOCKS - 1]) {
+		printf("REOPEN SIZE FAIL\n");
+		return 1;
+	}
+	testBlockHash(hash, 7);
+	if (store->numIndexed != TEST_BLOCKS || NOT BEBlockStoreFindBlock(store, hash, &ref) || ref.fileID || ref.filePos != positions[7]) {
+		printf("REOPEN INDEX FAIL\n");
+		return 1;
+	}
+	testBlockHash(hash, TEST_BLOCKS - 1);
+	if (NOT BEBlockStoreFindBlock(store, hash, &ref) || ref.fileID != 1 || ref.filePos) {
+		printf("REOPEN INDEX SECOND FILE FAIL\n");
+		return 1;
+	}
+	// Prune the first file. The last file cannot be pruned as it is appended to.
+	if (BEBlockStorePruneFile(store, 2)) {
+		printf("PRUNE LAST FILE FAIL\n");
+		return 1;
+	}
+	if (NOT BEBlockStorePruneFile(store, 0) || NOT access("./blocks0.dat", F_OK)) {
+		printf("PRUNE FAIL\n");
+		return 1;
+	}
+	// Pruned blocks are still indexed but cannot be read.
+	testBlockHash(hash, 7);
+	if (BEBlockStoreGetBlockStatus(store, hash) != BE_BLOCK_DATA_PRUNED || NOT BEBlockStoreFindBlock(store, hash, &ref)
+		|| BEBlockStoreRead(store, 0, positions[7] + BE_BLOCK_RECORD_HEADER_SIZE, data, 107)) {
+		printf("PRUNED STATUS FAIL\n");
+		return 1;
+	}
+	testBlockHash(hash, TEST_BLOCKS - 1);
+	if (BEBlockStoreGetBlockStatus(store, hash) != BE_BLOCK_DATA_AVAILABLE) {
+		printf("AVAILABLE STATUS FAIL\n");
+		return 1;
+	}
+	testBlockHash(hash, TEST_BLOCKS);
+	if (BEBlockStoreGetBlockStatus(store, hash) != BE_BLOCK_DATA_MISSING) {
+		printf("MISSING STATUS FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	// The pruned status is kept in the index and the pruned file is not counted as missing.
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	testBlockHash(hash, 7);
+	if (BEBlockStoreGetBlockStatus(store, hash) != BE_BLOCK_DATA_PRUNED || BEBlockStoreGetNumFiles(store) != 3
+		|| BEBlockStoreGetFileSize(store, 0) || NOT access("./blocks0.dat", F_OK)) {
+		printf("REOPEN PRUNED FAIL\n");
+		return 1;
+	}
+	// Add a block to the last file and sync it.
+	testFillBlock(data, 50, TEST_BLOCKS + 1);
+	testBlockHash(hash, TEST_BLOCKS + 1);
+	if (NOT BEBlockStoreAddBlock(store, hash, data, 50, &ref, &added) || ref.fileID != 2 || ref.filePos || NOT BEBlockStoreSync(store)) {
+		printf("ADD AND SYNC FAIL\n");
+		return 1;
+	}
+	// The block in the last file is sent from memory the first time.
+	if (NOT testSendBlock(TEST_BLOCKS + 1, TEST_BLOCKS + 1, 50, false) || NOT testSendBlock(TEST_BLOCKS + 1, TEST_BLOCKS + 1, 50, true)) {
+		printf("SEND FROM MEMORY FAIL\n");
+		return 1;
+	}
+	uint32_t numIndexed = store->numIndexed;
+	CBReleaseObject(store);
+	// Make it look like the program stopped while adding a block, with part of the block written and its index record written.
+	FILE * crashFile = fopen("./blocks2.dat", "ab");
+	fwrite(data, 1, 30, crashFile);
+	fclose(crashFile);
+	uint8_t record[BE_BLOCK_INDEX_RECORD_SIZE] = {0};
+	testBlockHash(record, TEST_BLOCKS + 2);
+	record[32] = 2;
+	record[34] = 58;
+	record[42] = BE_BLOCK_DATA_AVAILABLE;
+	uint32_t crc = BECRC32C(0, record, BE_BLOCK_INDEX_RECORD_SIZE - 4);
+	for (uint8_t x = 0; x < 4; x++)
+		record[43 + x] = crc >> 8*x;
+	crashFile = fopen("./blockindex.dat", "ab");
+	fwrite(record, 1, BE_BLOCK_INDEX_RECORD_SIZE, crashFile);
+	fclose(crashFile);
+	// Opening recovers the last file, removing the partial block and its index record.
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	testBlockHash(hash, TEST_BLOCKS + 2);
+	if (NOT store || store->numIndexed != numIndexed || BEBlockStoreFindBlock(store, hash, &ref) || BEBlockStoreGetFileSize(store, 2) != 58) {
+		printf("RECOVER FAIL\n");
+		return 1;
+	}
+	struct stat indexSt;
+	stat("./blockindex.dat", &indexSt);
+	block = BEBlockStoreReadBlock(store, 2, 0);
+	testFillBlock(data, 50, TEST_BLOCKS + 1);
+	if (indexSt.st_size != numIndexed * BE_BLOCK_INDEX_RECORD_SIZE || NOT block || block->length != 50 || memcmp(CBByteArrayGetData(block), data, 50)) {
+		printf("RECOVER DATA FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	// A corrupt block is found by its checksum when it is read and when scrubbing.
+	crashFile = fopen("./blocks2.dat", "r+b");
+	fseek(crashFile, BE_BLOCK_RECORD_HEADER_SIZE + 10, SEEK_SET);
+	fputc(data[10] ^ 1, crashFile);
+	fclose(crashFile);
+	if (BEBlockStoreReadBlock(store, 2, 0)) {
+		printf("CORRUPT READ FAIL\n");
+		return 1;
+	}
+	if (NOT BEBlockStoreStartScrub(store, 1000000)) {
+		printf("START SCRUB FAIL\n");
+		return 1;
+	}
+	while (NOT store->scrubPasses)
+		usleep(1000);
+	BEBlockStoreStopScrub(store);
+	if (NOT store->scrubErrors || store->scrubErrors > store->scrubPasses + 1 || store->scrubbedBytes < 18 + 58) {
+		printf("SCRUB FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	// A corrupt block index record is skipped.
+	crashFile = fopen("./blockindex.dat", "r+b");
+	fseek(crashFile, (numIndexed - 1) * BE_BLOCK_INDEX_RECORD_SIZE + 40, SEEK_SET);
+	fputc(0xFF, crashFile);
+	fclose(crashFile);
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	testBlockHash(hash, TEST_BLOCKS + 1);
+	if (NOT store || store->numIndexed != numIndexed - 1 || store->numRecords != numIndexed
+		|| BEBlockStoreGetBlockStatus(store, hash) != BE_BLOCK_DATA_MISSING) {
+		printf("CORRUPT INDEX FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	// The index grows past its initial size and is found again after blocks are removed.
+	remove("./blocks0.dat");
+	remove("./blocks1.dat");
+	remove("./blocks2.dat");
+	remove("./blockindex.dat");
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	uint32_t numBlocks = BE_BLOCK_INDEX_MIN_ENTRIES * 3;
+	for (uint32_t x = 0; x < numBlocks; x++) {
+		testFillBlock(data, 10, x);
+		testBlockHash(hash, x);
+		if (NOT BEBlockStoreAddBlock(store, hash, data, 10, &ref, &added) || NOT added || ref.filePos != x * (BE_BLOCK_RECORD_HEADER_SIZE + 10)) {
+			printf("GROW ADD FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	if (store->indexSize != BE_BLOCK_INDEX_MIN_ENTRIES * 4 || store->indexTableSize != store->indexSize * 2) {
+		printf("GROW SIZE FAIL\n");
+		return 1;
+	}
+	if (NOT BEBlockStoreTruncate(store, 0, numBlocks / 2 * (BE_BLOCK_RECORD_HEADER_SIZE + 10))) {
+		printf("GROW TRUNCATE FAIL\n");
+		return 1;
+	}
+	for (uint32_t x = 0; x < numBlocks; x++) {
+		testBlockHash(hash, x);
+		bool found = BEBlockStoreFindBlock(store, hash, &ref);
+		if (found != (x < numBlocks / 2) || (found && ref.filePos != x * (BE_BLOCK_RECORD_HEADER_SIZE + 10))) {
+			printf("GROW FIND FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	CBReleaseObject(store);
+#ifdef BE_LZ4
+	// Compressed files
+	remove("./blocks0.dat");
+	remove("./blocks1.dat");
+	remove("./blocks2.dat");
+	remove("./blockindex.dat");
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	for (uint32_t x = 0; x < TEST_BLOCKS; x++) {
+		testFillBlock(data, 100 + x, x);
+		testBlockHash(hash, x);
+		if (NOT BEBlockStoreAddBlock(store, hash, data, 100 + x, &ref, &added) || NOT added || ref.fileID) {
+			printf("COMPRESSED ADD FAIL AT %u\n", x);
+			return 1;
+		}
+		positions[x] = ref.filePos;
+	}
+	// Positions are in the uncompressed data.
+	if (positions[1] != 108 || BEBlockStoreGetFileSize(store, 0) != positions[TEST_BLOCKS - 1] + BE_BLOCK_RECORD_HEADER_SIZE + 100 + TEST_BLOCKS - 1) {
+		printf("COMPRESSED POSITIONS FAIL\n");
+		return 1;
+	}
+	if (NOT store->files[store->lruHead].compressed || access("./blocks0.idx", F_OK)) {
+		printf("COMPRESSED FILE FAIL\n");
+		return 1;
+	}
+	// Reads may cross frames.
+	uint8_t expected[1000];
+	testFillBlock(expected, 150, 50);
+	if (NOT BEBlockStoreRead(store, 0, positions[50] + BE_BLOCK_RECORD_HEADER_SIZE - 2, data, 150) || memcmp(data + 2, expected, 148)) {
+		printf("COMPRESSED READ FAIL\n");
+		return 1;
+	}
+	block = BEBlockStoreReadBlock(store, 0, positions[50]);
+	if (NOT block || block->length != 150 || memcmp(CBByteArrayGetData(block), expected, 150)) {
+		printf("COMPRESSED READ BLOCK FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	// Truncating removes whole frames.
+	size = BEBlockStoreGetFileSize(store, 0);
+	if (NOT BEBlockStoreTruncate(store, 0, positions[TEST_BLOCKS - 1]) || BEBlockStoreGetFileSize(store, 0) != positions[TEST_BLOCKS - 1]) {
+		printf("COMPRESSED TRUNCATE FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(store);
+	// Lose the last frame index record, which is found again from the frame header.
+	struct stat st;
+	stat("./blocks0.idx", &st);
+	truncate("./blocks0.idx", st.st_size - BE_FRAME_INDEX_RECORD_SIZE);
+	store = BENewBlockStore("./", 2, onErrorReceived);
+	if (BEBlockStoreGetFileSize(store, 0) != positions[TEST_BLOCKS - 1]) {
+		printf("COMPRESSED RECOVER FAIL\n");
+		return 1;
+	}
+	block = BEBlockStoreReadBlock(store, 0, positions[TEST_BLOCKS - 2]);
+	testFillBlock(expected, 100 + TEST_BLOCKS - 2, TEST_BLOCKS - 2);
+	if (NOT block || block->length != 100 + TEST_BLOCKS - 2 || memcmp(CBByteArrayGetData(block), expected, 100 + TEST_BLOCKS - 2)) {
+		printf("COMPRESSED RECOVER READ FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	CBReleaseObject(store);
+	remove("./blocks0.idx");
+#endif
+	return 0;
+}
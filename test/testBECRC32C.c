@@ -0,0 +1,69 @@
+//
+//  testBECRC32C.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 08/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BECRC32C.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(){
+	// Known checksums
+	uint8_t data[1000];
+	memcpy(data, "123456789", 9);
+	if (BECRC32C(0, data, 9) != 0xE3069283 || BECRC32CSoftware(0, data, 9) != 0xE3069283) {
+		printf("CHECK VALUE FAIL\n");
+		return 1;
+	}
+	memset(data, 0, 32);
+	if (BECRC32C(0, data, 32) != 0x8A9136AA || BECRC32CSoftware(0, data, 32) != 0x8A9136AA) {
+		printf("ZEROS FAIL\n");
+		return 1;
+	}
+	memset(data, 0xFF, 32);
+	if (BECRC32C(0, data, 32) != 0x62A8AB43 || BECRC32CSoftware(0, data, 32) != 0x62A8AB43) {
+		printf("ONES FAIL\n");
+		return 1;
+	}
+	if (BECRC32C(0, data, 0) != 0) {
+		printf("EMPTY FAIL\n");
+		return 1;
+	}
+	// The hardware and software checksums agree for all alignments and lengths, and checksums can be continued.
+	srand(0);
+	for (uint16_t x = 0; x < 1000; x++)
+		data[x] = rand();
+	for (uint8_t start = 0; start < 8; start++) {
+		for (uint16_t len = 0; len < 300; len++) {
+			uint32_t crc = BECRC32CSoftware(0, data + start, len);
+			if (BECRC32C(0, data + start, len) != crc) {
+				printf("HARDWARE FAIL AT %u %u\n", start, len);
+				return 1;
+			}
+			uint16_t split = len / 3;
+			if (BECRC32C(BECRC32C(0, data + start, split), data + start + split, len - split) != crc
+				|| BECRC32CSoftware(BECRC32CSoftware(0, data + start, split), data + start + split, len - split) != crc) {
+				printf("CONTINUE FAIL AT %u %u\n", start, len);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
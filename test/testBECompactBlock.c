@@ -0,0 +1,195 @@
+//
+//  testBECompactBlock.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 27/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "BECompactBlock.h"
+#include <stdarg.h>
+
+#define TEST_TX_SIZE 62
+#define TEST_NUM_TXS 21
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+void testMakeTransaction(uint8_t * data, uint32_t x);
+void testMakeTransaction(uint8_t * data, uint32_t x){
+	// One input spending an output made different by x, or a coinbase for zero, and one output.
+	memset(data, 0, TEST_TX_SIZE);
+	data[0] = 1;
+	data[4] = 1;
+	memset(data + 5, x ? x : 0, 32);
+	memset(data + 37, x ? x : 0xFF, 4);
+	data[41] = 1;
+	data[42] = x;
+	memset(data + 43, 0xFF, 4);
+	data[47] = 1;
+	data[48] = x;
+	data[49] = x >> 8;
+	data[56] = 1;
+	data[57] = 0x51;
+}
+
+CBBlock * testMakeBlock(uint32_t first);
+CBBlock * testMakeBlock(uint32_t first){
+	// A block with a coinbase and the transactions made from first onwards.
+	uint32_t size = 81 + TEST_NUM_TXS * TEST_TX_SIZE;
+	uint8_t * data = calloc(1, size);
+	data[0] = 1;
+	data[80] = TEST_NUM_TXS;
+	uint8_t txHashes[TEST_NUM_TXS * 32];
+	for (uint32_t x = 0; x < TEST_NUM_TXS; x++) {
+		testMakeTransaction(data + 81 + x * TEST_TX_SIZE, x ? first + x : 0);
+		CBSha256(data + 81 + x * TEST_TX_SIZE, TEST_TX_SIZE, txHashes + 32*x);
+	}
+	CBCalculateMerkleRoot(txHashes, TEST_NUM_TXS);
+	memcpy(data + 36, txHashes, 32);
+	CBByteArray * bytes = CBNewByteArrayWithData(data, size, onErrorReceived);
+	CBBlock * block = CBNewBlockFromData(bytes, onErrorReceived);
+	CBReleaseObject(bytes);
+	CBBlockDeserialise(block, true);
+	return block;
+}
+
+int main(){
+	CBBlock * block = testMakeBlock(0);
+	BECompactBlock * sent = BENewCompactBlockFromBlock(block, 0x1122334455667788ULL, onErrorReceived);
+	if (NOT sent) {
+		printf("NEW FROM BLOCK FAIL\n");
+		return 1;
+	}
+	// The coinbase is sent in full and the other transactions as short IDs.
+	CBByteArray * data = BECompactBlockSerialise(sent);
+	if (NOT data || data->length != 88 + 1 + (TEST_NUM_TXS - 1) * BE_SHORT_ID_SIZE + 1 + 1 + TEST_TX_SIZE) {
+		printf("SERIALISE FAIL\n");
+		return 1;
+	}
+	BECompactBlock * received = BENewCompactBlockFromData(data, 1000, onErrorReceived);
+	if (NOT received || received->transactionNum != TEST_NUM_TXS || received->numMissing != TEST_NUM_TXS - 1
+		|| NOT received->prefilled[0] || received->key0 != sent->key0 || received->key1 != sent->key1
+		|| memcmp(received->shortIDs, sent->shortIDs, sizeof(*sent->shortIDs) * TEST_NUM_TXS)
+		|| memcmp(CBBlockGetHash(received->header), CBBlockGetHash(block), 32)) {
+		printf("DESERIALISE FAIL\n");
+		return 1;
+	}
+	// Rebuild from a pool with half of the transactions and some others.
+	CBTransaction * pool[15];
+	for (uint8_t x = 0; x < 10; x++) {
+		pool[x] = block->transactions[x * 2 + 1];
+		CBRetainObject(pool[x]);
+	}
+	CBBlock * other = testMakeBlock(100);
+	for (uint8_t x = 10; x < 15; x++) {
+		pool[x] = other->transactions[x];
+		CBRetainObject(pool[x]);
+	}
+	if (BECompactBlockReconstruct(received, pool, 15) != BE_COMPACT_BLOCK_INCOMPLETE || received->numMissing != 10 || received->fromPool != 10) {
+		printf("RECONSTRUCT FAIL\n");
+		return 1;
+	}
+	// Get the missing transactions from the sender.
+	CBByteArray * request = BECompactBlockGetTransactionRequest(received);
+	CBByteArray * response = request ? BECompactBlockRespond(block, request, onErrorReceived) : NULL;
+	if (NOT response || BECompactBlockAddTransactions(received, response) != BE_COMPACT_BLOCK_COMPLETE || received->numMissing || received->requested != 10) {
+		printf("GET TRANSACTIONS FAIL\n");
+		return 1;
+	}
+	CBBlock * rebuilt = BECompactBlockGetBlock(received);
+	if (NOT rebuilt || CBGetMessage(rebuilt)->bytes->length != CBGetMessage(block)->bytes->length
+		|| memcmp(CBByteArrayGetData(CBGetMessage(rebuilt)->bytes), CBByteArrayGetData(CBGetMessage(block)->bytes), CBGetMessage(block)->bytes->length)) {
+		printf("GET BLOCK FAIL\n");
+		return 1;
+	}
+	BECompactBlockStats stats;
+	memset(&stats, 0, sizeof(stats));
+	BECompactBlockStatsRecord(&stats, received, rebuilt, 1050);
+	CBReleaseObject(rebuilt);
+	CBReleaseObject(received);
+	// With all of the transactions in the pool, the block is rebuilt at once.
+	received = BENewCompactBlockFromData(data, 2000, onErrorReceived);
+	if (BECompactBlockReconstruct(received, block->transactions + 1, TEST_NUM_TXS - 1) != BE_COMPACT_BLOCK_COMPLETE) {
+		printf("RECONSTRUCT ALL FAIL\n");
+		return 1;
+	}
+	rebuilt = BECompactBlockGetBlock(received);
+	if (NOT rebuilt) {
+		printf("GET BLOCK ALL FAIL\n");
+		return 1;
+	}
+	BECompactBlockStatsRecord(&stats, received, rebuilt, 2010);
+	CBReleaseObject(rebuilt);
+	CBReleaseObject(received);
+	if (stats.blocks != 2 || stats.immediate != 1 || stats.failed || stats.prefilled != 2 || stats.fromPool != 30
+		|| stats.requested != 10 || stats.totalLatency != 60 || stats.maxLatency != 50 || BECompactBlockStatsGetHitRate(&stats) != 0.75) {
+		printf("STATS FAIL\n");
+		return 1;
+	}
+	// Wrong transactions give a block with the wrong merkle root, which is not used.
+	received = BENewCompactBlockFromData(data, 3000, onErrorReceived);
+	CBByteArray * otherRequest = BECompactBlockGetTransactionRequest(received);
+	memcpy(CBByteArrayGetData(otherRequest), CBBlockGetHash(other), 32);
+	CBByteArray * otherResponse = BECompactBlockRespond(other, otherRequest, onErrorReceived);
+	if (BECompactBlockAddTransactions(received, otherResponse) != BE_COMPACT_BLOCK_BAD) {
+		printf("WRONG BLOCK TRANSACTIONS FAIL\n");
+		return 1;
+	}
+	memcpy(CBByteArrayGetData(otherResponse), CBBlockGetHash(block), 32);
+	if (BECompactBlockAddTransactions(received, otherResponse) != BE_COMPACT_BLOCK_COMPLETE || BECompactBlockGetBlock(received)) {
+		printf("MERKLE ROOT FAIL\n");
+		return 1;
+	}
+	BECompactBlockStatsRecord(&stats, received, NULL, 3000);
+	if (stats.failed != 1) {
+		printf("FAILED STATS FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(received);
+	// Invalid data is rejected.
+	data->length--;
+	if (BENewCompactBlockFromData(data, 0, onErrorReceived)) {
+		printf("TRUNCATED FAIL\n");
+		return 1;
+	}
+	data->length++;
+	CBByteArraySetByte(request, 33, TEST_NUM_TXS);
+	if (BECompactBlockRespond(block, request, onErrorReceived)) {
+		printf("BAD REQUEST FAIL\n");
+		return 1;
+	}
+	// Free data
+	for (uint8_t x = 0; x < 15; x++)
+		CBReleaseObject(pool[x]);
+	CBReleaseObject(data);
+	CBReleaseObject(request);
+	CBReleaseObject(response);
+	CBReleaseObject(otherRequest);
+	CBReleaseObject(otherResponse);
+	CBReleaseObject(sent);
+	CBReleaseObject(other);
+	CBReleaseObject(block);
+	return 0;
+}
@@ -0,0 +1,125 @@
+//
+//  testBEEventLoop.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 19/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEEventLoop.h"
+#include <stdarg.h>
+
+#define TEST_BUFFER_SIZE 64
+#define TEST_DATA_SIZE 200
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+uint8_t received[TEST_DATA_SIZE];
+uint32_t receivedLength = 0;
+bool sawBlocked = false;
+uint32_t timeouts = 0;
+
+void testOnReadable(void * loop, int32_t peer);
+void testOnReadable(void * loop, int32_t peer){
+	BEEventLoop * self = loop;
+	if (self->peers[peer].readBlocked)
+		sawBlocked = true;
+	// Take the data in parts which do not divide the buffer size, to check the ring buffer wraps.
+	while (self->peers[peer].readLength) {
+		uint32_t length = BEEventLoopPeek(self, peer, received + receivedLength, 40);
+		BEEventLoopConsume(self, peer, length);
+		receivedLength += length;
+	}
+	if (receivedLength == TEST_DATA_SIZE) {
+		BEEventLoopSend(self, peer, (uint8_t *)"pong", 4);
+		BEEventLoopSetTimer(self, peer, 150);
+	}
+}
+
+void testOnTimeout(void * loop, int32_t peer);
+void testOnTimeout(void * loop, int32_t peer){
+	(void)peer;
+	timeouts++;
+	BEEventLoopStop(loop);
+}
+
+int main(){
+	BEEventLoop * loop = BENewEventLoop(TEST_BUFFER_SIZE, onErrorReceived);
+	if (NOT loop) {
+		printf("NEW LOOP FAIL\n");
+		return 1;
+	}
+	loop->callbackHandler = loop;
+	loop->onReadable = testOnReadable;
+	loop->onTimeout = testOnTimeout;
+	int fds[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	int32_t peer = BEEventLoopAddSocket(loop, fds[0], false);
+	if (peer == -1) {
+		printf("ADD SOCKET FAIL\n");
+		return 1;
+	}
+	// Send more than the read buffer holds, so reading stops until data is consumed.
+	uint8_t data[TEST_DATA_SIZE];
+	for (uint32_t x = 0; x < TEST_DATA_SIZE; x++)
+		data[x] = x;
+	if (write(fds[1], data, TEST_DATA_SIZE) != TEST_DATA_SIZE) {
+		printf("WRITE FAIL\n");
+		return 1;
+	}
+	uint64_t start = BEEventLoopGetTime();
+	if (NOT BEEventLoopRun(loop)) {
+		printf("RUN FAIL\n");
+		return 1;
+	}
+	if (receivedLength != TEST_DATA_SIZE || memcmp(received, data, TEST_DATA_SIZE) || NOT sawBlocked) {
+		printf("READ FAIL\n");
+		return 1;
+	}
+	if (timeouts != 1 || BEEventLoopGetTime() - start < 100 || loop->peers[peer].timerTick) {
+		printf("TIMER FAIL\n");
+		return 1;
+	}
+	uint8_t pong[4];
+	if (read(fds[1], pong, 4) != 4 || memcmp(pong, "pong", 4)) {
+		printf("SEND FAIL\n");
+		return 1;
+	}
+	// Closing the other end closes the peer.
+	close(fds[1]);
+	loop->stop = false;
+	// Another peer stops the loop after the close is handled.
+	int otherFds[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, otherFds);
+	int32_t other = BEEventLoopAddSocket(loop, otherFds[0], false);
+	BEEventLoopSetTimer(loop, other, 100);
+	BEEventLoopRun(loop);
+	if (loop->peers[peer].fd != -1 || loop->numPeers != 1) {
+		printf("CLOSE FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(loop);
+	close(otherFds[1]);
+	return 0;
+}
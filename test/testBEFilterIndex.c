@@ -0,0 +1,227 @@
+//
+//  testBEFilterIndex.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 12/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEFilterIndex.h"
+#include <stdarg.h>
+
+#define TEST_NUM_SCRIPTS 500
+#define TEST_NUM_BLOCKS 20
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+CBByteArray * testBuildBlockFilter(uint8_t x);
+CBByteArray * testBuildBlockFilter(uint8_t x){
+	// A filter of x P2PKH scripts keyed by a hash made from x.
+	uint8_t hash[32];
+	memset(hash, x, 32);
+	CBScript * scripts[TEST_NUM_BLOCKS];
+	for (uint8_t y = 0; y < x; y++) {
+		scripts[y] = CBNewScriptOfSize(25, onErrorReceived);
+		memset(CBByteArrayGetData(scripts[y]), y, 25);
+	}
+	CBByteArray * filter = BEFilterIndexBuildFilter(hash, scripts, x, onErrorReceived);
+	for (uint8_t y = 0; y < x; y++)
+		CBReleaseObject(scripts[y]);
+	return filter;
+}
+
+int main(){
+	// The BIP158 basic filter of the testnet genesis block, which has the genesis output script.
+	uint8_t genesisHash[32] = {0x43,0x49,0x7F,0xD7,0xF8,0x26,0x95,0x71,0x08,0xF4,0xA3,0x0F,0xD9,0xCE,0xC3,0xAE,0xBA,0x79,0x97,0x20,0x84,0xE9,0x0E,0xAD,0x01,0xEA,0x33,0x09,0x00,0x00,0x00,0x00};
+	uint8_t genesisScript[67] = {0x41,0x04,0x67,0x8A,0xFD,0xB0,0xFE,0x55,0x48,0x27,0x19,0x67,0xF1,0xA6,0x71,0x30,0xB7,0x10,0x5C,0xD6,0xA8,0x28,0xE0,0x39,0x09,0xA6,0x79,0x62,0xE0,0xEA,0x1F,0x61,0xDE,0xB6,0x49,0xF6,0xBC,0x3F,0x4C,0xEF,0x38,0xC4,0xF3,0x55,0x04,0xE5,0x1E,0xC1,0x12,0xDE,0x5C,0x38,0x4D,0xF7,0xBA,0x0B,0x8D,0x57,0x8A,0x4C,0x70,0x2B,0x6B,0xF1,0x1D,0x5F,0xAC};
+	CBScript * script = CBNewScriptWithData(genesisScript, 67, onErrorReceived);
+	CBByteArray * filter = BEFilterIndexBuildFilter(genesisHash, &script, 1, onErrorReceived);
+	if (NOT filter || filter->length != 4 || memcmp(CBByteArrayGetData(filter), (uint8_t []){0x01,0x9D,0xFC,0xA8}, 4)) {
+		printf("GENESIS FILTER FAIL\n");
+		return 1;
+	}
+	// The element matches and the filter of the same script twice is the same.
+	if (NOT BEFilterIndexMatch(filter, genesisHash, genesisScript, 67)) {
+		printf("GENESIS MATCH FAIL\n");
+		return 1;
+	}
+	CBScript * twice[2] = {script, script};
+	CBByteArray * dupFilter = BEFilterIndexBuildFilter(genesisHash, twice, 2, onErrorReceived);
+	if (NOT dupFilter || dupFilter->length != 4 || memcmp(CBByteArrayGetData(dupFilter), CBByteArrayGetData(filter), 4)) {
+		printf("DUPLICATE FILTER FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(dupFilter);
+	CBReleaseObject(filter);
+	CBReleaseObject(script);
+	// An empty filter is only the number of elements and matches nothing.
+	filter = BEFilterIndexBuildFilter(genesisHash, NULL, 0, onErrorReceived);
+	if (NOT filter || filter->length != 1 || CBByteArrayGetByte(filter, 0) != 0
+		|| BEFilterIndexMatch(filter, genesisHash, genesisScript, 67)) {
+		printf("EMPTY FILTER FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(filter);
+	// Every element matches a larger filter and few other elements do.
+	CBScript * scripts[TEST_NUM_SCRIPTS];
+	for (uint32_t x = 0; x < TEST_NUM_SCRIPTS; x++) {
+		scripts[x] = CBNewScriptOfSize(25, onErrorReceived);
+		memset(CBByteArrayGetData(scripts[x]), 0, 25);
+		memcpy(CBByteArrayGetData(scripts[x]), &x, 4);
+	}
+	filter = BEFilterIndexBuildFilter(genesisHash, scripts, TEST_NUM_SCRIPTS, onErrorReceived);
+	if (NOT filter) {
+		printf("BUILD FILTER FAIL\n");
+		return 1;
+	}
+	for (uint32_t x = 0; x < TEST_NUM_SCRIPTS; x++) {
+		if (NOT BEFilterIndexMatch(filter, genesisHash, CBByteArrayGetData(scripts[x]), 25)) {
+			printf("MATCH FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	uint32_t falsePositives = 0;
+	for (uint32_t x = TEST_NUM_SCRIPTS; x < TEST_NUM_SCRIPTS + 10000; x++) {
+		uint8_t element[25] = {0};
+		memcpy(element, &x, 4);
+		if (BEFilterIndexMatch(filter, genesisHash, element, 25))
+			falsePositives++;
+	}
+	// The expected number is 10000 * 500 / 784931, about 6.
+	if (falsePositives > 30) {
+		printf("FALSE POSITIVE FAIL: %u\n", falsePositives);
+		return 1;
+	}
+	// A truncated filter is rejected rather than read past its end.
+	filter->length /= 2;
+	BEFilterIndexMatch(filter, genesisHash, CBByteArrayGetData(scripts[TEST_NUM_SCRIPTS - 1]), 25);
+	CBReleaseObject(filter);
+	for (uint32_t x = 0; x < TEST_NUM_SCRIPTS; x++)
+		CBReleaseObject(scripts[x]);
+	if (BEFilterIndexMultiplyHigh(0xFFFFFFFFFFFFFFFF, 0xFFFFFFFFFFFFFFFF) != 0xFFFFFFFFFFFFFFFE
+		|| BEFilterIndexMultiplyHigh(0x100000000, 0x100000000) != 1
+		|| BEFilterIndexMultiplyHigh(0x123456789ABCDEF0, 784931 * 500) != (uint64_t)(((unsigned __int128)0x123456789ABCDEF0 * (784931 * 500)) >> 64)) {
+		printf("MULTIPLY HIGH FAIL\n");
+		return 1;
+	}
+	// Index filters for a chain of blocks.
+	remove("./filters.dat");
+	remove("./filterindex.dat");
+	BEFilterIndex * index = BENewFilterIndex("./", onErrorReceived);
+	if (NOT index || index->numFilters) {
+		printf("NEW INDEX FAIL\n");
+		return 1;
+	}
+	uint64_t filterPos[TEST_NUM_BLOCKS];
+	uint8_t headers[32 * TEST_NUM_BLOCKS];
+	uint8_t prevHeader[32] = {0};
+	for (uint8_t x = 0; x < TEST_NUM_BLOCKS; x++) {
+		filter = testBuildBlockFilter(x);
+		uint8_t hash[32];
+		memset(hash, x, 32);
+		filterPos[x] = BEFilterIndexAddFilter(index, hash, filter);
+		if (filterPos[x] == BE_NO_FILTER || NOT BEFilterIndexAppend(index, filterPos[x])) {
+			printf("ADD FILTER FAIL AT %u\n", x);
+			return 1;
+		}
+		// The header commits to the filter and the previous header.
+		uint8_t data[64], hash2[32];
+		CBSha256(CBByteArrayGetData(filter), filter->length, hash2);
+		CBSha256(hash2, 32, data);
+		memcpy(data + 32, prevHeader, 32);
+		CBSha256(data, 64, hash2);
+		CBSha256(hash2, 32, headers + 32*x);
+		memcpy(prevHeader, headers + 32*x, 32);
+		CBReleaseObject(filter);
+	}
+	if (index->numFilters != TEST_NUM_BLOCKS || memcmp(index->lastHeader, prevHeader, 32)) {
+		printf("INDEX HEADER FAIL\n");
+		return 1;
+	}
+	for (uint8_t x = 0; x < TEST_NUM_BLOCKS; x++) {
+		CBByteArray * expected = testBuildBlockFilter(x);
+		uint8_t hash[32];
+		filter = BEFilterIndexGetFilter(index, x, hash);
+		if (NOT filter || filter->length != expected->length || memcmp(CBByteArrayGetData(filter), CBByteArrayGetData(expected), filter->length)
+			|| hash[0] != x || hash[31] != x) {
+			printf("GET FILTER FAIL AT %u\n", x);
+			return 1;
+		}
+		CBReleaseObject(filter);
+		CBReleaseObject(expected);
+	}
+	uint8_t readHeaders[32 * TEST_NUM_BLOCKS];
+	if (NOT BEFilterIndexGetHeaders(index, 5, 10, readHeaders) || memcmp(readHeaders, headers + 32*5, 32*10)
+		|| BEFilterIndexGetHeaders(index, 15, 10, readHeaders)
+		|| BEFilterIndexGetFilter(index, TEST_NUM_BLOCKS, NULL)) {
+		printf("GET HEADERS FAIL\n");
+		return 1;
+	}
+	// A reorganisation removes the top heights and the filters of the old blocks can be indexed again.
+	if (NOT BEFilterIndexTruncate(index, TEST_NUM_BLOCKS - 3) || index->numFilters != TEST_NUM_BLOCKS - 3
+		|| memcmp(index->lastHeader, headers + 32*(TEST_NUM_BLOCKS - 4), 32)) {
+		printf("TRUNCATE FAIL\n");
+		return 1;
+	}
+	for (uint8_t x = TEST_NUM_BLOCKS - 3; x < TEST_NUM_BLOCKS; x++) {
+		if (NOT BEFilterIndexAppend(index, filterPos[x])) {
+			printf("APPEND AFTER TRUNCATE FAIL\n");
+			return 1;
+		}
+	}
+	if (memcmp(index->lastHeader, prevHeader, 32) || NOT BEFilterIndexSyncFilters(index)) {
+		printf("REAPPEND HEADER FAIL\n");
+		return 1;
+	}
+	// A position which is not a filter record is not indexed.
+	if (BEFilterIndexAppend(index, filterPos[1] + 1) || index->numFilters != TEST_NUM_BLOCKS) {
+		printf("BAD POSITION FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(index);
+	// The index is the same when opened again.
+	index = BENewFilterIndex("./", onErrorReceived);
+	if (NOT index || index->numFilters != TEST_NUM_BLOCKS || memcmp(index->lastHeader, prevHeader, 32)) {
+		printf("REOPEN FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(index);
+	// A record which was not completely written is removed when the index is opened.
+	FILE * file = fopen("./filterindex.dat", "r+b");
+	fseek(file, -3, SEEK_END);
+	fputc(0xAB, file);
+	fclose(file);
+	index = BENewFilterIndex("./", onErrorReceived);
+	struct stat st;
+	stat("./filterindex.dat", &st);
+	if (NOT index || index->numFilters != TEST_NUM_BLOCKS - 1 || memcmp(index->lastHeader, headers + 32*(TEST_NUM_BLOCKS - 2), 32)
+		|| st.st_size != (TEST_NUM_BLOCKS - 1) * BE_FILTER_INDEX_RECORD_SIZE) {
+		printf("CORRUPT RECORD FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(index);
+	remove("./filters.dat");
+	remove("./filterindex.dat");
+	return 0;
+}
@@ -66,7 +66,9 @@ void onErrorReceived(CBError a,char * format,...){
 int main(){
 	remove("./validation.dat");
 	remove("./branch0.dat");
-	remove("./blocks0-0.dat");
+	remove("./blocks0.dat");
+	remove("./blockindex.dat");
+	remove("./orphans.dat");
 	// Create validator
 	BEFullValidator * validator = BENewFullValidator("./", onErrorReceived);
 	// Create initial data
@@ -89,8 +91,17 @@ int main(){
 		printf("VALIDATOR LOAD BRANCH FROM FILE FAIL\n");
 		return 1;
 	}
+	// Only the summary is loaded until the rest is needed.
+	if (validator->branches[0].loaded != BE_BRANCH_SUMMARY) {
+		printf("VALIDATOR LOAD SUMMARY FAIL\n");
+		return 1;
+	}
+	if (NOT BEFullValidatorLoadBranch(validator, 0, BE_BRANCH_ALL) || validator->branches[0].loaded != BE_BRANCH_ALL) {
+		printf("VALIDATOR LOAD REST OF BRANCH FAIL\n");
+		return 1;
+	}
 	// Now verify that the data is correct.
-	if(validator->numOrphans){
+	if(validator->orphanPool->numOrphans){
 		printf("ORPHAN NUM FAIL\n");
 		return 1;
 	}
@@ -171,15 +182,13 @@ int main(){
 		printf("UNSPENT OUTPUT FILE ID FAIL\n");
 		return 1;
 	}
-	if (validator->branches->unspentOutputs[0].ref.filePos != 209) {
+	if (validator->branches->unspentOutputs[0].ref.filePos != 213) {
 		printf("UNSPENT OUTPUT FILE POS FAIL\n");
 		return 1;
 	}
 	// Verify unspent output is correct
-	FILE * fd = BEFullValidatorGetBlockFile(validator, 0, 0);
-	fseek(fd, 209, SEEK_SET);
 	CBByteArray * outputBytes = CBNewByteArrayOfSize(76, onErrorReceived);
-	if (fread(CBByteArrayGetData(outputBytes), 1, 76, fd) != 76){
+	if (NOT BEBlockStoreRead(validator->blockStore, 0, 213, CBByteArrayGetData(outputBytes), 76)){
 		printf("UNSPENT OUTPUT READ FAIL\n");
 		return 1;
 	}
@@ -203,7 +212,7 @@ int main(){
 	CBReleaseObject(output);
 	CBReleaseObject(outputBytes);
 	// Try loading the genesis block
-	CBBlock * block = BEFullValidatorLoadBlock(validator, validator->branches[0].references[0], 0);
+	CBBlock * block = BEFullValidatorLoadBlock(validator, validator->branches[0].references[0]);
 	CBBlockDeserialise(block, true);
 	if (NOT block) {
 		printf("GENESIS RETRIEVE FAIL\n");
@@ -343,7 +352,7 @@ int main(){
 		printf("BLOCK ONE MUM BRANCHES FAIL\n");
 		return 1;
 	}
-	if (validator->numOrphans) {
+	if (validator->orphanPool->numOrphans) {
 		printf("BLOCK ONE MUM ORPHANS FAIL\n");
 		return 1;
 	}
@@ -393,7 +402,7 @@ int main(){
 		return 1;
 	}
 	// Try to load block
-	block1 = BEFullValidatorLoadBlock(validator, validator->branches[0].references[1], 0);
+	block1 = BEFullValidatorLoadBlock(validator, validator->branches[0].references[1]);
 	CBBlockDeserialise(block1, true);
 	if (NOT block1) {
 		printf("BLOCK ONE LOAD FAIL\n");
@@ -500,10 +509,8 @@ int main(){
 		printf("BLOCK ONE UNSPENT OUTPUT FILE ID FAIL\n");
 		return 1;
 	}
-	fd = BEFullValidatorGetBlockFile(validator, 0, 0);
-	fseek(fd, validator->branches[0].unspentOutputs[1].ref.filePos, SEEK_SET);
 	outputBytes = CBNewByteArrayOfSize(CBGetMessage(block1->transactions[0]->outputs[0])->bytes->length, onErrorReceived);
-	if (fread(CBByteArrayGetData(outputBytes), 1, outputBytes->length, fd) != outputBytes->length){
+	if (NOT BEBlockStoreRead(validator->blockStore, 0, validator->branches[0].unspentOutputs[1].ref.filePos, CBByteArrayGetData(outputBytes), outputBytes->length)){
 		printf("BLOCK ONE UNSPENT OUTPUT READ FAIL\n");
 		return 1;
 	}
@@ -565,6 +572,31 @@ int main(){
 				printf("SIDE FAIL AT %u\n",y);
 				return 1;
 			}
+			// The side block is validated in the background before the side branch becomes the main branch.
+			uint8_t sideBranch = NOT validator->mainBranch;
+			if (validator->numBranches != 2 || validator->branches[sideBranch].lastValidation != BE_NO_VALIDATION) {
+				printf("SIDE BRANCH NOT VALIDATED FAIL\n");
+				return 1;
+			}
+			if (NOT BEFullValidatorStartBackgroundValidation(validator)) {
+				printf("START BACKGROUND FOR SIDE FAIL\n");
+				return 1;
+			}
+			for (uint16_t z = 0; z < 1000; z++) {
+				pthread_mutex_lock(&validator->lock);
+				bool validated = validator->branches[sideBranch].lastValidation != BE_NO_VALIDATION;
+				pthread_mutex_unlock(&validator->lock);
+				if (validated)
+					break;
+				usleep(10000);
+			}
+			BEFullValidatorStopBackgroundValidation(validator);
+			if (validator->branches[sideBranch].lastValidation != 0
+				|| validator->branches[sideBranch].invalid
+				|| validator->backgroundValidated != 1) {
+				printf("BACKGROUND SIDE VALIDATION FAIL\n");
+				return 1;
+			}
 		}else if (y > 2 && y < 6){
 			if (res != BE_BLOCK_STATUS_ORPHAN) {
 				printf("ORPHAN FAIL AT %u\n",y);
@@ -576,6 +608,268 @@ int main(){
 			return 1;
 		}
 	}
+	// Known invalid blocks are remembered by hash.
+	uint8_t invalidHash[32] = {0x12,0x34,0x56};
+	if (BEFullValidatorIsKnownInvalid(validator, invalidHash)) {
+		printf("NOT KNOWN INVALID FAIL\n");
+		return 1;
+	}
+	BEFullValidatorAddInvalidBlock(validator, invalidHash);
+	invalidHash[31] = 1;
+	if (BEFullValidatorIsKnownInvalid(validator, invalidHash)) {
+		printf("KNOWN INVALID OTHER HASH FAIL\n");
+		return 1;
+	}
+	invalidHash[31] = 0;
+	if (NOT BEFullValidatorIsKnownInvalid(validator, invalidHash)) {
+		printf("KNOWN INVALID FAIL\n");
+		return 1;
+	}
+	// Blocks failing the header pre-check are rejected before anything is allocated or any branch is searched, so the counters are the only change.
+	uint32_t mainRefs = validator->branches[validator->mainBranch].numRefs;
+	uint32_t numOrphans = validator->orphanPool->numOrphans;
+	uint64_t rejectedPreCheck = validator->rejectedPreCheck;
+	uint64_t rejectedKnownInvalid = validator->rejectedKnownInvalid;
+	if (BEFullValidatorProcessBlock(validator, block1, block1->time - 7201) != BE_BLOCK_STATUS_BAD_TIME
+		|| validator->rejectedPreCheck != ++rejectedPreCheck
+		|| BEFullValidatorIsKnownInvalid(validator, CBBlockGetHash(block1))) {
+		printf("PRE-CHECK FUTURE TIME FAIL\n");
+		return 1;
+	}
+	// A block with the header of block one and no transactions.
+	CBBlock * badBlock = CBNewBlock(onErrorReceived);
+	badBlock->version = block1->version;
+	badBlock->prevBlockHash = block1->prevBlockHash;
+	CBRetainObject(badBlock->prevBlockHash);
+	badBlock->merkleRoot = block1->merkleRoot;
+	CBRetainObject(badBlock->merkleRoot);
+	badBlock->time = block1->time;
+	badBlock->target = block1->target;
+	badBlock->nonce = block1->nonce;
+	badBlock->transactionNum = 0;
+	CBGetMessage(badBlock)->bytes = CBNewByteArrayOfSize(CBBlockCalculateLength(badBlock, true), onErrorReceived);
+	CBBlockSerialise(badBlock, true, false);
+	if (BEFullValidatorProcessBlock(validator, badBlock, 1349643202) != BE_BLOCK_STATUS_BAD
+		|| validator->rejectedPreCheck != ++rejectedPreCheck
+		|| BEFullValidatorIsKnownInvalid(validator, CBBlockGetHash(badBlock))) {
+		printf("PRE-CHECK NO TRANSACTIONS FAIL\n");
+		return 1;
+	}
+	// The number of transactions is checked before the transactions are used.
+	badBlock->transactionNum = BE_MAX_BLOCK_TRANSACTIONS + 1;
+	res = BEFullValidatorProcessBlock(validator, badBlock, 1349643202);
+	badBlock->transactionNum = 0;
+	if (res != BE_BLOCK_STATUS_BAD
+		|| validator->rejectedPreCheck != ++rejectedPreCheck
+		|| BEFullValidatorIsKnownInvalid(validator, CBBlockGetHash(badBlock))) {
+		printf("PRE-CHECK TOO MANY TRANSACTIONS FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(badBlock);
+	// A block failing the proof of work is remembered as invalid.
+	badBlock = CBNewBlock(onErrorReceived);
+	badBlock->version = block1->version;
+	badBlock->prevBlockHash = block1->prevBlockHash;
+	CBRetainObject(badBlock->prevBlockHash);
+	badBlock->merkleRoot = block1->merkleRoot;
+	CBRetainObject(badBlock->merkleRoot);
+	badBlock->time = block1->time;
+	badBlock->target = block1->target;
+	badBlock->nonce = block1->nonce + 1;
+	badBlock->transactionNum = 0;
+	CBGetMessage(badBlock)->bytes = CBNewByteArrayOfSize(CBBlockCalculateLength(badBlock, true), onErrorReceived);
+	CBBlockSerialise(badBlock, true, false);
+	if (BEFullValidatorProcessBlock(validator, badBlock, 1349643202) != BE_BLOCK_STATUS_BAD
+		|| validator->rejectedPreCheck != ++rejectedPreCheck
+		|| validator->rejectedKnownInvalid != rejectedKnownInvalid
+		|| NOT BEFullValidatorIsKnownInvalid(validator, CBBlockGetHash(badBlock))) {
+		printf("PRE-CHECK PROOF OF WORK FAIL\n");
+		return 1;
+	}
+	// The repeated block is rejected as known invalid without checking the proof of work again.
+	if (BEFullValidatorProcessBlock(validator, badBlock, 1349643202) != BE_BLOCK_STATUS_BAD
+		|| validator->rejectedPreCheck != rejectedPreCheck
+		|| validator->rejectedKnownInvalid != ++rejectedKnownInvalid) {
+		printf("PRE-CHECK REPEATED BAD BLOCK FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(badBlock);
+	if (validator->branches[validator->mainBranch].numRefs != mainRefs || validator->orphanPool->numOrphans != numOrphans) {
+		printf("PRE-CHECK CHANGED VALIDATOR FAIL\n");
+		return 1;
+	}
+	// The background validation starts and stops, with nothing more to validate as the side branch became the main branch.
+	if (NOT BEFullValidatorStartBackgroundValidation(validator) || NOT validator->backgroundRunning) {
+		printf("START BACKGROUND FAIL\n");
+		return 1;
+	}
+	BEFullValidatorStopBackgroundValidation(validator);
+	if (validator->backgroundRunning || validator->backgroundValidated != 1) {
+		printf("STOP BACKGROUND FAIL\n");
+		return 1;
+	}
+	// A side block paying too much to the coinbase passes the basic validation and is found to be invalid in the background.
+	block = CBNewBlock(onErrorReceived);
+	block->version = 1;
+	block->time = 1231006506;
+	block->transactionNum = 1;
+	block->transactions = malloc(sizeof(*block->transactions));
+	block->transactions[0] = CBNewTransaction(0, 1, onErrorReceived);
+	CBScript * nullScript = CBNewScriptOfSize(0, onErrorReceived);
+	CBScript * inScript = CBNewScriptOfSize(2, onErrorReceived);
+	CBTransactionTakeInput(block->transactions[0], CBNewTransactionInput(inScript, CB_TRANSACTION_INPUT_FINAL, nullHash, 0xFFFFFFFF, onErrorReceived));
+	CBReleaseObject(inScript);
+	CBTransactionTakeOutput(block->transactions[0], CBNewTransactionOutput(5000000001, nullScript, onErrorReceived));
+	CBReleaseObject(nullScript);
+	block->target = CB_MAX_TARGET;
+	block->prevBlockHash = CBNewByteArrayWithDataCopy((uint8_t []){0x6F,0xE2,0x8C,0x0A,0xB6,0xF1,0xB3,0x72,0xC1,0xA6,0xA2,0x46,0xAE,0x63,0xF7,0x4F,0x93,0x1E,0x83,0x65,0xE1,0x5A,0x08,0x9C,0x68,0xD6,0x19,0x00,0x00,0x00,0x00,0x00}, 32, onErrorReceived);
+	CBGetMessage(block)->bytes = CBNewByteArrayOfSize(143, onErrorReceived);
+	CBGetMessage(block->transactions[0])->bytes = CBNewByteArrayOfSize(62, onErrorReceived);
+	CBByteArraySetByte(block->transactions[0]->inputs[0]->scriptObject, 0, 0);
+	CBByteArraySetByte(block->transactions[0]->inputs[0]->scriptObject, 1, 200);
+	block->nonce = 0xea4b953c;
+	CBTransactionSerialise(block->transactions[0], true);
+	block->merkleRoot = CBNewByteArrayWithDataCopy(CBTransactionGetHash(block->transactions[0]), 32, onErrorReceived);
+	CBBlockSerialise(block, true, false);
+	if (BEFullValidatorProcessBlock(validator, block, 1230999321) != BE_BLOCK_STATUS_SIDE || validator->numBranches != 3) {
+		printf("INVALID SIDE BLOCK ADD FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	if (NOT BEFullValidatorStartBackgroundValidation(validator)) {
+		printf("START BACKGROUND FOR INVALID SIDE FAIL\n");
+		return 1;
+	}
+	for (uint16_t z = 0; z < 1000; z++) {
+		pthread_mutex_lock(&validator->lock);
+		bool invalid = validator->branches[2].invalid;
+		pthread_mutex_unlock(&validator->lock);
+		if (invalid)
+			break;
+		usleep(10000);
+	}
+	BEFullValidatorStopBackgroundValidation(validator);
+	if (NOT validator->branches[2].invalid
+		|| validator->branches[2].lastValidation != BE_NO_VALIDATION
+		|| validator->backgroundValidated != 1) {
+		printf("BACKGROUND INVALID SIDE FAIL\n");
+		return 1;
+	}
+	// The new branches are saved with the number of branches, so they are loaded again.
+	CBReleaseObject(validator);
+	validator = BENewFullValidator("./", onErrorReceived);
+	if (NOT BEFullValidatorLoadValidator(validator)
+		|| validator->numBranches != 3
+		|| NOT BEFullValidatorLoadBranch(validator, 2, BE_BRANCH_REFERENCES)
+		|| validator->branches[2].numRefs != 1
+		|| validator->branches[2].startHeight != 1) {
+		printf("NEW BRANCH LOAD FAIL\n");
+		return 1;
+	}
+	// A side block spending an output from before the fork is validated against the unspent outputs at the fork, which are kept by the main branch.
+	block = CBNewBlock(onErrorReceived);
+	block->version = 1;
+	block->time = 1231006525;
+	block->transactionNum = 1;
+	block->transactions = malloc(sizeof(*block->transactions));
+	block->transactions[0] = CBNewTransaction(0, 1, onErrorReceived);
+	nullScript = CBNewScriptOfSize(0, onErrorReceived);
+	inScript = CBNewScriptOfSize(2, onErrorReceived);
+	CBTransactionTakeInput(block->transactions[0], CBNewTransactionInput(inScript, CB_TRANSACTION_INPUT_FINAL, nullHash, 0xFFFFFFFF, onErrorReceived));
+	CBReleaseObject(inScript);
+	CBTransactionTakeOutput(block->transactions[0], CBNewTransactionOutput(5000000000, nullScript, onErrorReceived));
+	block->target = CB_MAX_TARGET;
+	block->prevBlockHash = prevHash;
+	CBRetainObject(prevHash);
+	CBGetMessage(block)->bytes = CBNewByteArrayOfSize(143, onErrorReceived);
+	CBGetMessage(block->transactions[0])->bytes = CBNewByteArrayOfSize(62, onErrorReceived);
+	CBByteArraySetByte(block->transactions[0]->inputs[0]->scriptObject, 0, 0);
+	CBByteArraySetByte(block->transactions[0]->inputs[0]->scriptObject, 1, 100);
+	block->nonce = 0x27541488;
+	CBTransactionSerialise(block->transactions[0], true);
+	block->merkleRoot = CBNewByteArrayWithDataCopy(CBTransactionGetHash(block->transactions[0]), 32, onErrorReceived);
+	CBBlockSerialise(block, true, false);
+	if (BEFullValidatorProcessBlock(validator, block, 1231006525) != BE_BLOCK_STATUS_MAIN) {
+		printf("MAIN BLOCK BEFORE SPENDING SIDE BLOCK FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	// The side block spends the coinbase output of the first of the test blocks.
+	CBByteArray * spentHash = CBNewByteArrayWithDataCopy((uint8_t []){0x1C,0x1F,0x47,0x83,0xA8,0xD0,0x3F,0xAC,0xA6,0x24,0x4E,0xC8,0xEF,0x5B,0x09,0x0F,0x63,0x88,0x50,0x63,0xF7,0xB7,0x64,0x29,0x2A,0xBA,0x88,0x25,0x71,0xB5,0xD4,0x27}, 32, onErrorReceived);
+	block = CBNewBlock(onErrorReceived);
+	block->version = 1;
+	block->time = 1231006525;
+	block->transactionNum = 2;
+	block->transactions = malloc(sizeof(*block->transactions) * 2);
+	block->transactions[0] = CBNewTransaction(0, 1, onErrorReceived);
+	inScript = CBNewScriptOfSize(2, onErrorReceived);
+	CBTransactionTakeInput(block->transactions[0], CBNewTransactionInput(inScript, CB_TRANSACTION_INPUT_FINAL, nullHash, 0xFFFFFFFF, onErrorReceived));
+	CBReleaseObject(inScript);
+	CBTransactionTakeOutput(block->transactions[0], CBNewTransactionOutput(5000000000, nullScript, onErrorReceived));
+	block->transactions[1] = CBNewTransaction(0, 1, onErrorReceived);
+	inScript = CBNewScriptOfSize(1, onErrorReceived);
+	CBByteArraySetByte(inScript, 0, CB_SCRIPT_OP_TRUE);
+	CBTransactionTakeInput(block->transactions[1], CBNewTransactionInput(inScript, CB_TRANSACTION_INPUT_FINAL, spentHash, 0, onErrorReceived));
+	CBReleaseObject(inScript);
+	CBTransactionTakeOutput(block->transactions[1], CBNewTransactionOutput(5000000000, nullScript, onErrorReceived));
+	CBReleaseObject(nullScript);
+	block->target = CB_MAX_TARGET;
+	block->prevBlockHash = prevHash;
+	CBGetMessage(block)->bytes = CBNewByteArrayOfSize(204, onErrorReceived);
+	CBGetMessage(block->transactions[0])->bytes = CBNewByteArrayOfSize(62, onErrorReceived);
+	CBGetMessage(block->transactions[1])->bytes = CBNewByteArrayOfSize(61, onErrorReceived);
+	CBByteArraySetByte(block->transactions[0]->inputs[0]->scriptObject, 0, 0);
+	CBByteArraySetByte(block->transactions[0]->inputs[0]->scriptObject, 1, 101);
+	block->nonce = 0xd7848d8f;
+	CBTransactionSerialise(block->transactions[0], true);
+	CBTransactionSerialise(block->transactions[1], true);
+	uint8_t merkleHashes[64];
+	memcpy(merkleHashes, CBTransactionGetHash(block->transactions[0]), 32);
+	memcpy(merkleHashes + 32, CBTransactionGetHash(block->transactions[1]), 32);
+	CBCalculateMerkleRoot(merkleHashes, 2);
+	block->merkleRoot = CBNewByteArrayWithDataCopy(merkleHashes, 32, onErrorReceived);
+	CBBlockSerialise(block, true, false);
+	if (BEFullValidatorProcessBlock(validator, block, 1231006525) != BE_BLOCK_STATUS_SIDE
+		|| validator->numBranches != 4
+		|| validator->branches[3].lastValidation != BE_NO_VALIDATION) {
+		printf("SPENDING SIDE BLOCK ADD FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	if (NOT BEFullValidatorStartBackgroundValidation(validator)) {
+		printf("START BACKGROUND FOR SPENDING SIDE FAIL\n");
+		return 1;
+	}
+	for (uint16_t z = 0; z < 1000; z++) {
+		pthread_mutex_lock(&validator->lock);
+		bool done = validator->branches[3].lastValidation != BE_NO_VALIDATION || validator->branches[3].invalid;
+		pthread_mutex_unlock(&validator->lock);
+		if (done)
+			break;
+		usleep(10000);
+	}
+	BEFullValidatorStopBackgroundValidation(validator);
+	if (validator->branches[3].lastValidation != 0 || validator->branches[3].invalid) {
+		printf("BACKGROUND SPENDING SIDE VALIDATION FAIL\n");
+		return 1;
+	}
+	// The output is spent in the side branch and not in the main branch.
+	bool found;
+	BEFullValidatorFindOutputReference(validator->branches[3].unspentOutputs, validator->branches[3].numUnspentOutputs, CBByteArrayGetData(spentHash), 0, &found);
+	if (found) {
+		printf("SPENDING SIDE OUTPUT SPENT FAIL\n");
+		return 1;
+	}
+	if (NOT BEFullValidatorLoadBranch(validator, validator->mainBranch, BE_BRANCH_ALL)) {
+		printf("SPENDING SIDE LOAD MAIN FAIL\n");
+		return 1;
+	}
+	BEFullValidatorFindOutputReference(validator->branches[validator->mainBranch].unspentOutputs, validator->branches[validator->mainBranch].numUnspentOutputs, CBByteArrayGetData(spentHash), 0, &found);
+	if (NOT found) {
+		printf("SPENDING SIDE MAIN OUTPUT UNSPENT FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(spentHash);
 	// Free data
 	CBReleaseObject(block1);
 	CBReleaseObject(validator);
@@ -0,0 +1,227 @@
+//
+//  testBEMempool.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 31/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEMempool.h"
+#include <stdarg.h>
+
+#define TEST_INPUT_SIZE 42
+#define TEST_OUTPUT_SIZE 10
+#define TEST_CHAIN_LENGTH (BE_MEMPOOL_MAX_ANCESTORS + 1)
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+uint32_t testTransactionSize(uint8_t numInputs, uint8_t numOutputs);
+uint32_t testTransactionSize(uint8_t numInputs, uint8_t numOutputs){
+	return 10 + numInputs * TEST_INPUT_SIZE + numOutputs * TEST_OUTPUT_SIZE;
+}
+
+uint32_t testWriteTransaction(uint8_t * data, uint8_t * prevHash, uint32_t prevIndex, uint8_t numOutputs, uint8_t tag);
+uint32_t testWriteTransaction(uint8_t * data, uint8_t * prevHash, uint32_t prevIndex, uint8_t numOutputs, uint8_t tag){
+	// One input spending the previous output and outputs made different by the tag.
+	uint32_t size = testTransactionSize(1, numOutputs);
+	memset(data, 0, size);
+	data[0] = 1;
+	data[4] = 1;
+	memcpy(data + 5, prevHash, 32);
+	for (uint8_t x = 0; x < 4; x++)
+		data[37 + x] = prevIndex >> 8*x;
+	data[41] = 1;
+	data[42] = tag;
+	memset(data + 43, 0xFF, 4);
+	data[47] = numOutputs;
+	for (uint8_t x = 0; x < numOutputs; x++) {
+		data[48 + x * TEST_OUTPUT_SIZE] = tag;
+		data[48 + x * TEST_OUTPUT_SIZE + 1] = x;
+		data[48 + x * TEST_OUTPUT_SIZE + 8] = 1;
+		data[48 + x * TEST_OUTPUT_SIZE + 9] = 0x51;
+	}
+	return size;
+}
+
+CBTransaction * testMakeTransaction(uint8_t * prevHash, uint32_t prevIndex, uint8_t numOutputs, uint8_t tag);
+CBTransaction * testMakeTransaction(uint8_t * prevHash, uint32_t prevIndex, uint8_t numOutputs, uint8_t tag){
+	uint8_t data[testTransactionSize(1, numOutputs)];
+	uint32_t size = testWriteTransaction(data, prevHash, prevIndex, numOutputs, tag);
+	CBByteArray * bytes = CBNewByteArrayWithDataCopy(data, size, onErrorReceived);
+	CBTransaction * tx = CBNewTransactionFromData(bytes, onErrorReceived);
+	CBReleaseObject(bytes);
+	CBTransactionDeserialise(tx);
+	return tx;
+}
+
+int main(){
+	BEMempool * pool = BENewMempool(BE_MEMPOOL_MAX_SIZE, onErrorReceived);
+	if (NOT pool) {
+		printf("NEW MEMPOOL FAIL\n");
+		return 1;
+	}
+	uint8_t confirmedA[32], confirmedB[32];
+	memset(confirmedA, 0xAA, 32);
+	memset(confirmedB, 0xBB, 32);
+	// A parent spending a confirmed output and a child spending the parent.
+	CBTransaction * parent = testMakeTransaction(confirmedA, 0, 2, 1);
+	CBTransaction * child = testMakeTransaction(CBTransactionGetHash(parent), 0, 1, 2);
+	if (BEMempoolAdd(pool, parent, 1000, 0, 1) != BE_MEMPOOL_ADDED
+		|| BEMempoolAdd(pool, child, 5000, 3, 2) != BE_MEMPOOL_ADDED) {
+		printf("ADD FAIL\n");
+		return 1;
+	}
+	if (BEMempoolAdd(pool, parent, 1000, 0, 3) != BE_MEMPOOL_DUPLICATE) {
+		printf("DUPLICATE FAIL\n");
+		return 1;
+	}
+	CBTransaction * doubleSpend = testMakeTransaction(confirmedA, 0, 1, 3);
+	if (BEMempoolAdd(pool, doubleSpend, 100000, 0, 3) != BE_MEMPOOL_CONFLICT) {
+		printf("CONFLICT FAIL\n");
+		return 1;
+	}
+	// The child has the parent as its parent and ancestor.
+	BEMempoolEntry * childEntry = pool->entries + BEMempoolFind(pool, CBTransactionGetHash(child));
+	uint32_t parentSize = testTransactionSize(1, 2);
+	uint32_t childSize = testTransactionSize(1, 1);
+	if (childEntry->numParents != 1 || childEntry->parents[0] != BEMempoolFind(pool, CBTransactionGetHash(parent))
+		|| childEntry->numAncestors != 2 || childEntry->ancestorFee != 6000 || childEntry->ancestorSize != parentSize + childSize
+		|| pool->size != parentSize + childSize) {
+		printf("ANCESTORS FAIL\n");
+		return 1;
+	}
+	// The outputs of the parent are available and the spent one is known.
+	CBTransactionOutput * output = BEMempoolGetOutput(pool, CBTransactionGetHash(parent), 1);
+	if (NOT output || output != parent->outputs[1] || BEMempoolGetOutput(pool, CBTransactionGetHash(parent), 2)
+		|| NOT BEMempoolIsSpent(pool, CBTransactionGetHash(parent), 0) || BEMempoolIsSpent(pool, CBTransactionGetHash(parent), 1)) {
+		printf("OUTPUT FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(output);
+	uint32_t p2shSigOps;
+	if (NOT BEMempoolGetVerified(pool, CBTransactionGetHash(child), &p2shSigOps) || p2shSigOps != 3
+		|| BEMempoolGetVerified(pool, CBTransactionGetHash(doubleSpend), &p2shSigOps) || pool->reused != 1) {
+		printf("VERIFIED FAIL\n");
+		return 1;
+	}
+	// A chain can only be as long as the ancestor limit.
+	CBTransaction * chain[TEST_CHAIN_LENGTH];
+	for (uint8_t x = 0; x < TEST_CHAIN_LENGTH; x++) {
+		chain[x] = testMakeTransaction(x ? CBTransactionGetHash(chain[x - 1]) : confirmedB, 0, 1, 10 + x);
+		BEMempoolStatus status = BEMempoolAdd(pool, chain[x], 2000 + x * 100, 0, 4);
+		if (status != (x < BE_MEMPOOL_MAX_ANCESTORS ? BE_MEMPOOL_ADDED : BE_MEMPOOL_REJECTED)) {
+			printf("ANCESTOR LIMIT FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	if (pool->numEntries != 2 + BE_MEMPOOL_MAX_ANCESTORS) {
+		printf("ANCESTOR LIMIT COUNT FAIL\n");
+		return 1;
+	}
+	// The transactions are given from the highest fee rate to the lowest.
+	CBTransaction ** txs;
+	uint32_t numTxs = BEMempoolGetTransactions(pool, &txs);
+	if (numTxs != pool->numEntries || txs[0] != child) {
+		printf("GET TRANSACTIONS FAIL\n");
+		return 1;
+	}
+	for (uint32_t x = 0; x < numTxs; x++) {
+		if (x && pool->entries[BEMempoolFind(pool, CBTransactionGetHash(txs[x]))].feeRate > pool->entries[BEMempoolFind(pool, CBTransactionGetHash(txs[x - 1]))].feeRate) {
+			printf("FEE RATE ORDER FAIL\n");
+			return 1;
+		}
+		CBReleaseObject(txs[x]);
+	}
+	free(txs);
+	// A block with the parent and a double spend of the start of the chain.
+	CBTransaction * chainDoubleSpend = testMakeTransaction(confirmedB, 0, 1, 4);
+	CBTransaction * blockTxs[3] = {doubleSpend, parent, chainDoubleSpend};
+	uint32_t blockSize = 81;
+	for (uint8_t x = 0; x < 3; x++)
+		blockSize += CBGetMessage(blockTxs[x])->bytes->length;
+	uint8_t * blockData = calloc(1, blockSize);
+	uint8_t txHashes[96];
+	blockData[80] = 3;
+	uint32_t cursor = 81;
+	for (uint8_t x = 0; x < 3; x++) {
+		CBByteArray * bytes = CBGetMessage(blockTxs[x])->bytes;
+		memcpy(blockData + cursor, CBByteArrayGetData(bytes), bytes->length);
+		cursor += bytes->length;
+		memcpy(txHashes + 32*x, CBTransactionGetHash(blockTxs[x]), 32);
+	}
+	CBByteArray * bytes = CBNewByteArrayWithData(blockData, blockSize, onErrorReceived);
+	CBBlock * block = CBNewBlockFromData(bytes, onErrorReceived);
+	CBReleaseObject(bytes);
+	CBBlockDeserialise(block, true);
+	BEMempoolRemoveBlock(pool, block, txHashes);
+	// The child is left without ancestors and the chain is removed.
+	childEntry = pool->entries + BEMempoolFind(pool, CBTransactionGetHash(child));
+	if (pool->numEntries != 1 || BEMempoolContains(pool, CBTransactionGetHash(parent)) || BEMempoolContains(pool, CBTransactionGetHash(chain[0]))
+		|| childEntry->numParents || childEntry->numAncestors != 1 || childEntry->ancestorFee != 5000 || childEntry->ancestorSize != childSize
+		|| pool->mined != 1 || pool->conflicts != BE_MEMPOOL_MAX_ANCESTORS || pool->size != childSize || pool->numSpends != 1) {
+		printf("REMOVE BLOCK FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(block);
+	// Clear the pool and make it hold three transactions, so that the lowest fee rate is removed for a higher one.
+	BEMempoolClear(pool);
+	if (pool->numEntries || pool->size || BEMempoolContains(pool, CBTransactionGetHash(child))) {
+		printf("CLEAR FAIL\n");
+		return 1;
+	}
+	pool->maxSize = childSize * 3;
+	CBTransaction * small[5];
+	uint64_t fees[5] = {3000, 1000, 2000, 4000, 500};
+	for (uint8_t x = 0; x < 5; x++) {
+		uint8_t prevHash[32];
+		memset(prevHash, 0x10 + x, 32);
+		small[x] = testMakeTransaction(prevHash, 0, 1, 50 + x);
+	}
+	for (uint8_t x = 0; x < 3; x++) {
+		if (BEMempoolAdd(pool, small[x], fees[x], 0, 5) != BE_MEMPOOL_ADDED) {
+			printf("FILL FAIL\n");
+			return 1;
+		}
+	}
+	if (BEMempoolAdd(pool, small[3], fees[3], 0, 5) != BE_MEMPOOL_ADDED || BEMempoolContains(pool, CBTransactionGetHash(small[1]))
+		|| pool->evictions != 1 || pool->numEntries != 3) {
+		printf("EVICTION FAIL\n");
+		return 1;
+	}
+	if (BEMempoolAdd(pool, small[4], fees[4], 0, 5) != BE_MEMPOOL_REJECTED || pool->numEntries != 3) {
+		printf("LOW FEE FAIL\n");
+		return 1;
+	}
+	// Free data
+	CBReleaseObject(pool);
+	CBReleaseObject(parent);
+	CBReleaseObject(child);
+	CBReleaseObject(doubleSpend);
+	CBReleaseObject(chainDoubleSpend);
+	for (uint8_t x = 0; x < TEST_CHAIN_LENGTH; x++)
+		CBReleaseObject(chain[x]);
+	for (uint8_t x = 0; x < 5; x++)
+		CBReleaseObject(small[x]);
+	return 0;
+}
@@ -0,0 +1,163 @@
+//
+//  testBEMerkleCache.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 16/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEMerkleCache.h"
+#include "CBValidationFunctions.h"
+#include <stdarg.h>
+#include <math.h>
+
+#define TEST_TX_SIZE 62
+#define TEST_NUM_TXS 21
+#define TEST_MAX_HASHES 40
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+CBBlock * testMakeBlock(uint32_t first);
+CBBlock * testMakeBlock(uint32_t first){
+	// A block of transactions with one input and one output, made different by first.
+	uint32_t size = 81 + TEST_NUM_TXS * TEST_TX_SIZE;
+	uint8_t * data = calloc(1, size);
+	data[0] = 1;
+	data[80] = TEST_NUM_TXS;
+	for (uint32_t x = 0; x < TEST_NUM_TXS; x++) {
+		uint8_t * tx = data + 81 + x * TEST_TX_SIZE;
+		tx[0] = 1;
+		tx[4] = 1;
+		memset(tx + 5, first + x, 32);
+		tx[41] = 1;
+		memset(tx + 43, 0xFF, 4);
+		tx[47] = 1;
+		tx[48] = x;
+		tx[56] = 1;
+		tx[57] = 0x51;
+	}
+	CBByteArray * bytes = CBNewByteArrayWithData(data, size, onErrorReceived);
+	CBBlock * block = CBNewBlockFromData(bytes, onErrorReceived);
+	CBReleaseObject(bytes);
+	CBBlockDeserialise(block, true);
+	return block;
+}
+
+int main(){
+	// Every branch of trees of many sizes gives the merkle root.
+	uint8_t txHashes[TEST_MAX_HASHES * 32];
+	for (uint32_t x = 0; x < TEST_MAX_HASHES * 32; x++)
+		txHashes[x] = x * 7 + x / 32;
+	for (uint32_t numTxs = 1; numTxs <= TEST_MAX_HASHES; numTxs++) {
+		uint8_t root[TEST_MAX_HASHES * 32];
+		memcpy(root, txHashes, numTxs * 32);
+		CBCalculateMerkleRoot(root, numTxs);
+		uint8_t * levels = BEMerkleCacheBuildTree(txHashes, numTxs, onErrorReceived);
+		uint8_t depth = BEMerkleCacheGetDepth(numTxs);
+		if (NOT levels || depth != (numTxs == 1 ? 0 : (uint8_t)ceil(log2(numTxs)))) {
+			printf("BUILD TREE FAIL AT %u\n", numTxs);
+			return 1;
+		}
+		for (uint32_t x = 0; x < numTxs; x++) {
+			uint8_t branch[32 * 8], branchRoot[32];
+			BEMerkleCacheReadBranch(levels, numTxs, x, branch);
+			BEMerkleCacheRootFromBranch(txHashes + 32*x, x, branch, depth, branchRoot);
+			if (memcmp(branchRoot, root, 32)) {
+				printf("BRANCH FAIL AT %u OF %u\n", x, numTxs);
+				return 1;
+			}
+			// The branch does not prove the transaction at another index.
+			BEMerkleCacheRootFromBranch(txHashes + 32*x, x ^ 1, branch, depth, branchRoot);
+			if (depth && x + 1 != numTxs && NOT memcmp(branchRoot, root, 32)) {
+				printf("WRONG INDEX FAIL AT %u OF %u\n", x, numTxs);
+				return 1;
+			}
+		}
+		free(levels);
+	}
+	BEMerkleCache * cache = BENewMerkleCache(onErrorReceived);
+	if (NOT cache) {
+		printf("NEW CACHE FAIL\n");
+		return 1;
+	}
+	// The first request for a block builds its tree and later requests use it.
+	CBBlock * block = testMakeBlock(0);
+	uint8_t blockHashes[TEST_NUM_TXS * 32];
+	for (uint32_t x = 0; x < TEST_NUM_TXS; x++)
+		memcpy(blockHashes + 32*x, CBTransactionGetHash(block->transactions[x]), 32);
+	uint8_t root[32 * TEST_NUM_TXS];
+	memcpy(root, blockHashes, sizeof(root));
+	CBCalculateMerkleRoot(root, TEST_NUM_TXS);
+	uint8_t depth = BEMerkleCacheGetDepth(TEST_NUM_TXS);
+	uint32_t txIndexes[TEST_NUM_TXS];
+	for (uint32_t x = 0; x < TEST_NUM_TXS; x++)
+		txIndexes[x] = TEST_NUM_TXS - 1 - x;
+	uint8_t branches[TEST_NUM_TXS * 32 * 8];
+	for (uint8_t y = 0; y < 2; y++) {
+		if (NOT BEMerkleCacheGetBranches(cache, block, txIndexes, TEST_NUM_TXS, branches)
+			|| cache->hits != y || cache->misses != 1) {
+			printf("GET BRANCHES FAIL\n");
+			return 1;
+		}
+		for (uint32_t x = 0; x < TEST_NUM_TXS; x++) {
+			uint8_t branchRoot[32];
+			BEMerkleCacheRootFromBranch(blockHashes + 32*txIndexes[x], txIndexes[x], branches + 32 * depth * x, depth, branchRoot);
+			if (memcmp(branchRoot, root, 32)) {
+				printf("BATCH BRANCH FAIL AT %u\n", x);
+				return 1;
+			}
+		}
+	}
+	uint8_t branch[32 * 8];
+	if (NOT BEMerkleCacheGetBranch(cache, block, 3, branch) || memcmp(branch, branches + 32 * depth * (TEST_NUM_TXS - 4), 32 * depth)
+		|| BEMerkleCacheGetBranch(cache, block, TEST_NUM_TXS, branch)) {
+		printf("GET BRANCH FAIL\n");
+		return 1;
+	}
+	// Adding more blocks than the cache holds replaces the trees used least recently.
+	uint8_t hash[32] = {0};
+	for (uint32_t x = 0; x < BE_MERKLE_CACHE_BLOCKS; x++) {
+		hash[0] = x + 1;
+		if (NOT BEMerkleCacheAdd(cache, hash, txHashes, x + 1)) {
+			printf("ADD FAIL\n");
+			return 1;
+		}
+		if (x == BE_MERKLE_CACHE_BLOCKS / 2)
+			BEMerkleCacheGetBranch(cache, block, 0, branch);
+	}
+	hash[0] = 1;
+	if (BEMerkleCacheFind(cache, CBBlockGetHash(block)) == -1 || BEMerkleCacheFind(cache, hash) != -1) {
+		printf("REPLACE FAIL\n");
+		return 1;
+	}
+	hash[0] = BE_MERKLE_CACHE_BLOCKS;
+	int32_t index = BEMerkleCacheFind(cache, hash);
+	if (index == -1 || cache->trees[index].numTxs != BE_MERKLE_CACHE_BLOCKS) {
+		printf("FIND FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(cache);
+	CBReleaseObject(block);
+	return 0;
+}
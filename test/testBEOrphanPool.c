@@ -0,0 +1,184 @@
+//
+//  testBEOrphanPool.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 12/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BEOrphanPool.h"
+#include <stdarg.h>
+
+#define TEST_BLOCK_SIZE 143
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+CBBlock * testMakeBlock(uint8_t * prevHash, uint8_t x);
+CBBlock * testMakeBlock(uint8_t * prevHash, uint8_t x){
+	// A block with only a coinbase transaction, made different by x.
+	uint8_t data[TEST_BLOCK_SIZE] = {0x01,0x00,0x00,0x00};
+	memcpy(data + 4, prevHash, 32);
+	memset(data + 36, x, 32);
+	data[80] = 1;
+	uint8_t * tx = data + 81;
+	tx[0] = 1;
+	tx[4] = 1;
+	memset(tx + 37, 0xFF, 4);
+	tx[41] = 2;
+	tx[42] = x;
+	tx[43] = x;
+	memset(tx + 44, 0xFF, 4);
+	tx[48] = 1;
+	memcpy(tx + 49, (uint8_t []){0x00,0xF2,0x05,0x2A,0x01,0x00,0x00,0x00}, 8);
+	CBByteArray * bytes = CBNewByteArrayWithDataCopy(data, TEST_BLOCK_SIZE, onErrorReceived);
+	CBBlock * block = CBNewBlockFromData(bytes, onErrorReceived);
+	CBReleaseObject(bytes);
+	CBBlockDeserialise(block, true);
+	return block;
+}
+
+int main(){
+	remove("./orphans.dat");
+	BEOrphanPool * pool = BENewOrphanPool("./", TEST_BLOCK_SIZE * 4, 100, onErrorReceived);
+	if (NOT pool) {
+		printf("NEW POOL FAIL\n");
+		return 1;
+	}
+	// Make a chain of orphans a <- b <- c, with d also following a.
+	uint8_t unknown[32] = {1,2,3};
+	CBBlock * a = testMakeBlock(unknown, 1);
+	CBBlock * b = testMakeBlock(CBBlockGetHash(a), 2);
+	CBBlock * c = testMakeBlock(CBBlockGetHash(b), 3);
+	CBBlock * d = testMakeBlock(CBBlockGetHash(a), 4);
+	CBBlock * blocks[4] = {a, b, c, d};
+	for (uint8_t x = 0; x < 4; x++) {
+		if (NOT BEOrphanPoolAdd(pool, blocks[x], x)) {
+			printf("ADD FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	if (pool->numOrphans != 4 || pool->size != TEST_BLOCK_SIZE * 4 || NOT BEOrphanPoolContains(pool, CBBlockGetHash(c)) || BEOrphanPoolContains(pool, unknown)) {
+		printf("CONTAINS FAIL\n");
+		return 1;
+	}
+	// Reload the pool from the file.
+	CBReleaseObject(pool);
+	pool = BENewOrphanPool("./", TEST_BLOCK_SIZE * 4, 100, onErrorReceived);
+	if (NOT pool || pool->numOrphans != 4 || NOT BEOrphanPoolContains(pool, CBBlockGetHash(d))) {
+		printf("LOAD FAIL\n");
+		return 1;
+	}
+	// Take the orphans which follow each block.
+	CBBlock * child = BEOrphanPoolTakeChild(pool, unknown);
+	if (NOT child || memcmp(CBBlockGetHash(child), CBBlockGetHash(a), 32) || BEOrphanPoolTakeChild(pool, unknown)) {
+		printf("TAKE FIRST FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(child);
+	uint8_t found = 0;
+	while ((child = BEOrphanPoolTakeChild(pool, CBBlockGetHash(a)))) {
+		if (NOT memcmp(CBBlockGetHash(child), CBBlockGetHash(b), 32))
+			found |= 1;
+		else if (NOT memcmp(CBBlockGetHash(child), CBBlockGetHash(d), 32))
+			found |= 2;
+		CBReleaseObject(child);
+	}
+	if (found != 3 || pool->numOrphans != 1 || pool->size != TEST_BLOCK_SIZE) {
+		printf("TAKE SIBLINGS FAIL\n");
+		return 1;
+	}
+	// The removals are replayed when loading.
+	CBReleaseObject(pool);
+	pool = BENewOrphanPool("./", TEST_BLOCK_SIZE * 4, 100, onErrorReceived);
+	if (NOT pool || pool->numOrphans != 1 || NOT BEOrphanPoolContains(pool, CBBlockGetHash(c))) {
+		printf("LOAD AFTER REMOVE FAIL\n");
+		return 1;
+	}
+	// The oldest orphans are removed when over the size limit.
+	CBBlock * e = testMakeBlock(unknown, 5);
+	BEOrphanPoolAdd(pool, a, 10);
+	BEOrphanPoolAdd(pool, b, 11);
+	BEOrphanPoolAdd(pool, d, 12);
+	if (pool->numOrphans != 4 || pool->evictions) {
+		printf("ADD UP TO SIZE LIMIT FAIL\n");
+		return 1;
+	}
+	BEOrphanPoolAdd(pool, e, 13);
+	if (pool->numOrphans != 4 || BEOrphanPoolContains(pool, CBBlockGetHash(c)) || NOT BEOrphanPoolContains(pool, CBBlockGetHash(e)) || pool->evictions != 1) {
+		printf("SIZE LIMIT FAIL\n");
+		return 1;
+	}
+	// Orphans older than the maximum age are removed.
+	BEOrphanPoolAdd(pool, c, 112);
+	if (pool->numOrphans != 3 || BEOrphanPoolContains(pool, CBBlockGetHash(a)) || BEOrphanPoolContains(pool, CBBlockGetHash(b)) || NOT BEOrphanPoolContains(pool, CBBlockGetHash(d)) || pool->evictions != 3) {
+		printf("AGE LIMIT FAIL\n");
+		return 1;
+	}
+	// A partially written record is removed when loading.
+	CBReleaseObject(pool);
+	FILE * file = fopen("./orphans.dat", "ab");
+	fwrite((uint8_t []){BE_ORPHAN_RECORD_ADD, 0xFF, 0x00}, 1, 3, file);
+	fclose(file);
+	pool = BENewOrphanPool("./", TEST_BLOCK_SIZE * 4, 100, onErrorReceived);
+	if (NOT pool || pool->numOrphans != 3 || NOT BEOrphanPoolAdd(pool, a, 112)) {
+		printf("PARTIAL RECORD FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(pool);
+	pool = BENewOrphanPool("./", TEST_BLOCK_SIZE * 4, 100, onErrorReceived);
+	if (NOT pool || pool->numOrphans != 4 || NOT BEOrphanPoolContains(pool, CBBlockGetHash(a))) {
+		printf("ADD AFTER PARTIAL RECORD FAIL\n");
+		return 1;
+	}
+	// The file is rewritten with only the orphans in the pool once it is mostly removed orphans.
+	uint8_t other[32] = {4,5,6};
+	CBBlock * f = testMakeBlock(other, 6);
+	bool compacted = false;
+	for (uint32_t x = 0; x < 20000 && NOT compacted; x++) {
+		uint64_t fileSize = pool->fileSize;
+		if (NOT BEOrphanPoolAdd(pool, f, 112)) {
+			printf("COMPACT ADD FAIL AT %u\n", x);
+			return 1;
+		}
+		CBReleaseObject(BEOrphanPoolTakeChild(pool, other));
+		compacted = pool->fileSize < fileSize;
+	}
+	if (NOT compacted || pool->fileSize != pool->fileOrphanBytes || NOT access("./orphans.dat.tmp", F_OK)) {
+		printf("COMPACT FAIL\n");
+		return 1;
+	}
+	uint32_t numOrphans = pool->numOrphans;
+	CBReleaseObject(pool);
+	pool = BENewOrphanPool("./", TEST_BLOCK_SIZE * 4, 100, onErrorReceived);
+	if (NOT pool || pool->numOrphans != numOrphans || BEOrphanPoolContains(pool, CBBlockGetHash(f)) || NOT BEOrphanPoolContains(pool, CBBlockGetHash(a))) {
+		printf("LOAD AFTER COMPACT FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(f);
+	CBReleaseObject(pool);
+	for (uint8_t x = 0; x < 4; x++)
+		CBReleaseObject(blocks[x]);
+	CBReleaseObject(e);
+	return 0;
+}
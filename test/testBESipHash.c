@@ -0,0 +1,53 @@
+//
+//  testBESipHash.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 27/10/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "BESipHash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(){
+	// Reference vectors, with the key 00 01 ... 0f and the data 00 01 ... of each length.
+	uint8_t key[16];
+	uint8_t data[64];
+	for (uint8_t x = 0; x < 64; x++)
+		data[x] = x;
+	memcpy(key, data, 16);
+	uint64_t key0 = BESipHashReadInt64(key);
+	uint64_t key1 = BESipHashReadInt64(key + 8);
+	if (BESipHash(key0, key1, data, 0) != 0x726fdb47dd0e0e31ULL
+		|| BESipHash(key0, key1, data, 1) != 0x74f839c593dc67fdULL
+		|| BESipHash(key0, key1, data, 15) != 0xa129ca6149be45e5ULL
+		|| BESipHash(key0, key1, data, 63) != 0x958a324ceb064572ULL) {
+		printf("REFERENCE FAIL\n");
+		return 1;
+	}
+	// The 32 byte version gives the same hashes.
+	for (uint8_t x = 0; x < 32; x++) {
+		if (BESipHash256(key0 + x, key1, data + x) != BESipHash(key0 + x, key1, data + x, 32)) {
+			printf("HASH 256 FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	return 0;
+}
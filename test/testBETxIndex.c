@@ -0,0 +1,229 @@
+//
+//  testBETxIndex.c
+//  BitEagle-FullNode
+//
+//  Created by Matthew Mitchell on 21/11/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of BitEagle-FullNode.
+//
+//  BitEagle-FullNode is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitEagle-FullNode is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitEagle-FullNode.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BETxIndex.h"
+#include <stdarg.h>
+
+#define TEST_TX_SIZE 62
+#define TEST_NUM_TXS 21
+#define TEST_NUM_BLOCKS 10
+
+void onErrorReceived(CBError a,char * format,...);
+void onErrorReceived(CBError a,char * format,...){
+	va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+	printf("\n");
+}
+
+CBBlock * testMakeBlock(uint32_t first);
+CBBlock * testMakeBlock(uint32_t first){
+	// A block of transactions with one input and one output, made different by first.
+	uint32_t size = 81 + TEST_NUM_TXS * TEST_TX_SIZE;
+	uint8_t * data = calloc(1, size);
+	data[0] = 1;
+	data[80] = TEST_NUM_TXS;
+	for (uint32_t x = 0; x < TEST_NUM_TXS; x++) {
+		uint8_t * tx = data + 81 + x * TEST_TX_SIZE;
+		tx[0] = 1;
+		tx[4] = 1;
+		memset(tx + 5, first + x, 32);
+		tx[41] = 1;
+		memset(tx + 43, 0xFF, 4);
+		tx[47] = 1;
+		tx[48] = x;
+		tx[56] = 1;
+		tx[57] = 0x51;
+	}
+	CBByteArray * bytes = CBNewByteArrayWithData(data, size, onErrorReceived);
+	CBBlock * block = CBNewBlockFromData(bytes, onErrorReceived);
+	CBReleaseObject(bytes);
+	CBBlockDeserialise(block, true);
+	return block;
+}
+
+bool testFindBlock(BETxIndex * index, CBBlock * block, uint32_t height, bool expectFound);
+bool testFindBlock(BETxIndex * index, CBBlock * block, uint32_t height, bool expectFound){
+	// Each transaction is found at its place in the block data.
+	uint8_t * data = CBByteArrayGetData(CBGetMessage(block)->bytes);
+	for (uint32_t x = 0; x < block->transactionNum; x++) {
+		BETxIndexEntry entry;
+		CBTransaction * tx = block->transactions[x];
+		bool found = BETxIndexFind(index, CBTransactionGetHash(tx), &entry);
+		if (found != expectFound)
+			return false;
+		if (found && (entry.height != height || entry.blockRef.fileID != 1 || entry.blockRef.filePos != height * 10000
+					  || entry.length != CBGetMessage(tx)->bytes->length
+					  || memcmp(data + entry.offset, CBByteArrayGetData(CBGetMessage(tx)->bytes), entry.length)))
+			return false;
+	}
+	return true;
+}
+
+int main(){
+	remove("./txindex.dat");
+	BETxIndex * index = BENewTxIndex("./", onErrorReceived);
+	if (NOT index || index->numSlots != BE_TX_INDEX_MIN_SLOTS || index->numBlocks || NOT index->clean) {
+		printf("NEW INDEX FAIL\n");
+		return 1;
+	}
+	// Index the transactions of a chain of blocks.
+	CBBlock * blocks[TEST_NUM_BLOCKS];
+	for (uint32_t x = 0; x < TEST_NUM_BLOCKS; x++) {
+		blocks[x] = testMakeBlock(x * TEST_NUM_TXS);
+		if (NOT BETxIndexAddBlock(index, blocks[x], (BEFileReference){1, x * 10000})) {
+			printf("ADD BLOCK FAIL\n");
+			return 1;
+		}
+	}
+	if (index->numBlocks != TEST_NUM_BLOCKS || index->numUsed != TEST_NUM_BLOCKS * TEST_NUM_TXS || index->clean || NOT index->numDirty
+		|| index->tipRef.filePos != (TEST_NUM_BLOCKS - 1) * 10000) {
+		printf("INDEX COUNT FAIL\n");
+		return 1;
+	}
+	for (uint32_t x = 0; x < TEST_NUM_BLOCKS; x++) {
+		if (NOT testFindBlock(index, blocks[x], x, true)) {
+			printf("FIND FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	// A transaction is only removed for its own block.
+	if (NOT BETxIndexRemove(index, CBTransactionGetHash(blocks[0]->transactions[0]), (BEFileReference){1, 10000})
+		|| NOT testFindBlock(index, blocks[0], 0, true)) {
+		printf("REMOVE OTHER BLOCK FAIL\n");
+		return 1;
+	}
+	// A reorganisation removes the last blocks and adds others.
+	for (uint32_t x = TEST_NUM_BLOCKS; x-- > TEST_NUM_BLOCKS - 3;) {
+		if (NOT BETxIndexRemoveBlock(index, blocks[x], (BEFileReference){1, (x - 1) * 10000}) || NOT testFindBlock(index, blocks[x], x, false)) {
+			printf("REMOVE BLOCK FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	if (index->numBlocks != TEST_NUM_BLOCKS - 3 || index->numUsed != (TEST_NUM_BLOCKS - 3) * TEST_NUM_TXS || index->numDeleted != 3 * TEST_NUM_TXS
+		|| index->tipRef.filePos != (TEST_NUM_BLOCKS - 4) * 10000) {
+		printf("REORGANISATION COUNT FAIL\n");
+		return 1;
+	}
+	for (uint32_t x = TEST_NUM_BLOCKS - 3; x < TEST_NUM_BLOCKS; x++) {
+		if (NOT BETxIndexAddBlock(index, blocks[x], (BEFileReference){1, x * 10000}) || NOT testFindBlock(index, blocks[x], x, true)) {
+			printf("ADD AGAIN FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	// Deleted records are used again.
+	if (index->numUsed != TEST_NUM_BLOCKS * TEST_NUM_TXS || index->numDeleted > 3 * TEST_NUM_TXS) {
+		printf("REUSE FAIL\n");
+		return 1;
+	}
+	uint32_t numDeleted = index->numDeleted;
+	if (NOT BETxIndexSync(index) || NOT index->clean || index->numDirty) {
+		printf("SYNC FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(index);
+	// The index is the same when opened again.
+	index = BENewTxIndex("./", onErrorReceived);
+	if (NOT index || index->numBlocks != TEST_NUM_BLOCKS || index->numUsed != TEST_NUM_BLOCKS * TEST_NUM_TXS || index->numDeleted != numDeleted
+		|| index->tipRef.fileID != 1 || index->tipRef.filePos != (TEST_NUM_BLOCKS - 1) * 10000 || NOT index->clean) {
+		printf("REOPEN FAIL\n");
+		return 1;
+	}
+	for (uint32_t x = 0; x < TEST_NUM_BLOCKS; x++) {
+		if (NOT testFindBlock(index, blocks[x], x, true)) {
+			printf("REOPEN FIND FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	// A record which was not completely written is deleted, and the records are counted again when the header was not written after the records.
+	BETxIndexEntry entry;
+	bool found;
+	uint32_t slot = BETxIndexFindSlot(index, CBTransactionGetHash(blocks[3]->transactions[5]), &found);
+	CBReleaseObject(index);
+	FILE * file = fopen("./txindex.dat", "r+b");
+	uint8_t header[51];
+	fread(header, 1, 51, file);
+	header[46] = 0;
+	uint32_t crc = BECRC32C(0, header, 47);
+	for (uint8_t x = 0; x < 4; x++)
+		header[47 + x] = crc >> 8*x;
+	fseek(file, 0, SEEK_SET);
+	fwrite(header, 1, 51, file);
+	fseek(file, BE_TX_INDEX_HEADER_SIZE + (long)slot * BE_TX_INDEX_RECORD_SIZE + 40, SEEK_SET);
+	fputc(0xAB, file);
+	fclose(file);
+	index = BENewTxIndex("./", onErrorReceived);
+	if (NOT index || NOT found || index->numUsed != TEST_NUM_BLOCKS * TEST_NUM_TXS - 1 || index->numDeleted != numDeleted + 1
+		|| BETxIndexFind(index, CBTransactionGetHash(blocks[3]->transactions[5]), &entry)
+		|| NOT testFindBlock(index, blocks[4], 4, true)) {
+		printf("RECOUNT FAIL\n");
+		return 1;
+	}
+	// Adding the block again replaces the record.
+	if (NOT BETxIndexAdd(index, CBTransactionGetHash(blocks[3]->transactions[5]), &(BETxIndexEntry){{1, 30000}, 0, 62, 3})
+		|| NOT BETxIndexFind(index, CBTransactionGetHash(blocks[3]->transactions[5]), &entry) || entry.height != 3) {
+		printf("REPLACE FAIL\n");
+		return 1;
+	}
+	// The table grows once three quarters of the slots are used, keeping the records.
+	uint8_t txHash[32] = {0};
+	uint32_t numAdded = BE_TX_INDEX_MIN_SLOTS * 3 / 4 - index->numUsed - index->numDeleted + 1;
+	for (uint32_t x = 0; x < numAdded; x++) {
+		txHash[31] = 0xEE;
+		memcpy(txHash, &x, 4);
+		if (NOT BETxIndexAdd(index, txHash, &(BETxIndexEntry){{2, x}, 0, 0, 0})) {
+			printf("GROW ADD FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	if (index->numSlots != 2 * BE_TX_INDEX_MIN_SLOTS || index->numDeleted || NOT testFindBlock(index, blocks[9], 9, true)) {
+		printf("GROW FAIL\n");
+		return 1;
+	}
+	for (uint32_t x = 0; x < numAdded; x += 997) {
+		memcpy(txHash, &x, 4);
+		if (NOT BETxIndexFind(index, txHash, &entry) || entry.blockRef.fileID != 2 || entry.blockRef.filePos != x) {
+			printf("GROW FIND FAIL AT %u\n", x);
+			return 1;
+		}
+	}
+	CBReleaseObject(index);
+	index = BENewTxIndex("./", onErrorReceived);
+	if (NOT index || index->numSlots != 2 * BE_TX_INDEX_MIN_SLOTS || index->numUsed != TEST_NUM_BLOCKS * TEST_NUM_TXS + numAdded) {
+		printf("GROW REOPEN FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(index);
+	// A file which is not a transaction index is replaced with an empty index.
+	truncate("./txindex.dat", 100);
+	index = BENewTxIndex("./", onErrorReceived);
+	if (NOT index || index->numUsed || index->numBlocks || BETxIndexFind(index, CBTransactionGetHash(blocks[0]->transactions[0]), &entry)) {
+		printf("INVALID FILE FAIL\n");
+		return 1;
+	}
+	CBReleaseObject(index);
+	for (uint32_t x = 0; x < TEST_NUM_BLOCKS; x++)
+		CBReleaseObject(blocks[x]);
+	remove("./txindex.dat");
+	return 0;
+}